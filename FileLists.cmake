@@ -15,6 +15,7 @@ set(sources
     include/Teide/Device.h
     include/Teide/Format.h
     include/Teide/ForwardDeclare.h
+    include/Teide/GraphicsSettings.h
     include/Teide/Handle.h
     include/Teide/Hash.h
     include/Teide/Kernel.h
@@ -29,6 +30,7 @@ set(sources
     include/Teide/ShaderEnvironment.h
     include/Teide/Surface.h
     include/Teide/Task.h
+    include/Teide/TaskScheduler.h
     include/Teide/Texture.h
     include/Teide/TextureData.h
     include/Teide/Util/RenderDocHooks.h
@@ -44,19 +46,33 @@ set(sources
     src/Teide/DescriptorPool.cpp
     src/Teide/DescriptorPool.h
     src/Teide/Format.cpp
+    src/Teide/GeometryHeap.cpp
+    src/Teide/GeometryHeap.h
     src/Teide/GpuExecutor.cpp
     src/Teide/GpuExecutor.h
     src/Teide/Queue.cpp
     src/Teide/Queue.h
+    src/Teide/SamplerCache.cpp
+    src/Teide/SamplerCache.h
     src/Teide/Scheduler.cpp
     src/Teide/Scheduler.h
     src/Teide/ShaderData.cpp
+    src/Teide/StagingRing.cpp
+    src/Teide/StagingRing.h
     src/Teide/TextureData.cpp
+    src/Teide/TextureResidency.cpp
+    src/Teide/TextureResidency.h
+    src/Teide/UniformAllocator.cpp
+    src/Teide/UniformAllocator.h
     src/Teide/Util/FrameArray.h
+    src/Teide/Util/FreeListAllocator.h
     src/Teide/Util/RenderDocHooks.cpp
     src/Teide/Util/ListenSender.h
+    src/Teide/Util/MemoryCounter.h
     src/Teide/Util/ResourceMap.h
+    src/Teide/Util/RingAllocator.h
     src/Teide/Util/SafeMemCpy.h
+    src/Teide/Util/SegmentedArray.h
     src/Teide/Util/StaticMap.h
     src/Teide/Util/ThreadUtils.cpp
     src/Teide/Util/ThreadUtils.h
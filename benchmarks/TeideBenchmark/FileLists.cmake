@@ -1 +1 @@
-set(sources src/Main.cpp src/RenderBenchmarks.cpp)
+set(sources src/Main.cpp src/RenderBenchmarks.cpp src/SchedulerBenchmarks.cpp)
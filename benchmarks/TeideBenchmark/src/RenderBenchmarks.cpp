@@ -7,6 +7,10 @@
 #include <benchmark/benchmark.h>
 #include <spdlog/spdlog.h>
 
+#include <atomic>
+#include <chrono>
+#include <vector>
+
 namespace
 {
 
@@ -146,4 +150,45 @@ void RenderToTexture(benchmark::State& state)
     }
 }
 BENCHMARK(RenderToTexture)->Arg(8); //->Arg(256)->Arg(4096);
+
+// Throughput vs latency for different numbers of frames in flight. Each frame renders to a texture and reads it back,
+// and the latency is the time from the start of the frame until the readback has arrived on the CPU.
+void FramesInFlight(benchmark::State& state)
+{
+    spdlog::set_level(spdlog::level::err);
+
+    const Teide::RenderTargetInfo renderTarget = CreateRenderTargetInfo(256);
+
+    const Teide::DevicePtr device
+        = Teide::CreateHeadlessDevice({.framesInFlight = static_cast<Teide::uint32>(state.range(0))});
+    const Teide::RendererPtr renderer = device->CreateRenderer(nullptr);
+
+    std::atomic<std::chrono::steady_clock::duration::rep> totalLatency = 0;
+    std::vector<Teide::Task<>> readbacks;
+
+    for (auto _ [[maybe_unused]] : state)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        renderer->BeginFrame({});
+        auto texture = Render(renderer, renderTarget, {});
+        auto readback = renderer->CopyTextureData(std::move(texture));
+        readbacks.push_back(readback.then([&totalLatency, start](const Teide::Task<Teide::TextureData>&) {
+            totalLatency += (std::chrono::steady_clock::now() - start).count();
+        }));
+        renderer->EndFrame();
+    }
+
+    renderer->WaitForGpu();
+    for (const auto& readback : readbacks)
+    {
+        readback.get();
+    }
+
+    const auto averageLatency = std::chrono::steady_clock::duration(totalLatency.load())
+        / static_cast<std::chrono::steady_clock::duration::rep>(state.iterations());
+    state.counters["Latency"] = std::chrono::duration<double>(averageLatency).count();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(FramesInFlight)->DenseRange(1, 4)->UseRealTime();
 } // namespace
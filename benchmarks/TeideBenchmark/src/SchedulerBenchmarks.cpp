@@ -0,0 +1,35 @@
+#include "Teide/CpuExecutor.h"
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+
+namespace
+{
+
+void CpuDependencyChain(benchmark::State& state)
+{
+    const auto chainLength = static_cast<int>(state.range(0));
+
+    auto executor = Teide::CpuExecutor(4);
+
+    auto elapsed = std::chrono::duration<double, std::micro>{};
+    for (auto _ [[maybe_unused]] : state)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        auto task = executor.LaunchTask([] { return 0; });
+        for (int i = 0; i < chainLength; i++)
+        {
+            task = executor.LaunchTask([](int value) { return value + 1; }, task);
+        }
+        benchmark::DoNotOptimize(task.get());
+        elapsed += std::chrono::steady_clock::now() - start;
+    }
+
+    // Average time in microseconds between a task completing and its continuation finishing
+    const auto hops = static_cast<double>(state.iterations()) * chainLength;
+    state.counters["HopLatencyUs"] = benchmark::Counter(elapsed.count() / hops);
+}
+BENCHMARK(CpuDependencyChain)->Arg(1)->Arg(16)->Arg(256)->Unit(benchmark::kMicrosecond);
+
+} // namespace
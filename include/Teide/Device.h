@@ -2,12 +2,17 @@
 #pragma once
 
 #include "Teide/ForwardDeclare.h"
+#include "Teide/GraphicsSettings.h"
 #include "Teide/Kernel.h"
 #include "Teide/ParameterBlock.h"
 #include "Teide/Renderer.h"
 #include "Teide/Surface.h"
+#include "Teide/TaskScheduler.h"
 
-#include <thread>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <vector>
 
 struct SDL_Window;
 
@@ -16,9 +21,56 @@ namespace Teide
 
 void EnableSoftwareRendering();
 
-struct GraphicsSettings
+// A resource that can be used straight away, while its initial contents are still being uploaded. Anything scheduled
+// later that uses the resource (e.g. a RenderList) runs after the upload on the GPU, so only CPU code that needs the
+// upload to have finished has to wait for the task.
+template <class T>
+struct PendingResource
 {
-    uint32 numThreads = std::thread::hardware_concurrency();
+    T resource;
+    Task<> uploaded;
+};
+
+// Device memory held for one kind of resource. Resources that are suballocated from larger buffers (meshes, uniforms,
+// staging) count the buffers they are suballocated from.
+struct MemoryCategoryStatistics
+{
+    uint64 bytes = 0;
+    uint64 allocationCount = 0;
+    uint64 peakBytes = 0; // Since the device was created
+};
+
+// One of the device's memory heaps, as seen by the allocator
+struct MemoryHeapStatistics
+{
+    uint64 size = 0;
+    bool deviceLocal = false;
+
+    // From the driver if VK_EXT_memory_budget is supported, otherwise estimated by the allocator
+    uint64 usage = 0;
+    uint64 budget = 0;
+    uint64 peakUsage = 0; // Sampled once per frame and whenever the statistics are read
+
+    // Memory blocks allocated from Vulkan, and the allocations made from them
+    uint64 blockBytes = 0;
+    uint32 blockCount = 0;
+    uint64 allocationBytes = 0;
+    uint32 allocationCount = 0;
+
+    // Free space between allocations in the blocks. Lots of small ranges means the blocks are fragmented.
+    uint32 unusedRangeCount = 0;
+    uint64 largestUnusedRange = 0;
+};
+
+struct MemoryStatistics
+{
+    MemoryCategoryStatistics textures;      // Created from data
+    MemoryCategoryStatistics renderTargets; // Written by the GPU (render targets and kernel outputs)
+    MemoryCategoryStatistics meshes;
+    MemoryCategoryStatistics uniformBuffers;
+    MemoryCategoryStatistics staging; // Including buffers that texture data is copied back to the CPU through
+    MemoryCategoryStatistics buffers; // Created with CreateBuffer, other than vertex, index and uniform buffers
+    std::vector<MemoryHeapStatistics> heaps;
 };
 
 class Device : AbstractBase
@@ -26,6 +78,9 @@ class Device : AbstractBase
 public:
     virtual RendererPtr CreateRenderer(ShaderEnvironmentPtr shaderEnvironment) = 0;
 
+    // Scheduler for the device's worker threads, for running CPU work in sender pipelines and coroutines
+    virtual TaskScheduler GetTaskScheduler() = 0;
+
     virtual BufferPtr CreateBuffer(const BufferData& data, const char* name) = 0;
     virtual ShaderEnvironmentPtr CreateShaderEnvironment(const ShaderEnvironmentData& data, const char* name) = 0;
     virtual ShaderPtr CreateShader(const ShaderData& data, const char* name) = 0;
@@ -34,6 +89,35 @@ public:
     virtual MeshPtr CreateMesh(const MeshData& data, const char* name) = 0;
     virtual PipelinePtr CreatePipeline(const PipelineData& data) = 0;
     virtual ParameterBlock CreateParameterBlock(const ParameterBlockData& data, const char* name) = 0;
+
+    // Non-blocking versions of the above, which return as soon as the resource has been created. The data is copied
+    // before returning, so it doesn't need to outlive the upload.
+    // If stop is requested before the upload starts, it is skipped and the uploaded task fails with TaskCancelled.
+    // The resource's contents are then undefined, so it should be dropped without being used.
+    virtual PendingResource<BufferPtr>
+    CreateBufferAsync(const BufferData& data, const char* name, std::stop_token stopToken = {}) = 0;
+    virtual PendingResource<Texture>
+    CreateTextureAsync(const TextureData& data, const char* name, std::stop_token stopToken = {}) = 0;
+    virtual PendingResource<MeshPtr>
+    CreateMeshAsync(const MeshData& data, const char* name, std::stop_token stopToken = {}) = 0;
+    virtual PendingResource<ParameterBlock>
+    CreateParameterBlockAsync(const ParameterBlockData& data, const char* name, std::stop_token stopToken = {}) = 0;
+
+    // Create many resources at once. Their data is staged in a single buffer and uploaded by a single command buffer,
+    // which is much cheaper than creating them one at a time. Each resource is named "name[index]".
+    virtual PendingResource<std::vector<Texture>>
+    CreateTextures(std::span<const TextureData> data, const char* name, std::stop_token stopToken = {}) = 0;
+    virtual PendingResource<std::vector<MeshPtr>>
+    CreateMeshes(std::span<const MeshData> data, const char* name, std::stop_token stopToken = {}) = 0;
+    virtual PendingResource<std::vector<ParameterBlock>>
+    CreateParameterBlocks(
+        std::span<const ParameterBlockData> data, const char* name, std::stop_token stopToken = {}) = 0;
+
+    // Where device memory is going, for sizing budgets and finding leaks. Can be called from any thread.
+    virtual MemoryStatistics GetMemoryStatistics() = 0;
+    // The allocator's own statistics as JSON, including a map of every block's allocations if detailed is set.
+    // Much slower than GetMemoryStatistics.
+    virtual std::string DumpMemoryStatistics(bool detailed) = 0;
 };
 
 using DevicePtr = std::unique_ptr<Device>;
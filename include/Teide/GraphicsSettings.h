@@ -0,0 +1,75 @@
+
+#pragma once
+
+#include "Teide/BasicTypes.h"
+
+#include <chrono>
+#include <optional>
+#include <thread>
+
+namespace Teide
+{
+
+enum class SubmitFlushPolicy : uint8
+{
+    PerFrame,  // Submit queued command buffers at the end of each frame (or when the device waits for the GPU)
+    BatchSize, // Submit once batchSize command buffers have been queued
+    Deadline,  // Submit once the oldest queued command buffer has been waiting for the deadline
+};
+
+struct SubmitThreadSettings
+{
+    SubmitFlushPolicy flushPolicy = SubmitFlushPolicy::Deadline;
+    uint32 batchSize = 16;
+
+    // Unless the flush policy is PerFrame, queued command buffers are always submitted within this time, so that work
+    // that is waited on mid-frame still completes. With PerFrame, such work waits for the end of the frame.
+    std::chrono::microseconds deadline{250};
+};
+
+struct ParallelRecordingSettings
+{
+    // RenderLists with at least this many objects are split into chunks, which are recorded in parallel into secondary
+    // command buffers
+    uint32 minObjects = 4096;
+
+    // Smallest number of objects worth recording in a chunk of its own. There is at most one chunk per worker thread.
+    uint32 minChunkSize = 1024;
+};
+
+constexpr uint32 DefaultFramesInFlight = 2;
+
+struct GraphicsSettings
+{
+    uint32 numThreads = std::thread::hardware_concurrency();
+
+    // How many frames the CPU can get ahead of the GPU. Each frame in flight has its own command pools, descriptor
+    // pools and scene parameters, so more frames use more memory, and add latency in exchange for throughput.
+    uint32 framesInFlight = DefaultFramesInFlight;
+
+    // If set, command buffers are submitted from a dedicated thread, which merges them into as few vkQueueSubmit
+    // calls as the flush policy allows
+    std::optional<SubmitThreadSettings> submitThread;
+
+    // If the GPU has a separate transfer queue, use it for uploads and readbacks, so they can overlap with rendering
+    bool useTransferQueue = true;
+
+    // If the GPU has a compute queue without graphics, use it for Renderer::Dispatch, so kernels can overlap with
+    // rendering
+    bool useComputeQueue = true;
+
+    // Size of the persistently mapped buffer that upload data is staged in. Space is reused once the GPU has copied
+    // out of it; uploads that don't fit get a staging buffer of their own. 0 disables the ring, so that every upload
+    // does.
+    uint64 stagingRingSize = 64 * 1024 * 1024;
+
+    // If set, textures created from data are evicted (least recently used first) when device-local memory use goes
+    // over this many bytes, or over the driver's budget if that is lower, and made resident again when next used.
+    // Evictable textures keep a copy of their data in CPU memory.
+    std::optional<uint64> textureMemoryBudget;
+
+    // How large RenderLists are recorded. Renderer::GetLastFrameStatistics reports the time taken by each chunk.
+    ParallelRecordingSettings parallelRecording;
+};
+
+} // namespace Teide
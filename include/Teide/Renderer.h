@@ -5,13 +5,18 @@
 #include "GeoLib/Vector.h"
 #include "Teide/BasicTypes.h"
 #include "Teide/ForwardDeclare.h"
+#include "Teide/Kernel.h"
 #include "Teide/ParameterBlock.h"
 #include "Teide/Surface.h"
 #include "Teide/Task.h"
 #include "Teide/Texture.h"
 
 #include <array>
+#include <chrono>
 #include <optional>
+#include <stop_token>
+#include <string>
+#include <vector>
 
 namespace Teide
 {
@@ -59,6 +64,7 @@ struct RenderToTextureResult
 {
     std::optional<Texture> colorTexture;
     std::optional<Texture> depthStencilTexture;
+    Task<> rendered; // Completes once the render list has been submitted
 };
 
 struct RenderTargetInfo
@@ -70,6 +76,30 @@ struct RenderTargetInfo
     bool captureDepthStencil = false;
 };
 
+struct DispatchInfo
+{
+    std::string name;
+    std::vector<Texture> inputs;
+    Geo::Size2i outputSize;
+    SamplerState outputSamplerState;
+    Geo::Size3i groupCount = {1, 1, 1};
+};
+
+// A chunk of a RenderList that was recorded into its own secondary command buffer
+struct RecordedChunk
+{
+    std::string renderListName;
+    uint32 firstObject = 0;
+    uint32 objectCount = 0;
+    std::chrono::nanoseconds recordTime{};
+};
+
+struct RendererStatistics
+{
+    std::vector<RecordedChunk> recordedChunks;
+    uint32 viewDescriptorSetWrites = 0; // View descriptor sets that couldn't be reused from an earlier frame
+};
+
 class Renderer
 {
 public:
@@ -87,10 +117,21 @@ public:
     virtual void WaitForCpu() = 0;
     virtual void WaitForGpu() = 0;
 
-    virtual RenderToTextureResult RenderToTexture(const RenderTargetInfo& renderTarget, RenderList renderList) = 0;
+    // If stop is requested before the render list is recorded, it is skipped and rendered fails with TaskCancelled.
+    // The textures' contents are then undefined, so they should be dropped without being used.
+    virtual RenderToTextureResult
+    RenderToTexture(const RenderTargetInfo& renderTarget, RenderList renderList, std::stop_token stopToken = {}) = 0;
     virtual void RenderToSurface(Surface& surface, RenderList renderList) = 0;
 
-    virtual Task<TextureData> CopyTextureData(Texture texture) = 0;
+    // If stop is requested before the copy starts, it is skipped and the task fails with TaskCancelled
+    virtual Task<TextureData> CopyTextureData(Texture texture, std::stop_token stopToken = {}) = 0;
+
+    // Run a kernel, returning a texture for each of its outputs. The kernel runs on the async compute queue if there
+    // is one, so it can overlap with rendering. Anything scheduled afterwards that uses the outputs waits for it.
+    virtual std::vector<Texture> Dispatch(Kernel kernel, DispatchInfo info) = 0;
+
+    // Statistics for the work that had been scheduled by the last call to EndFrame
+    virtual RendererStatistics GetLastFrameStatistics() const = 0;
 };
 
 using RendererPtr = std::unique_ptr<Renderer>;
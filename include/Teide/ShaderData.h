@@ -2,6 +2,7 @@
 #pragma once
 
 #include "Teide/BasicTypes.h"
+#include "Teide/Format.h"
 
 #include <iosfwd>
 #include <string>
@@ -119,6 +120,10 @@ struct KernelData
 
 bool IsResourceType(ShaderVariableType::BaseType type);
 
+// The format of the storage image that a kernel output of the given type is written to. There are no three-component
+// storage image formats, so Vector3 outputs are padded to four components.
+Format GetKernelOutputFormat(ShaderVariableType type);
+
 std::ostream& operator<<(std::ostream& os, ShaderVariableType::BaseType type);
 std::ostream& operator<<(std::ostream& os, ShaderVariableType type);
 
@@ -139,6 +144,7 @@ struct ParameterBlockLayoutData
     std::vector<ShaderVariableType::BaseType> resourceDescs;
     bool isPushConstant = false;
     ShaderStageFlags uniformsStages = {};
+    bool dynamicUniforms = false; // The uniform buffer is bound with a dynamic offset (see UniformAllocator)
 };
 
 ParameterBlockLayoutData BuildParameterBlockLayout(const ParameterBlockDesc& pblock, int set);
@@ -1,13 +1,836 @@
 
 #pragma once
 
+#include "Teide/Assert.h"
+#include "Teide/BasicTypes.h"
+
+#include <stdexec/execution.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
 #include <future>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace Teide
 {
 
 template <class T = void>
-using Task = std::shared_future<T>;
+class Task;
+
+// The exception that a task fails with if it was cancelled (e.g. through a stop token passed to Scheduler) before it
+// could run. When a cancelled task is used as a sender, it completes with set_stopped instead.
+class TaskCancelled : public std::exception
+{
+public:
+    [[nodiscard]] const char* what() const noexcept override { return "Task was cancelled"; }
+};
+
+namespace detail
+{
+    // Shared by every cancelled task, so that cancelling doesn't allocate
+    inline const std::exception_ptr& GetTaskCancelledException()
+    {
+        static const auto exception = std::make_exception_ptr(TaskCancelled());
+        return exception;
+    }
+
+    // Intrusive node in a task's list of continuations
+    class TaskContinuation
+    {
+    public:
+        TaskContinuation() = default;
+
+        TaskContinuation(const TaskContinuation&) = delete;
+        TaskContinuation(TaskContinuation&&) = delete;
+        TaskContinuation& operator=(const TaskContinuation&) = delete;
+        TaskContinuation& operator=(TaskContinuation&&) = delete;
+
+        // Called exactly once, by the thread that completes the task. The node may destroy or recycle itself.
+        virtual void Run() noexcept = 0;
+
+        TaskContinuation* next = nullptr;
+
+    protected:
+        ~TaskContinuation() = default;
+    };
+
+    // Marks a task's continuation list as closed, once the task has completed
+    class CompletedTaskSentinel final : public TaskContinuation
+    {
+    public:
+        void Run() noexcept override {}
+    };
+    inline CompletedTaskSentinel s_completedTask;
+
+    // Shared between a task's producer and all copies of the task. States are reference counted and recycled through
+    // a pool rather than deleted, so creating a task doesn't allocate in steady state.
+    class TaskStateBase
+    {
+    public:
+        TaskStateBase() = default;
+
+        TaskStateBase(const TaskStateBase&) = delete;
+        TaskStateBase(TaskStateBase&&) = delete;
+        TaskStateBase& operator=(const TaskStateBase&) = delete;
+        TaskStateBase& operator=(TaskStateBase&&) = delete;
+
+        void AddRef() noexcept { m_refCount.fetch_add(1, std::memory_order_relaxed); }
+
+        void Release() noexcept
+        {
+            if (m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                Recycle();
+            }
+        }
+
+        bool IsReady() const noexcept { return m_continuations.load(std::memory_order_acquire) == &s_completedTask; }
+
+        void Wait() const noexcept
+        {
+            for (auto* head = m_continuations.load(std::memory_order_acquire); head != &s_completedTask;
+                 head = m_continuations.load(std::memory_order_acquire))
+            {
+                m_continuations.wait(head, std::memory_order_acquire);
+            }
+        }
+
+        // Returns false without adding the continuation if the task has already completed
+        bool AddContinuation(TaskContinuation& continuation) noexcept
+        {
+            auto* head = m_continuations.load(std::memory_order_acquire);
+            do
+            {
+                if (head == &s_completedTask)
+                {
+                    return false;
+                }
+                continuation.next = head;
+            } while (!m_continuations.compare_exchange_weak(
+                head, &continuation, std::memory_order_release, std::memory_order_acquire));
+            return true;
+        }
+
+        const std::exception_ptr& GetException() const noexcept { return m_exception; }
+        void SetException(std::exception_ptr exception) noexcept { m_exception = std::move(exception); }
+
+        // Cancellation is recorded alongside the exception, so that it can be told apart without rethrowing
+        bool IsCancelled() const noexcept { return m_cancelled; }
+        void SetCancelled()
+        {
+            m_exception = GetTaskCancelledException();
+            m_cancelled = true;
+        }
+
+        // Mark the task as complete and run its continuations. The result must have been set first.
+        void Complete() noexcept
+        {
+            auto* head = m_continuations.exchange(&s_completedTask, std::memory_order_acq_rel);
+            m_continuations.notify_all();
+
+            // Continuations are pushed to the front of the list, so reverse it to run them in the order they were added
+            TaskContinuation* ordered = nullptr;
+            while (head)
+            {
+                head = std::exchange(head->next, std::exchange(ordered, head));
+            }
+            while (ordered)
+            {
+                std::exchange(ordered, ordered->next)->Run();
+            }
+        }
+
+    protected:
+        ~TaskStateBase() = default;
+
+        virtual void Recycle() noexcept = 0;
+
+        void ResetBase() noexcept
+        {
+            m_continuations.store(nullptr, std::memory_order_relaxed);
+            m_exception = nullptr;
+            m_cancelled = false;
+        }
+
+    private:
+        template <class State>
+        friend class TaskStatePool;
+
+        std::atomic<uint32> m_refCount = 0;
+        std::atomic<TaskContinuation*> m_continuations = nullptr;
+        std::exception_ptr m_exception;
+        bool m_cancelled = false;
+        TaskStateBase* m_nextFree = nullptr;
+    };
+
+    template <class T>
+    class TaskState : public TaskStateBase
+    {
+    public:
+        template <class... Args>
+        void SetValue(Args&&... args)
+        {
+            m_value.emplace(std::forward<Args>(args)...);
+        }
+
+        const T& GetValue() const { return *m_value; }
+
+    protected:
+        ~TaskState() = default;
+
+        void ResetState() noexcept
+        {
+            m_value.reset();
+            ResetBase();
+        }
+
+    private:
+        std::optional<T> m_value;
+    };
+
+    template <>
+    class TaskState<void> : public TaskStateBase
+    {
+    public:
+        void SetValue() noexcept {}
+
+    protected:
+        ~TaskState() = default;
+
+        void ResetState() noexcept { ResetBase(); }
+    };
+
+    // Invoke f and store its result (or the exception it threw) in the state, without completing it
+    template <class T, class F>
+    void SetResultOf(TaskState<T>& state, F&& f) noexcept
+    {
+        try
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                std::invoke(std::forward<F>(f));
+                state.SetValue();
+            }
+            else
+            {
+                state.SetValue(std::invoke(std::forward<F>(f)));
+            }
+        }
+        catch (const TaskCancelled&)
+        {
+            // e.g. a continuation that got its cancelled dependency's result
+            state.SetCancelled();
+        }
+        catch (...)
+        {
+            state.SetException(std::current_exception());
+        }
+    }
+
+    // Free list of task states of one concrete type. Each thread keeps its own list, so recycling a state doesn't
+    // take a lock. States are often released on a different thread to the one that acquired them, so full lists are
+    // handed over to a shared list in batches, which any thread can take from once its own list is empty.
+    template <class State>
+    class TaskStatePool
+    {
+    public:
+        // Returns a state with a reference count of zero
+        static State* Acquire()
+        {
+            LocalList& local = GetLocal();
+            if (!local.head && !local.closed)
+            {
+                local.TakeBatch(GetShared());
+            }
+            if (local.head)
+            {
+                local.size--;
+                return static_cast<State*>(std::exchange(local.head, local.head->m_nextFree));
+            }
+            return new State();
+        }
+
+        static void Recycle(State* state) noexcept
+        {
+            LocalList& local = GetLocal();
+            if (local.closed)
+            {
+                // The thread is exiting, so give the state straight to the shared list
+                GetShared().Add({.head = state, .size = 1});
+                return;
+            }
+
+            state->m_nextFree = std::exchange(local.head, state);
+            if (++local.size >= BatchSize)
+            {
+                GetShared().Add({.head = std::exchange(local.head, nullptr), .size = std::exchange(local.size, 0)});
+            }
+        }
+
+    private:
+        static constexpr uint32 BatchSize = 64;
+
+        struct Batch
+        {
+            TaskStateBase* head = nullptr;
+            uint32 size = 0;
+        };
+
+        class SharedList
+        {
+        public:
+            void Add(Batch batch) noexcept
+            {
+                const auto lock = std::scoped_lock(m_mutex);
+                try
+                {
+                    m_batches.push_back(batch);
+                }
+                catch (...)
+                {
+                    // Only happens while the pool is growing, so leaking a few states is better than failing
+                }
+            }
+
+            std::optional<Batch> Take()
+            {
+                const auto lock = std::scoped_lock(m_mutex);
+                if (m_batches.empty())
+                {
+                    return std::nullopt;
+                }
+                const Batch batch = m_batches.back();
+                m_batches.pop_back();
+                return batch;
+            }
+
+        private:
+            std::mutex m_mutex;
+            std::vector<Batch> m_batches;
+        };
+
+        // Trivially destructible, so that it can still be used by tasks that are released while the thread's other
+        // thread_local objects are being destroyed
+        struct LocalList
+        {
+            TaskStateBase* head = nullptr;
+            uint32 size = 0;
+            bool closed = false;
+
+            void TakeBatch(SharedList& shared)
+            {
+                if (const auto batch = shared.Take())
+                {
+                    head = batch->head;
+                    size = batch->size;
+                }
+            }
+        };
+
+        // Hands the thread's states over to the shared list when the thread exits
+        struct LocalListCloser
+        {
+            LocalList& list;
+
+            ~LocalListCloser()
+            {
+                if (list.head)
+                {
+                    GetShared().Add({.head = std::exchange(list.head, nullptr), .size = std::exchange(list.size, 0)});
+                }
+                list.closed = true;
+            }
+        };
+
+        static LocalList& GetLocal() noexcept
+        {
+            thread_local constinit LocalList list;
+            thread_local const LocalListCloser closer{list};
+            return list;
+        }
+
+        static SharedList& GetShared() noexcept
+        {
+            // Never destroyed, because tasks may still be released during static destruction
+            static auto* const shared = new SharedList();
+            return *shared;
+        }
+    };
+
+    // Task state that is fulfilled explicitly (see TaskPromise)
+    template <class T>
+    class PromiseTaskState final : public TaskState<T>
+    {
+    protected:
+        void Recycle() noexcept override
+        {
+            this->ResetState();
+            TaskStatePool<PromiseTaskState>::Recycle(this);
+        }
+    };
+
+    // Task state that is fulfilled by calling f with the result of another task, on the thread that completes it
+    template <class T, class F>
+    class ThenTaskState final : public TaskState<std::invoke_result_t<F, const Task<T>&>>, public TaskContinuation
+    {
+    public:
+        template <class G>
+        void Init(Task<T> dependency, G&& f)
+        {
+            m_dependency = std::move(dependency);
+            m_func.emplace(std::forward<G>(f));
+        }
+
+        void Run() noexcept override
+        {
+            SetResultOf(*this, [this] { return std::invoke(std::move(*m_func), std::as_const(m_dependency)); });
+            m_func.reset();
+            m_dependency = {};
+            this->Complete();
+            this->Release(); // the reference held while the continuation was pending
+        }
+
+    protected:
+        void Recycle() noexcept override
+        {
+            this->ResetState();
+            TaskStatePool<ThenTaskState>::Recycle(this);
+        }
+
+    private:
+        Task<T> m_dependency;
+        std::optional<F> m_func;
+    };
+
+    // Task state that completes once all of a set of tasks have completed
+    class WhenAllTaskState final : public TaskState<void>
+    {
+    public:
+        // Takes a reference for the returned task, and one that is released once all dependencies have completed
+        template <class... Ts>
+        Task<> Start(const Task<Ts>&... tasks);
+
+        template <class T>
+        Task<> Start(std::span<const Task<T>> tasks);
+
+    protected:
+        void Recycle() noexcept override
+        {
+            ResetState();
+            TaskStatePool<WhenAllTaskState>::Recycle(this);
+        }
+
+    private:
+        struct Node final : TaskContinuation
+        {
+            // The owner can be recycled as soon as it has been told, so take the dependency first
+            void Run() noexcept override { owner->OnDependencyComplete(std::exchange(dependency, nullptr)); }
+
+            WhenAllTaskState* owner = nullptr;
+            TaskStateBase* dependency = nullptr;
+        };
+
+        void Reserve(usize count)
+        {
+            // The nodes are kept when the state is recycled, so this only allocates while the pool warms up
+            if (m_nodeCapacity < count)
+            {
+                m_nodes = std::make_unique<Node[]>(count);
+                m_nodeCapacity = count;
+            }
+            m_numNodes = count;
+            m_remaining.store(count + 1, std::memory_order_relaxed);
+            m_hasException.store(false, std::memory_order_relaxed);
+        }
+
+        // Holds a reference to the dependency until it has completed, in case every task for it is released first
+        void SetDependency(usize index, TaskStateBase* dependency) noexcept
+        {
+            TEIDE_ASSERT(dependency, "Task has no state");
+            dependency->AddRef();
+            m_nodes[index].owner = this;
+            m_nodes[index].dependency = dependency;
+        }
+
+        void AddContinuations() noexcept
+        {
+            for (usize i = 0; i < m_numNodes; i++)
+            {
+                if (!m_nodes[i].dependency->AddContinuation(m_nodes[i]))
+                {
+                    m_nodes[i].Run();
+                }
+            }
+
+            // Balances the extra count from Reserve, so the state can't complete while nodes are still being added
+            OnDependencyComplete(nullptr);
+        }
+
+        void OnDependencyComplete(TaskStateBase* dependency) noexcept
+        {
+            if (dependency)
+            {
+                // Report the first exception, if any of the tasks failed
+                if (dependency->GetException() && !m_hasException.exchange(true, std::memory_order_relaxed))
+                {
+                    if (dependency->IsCancelled())
+                    {
+                        SetCancelled();
+                    }
+                    else
+                    {
+                        SetException(dependency->GetException());
+                    }
+                }
+                dependency->Release();
+            }
+
+            if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                Complete();
+                Release(); // the reference held while dependencies were pending
+            }
+        }
+
+        std::unique_ptr<Node[]> m_nodes;
+        usize m_nodeCapacity = 0;
+        usize m_numNodes = 0;
+        std::atomic<usize> m_remaining = 0;
+        std::atomic<bool> m_hasException = false;
+    };
+
+    // Heap-allocated continuation for arbitrary callables (see Task::OnComplete)
+    template <class F>
+    class CallbackContinuation final : public TaskContinuation
+    {
+    public:
+        explicit CallbackContinuation(F&& f) : m_func{std::move(f)} {}
+
+        void Run() noexcept override
+        {
+            std::invoke(std::move(m_func));
+            delete this;
+        }
+
+    private:
+        ~CallbackContinuation() = default;
+
+        F m_func;
+    };
+
+    struct TaskAccess
+    {
+        template <class T>
+        static TaskState<T>* GetState(const Task<T>& task)
+        {
+            return task.m_state;
+        }
+    };
+
+    template <class T>
+    struct TaskValueSignature
+    {
+        using type = stdexec::set_value_t(T);
+    };
+
+    template <>
+    struct TaskValueSignature<void>
+    {
+        using type = stdexec::set_value_t();
+    };
+
+    template <class T>
+    using TaskCompletionSignatures = stdexec::completion_signatures<
+        typename TaskValueSignature<T>::type, stdexec::set_error_t(std::exception_ptr), stdexec::set_stopped_t()>;
+
+    // Operation state for a task used as a sender. It is its own continuation node, so connecting and starting it
+    // don't allocate.
+    template <class T, class Receiver>
+    class TaskOperation final : public TaskContinuation
+    {
+    public:
+        TaskOperation(Task<T> task, Receiver receiver) : m_task{std::move(task)}, m_receiver{std::move(receiver)} {}
+
+        void start() & noexcept
+        {
+            if (!TaskAccess::GetState(m_task)->AddContinuation(*this))
+            {
+                Run();
+            }
+        }
+
+        // The receiver is completed on whichever thread completes the task
+        void Run() noexcept override
+        {
+            const TaskState<T>& state = *TaskAccess::GetState(m_task);
+            if (const auto& exception = state.GetException())
+            {
+                if (state.IsCancelled())
+                {
+                    stdexec::set_stopped(std::move(m_receiver));
+                }
+                else
+                {
+                    stdexec::set_error(std::move(m_receiver), exception);
+                }
+                return;
+            }
+
+            if constexpr (std::is_void_v<T>)
+            {
+                stdexec::set_value(std::move(m_receiver));
+            }
+            else
+            {
+                // Other copies of the task may still read the value, so pass the receiver a copy
+                std::optional<T> value;
+                try
+                {
+                    value.emplace(state.GetValue());
+                }
+                catch (...)
+                {
+                    stdexec::set_error(std::move(m_receiver), std::current_exception());
+                    return;
+                }
+                stdexec::set_value(std::move(m_receiver), std::move(*value));
+            }
+        }
+
+    private:
+        Task<T> m_task;
+        Receiver m_receiver;
+    };
+
+} // namespace detail
+
+/**
+ * Handle to the result of an asynchronous operation. Tasks are also stdexec senders, which complete on whichever
+ * thread completes the task, so they can be composed with stdexec algorithms or co_await-ed in a coroutine.
+ */
+template <class T>
+class Task
+{
+public:
+    using sender_concept = stdexec::sender_t;
+
+    using completion_signatures = detail::TaskCompletionSignatures<T>;
+
+    Task() = default;
+
+    // Takes ownership of one reference to the state
+    explicit Task(detail::TaskState<T>* state) noexcept : m_state{state} {}
+
+    Task(const Task& other) noexcept : m_state{other.m_state}
+    {
+        if (m_state)
+        {
+            m_state->AddRef();
+        }
+    }
+
+    Task(Task&& other) noexcept : m_state{std::exchange(other.m_state, nullptr)} {}
+
+    Task& operator=(const Task& other) noexcept
+    {
+        Task(other).swap(*this);
+        return *this;
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        Task(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~Task()
+    {
+        if (m_state)
+        {
+            m_state->Release();
+        }
+    }
+
+    void swap(Task& other) noexcept { std::swap(m_state, other.m_state); }
+
+    bool valid() const noexcept { return m_state != nullptr; }
+
+    bool IsReady() const
+    {
+        TEIDE_ASSERT(valid(), "Task has no state");
+        return m_state->IsReady();
+    }
+
+    // Whether the task has completed by being cancelled, in which case get() throws TaskCancelled
+    bool IsCancelled() const
+    {
+        TEIDE_ASSERT(valid(), "Task has no state");
+        return m_state->IsReady() && m_state->IsCancelled();
+    }
+
+    void wait() const
+    {
+        TEIDE_ASSERT(valid(), "Task has no state");
+        m_state->Wait();
+    }
+
+    template <class Rep, class Period>
+    std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const
+    {
+        return wait_until(std::chrono::steady_clock::now() + timeout);
+    }
+
+    template <class Clock, class Duration>
+    std::future_status wait_until(const std::chrono::time_point<Clock, Duration>& deadline) const
+    {
+        TEIDE_ASSERT(valid(), "Task has no state");
+
+        // Atomic waits can't time out, so back off with short sleeps instead. Untimed waits don't poll.
+        auto sleepTime = std::chrono::microseconds{1};
+        while (!m_state->IsReady())
+        {
+            if (Clock::now() >= deadline)
+            {
+                return std::future_status::timeout;
+            }
+            std::this_thread::sleep_for(sleepTime);
+            sleepTime = std::min(sleepTime * 2, std::chrono::microseconds{1000});
+        }
+        return std::future_status::ready;
+    }
+
+    decltype(auto) get() const
+    {
+        wait();
+        if (const auto& exception = m_state->GetException())
+        {
+            std::rethrow_exception(exception);
+        }
+        if constexpr (!std::is_void_v<T>)
+        {
+            return m_state->GetValue();
+        }
+    }
+
+    /**
+     * Returns a task for the result of calling f with this task, once this task has completed. f is called on
+     * whichever thread completes this task (or immediately, if it has already completed), so it should do as little
+     * work as possible.
+     */
+    template <std::invocable<const Task&> F>
+    auto then(F&& f) const -> Task<std::invoke_result_t<F, const Task&>>
+    {
+        using State = detail::ThenTaskState<T, std::decay_t<F>>;
+
+        TEIDE_ASSERT(valid(), "Task has no state");
+
+        State* state = detail::TaskStatePool<State>::Acquire();
+        state->AddRef(); // for the returned task
+        state->AddRef(); // released once the continuation has run
+        state->Init(*this, std::forward<F>(f));
+
+        auto ret = Task<std::invoke_result_t<F, const Task&>>(state);
+        if (!m_state->AddContinuation(*state))
+        {
+            state->Run();
+        }
+        return ret;
+    }
+
+    /**
+     * Call f once the result of this task is available. This is called on whichever thread completes the task (or
+     * immediately, if it has already completed), so f should do as little work as possible.
+     *
+     * @note This allocates, so prefer then() for tasks that are created often.
+     */
+    template <std::invocable<> F>
+    void OnComplete(F&& f) const
+    {
+        TEIDE_ASSERT(valid(), "Task has no state");
+        auto* continuation = new detail::CallbackContinuation<std::decay_t<F>>(std::forward<F>(f));
+        if (!m_state->AddContinuation(*continuation))
+        {
+            continuation->Run();
+        }
+    }
+
+    template <stdexec::receiver R>
+    auto connect(R receiver) const&
+    {
+        return detail::TaskOperation<T, R>(*this, std::move(receiver));
+    }
+
+    template <stdexec::receiver R>
+    auto connect(R receiver) &&
+    {
+        return detail::TaskOperation<T, R>(std::move(*this), std::move(receiver));
+    }
+
+private:
+    friend struct detail::TaskAccess;
+
+    detail::TaskState<T>* m_state = nullptr;
+};
+
+template <class... Ts>
+Task<> detail::WhenAllTaskState::Start(const Task<Ts>&... tasks)
+{
+    Reserve(sizeof...(Ts));
+    usize i = 0;
+    (SetDependency(i++, TaskAccess::GetState(tasks)), ...);
+
+    AddRef(); // for the returned task
+    AddRef(); // released once all dependencies have completed
+    auto ret = Task<>(this);
+    AddContinuations();
+    return ret;
+}
+
+template <class T>
+Task<> detail::WhenAllTaskState::Start(std::span<const Task<T>> tasks)
+{
+    Reserve(tasks.size());
+    for (usize i = 0; i < tasks.size(); i++)
+    {
+        SetDependency(i, TaskAccess::GetState(tasks[i]));
+    }
+
+    AddRef(); // for the returned task
+    AddRef(); // released once all dependencies have completed
+    auto ret = Task<>(this);
+    AddContinuations();
+    return ret;
+}
+
+// Returns a task that completes when all of the given tasks have completed. If any of them failed, the returned task
+// rethrows the first exception that was reported.
+template <class... Ts>
+Task<> when_all(const Task<Ts>&... tasks)
+{
+    return detail::TaskStatePool<detail::WhenAllTaskState>::Acquire()->Start(tasks...);
+}
+
+template <class T>
+Task<> when_all(std::span<const Task<T>> tasks)
+{
+    return detail::TaskStatePool<detail::WhenAllTaskState>::Acquire()->Start(tasks);
+}
+
+template <class T>
+Task<> when_all(const std::vector<Task<T>>& tasks)
+{
+    return when_all(std::span<const Task<T>>(tasks));
+}
 
 } // namespace Teide
@@ -0,0 +1,131 @@
+
+#pragma once
+
+#include "Teide/AbstractBase.h"
+#include "Teide/Task.h"
+
+#include <stdexec/execution.hpp>
+
+#include <utility>
+
+namespace Teide
+{
+
+// Tasks of higher priority are started first, so that frame work never waits behind bulk work that was launched
+// before it. Lower priority tasks still run eventually (see CpuExecutor::StarvationLimit).
+enum class TaskPriority : uint8
+{
+    FrameCritical, // Work that the current frame is waiting on, e.g. recording render lists
+    Normal,
+    Background, // Bulk work that can take as long as it needs, e.g. readbacks and asset loading
+};
+
+constexpr usize TaskPriorityCount = 3;
+
+class TaskScheduler;
+
+namespace detail
+{
+    // A pool of threads that continuations can be posted to (see CpuExecutor)
+    class TaskExecutor : public AbstractBase
+    {
+    public:
+        // Run the continuation on one of the executor's threads, ahead of lower priority work. The continuation must
+        // stay alive until it has run.
+        virtual void Post(TaskContinuation& continuation, TaskPriority priority) = 0;
+    };
+
+    // Operation state for TaskScheduler::schedule(). It is posted to the executor as its own continuation node, so
+    // scheduling doesn't allocate (beyond what the executor itself does).
+    template <class Receiver>
+    class ScheduleOperation final : public TaskContinuation
+    {
+    public:
+        ScheduleOperation(TaskExecutor& executor, TaskPriority priority, Receiver receiver) :
+            m_executor{executor}, m_priority{priority}, m_receiver{std::move(receiver)}
+        {}
+
+        void start() & noexcept { m_executor.Post(*this, m_priority); }
+
+        void Run() noexcept override
+        {
+            if (stdexec::get_stop_token(stdexec::get_env(m_receiver)).stop_requested())
+            {
+                stdexec::set_stopped(std::move(m_receiver));
+            }
+            else
+            {
+                stdexec::set_value(std::move(m_receiver));
+            }
+        }
+
+    private:
+        TaskExecutor& m_executor;
+        TaskPriority m_priority;
+        Receiver m_receiver;
+    };
+} // namespace detail
+
+/**
+ * Lightweight handle to a thread pool that models stdexec::scheduler, for running CPU work in sender pipelines and
+ * coroutines. Work is started with the scheduler's priority. The thread pool must outlive the scheduler and any work
+ * scheduled on it.
+ */
+class TaskScheduler
+{
+public:
+    class ScheduleSender
+    {
+    public:
+        using sender_concept = stdexec::sender_t;
+
+        using completion_signatures = stdexec::completion_signatures<stdexec::set_value_t(), stdexec::set_stopped_t()>;
+
+        struct Env
+        {
+            detail::TaskExecutor* executor;
+            TaskPriority priority;
+
+            template <class CPO>
+            auto query(stdexec::get_completion_scheduler_t<CPO> /*unused*/) const noexcept -> TaskScheduler
+            {
+                return TaskScheduler(*executor, priority);
+            }
+        };
+
+        ScheduleSender(detail::TaskExecutor& executor, TaskPriority priority) :
+            m_executor{&executor}, m_priority{priority}
+        {}
+
+        template <stdexec::receiver R>
+        auto connect(R receiver) const
+        {
+            return detail::ScheduleOperation<R>(*m_executor, m_priority, std::move(receiver));
+        }
+
+        auto get_env() const noexcept -> Env { return {.executor = m_executor, .priority = m_priority}; }
+
+    private:
+        detail::TaskExecutor* m_executor;
+        TaskPriority m_priority;
+    };
+
+    explicit TaskScheduler(detail::TaskExecutor& executor, TaskPriority priority = TaskPriority::Normal) :
+        m_executor{&executor}, m_priority{priority}
+    {}
+
+    auto schedule() const noexcept -> ScheduleSender { return ScheduleSender(*m_executor, m_priority); }
+
+    // A scheduler for the same thread pool that starts work with the given priority
+    TaskScheduler WithPriority(TaskPriority priority) const { return TaskScheduler(*m_executor, priority); }
+
+    TaskPriority GetPriority() const { return m_priority; }
+
+    bool operator==(const TaskScheduler&) const = default;
+
+private:
+    detail::TaskExecutor* m_executor;
+    TaskPriority m_priority;
+};
+
+} // namespace Teide
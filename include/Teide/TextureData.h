@@ -55,6 +55,10 @@ struct SamplerState
     std::optional<CompareOp> compareOp;
 
     bool operator==(const SamplerState&) const noexcept = default;
+    void Visit(auto f) const
+    {
+        return f(magFilter, minFilter, mipmapMode, addressModeU, addressModeV, addressModeW, maxAnisotropy, compareOp);
+    }
 };
 
 struct TextureData
@@ -17,6 +17,7 @@
 #include <optional>
 #include <ranges>
 #include <span>
+#include <string_view>
 
 using namespace Teide;
 
@@ -396,40 +397,86 @@ void BuildVaryings(std::string& source, ShaderStageData& data, const ShaderStage
     source += '\n';
 }
 
-void BuildKernelVaryings(std::string& source, ShaderStageData& data, const ShaderStageDefinition& sourceStage)
+constexpr int KernelParamsSet = 2;
+
+std::string_view GetGlslImageFormat(Format format)
+{
+    switch (format)
+    {
+        case Format::Float1: return "r32f";
+        case Format::Float2: return "rg32f";
+        case Format::Float4: return "rgba32f";
+        default: Unreachable();
+    }
+}
+
+// The extra components that make a kernel output up to the vec4 that imageStore takes
+std::string_view GetVec4Padding(ShaderVariableType::BaseType type)
+{
+    using enum ShaderVariableType::BaseType;
+    switch (type)
+    {
+        case Vector2: return ", 0.0, 0.0";
+        case Vector3: return ", 0.0";
+        default: return "";
+    }
+}
+
+// Texture inputs are bound in the params set, after the uniform buffer and before the outputs. Other inputs are
+// plain globals.
+void BuildKernelVaryings(std::string& source, KernelData& data, const ShaderStageDefinition& sourceStage)
 {
     auto out = std::back_inserter(source);
 
+    usize slot = 1; // start at 1 because slot 0 is reserved for uniform buffer
     for (const auto& input : sourceStage.inputs)
     {
-        data.inputs.push_back(input);
-        fmt::format_to(out, "{} {};\n", input.type, input.name);
+        data.computeShader.inputs.push_back(input);
+        if (IsResourceType(input.type.baseType))
+        {
+            if (input.type.baseType != ShaderVariableType::BaseType::Texture2D)
+            {
+                throw CompileError(fmt::format("Kernel input '{}' has unsupported type {}", input.name, input.type));
+            }
+            fmt::format_to(
+                out, "layout(set = {}, binding = {}) uniform {} {};\n", KernelParamsSet, slot++, input.type,
+                input.name);
+            data.paramsPblock.parameters.push_back(input);
+        }
+        else
+        {
+            fmt::format_to(out, "{} {};\n", input.type, input.name);
+        }
     }
 
     for (const auto& output : sourceStage.outputs)
     {
-        data.outputs.push_back(output);
+        if (IsResourceType(output.type.baseType) || output.type.baseType == ShaderVariableType::BaseType::Matrix4
+            || output.type.arraySize != 0)
+        {
+            throw CompileError(fmt::format("Kernel output '{}' has unsupported type {}", output.name, output.type));
+        }
+        data.computeShader.outputs.push_back(output);
         fmt::format_to(out, "{} {};\n", output.type, output.name);
     }
 
     source += '\n';
 }
 
+// Outputs are bound as storage images in the params set, after the texture inputs, in the format that
+// GetKernelOutputFormat gives for their type
 void BuildKernelEntrypoint(std::string& source, KernelData& data, const ShaderStageDefinition& sourceStage)
 {
     auto out = std::back_inserter(source);
 
-    usize slot = 1; // start at 1 because slot 0 is reserved for uniform buffer
-    constexpr int paramsSet = 2;
+    usize slot = data.paramsPblock.parameters.size() + 1; // the texture inputs and the uniform buffer come first
     for (const auto& output : sourceStage.outputs)
     {
-        // TODO: derive glslFormat and storageType from output.type and storage method (buffer/image2D etc)
-        using namespace std::literals;
-        const auto glslFormat = "r32f"sv;
-        const auto storageType = "image2D"sv;
+        // TODO: handle buffers and non-2D images
+        const auto glslFormat = GetGlslImageFormat(GetKernelOutputFormat(output.type));
         fmt::format_to(
-            out, "layout(set = {}, binding = {}, {}) uniform {} _{}_image_;\n", paramsSet, slot++, //
-            glslFormat, storageType, output.name);
+            out, "layout(set = {}, binding = {}, {}) uniform image2D _{}_image_;\n", KernelParamsSet, slot++, //
+            glslFormat, output.name);
     }
 
     fmt::format_to(out, "void main() {{\n");
@@ -437,13 +484,11 @@ void BuildKernelEntrypoint(std::string& source, KernelData& data, const ShaderSt
 
     for (const auto& output : sourceStage.outputs)
     {
-        TEIDE_ASSERT(!IsResourceType(output.type.baseType));
-        // TODO: handle buffers and non-2D images
-        // TODO: handle vec2 and vec4 output types
+        const auto padding = GetVec4Padding(output.type.baseType);
         const auto resourceName = fmt::format("_{}_image_", output.name);
         fmt::format_to(
-            out, "    imageStore({}, ivec2(gl_GlobalInvocationID.xy), vec4({}));\n", //
-            resourceName, output.name);
+            out, "    imageStore({}, ivec2(gl_GlobalInvocationID.xy), vec4({}{}));\n", //
+            resourceName, output.name, padding);
 
         data.paramsPblock.parameters.emplace_back(resourceName, ShaderVariableType::BaseType::RWTexture2D);
     }
@@ -525,7 +570,7 @@ KernelData ShaderCompiler::Compile(const KernelSourceData& sourceData) const
     BuildBindings<0>(computeShader, sourceData.environment.scenePblock);
     BuildBindings<1>(computeShader, sourceData.environment.viewPblock);
 
-    BuildKernelVaryings(computeShader, data.computeShader, sourceData.kernelShader);
+    BuildKernelVaryings(computeShader, data, sourceData.kernelShader);
     computeShader += sourceData.kernelShader.source;
     computeShader += "#undef main\n";
     BuildKernelEntrypoint(computeShader, data, sourceData.kernelShader);
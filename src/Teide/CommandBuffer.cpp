@@ -10,40 +10,6 @@ namespace Teide
 CommandBuffer::CommandBuffer(vk::UniqueCommandBuffer commandBuffer) : m_cmdBuffer(std::move(commandBuffer))
 {}
 
-void CommandBuffer::AddReference(const Texture& p)
-{
-    m_referencedTextures.insert(p);
-}
-
-void CommandBuffer::AddReference(const BufferPtr& p)
-{
-    m_referencedBuffers.insert(p);
-}
-
-void CommandBuffer::TakeOwnership(vk::UniqueBuffer buffer)
-{
-    m_ownedBuffers.push_back(std::move(buffer));
-}
-
-void CommandBuffer::TakeOwnership(vma::UniqueAllocation allocation)
-{
-    m_ownedAllocations.push_back(std::move(allocation));
-}
-
-void CommandBuffer::TakeOwnership(RenderList renderList)
-{
-    m_ownedRenderLists.push_back(std::move(renderList));
-}
-
-void CommandBuffer::Reset()
-{
-    m_referencedTextures.clear();
-    m_referencedBuffers.clear();
-    m_referencedParameterBlocks.clear();
-    m_ownedBuffers.clear();
-    m_ownedAllocations.clear();
-}
-
 std::string_view CommandBuffer::GetDebugName() const
 {
     return m_debugName;
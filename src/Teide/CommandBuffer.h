@@ -2,32 +2,23 @@
 #pragma once
 
 #include "Teide/Definitions.h"
-#include "Teide/ForwardDeclare.h"
-#include "Teide/Renderer.h"
-#include "Teide/Texture.h"
-#include "Teide/VulkanMemAlloc.h"
 
 #include <fmt/base.h>
 #include <vulkan/vulkan.hpp>
 
-#include <unordered_set>
+#include <string>
+#include <string_view>
 
 namespace Teide
 {
 
+// Command buffers don't keep the resources they use alive. Resources are destroyed once the GPU has finished the work
+// scheduled before they were released (see Scheduler::DestroyAfterGpuWork).
 class CommandBuffer
 {
 public:
     explicit CommandBuffer(vk::UniqueCommandBuffer commandBuffer);
 
-    void AddReference(const Texture& p);
-    void AddReference(const BufferPtr& p);
-
-    void TakeOwnership(vk::UniqueBuffer buffer);
-    void TakeOwnership(vma::UniqueAllocation allocation);
-    void TakeOwnership(RenderList renderList);
-    void Reset();
-
     std::string_view GetDebugName() const;
     void SetDebugName(std::string_view name);
 
@@ -51,15 +42,6 @@ private:
 
     vk::UniqueCommandBuffer m_cmdBuffer;
 
-    std::unordered_set<Texture> m_referencedTextures;
-    std::unordered_set<BufferPtr> m_referencedBuffers;
-    std::unordered_set<MeshPtr> m_referencedMeshes;
-    std::unordered_set<ParameterBlock> m_referencedParameterBlocks;
-    std::unordered_set<PipelinePtr> m_referencedPipelines;
-    std::vector<vk::UniqueBuffer> m_ownedBuffers;
-    std::vector<vma::UniqueAllocation> m_ownedAllocations;
-    std::vector<RenderList> m_ownedRenderLists;
-
     std::string m_debugName = "Unnamed";
 };
 
@@ -1,66 +1,237 @@
 
 #include "CpuExecutor.h"
 
-#include "Teide/Assert.h"
-#include "Teide/Util/ThreadUtils.h"
-
-#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <utility>
 
 namespace Teide
 {
 
-CpuExecutor::CpuExecutor(uint32 numThreads) : m_executor(numThreads)
+namespace
+{
+    constexpr usize BackgroundLane = static_cast<usize>(TaskPriority::Background);
+
+    // With only one worker there is none to spare, so background jobs have to share it with everything else
+    uint32 GetMaxBackgroundJobs(uint32 numWorkers)
+    {
+        return numWorkers > 1 ? numWorkers - 1 : 1;
+    }
+} // namespace
+
+CpuExecutor::CpuExecutor(uint32 numThreads) :
+    m_executor(std::max(numThreads, 1u)), m_maxBackgroundJobs{GetMaxBackgroundJobs(GetThreadCount())}
+{}
+
+CpuExecutor::~CpuExecutor()
+{
+    WaitForTasks();
+}
+
+void CpuExecutor::WaitForTasks()
 {
-    m_schedulerThread = std::thread([this] {
-        SetCurrentTheadName("CpuExecutor");
-        constexpr auto timeout = std::chrono::milliseconds{2};
+    m_executor.wait_for_all();
 
-        while (!m_schedulerStop)
+    // Scheduled tasks may be waiting on work outside of this executor (e.g. on the GPU), so wait for them to be
+    // triggered and then wait for whatever they launched
+    for (auto numTasks = m_numScheduledTasks.load(); numTasks > 0; numTasks = m_numScheduledTasks.load())
+    {
+        m_numScheduledTasks.wait(numTasks);
+        m_executor.wait_for_all();
+    }
+
+    m_executor.wait_for_all();
+}
+
+void CpuExecutor::OnScheduledTaskDone()
+{
+    --m_numScheduledTasks;
+    m_numScheduledTasks.notify_all();
+}
+
+void CpuExecutor::NextFrame()
+{
+    TaskStatistics statistics;
+    for (usize i = 0; i < TaskPriorityCount; i++)
+    {
+        auto _ = std::unique_lock(m_lanes[i].mutex);
+        statistics[i] = std::exchange(m_lanes[i].statistics, {});
+    }
+
+    auto _ = std::unique_lock(m_statisticsMutex);
+    m_lastFrameStatistics = statistics;
+}
+
+TaskStatistics CpuExecutor::GetLastFrameStatistics() const
+{
+    auto _ = std::unique_lock(m_statisticsMutex);
+    return m_lastFrameStatistics;
+}
+
+void CpuExecutor::Lane::push_back(detail::TaskContinuation& job)
+{
+    job.next = nullptr;
+    (tail ? tail->next : head) = &job;
+    tail = &job;
+    size++;
+}
+
+detail::TaskContinuation& CpuExecutor::Lane::pop_front()
+{
+    detail::TaskContinuation& job = *std::exchange(head, head->next);
+    if (!head)
+    {
+        tail = nullptr;
+    }
+    size--;
+    return job;
+}
+
+void CpuExecutor::Enqueue(TaskPriority priority, detail::TaskContinuation& job)
+{
+    {
+        Lane& lane = m_lanes[static_cast<usize>(priority)];
+        auto _ = std::unique_lock(lane.mutex);
+        lane.push_back(job);
+        lane.statistics.launched++;
+        lane.statistics.maxQueued = std::max(lane.statistics.maxQueued, lane.size.load());
+    }
+
+    m_executor.silent_async([this] { RunNextJob(); });
+}
+
+void CpuExecutor::RunNextJob()
+{
+    while (true)
+    {
+        if (const auto [job, isBackground] = PopNextJob(); job)
         {
-            std::this_thread::sleep_for(timeout);
+            job->Run();
+            if (isBackground)
+            {
+                OnBackgroundJobDone();
+            }
+            return;
+        }
 
-            auto lock = std::scoped_lock(m_schedulerMutex);
+        // There is always one runner per waiting job, so a runner that finds nothing it can start has been held back
+        // by the background limit. It is parked, and reposted by the next background job to finish.
+        m_numParkedRunners++;
 
-            // If there are futures, check if any have a value
-            for (auto& task : m_scheduledTasks)
+        // If the last running background job finished before the runner was parked, nothing would repost it, so it
+        // takes itself back out and tries again
+        if (m_numRunningBackgroundJobs.load() >= m_maxBackgroundJobs || !TryUnparkRunner())
+        {
+            return;
+        }
+    }
+}
+
+std::pair<detail::TaskContinuation*, bool> CpuExecutor::PopNextJob()
+{
+    // A lane that has been passed over too often goes first, even if there is more important work waiting
+    for (usize lane = TaskPriorityCount; lane-- > 0;)
+    {
+        if (m_lanes[lane].timesPassedOver.load() >= StarvationLimit)
+        {
+            if (auto* const job = TryPopJob(lane, true))
+            {
+                return {job, lane == BackgroundLane};
+            }
+        }
+    }
+
+    for (usize lane = 0; lane < TaskPriorityCount; lane++)
+    {
+        if (auto* const job = TryPopJob(lane, false))
+        {
+            for (usize other = lane + 1; other < TaskPriorityCount; other++)
             {
-                if (task->IsReady())
+                if (CanStart(other))
                 {
-                    auto t = std::exchange(task, nullptr);
-                    t->Execute(*this);
+                    m_lanes[other].timesPassedOver++;
                 }
             }
-
-            // Remove done tasks
-            std::erase(m_scheduledTasks, nullptr);
+            return {job, lane == BackgroundLane};
         }
-    });
+    }
+
+    return {nullptr, false};
 }
 
-CpuExecutor::~CpuExecutor()
+detail::TaskContinuation* CpuExecutor::TryPopJob(usize laneIndex, bool promoted)
 {
-    m_schedulerStop = true;
-    m_schedulerThread.join();
-    WaitForTasks();
+    Lane& lane = m_lanes[laneIndex];
+    if (lane.size.load() == 0)
+    {
+        return nullptr;
+    }
+
+    const bool isBackground = laneIndex == BackgroundLane;
+    if (isBackground && !TryStartBackgroundJob())
+    {
+        return nullptr;
+    }
+
+    {
+        auto _ = std::unique_lock(lane.mutex);
+        if (!lane.empty())
+        {
+            lane.timesPassedOver = 0;
+            if (promoted)
+            {
+                lane.statistics.promoted++;
+            }
+            return &lane.pop_front();
+        }
+    }
+
+    // Another runner got there first
+    if (isBackground)
+    {
+        OnBackgroundJobDone();
+    }
+    return nullptr;
 }
 
-void CpuExecutor::WaitForTasks()
+bool CpuExecutor::CanStart(usize laneIndex) const
 {
-    m_executor.wait_for_all();
+    return m_lanes[laneIndex].size.load() > 0
+        && (laneIndex != BackgroundLane || m_numRunningBackgroundJobs.load() < m_maxBackgroundJobs);
+}
 
-    const auto hasScheduledTasks = [this] {
-        auto lock = std::scoped_lock(m_schedulerMutex);
-        return !m_scheduledTasks.empty();
-    };
+bool CpuExecutor::TryStartBackgroundJob()
+{
+    uint32 numRunning = m_numRunningBackgroundJobs.load();
+    while (numRunning < m_maxBackgroundJobs)
+    {
+        if (m_numRunningBackgroundJobs.compare_exchange_weak(numRunning, numRunning + 1))
+        {
+            return true;
+        }
+    }
+    return false;
+}
 
-    while (hasScheduledTasks())
+void CpuExecutor::OnBackgroundJobDone()
+{
+    m_numRunningBackgroundJobs--;
+    if (TryUnparkRunner())
     {
-        // busy loop for now
-        std::this_thread::sleep_for(std::chrono::milliseconds{2});
-        m_executor.wait_for_all();
+        m_executor.silent_async([this] { RunNextJob(); });
     }
+}
 
-    m_executor.wait_for_all();
+bool CpuExecutor::TryUnparkRunner()
+{
+    uint32 numParked = m_numParkedRunners.load();
+    while (numParked > 0)
+    {
+        if (m_numParkedRunners.compare_exchange_weak(numParked, numParked - 1))
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
 } // namespace Teide
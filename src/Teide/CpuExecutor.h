@@ -1,183 +1,380 @@
 
 #pragma once
 
-#include "Teide/AbstractBase.h"
 #include "Teide/BasicTypes.h"
 #include "Teide/Task.h"
+#include "Teide/TaskScheduler.h"
 
-#include <function2/function2.hpp>
 #include <taskflow/taskflow.hpp>
 
+#include <array>
 #include <atomic>
+#include <exception>
 #include <future>
-#include <memory>
 #include <mutex>
-#include <thread>
+#include <optional>
+#include <stop_token>
+#include <utility>
 
 namespace Teide
 {
 
-namespace detail
+struct TaskLaneStatistics
 {
-    template <class Ret, class Arg>
-    struct UnaryFunctionHelper
-    {
-        using type = fu2::unique_function<Ret(Arg)>;
-    };
-
-    template <class Ret>
-    struct UnaryFunctionHelper<Ret, void>
-    {
-        using type = fu2::unique_function<Ret()>;
-    };
+    uint32 launched = 0;  // Number of tasks launched with the priority
+    uint32 maxQueued = 0; // Most tasks waiting to start at once
+    uint32 promoted = 0;  // Number of tasks started ahead of higher priority tasks, so that the priority wasn't starved
+};
 
-} // namespace detail
+using TaskStatistics = std::array<TaskLaneStatistics, TaskPriorityCount>;
 
 template <class F, class... Args>
     requires std::invocable<F, Args...>
 using TaskForCallable = Task<std::invoke_result_t<F, Args...>>;
 
+// Fulfils a task explicitly. If the promise is destroyed without being fulfilled, the task fails with
+// std::future_errc::broken_promise.
+template <class T = void>
+class TaskPromise
+{
+public:
+    TaskPromise() : m_state{detail::TaskStatePool<detail::PromiseTaskState<T>>::Acquire()} { m_state->AddRef(); }
+
+    ~TaskPromise()
+    {
+        if (m_state)
+        {
+            if (!m_satisfied)
+            {
+                // Make sure continuations still run (and see the error) if the task is abandoned
+                SetException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+            m_state->Release();
+        }
+    }
+
+    TaskPromise(const TaskPromise&) = delete;
+    TaskPromise& operator=(const TaskPromise&) = delete;
+
+    TaskPromise(TaskPromise&& other) noexcept :
+        m_state{std::exchange(other.m_state, nullptr)}, m_satisfied{other.m_satisfied}
+    {}
+
+    TaskPromise& operator=(TaskPromise&& other) noexcept
+    {
+        TaskPromise(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    void swap(TaskPromise& other) noexcept
+    {
+        std::swap(m_state, other.m_state);
+        std::swap(m_satisfied, other.m_satisfied);
+    }
+
+    Task<T> GetTask()
+    {
+        m_state->AddRef();
+        return Task<T>(m_state);
+    }
+
+    template <class... Args>
+    void SetValue(Args&&... args)
+    {
+        m_state->SetValue(std::forward<Args>(args)...);
+        Complete();
+    }
+
+    void SetException(std::exception_ptr exception)
+    {
+        m_state->SetException(std::move(exception));
+        Complete();
+    }
+
+    // Fail the task with TaskCancelled, so that it and its continuations are treated as cancelled
+    void SetCancelled()
+    {
+        m_state->SetCancelled();
+        Complete();
+    }
+
+    template <class F>
+    void SetResultOf(F&& f) noexcept
+    {
+        detail::SetResultOf(*m_state, std::forward<F>(f));
+        Complete();
+    }
+
+private:
+    void Complete()
+    {
+        m_satisfied = true;
+        m_state->Complete();
+    }
+
+    detail::TaskState<T>* m_state;
+    bool m_satisfied = false;
+};
 
-class CpuExecutor
+class CpuExecutor final : public detail::TaskExecutor
 {
 public:
+    // There is always at least one worker thread, even if numThreads is 0
     explicit CpuExecutor(uint32 numThreads);
-    ~CpuExecutor();
+    ~CpuExecutor() override;
 
     CpuExecutor(const CpuExecutor&) = delete;
     CpuExecutor(CpuExecutor&&) = delete;
     CpuExecutor& operator=(const CpuExecutor&) = delete;
     CpuExecutor& operator=(CpuExecutor&&) = delete;
 
+    // If stop is requested before a task starts, the task fails with TaskCancelled instead of running, and its
+    // callable is destroyed straight away
     template <std::invocable<> F>
-    auto LaunchTask(F&& f) -> TaskForCallable<F>
+    auto LaunchTask(F&& f, TaskPriority priority = TaskPriority::Normal, std::stop_token stopToken = {})
+        -> TaskForCallable<F>
     {
-        return LaunchTaskImpl(std::forward<F>(f));
+        using State = LaunchedTaskState<std::invoke_result_t<F>, std::decay_t<F>>;
+
+        State* state = detail::TaskStatePool<State>::Acquire();
+        auto task = state->Init(std::forward<F>(f), std::move(stopToken));
+
+        // The state is its own node in the lane, so enqueuing it doesn't allocate
+        Enqueue(priority, *state);
+        return task;
     }
 
     template <std::invocable<> F>
-    auto LaunchTask(F&& f, Task<> dependency) -> TaskForCallable<F>
+    auto LaunchTask(
+        F&& f, Task<> dependency, TaskPriority priority = TaskPriority::Normal, std::stop_token stopToken = {})
+        -> TaskForCallable<F>
     {
-        const auto lock = std::scoped_lock(m_schedulerMutex);
-
-        auto newTask = MakeScheduledTask<void>(std::move(dependency), std::forward<F>(f));
-        auto future = newTask->GetFuture();
-        m_scheduledTasks.emplace_back(std::move(newTask));
-        return future;
+        return LaunchContinuation(
+            std::move(dependency), priority, std::move(stopToken), [f = std::forward<F>(f)](const Task<>& dep) mutable {
+                dep.get(); // rethrows the dependency's exception, if any
+                return std::invoke(std::move(f));
+            });
     }
 
     template <class T, std::invocable<T> F>
-    auto LaunchTask(F&& f, Task<T> dependency) -> TaskForCallable<F, T>
+    auto LaunchTask(
+        F&& f, Task<T> dependency, TaskPriority priority = TaskPriority::Normal, std::stop_token stopToken = {})
+        -> TaskForCallable<F, T>
     {
-        const auto lock = std::scoped_lock(m_schedulerMutex);
+        return LaunchContinuation(
+            std::move(dependency), priority, std::move(stopToken),
+            [f = std::forward<F>(f)](const Task<T>& dep) mutable { return std::invoke(std::move(f), dep.get()); });
+    }
 
-        auto newTask = MakeScheduledTask<T>(std::move(dependency), std::forward<F>(f));
-        auto future = newTask->GetFuture();
-        m_scheduledTasks.emplace_back(std::move(newTask));
-        return future;
+    // Run the continuation on one of the executor's threads, without wrapping it in a task
+    void Post(detail::TaskContinuation& continuation, TaskPriority priority) override
+    {
+        Enqueue(priority, continuation);
+    }
+
+    TaskScheduler GetScheduler(TaskPriority priority = TaskPriority::Normal) { return TaskScheduler(*this, priority); }
+
+    // Wait for a task from inside another task. Instead of blocking, the calling worker runs other tasks until the task
+    // is ready, so that the pool can't deadlock when every worker is waiting.
+    template <class T>
+    void WaitInWorker(const Task<T>& task)
+    {
+        m_executor.corun_until([&task] { return task.IsReady(); });
     }
 
     uint32 GetThreadCount() const { return static_cast<uint32>(m_executor.num_workers()); }
 
     void WaitForTasks();
 
+    void NextFrame();
+    TaskStatistics GetLastFrameStatistics() const;
+
 private:
-    template <class Ret, class Arg>
-    using UnaryFunction = typename detail::UnaryFunctionHelper<Ret, Arg>::type;
+    // A lower priority task is started ahead of higher priority ones once it has been passed over this many times
+    static constexpr uint32 StarvationLimit = 8;
 
-    template <std::invocable<> F>
-    auto LaunchTaskImpl(F&& f)
+    // Runs f on the executor, and holds the result
+    template <class T, class F>
+    class LaunchedTaskState final : public detail::TaskState<T>, public detail::TaskContinuation
     {
-        return m_executor.async(std::forward<F>(f));
-    }
+    public:
+        template <class G>
+        Task<T> Init(G&& f, std::stop_token stopToken)
+        {
+            m_func.emplace(std::forward<G>(f));
+            m_stopToken = std::move(stopToken);
+            this->AddRef(); // released once executed
+            this->AddRef();
+            return Task<T>(this);
+        }
 
-    struct AbstractScheduledTask : AbstractBase
-    {
-        virtual bool IsReady() const = 0;
-        virtual void Execute(CpuExecutor& executor) = 0;
+        // Called on the executor
+        void Run() noexcept override
+        {
+            if (m_stopToken.stop_requested())
+            {
+                this->SetCancelled();
+            }
+            else
+            {
+                detail::SetResultOf(*this, std::move(*m_func));
+            }
+            m_func.reset();
+            m_stopToken = {};
+            this->Complete();
+            this->Release();
+        }
+
+    protected:
+        void Recycle() noexcept override
+        {
+            this->ResetState();
+            detail::TaskStatePool<LaunchedTaskState>::Recycle(this);
+        }
+
+    private:
+        std::optional<F> m_func;
+        std::stop_token m_stopToken;
     };
 
-    template <class InT, class OutT>
-    struct ConcreteScheduledTask :
-        AbstractScheduledTask,
-        public std::enable_shared_from_this<ConcreteScheduledTask<InT, OutT>>
+    // Waits for a dependency to complete, then runs f on the executor with the dependency
+    template <class T, class F>
+    class ContinuationTaskState final :
+        public detail::TaskState<std::invoke_result_t<F, const Task<T>&>>,
+        public detail::TaskContinuation
     {
-        Task<InT> future;
-        UnaryFunction<OutT, InT> callback;
-        std::promise<OutT> promise;
+    public:
+        using Result = std::invoke_result_t<F, const Task<T>&>;
 
-        OutT InvokeCallback()
-            requires std::is_void_v<InT>
+        template <class G>
+        Task<Result>
+        Init(CpuExecutor& owner, Task<T> dependency, TaskPriority priority, std::stop_token stopToken, G&& f)
         {
-            return callback();
+            m_owner = &owner;
+            m_priority = priority;
+            m_stopToken = std::move(stopToken);
+            m_dependency = std::move(dependency);
+            m_func.emplace(std::forward<G>(f));
+            m_executeNode.owner = this;
+            this->AddRef(); // released once executed
+            this->AddRef();
+            return Task<Result>(this);
         }
 
-        OutT InvokeCallback() { return callback(future.get()); }
+        // Called by whichever thread completes the dependency, so there is no latency from polling
+        void Run() noexcept override { m_owner->Enqueue(m_priority, m_executeNode); }
 
-        void ExecuteTask()
-            requires std::is_void_v<OutT>
+        void Execute() noexcept
         {
-            InvokeCallback();
-            promise.set_value();
+            CpuExecutor& owner = *m_owner;
+
+            if (m_stopToken.stop_requested())
+            {
+                this->SetCancelled();
+            }
+            else
+            {
+                detail::SetResultOf(
+                    *this, [this] { return std::invoke(std::move(*m_func), std::as_const(m_dependency)); });
+            }
+            m_func.reset();
+            m_dependency = {};
+            m_stopToken = {};
+            this->Complete();
+            this->Release();
+
+            owner.OnScheduledTaskDone();
         }
 
-        void ExecuteTask()
+    protected:
+        void Recycle() noexcept override
         {
-            auto value = InvokeCallback();
-            promise.set_value(std::move(value));
+            this->ResetState();
+            detail::TaskStatePool<ContinuationTaskState>::Recycle(this);
         }
 
-        ConcreteScheduledTask(Task<InT> future, UnaryFunction<OutT, InT> callback) :
-            future{std::move(future)}, callback{std::move(callback)}
-        {}
-
-        bool IsReady() const override { return future.wait_for(std::chrono::seconds{0}) == std::future_status::ready; }
-
-        void Execute(CpuExecutor& executor) override
+    private:
+        // The state's own node is used to wait for the dependency, so it needs another to wait in a lane
+        struct ExecuteNode final : detail::TaskContinuation
         {
-            // Make sure the future actually has a result (get will throw exception if not)
-            static_cast<void>(future.get());
+            void Run() noexcept override { owner->Execute(); }
 
-            // Found one; execute the scheduled task
-            executor.LaunchTaskImpl([t = this->shared_from_this()]() { t->ExecuteTask(); });
-        }
+            ContinuationTaskState* owner = nullptr;
+        };
 
-        Task<OutT> GetFuture() { return promise.get_future(); }
+        CpuExecutor* m_owner = nullptr;
+        ExecuteNode m_executeNode;
+        TaskPriority m_priority = TaskPriority::Normal;
+        std::stop_token m_stopToken;
+        Task<T> m_dependency;
+        std::optional<F> m_func;
     };
 
-    template <class T, class U>
-    auto MakeScheduledTask(Task<T> future, UnaryFunction<U, T> callback)
-    {
-        return std::make_shared<ConcreteScheduledTask<T, U>>(std::move(future), std::move(callback));
-    }
-
+    // Launch f on the executor as soon as the dependency completes
     template <class T, class F>
-        requires(std::is_void_v<T>)
-    auto MakeScheduledTask(Task<T> future, F&& callback)
+    auto LaunchContinuation(Task<T> dependency, TaskPriority priority, std::stop_token stopToken, F&& f)
     {
-        using U = std::invoke_result_t<F>;
-        return MakeScheduledTask<T, U>(std::move(future), std::forward<F>(callback));
+        using State = ContinuationTaskState<T, std::decay_t<F>>;
+
+        ++m_numScheduledTasks;
+
+        State* state = detail::TaskStatePool<State>::Acquire();
+        detail::TaskStateBase& dependencyState = *detail::TaskAccess::GetState(dependency);
+        auto task = state->Init(*this, std::move(dependency), priority, std::move(stopToken), std::forward<F>(f));
+
+        if (!dependencyState.AddContinuation(*state))
+        {
+            state->Run();
+        }
+
+        return task;
     }
 
-    template <class T, class F>
-        requires(!std::is_void_v<T>)
-    auto MakeScheduledTask(Task<T> future, F&& callback)
+    void OnScheduledTaskDone();
+
+    // Intrusive FIFO of jobs, linked through TaskContinuation::next, so queuing a job never allocates. Each lane has its
+    // own lock, and its size can be read without it, so that runners only lock the lane they take a job from.
+    struct Lane
     {
-        using U = std::invoke_result_t<F, T>;
-        return MakeScheduledTask<T, U>(std::move(future), std::forward<F>(callback));
-    }
+        std::mutex mutex;
+        detail::TaskContinuation* head = nullptr;
+        detail::TaskContinuation* tail = nullptr;
+        std::atomic<uint32> size = 0;
+        std::atomic<uint32> timesPassedOver = 0;
+        TaskLaneStatistics statistics;
+
+        bool empty() const { return head == nullptr; }
+        void push_back(detail::TaskContinuation& job);
+        detail::TaskContinuation& pop_front();
+    };
+
+    // Jobs wait in a lane for their priority, and each job posts a runner to Taskflow, which starts the most important
+    // waiting job rather than any particular one. Jobs must stay alive until they have run.
+    void Enqueue(TaskPriority priority, detail::TaskContinuation& job);
+    void RunNextJob();
+    std::pair<detail::TaskContinuation*, bool> PopNextJob();
+    detail::TaskContinuation* TryPopJob(usize laneIndex, bool promoted);
+    bool CanStart(usize laneIndex) const;
+    bool TryStartBackgroundJob();
+    void OnBackgroundJobDone();
+    bool TryUnparkRunner();
 
     tf::Executor m_executor;
 
-    // Ideally we'd store unique_ptrs here. However, the Taskflow library doesn't support move-only
-    // function types, which causes problems as std::future and std::promise are both move-only.
-    // This means the lambda that invokes a scheduled task will also be move-only, *unless* we store
-    // the task object in a shared_ptr and capture it by copy.
-    std::vector<std::shared_ptr<AbstractScheduledTask>> m_scheduledTasks;
+    std::array<Lane, TaskPriorityCount> m_lanes;
+
+    // Background jobs are kept off at least one worker when there is more than one, so that frame work can always
+    // start straight away. Runners that only find background jobs when the limit has been reached are parked, and
+    // reposted as background jobs finish.
+    uint32 m_maxBackgroundJobs;
+    std::atomic<uint32> m_numRunningBackgroundJobs = 0;
+    std::atomic<uint32> m_numParkedRunners = 0;
+
+    mutable std::mutex m_statisticsMutex;
+    TaskStatistics m_lastFrameStatistics;
 
-    std::mutex m_schedulerMutex;
-    std::thread m_schedulerThread;
-    std::atomic_bool m_schedulerStop = false;
+    // Number of continuations that have been launched but have not yet finished executing
+    std::atomic<usize> m_numScheduledTasks = 0;
 };
 
 } // namespace Teide
@@ -5,8 +5,13 @@
 
 #include "vkex/vkex.hpp"
 
+#include "Teide/Util/ThreadUtils.h"
+
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <utility>
+
 namespace Teide
 {
 
@@ -63,4 +68,99 @@ void DescriptorPool::AddPool()
         }));
 }
 
+PooledDescriptorSet::PooledDescriptorSet(
+    vk::Device device, SharedDescriptorPoolShard& shard, vk::DescriptorPool pool, vk::DescriptorSet descriptorSet) :
+    m_device{device}, m_shard{&shard}, m_pool{pool}, m_descriptorSet{descriptorSet}
+{}
+
+PooledDescriptorSet::~PooledDescriptorSet()
+{
+    Free();
+}
+
+PooledDescriptorSet::PooledDescriptorSet(PooledDescriptorSet&& other) noexcept :
+    m_device{other.m_device},
+    m_shard{std::exchange(other.m_shard, nullptr)},
+    m_pool{std::exchange(other.m_pool, {})},
+    m_descriptorSet{std::exchange(other.m_descriptorSet, {})}
+{}
+
+PooledDescriptorSet& PooledDescriptorSet::operator=(PooledDescriptorSet&& other) noexcept
+{
+    if (this != &other)
+    {
+        Free();
+        m_device = other.m_device;
+        m_shard = std::exchange(other.m_shard, nullptr);
+        m_pool = std::exchange(other.m_pool, {});
+        m_descriptorSet = std::exchange(other.m_descriptorSet, {});
+    }
+    return *this;
+}
+
+void PooledDescriptorSet::Free()
+{
+    if (m_descriptorSet)
+    {
+        const auto lock = std::scoped_lock(m_shard->mutex);
+        m_device.freeDescriptorSets(m_pool, m_descriptorSet);
+        m_descriptorSet = nullptr;
+    }
+}
+
+SharedDescriptorPool::SharedDescriptorPool(
+    vk::Device device, uint32 numShards, std::vector<vk::DescriptorPoolSize> poolSizes, uint32 maxSetsPerPool) :
+    m_device{device},
+    m_poolSizes{std::move(poolSizes)},
+    m_maxSetsPerPool{maxSetsPerPool},
+    m_numShards{std::max(numShards, 1u)},
+    m_shards{std::make_unique<SharedDescriptorPoolShard[]>(m_numShards)}
+{}
+
+PooledDescriptorSet SharedDescriptorPool::Allocate(vk::DescriptorSetLayout layout, const char* name)
+{
+    auto& shard = m_shards[GetCurrentThreadIndex() % m_numShards];
+    const auto lock = std::scoped_lock(shard.mutex);
+
+    const auto allocate = [&](vk::DescriptorPool pool) {
+        const vk::DescriptorSetAllocateInfo allocInfo = {
+            .descriptorPool = pool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &layout,
+        };
+        return m_device.allocateDescriptorSets(allocInfo).front();
+    };
+
+    vk::DescriptorSet descriptorSet;
+    if (!shard.pools.empty())
+    {
+        try
+        {
+            descriptorSet = allocate(shard.pools.back().get());
+        }
+        catch (const vk::OutOfPoolMemoryError&)
+        {}
+        catch (const vk::FragmentedPoolError&)
+        {}
+    }
+    if (!descriptorSet)
+    {
+        shard.pools.push_back(CreatePool());
+        descriptorSet = allocate(shard.pools.back().get());
+    }
+
+    SetDebugName(m_device, descriptorSet, name);
+    return PooledDescriptorSet(m_device, shard, shard.pools.back().get(), descriptorSet);
+}
+
+vk::UniqueDescriptorPool SharedDescriptorPool::CreatePool() const
+{
+    return m_device.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{
+        .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+        .maxSets = m_maxSetsPerPool,
+        .poolSizeCount = size32(m_poolSizes),
+        .pPoolSizes = data(m_poolSizes),
+    });
+}
+
 } // namespace Teide
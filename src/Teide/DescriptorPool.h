@@ -6,6 +6,8 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include <memory>
+#include <mutex>
 #include <vector>
 
 namespace Teide
@@ -32,4 +34,57 @@ private:
     uint32 m_maxSets;
     uint32 m_numAllocatedSets = 0;
 };
+
+struct SharedDescriptorPoolShard
+{
+    std::mutex mutex;
+    std::vector<vk::UniqueDescriptorPool> pools;
+};
+
+// A descriptor set allocated from a SharedDescriptorPool, which is freed under the lock of the pool it came from
+class PooledDescriptorSet
+{
+public:
+    PooledDescriptorSet() = default;
+    explicit PooledDescriptorSet(
+        vk::Device device, SharedDescriptorPoolShard& shard, vk::DescriptorPool pool, vk::DescriptorSet descriptorSet);
+    ~PooledDescriptorSet();
+
+    PooledDescriptorSet(const PooledDescriptorSet&) = delete;
+    PooledDescriptorSet(PooledDescriptorSet&& other) noexcept;
+    PooledDescriptorSet& operator=(const PooledDescriptorSet&) = delete;
+    PooledDescriptorSet& operator=(PooledDescriptorSet&& other) noexcept;
+
+    vk::DescriptorSet get() const { return m_descriptorSet; }
+    explicit operator bool() const { return static_cast<bool>(m_descriptorSet); }
+
+private:
+    void Free();
+
+    vk::Device m_device;
+    SharedDescriptorPoolShard* m_shard = nullptr;
+    vk::DescriptorPool m_pool;
+    vk::DescriptorSet m_descriptorSet;
+};
+
+// Descriptor pools for long-lived descriptor sets, which can be allocated on any thread and freed on any other. Each
+// thread allocates from its own shard, so threads creating parameter blocks at the same time don't contend on one lock,
+// and a shard grows by another pool when its newest one is full.
+class SharedDescriptorPool
+{
+public:
+    explicit SharedDescriptorPool(
+        vk::Device device, uint32 numShards, std::vector<vk::DescriptorPoolSize> poolSizes, uint32 maxSetsPerPool);
+
+    PooledDescriptorSet Allocate(vk::DescriptorSetLayout layout, const char* name);
+
+private:
+    vk::UniqueDescriptorPool CreatePool() const;
+
+    vk::Device m_device;
+    std::vector<vk::DescriptorPoolSize> m_poolSizes;
+    uint32 m_maxSetsPerPool;
+    uint32 m_numShards;
+    std::unique_ptr<SharedDescriptorPoolShard[]> m_shards;
+};
 } // namespace Teide
@@ -0,0 +1,124 @@
+
+#include "GeometryHeap.h"
+
+#include "Vulkan.h"
+
+#include "Teide/Assert.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace Teide
+{
+
+GeometryHeap::Range::Range(
+    GeometryHeap& heap, uint32 block, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize size) :
+    m_heap{&heap}, m_block{block}, m_buffer{buffer}, m_offset{offset}, m_size{size}
+{}
+
+GeometryHeap::Range::~Range()
+{
+    if (m_heap)
+    {
+        m_heap->Free(m_block, m_offset, m_size);
+    }
+}
+
+GeometryHeap::Range::Range(Range&& other) noexcept :
+    m_heap{std::exchange(other.m_heap, nullptr)},
+    m_block{other.m_block},
+    m_buffer{other.m_buffer},
+    m_offset{other.m_offset},
+    m_size{other.m_size}
+{}
+
+auto GeometryHeap::Range::operator=(Range&& other) noexcept -> Range&
+{
+    if (this != &other)
+    {
+        if (m_heap)
+        {
+            m_heap->Free(m_block, m_offset, m_size);
+        }
+        m_heap = std::exchange(other.m_heap, nullptr);
+        m_block = other.m_block;
+        m_buffer = other.m_buffer;
+        m_offset = other.m_offset;
+        m_size = other.m_size;
+    }
+    return *this;
+}
+
+GeometryHeap::GeometryHeap(
+    vk::Device device, vma::Allocator allocator, MemoryCounter& memoryCounter, std::span<const uint32> queueFamilies,
+    vk::DeviceSize blockSize) :
+    m_device{device},
+    m_allocator{allocator},
+    m_memoryCounter{memoryCounter},
+    m_queueFamilies(queueFamilies.begin(), queueFamilies.end()),
+    m_blockSize{blockSize}
+{
+    std::ranges::sort(m_queueFamilies);
+    const auto [first, last] = std::ranges::unique(m_queueFamilies);
+    m_queueFamilies.erase(first, last);
+}
+
+auto GeometryHeap::Allocate(vk::DeviceSize size, vk::DeviceSize alignment) -> Range
+{
+    const auto lock = std::scoped_lock(m_mutex);
+
+    for (uint32 i = 0; i < m_blocks.size(); i++)
+    {
+        auto& block = m_blocks[i];
+        if (const auto offset = block.allocator.Allocate(size, alignment))
+        {
+            return Range(*this, i, block.buffer.buffer.get(), *offset, size);
+        }
+    }
+
+    // Data that is bigger than a block gets a block of its own
+    auto& block = AddBlock(std::max(size, m_blockSize));
+    const auto offset = block.allocator.Allocate(size, alignment);
+    TEIDE_ASSERT(offset.has_value());
+    return Range(*this, static_cast<uint32>(m_blocks.size() - 1), block.buffer.buffer.get(), *offset, size);
+}
+
+void GeometryHeap::Free(uint32 block, vk::DeviceSize offset, vk::DeviceSize size)
+{
+    const auto lock = std::scoped_lock(m_mutex);
+    m_blocks.at(block).allocator.Free(offset, size);
+}
+
+auto GeometryHeap::AddBlock(vk::DeviceSize size) -> Block&
+{
+    spdlog::debug("Adding geometry heap block {} of size {}", m_blocks.size(), size);
+
+    const auto concurrent = IsConcurrent();
+    auto [allocation, buffer] = m_allocator.createBufferUnique(
+        vk::BufferCreateInfo{
+            .size = size,
+            .usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer
+                | vk::BufferUsageFlagBits::eTransferDst,
+            .sharingMode = concurrent ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
+            .queueFamilyIndexCount = concurrent ? size32(m_queueFamilies) : 0,
+            .pQueueFamilyIndices = concurrent ? data(m_queueFamilies) : nullptr,
+        },
+        vma::AllocationCreateInfo{
+            .usage = vma::MemoryUsage::eAutoPreferDevice,
+        });
+
+    auto& block = m_blocks.emplace_back(
+        VulkanBufferData{
+            .size = size,
+            .buffer = vk::UniqueBuffer(buffer.release(), m_device),
+            .allocation = std::move(allocation),
+            .memory = m_memoryCounter.Add(size),
+        },
+        FreeListAllocator(size));
+    SetDebugName(block.buffer.buffer, "GeometryHeap:Block{}", m_blocks.size() - 1);
+    return block;
+}
+
+} // namespace Teide
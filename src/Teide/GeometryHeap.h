@@ -0,0 +1,89 @@
+
+#pragma once
+
+#include "VulkanBuffer.h"
+
+#include "Teide/BasicTypes.h"
+#include "Teide/Buffer.h"
+#include "Teide/Util/FreeListAllocator.h"
+#include "Teide/Util/MemoryCounter.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <deque>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace Teide
+{
+
+// Suballocates mesh vertex and index data from a few large device-local buffers ("blocks"), so that each mesh doesn't
+// need buffers (and memory allocations) of its own, and meshes in the same block can be drawn without rebinding.
+// Allocating and freeing are thread safe.
+// The heap only grows: blocks are kept until the heap is destroyed, even once everything in them has been freed, so
+// its memory stays at the most that was ever allocated at once. That includes blocks added for oversized meshes.
+class GeometryHeap
+{
+public:
+    static constexpr vk::DeviceSize DefaultBlockSize = 64 * 1024 * 1024;
+
+    // A range of one of the heap's blocks, which is returned to the heap when destroyed
+    class Range : public Buffer
+    {
+    public:
+        Range() = default;
+        Range(GeometryHeap& heap, uint32 block, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize size);
+        ~Range() override;
+
+        Range(const Range&) = delete;
+        Range(Range&& other) noexcept;
+        Range& operator=(const Range&) = delete;
+        Range& operator=(Range&& other) noexcept;
+
+        usize GetSize() const override { return m_size; }
+        BytesView GetData() const override { return {}; } // device-local, so not mapped
+
+        vk::Buffer GetBuffer() const { return m_buffer; }
+        vk::DeviceSize GetOffset() const { return m_offset; }
+
+    private:
+        GeometryHeap* m_heap = nullptr;
+        uint32 m_block = 0;
+        vk::Buffer m_buffer;
+        vk::DeviceSize m_offset = 0;
+        vk::DeviceSize m_size = 0;
+    };
+
+    // If more than one queue family is given, the blocks are shared between them concurrently, so that uploads on
+    // one queue don't need to transfer ownership of the whole block away from the queue that draws from it
+    GeometryHeap(
+        vk::Device device, vma::Allocator allocator, MemoryCounter& memoryCounter,
+        std::span<const uint32> queueFamilies, vk::DeviceSize blockSize = DefaultBlockSize);
+
+    // The offset is a multiple of the alignment, which doesn't have to be a power of two (e.g. a vertex stride)
+    Range Allocate(vk::DeviceSize size, vk::DeviceSize alignment);
+
+    bool IsConcurrent() const { return m_queueFamilies.size() > 1; }
+
+private:
+    struct Block
+    {
+        VulkanBufferData buffer;
+        FreeListAllocator allocator;
+    };
+
+    void Free(uint32 block, vk::DeviceSize offset, vk::DeviceSize size);
+    Block& AddBlock(vk::DeviceSize size);
+
+    vk::Device m_device;
+    vma::Allocator m_allocator;
+    MemoryCounter& m_memoryCounter; // Counts the blocks
+    std::vector<uint32> m_queueFamilies;
+    vk::DeviceSize m_blockSize;
+
+    std::mutex m_mutex;
+    std::deque<Block> m_blocks;
+};
+
+} // namespace Teide
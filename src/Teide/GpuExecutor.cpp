@@ -5,11 +5,13 @@
 
 #include "Teide/Assert.h"
 
+#include <fmt/chrono.h>
 #include <spdlog/spdlog.h>
 
-#include <ranges>
-#include <span>
+#include <chrono>
 #include <sstream>
+#include <utility>
+#include <vector>
 
 namespace Teide
 {
@@ -21,6 +23,11 @@ namespace
         SetDebugName(commandBuffer, "RenderThread{}:CommandBuffer{}", threadIndex, cbIndex);
     }
 
+    void SetSecondaryCommandBufferDebugName(vk::UniqueCommandBuffer& commandBuffer, uint32 threadIndex, uint32 cbIndex)
+    {
+        SetDebugName(commandBuffer, "RenderThread{}:SecondaryCommandBuffer{}", threadIndex, cbIndex);
+    }
+
     std::string GetThreadName(std::thread::id id)
     {
         std::stringstream ss;
@@ -30,8 +37,12 @@ namespace
 
 } // namespace
 
-GpuExecutor::GpuExecutor(uint32 numThreads, vk::Device device, vk::Queue queue, uint32 queueFamilyIndex) :
-    m_frameResources(numThreads, device, queueFamilyIndex), m_device{device}, m_queue{Queue(device, queue)}
+GpuExecutor::GpuExecutor(
+    vk::Device device, vk::Queue queue, uint32 queueFamilyIndex,
+    Queue::CallbackDispatcher dispatcher, std::optional<SubmitThreadSettings> submitThread, uint32 framesInFlight) :
+    m_frameResources(framesInFlight, device, queueFamilyIndex),
+    m_device{device},
+    m_queue{Queue(device, queue, std::move(dispatcher), submitThread)}
 {
     spdlog::info("Creating GpuExecutor");
     spdlog::debug("this thread: {}", GetThreadName(std::this_thread::get_id()));
@@ -43,35 +54,166 @@ GpuExecutor::~GpuExecutor() noexcept
     spdlog::debug("main thread: {}", GetThreadName(m_mainThread));
     spdlog::debug("this thread: {}", GetThreadName(std::this_thread::get_id()));
     TEIDE_ASSERT(m_mainThread == std::this_thread::get_id());
+
+    // Destroying an object can release others (e.g. a parameter block's textures), so keep going until none are left
+    m_queue.WaitForTasks();
+    while (!m_unsubmittedObjects.empty() || !m_submittedObjects.empty())
+    {
+        const auto unsubmitted = std::exchange(m_unsubmittedObjects, {});
+        const auto submitted = std::exchange(m_submittedObjects, {});
+    }
 }
 
 void GpuExecutor::WaitForTasks()
 {
     m_queue.WaitForTasks();
+    DestroyRetiredObjects();
 }
 
 void GpuExecutor::NextFrame()
 {
-    m_frameResources.NextFrame();
+    m_queue.NextFrame();
+
+    FrameResources& endedFrame = m_frameResources.Current();
+    FrameResources& nextFrame = m_frameResources.Next();
+    if (&nextFrame == &endedFrame)
+    {
+        // With a single frame in flight, its pools are reset while they are still current
+        EndFrame(endedFrame);
+        ResetFrame(endedFrame);
+    }
+    else
+    {
+        // The next frame's pools are reset before it becomes current, as a thread that starts recording once it is
+        // current has a slot that the wait doesn't cover
+        ResetFrame(nextFrame);
+        m_frameResources.NextFrame();
+        EndFrame(endedFrame);
+    }
+
+    DestroyRetiredObjects();
+}
+
+void GpuExecutor::ResetFrame(FrameResources& frame)
+{
+    // Command buffers can't be reset while the GPU is still executing them, so this is what limits how far the CPU can
+    // get ahead of the GPU
+    WaitForFrame(frame);
+
+    frame.threadResources.ForEach([this](auto& threadResources) { threadResources.Reset(m_device); });
+}
+
+void GpuExecutor::EndFrame(FrameResources& frame)
+{
+    // A thread adds its slot before getting a command buffer, so a thread that got this frame's command pools did so
+    // before the frame changed, and its slot is before the one read here
+    frame.endSequenceIndex = m_nextSequenceIndex.load();
+
+    const auto lock = std::scoped_lock(m_frameMutex);
+    if (m_numSubmittedCommandBuffers.load() >= frame.endSequenceIndex)
+    {
+        frame.lastSubmissionId = m_queue.GetLastSubmission();
+    }
+    else
+    {
+        m_endingFrames.push_back(&frame);
+    }
+}
+
+void GpuExecutor::WaitForFrame(const FrameResources& frame)
+{
+    // Wait for the frame's slots to be submitted first, so that the submission they ended up in is known
+    for (uint64 numSubmitted = m_numSubmittedCommandBuffers.load(); numSubmitted < frame.endSequenceIndex;
+         numSubmitted = m_numSubmittedCommandBuffers.load())
+    {
+        m_numSubmittedCommandBuffers.wait(numSubmitted);
+    }
+
+    const uint64 lastSubmissionId = [&] {
+        const auto lock = std::scoped_lock(m_frameMutex);
+        return frame.lastSubmissionId;
+    }();
+
+    // The frame's command pools are reset straight after this, which mustn't happen while the GPU could still be using
+    // them, so this keeps waiting however long it takes. A lost device makes the wait throw instead.
+    constexpr auto timeout = std::chrono::seconds{4};
+    while (!m_queue.WaitForSubmission(lastSubmissionId, timeout))
+    {
+        spdlog::error("Timeout (>{}) while waiting for frame's command buffers to complete! Still waiting", timeout);
+    }
+}
+
+void GpuExecutor::AddRetiringObject(std::shared_ptr<void> object)
+{
+    // Anything that could still use the object has already added its slot, because it was scheduled while the object
+    // was alive
+    const auto lock = std::scoped_lock(m_retireMutex);
+    m_unsubmittedObjects.push_back({.retirePoint = m_nextSequenceIndex.load(), .object = std::move(object)});
+}
+
+void GpuExecutor::DestroyRetiredObjects()
+{
+    auto lock = std::unique_lock(m_retireMutex);
+    DestroyRetiredObjects(lock);
+}
 
-    m_frameResources.Current().threadResources.LockAll([this](auto& threadResources) { threadResources.Reset(m_device); });
+void GpuExecutor::TryDestroyRetiredObjects()
+{
+    // Another thread that is already destroying objects will pick up this thread's too
+    auto lock = std::unique_lock(m_retireMutex, std::try_to_lock);
+    if (lock && !(m_unsubmittedObjects.empty() && m_submittedObjects.empty()))
+    {
+        DestroyRetiredObjects(lock);
+    }
+}
+
+void GpuExecutor::DestroyRetiredObjects(std::unique_lock<std::mutex>& lock)
+{
+    // The submitted count is only updated after the queue has been given the command buffers, so the last submission
+    // (read afterwards) includes all of them
+    const uint64 numSubmitted = m_numSubmittedCommandBuffers.load();
+    const uint64 lastSubmissionId = m_queue.GetLastSubmission();
+    while (!m_unsubmittedObjects.empty() && m_unsubmittedObjects.front().retirePoint <= numSubmitted)
+    {
+        m_submittedObjects.push_back(
+            {.retirePoint = lastSubmissionId, .object = std::move(m_unsubmittedObjects.front().object)});
+        m_unsubmittedObjects.pop_front();
+    }
+
+    std::vector<std::shared_ptr<void>> retiredObjects;
+    const uint64 completedSubmissionId = m_queue.GetCompletedSubmission();
+    while (!m_submittedObjects.empty() && m_submittedObjects.front().retirePoint <= completedSubmissionId)
+    {
+        retiredObjects.push_back(std::move(m_submittedObjects.front().object));
+        m_submittedObjects.pop_front();
+    }
+
+    // The objects are destroyed outside the lock, as destroying them can release more objects
+    lock.unlock();
+    retiredObjects.clear();
 }
 
 void GpuExecutor::ThreadResources::Reset(vk::Device device)
 {
     device.resetCommandPool(commandPool.get());
     numUsedCommandBuffers = 0;
+    numUsedSecondaryCommandBuffers = 0;
 
     // Resetting also resets the command buffers' debug names
     for (uint32 i = 0; i < commandBuffers.size(); i++)
     {
-        commandBuffers[i].Reset();
         SetCommandBufferDebugName(commandBuffers[i].Get(), threadIndex, i);
     }
+    for (uint32 i = 0; i < secondaryCommandBuffers.size(); i++)
+    {
+        SetSecondaryCommandBufferDebugName(secondaryCommandBuffers[i], threadIndex, i);
+    }
 }
 
-GpuExecutor::FrameResources::FrameResources(uint32 numThreads, vk::Device device, uint32 queueFamilyIndex, uint32 index) :
-    threadResources{numThreads, [&]() { return ThreadResources(index, device, queueFamilyIndex); }}
+GpuExecutor::FrameResources::FrameResources(vk::Device device, uint32 queueFamilyIndex, uint32 /*index*/) :
+    threadResources{[=, threadIndex = uint32{0}]() mutable {
+        return ThreadResources(threadIndex, device, queueFamilyIndex);
+    }}
 {}
 
 GpuExecutor::ThreadResources::ThreadResources(uint32& i, vk::Device device, uint32 queueFamilyIndex) :
@@ -84,7 +226,7 @@ GpuExecutor::ThreadResources::ThreadResources(uint32& i, vk::Device device, uint
 
 CommandBuffer& GpuExecutor::GetCommandBuffer()
 {
-    return m_frameResources.Current().threadResources.LockCurrent([this](auto& threadResources) -> CommandBuffer& {
+    return m_frameResources.Current().threadResources.WithCurrent([this](auto& threadResources) -> CommandBuffer& {
         if (threadResources.numUsedCommandBuffers == threadResources.commandBuffers.size())
         {
             const vk::CommandBufferAllocateInfo allocateInfo = {
@@ -110,39 +252,177 @@ CommandBuffer& GpuExecutor::GetCommandBuffer()
     });
 }
 
-uint32 GpuExecutor::AddCommandBufferSlot()
+vk::CommandBuffer GpuExecutor::GetSecondaryCommandBuffer(const vk::CommandBufferInheritanceInfo& inheritanceInfo)
 {
-    m_readyCommandBuffers.emplace_back();
-    m_completionHandlers.emplace_back();
-    return static_cast<uint32>(m_readyCommandBuffers.size() - 1);
+    return m_frameResources.Current().threadResources.WithCurrent([&, this](auto& threadResources) {
+        if (threadResources.numUsedSecondaryCommandBuffers == threadResources.secondaryCommandBuffers.size())
+        {
+            const vk::CommandBufferAllocateInfo allocateInfo = {
+                .commandPool = threadResources.commandPool.get(),
+                .level = vk::CommandBufferLevel::eSecondary,
+                .commandBufferCount = std::max(1u, static_cast<uint32>(threadResources.secondaryCommandBuffers.size())),
+            };
+
+            auto newCommandBuffers = m_device.allocateCommandBuffersUnique(allocateInfo);
+            const auto numCBs = static_cast<uint32>(threadResources.secondaryCommandBuffers.size());
+            for (uint32 i = 0; i < newCommandBuffers.size(); i++)
+            {
+                SetSecondaryCommandBufferDebugName(newCommandBuffers[i], threadResources.threadIndex, i + numCBs);
+                threadResources.secondaryCommandBuffers.push_back(std::move(newCommandBuffers[i]));
+            }
+        }
+
+        const auto commandBufferIndex = threadResources.numUsedSecondaryCommandBuffers++;
+        const vk::CommandBuffer commandBuffer = threadResources.secondaryCommandBuffers.at(commandBufferIndex).get();
+        commandBuffer.begin(
+            vk::CommandBufferBeginInfo{
+                .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+                    | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+                .pInheritanceInfo = &inheritanceInfo,
+            });
+
+        return commandBuffer;
+    });
 }
 
-void GpuExecutor::SubmitCommandBuffer(uint32 index, vk::CommandBuffer commandBuffer, OnCompleteFunction func)
+uint64 GpuExecutor::AddCommandBufferSlot()
+{
+    const uint64 index = m_nextSequenceIndex.fetch_add(1);
+
+    // If the ring is full, wait for the oldest command buffers to be submitted before handing out the slot
+    for (uint64 numSubmitted = m_numSubmittedCommandBuffers.load(); index >= numSubmitted + SubmitRingSize;
+         numSubmitted = m_numSubmittedCommandBuffers.load())
+    {
+        m_numSubmittedCommandBuffers.wait(numSubmitted);
+    }
+
+    return index;
+}
+
+void GpuExecutor::SubmitCommandBuffer(
+    uint64 index, vk::CommandBuffer commandBuffer, OnCompleteFunction func, Queue::CallbackMode mode,
+    std::optional<Queue::SemaphoreWait> wait, OnSubmittedFunction onSubmitted)
 {
     commandBuffer.end();
-    m_readyCommandBuffers.at(index) = commandBuffer;
-    m_completionHandlers.at(index) = std::move(func);
+    SubmitEndedCommandBuffer(index, commandBuffer, std::move(func), mode, wait, std::move(onSubmitted));
+}
+
+void GpuExecutor::SubmitEndedCommandBuffer(
+    uint64 index, vk::CommandBuffer commandBuffer, OnCompleteFunction func, Queue::CallbackMode mode,
+    std::optional<Queue::SemaphoreWait> wait, OnSubmittedFunction onSubmitted)
+{
+    SubmitSlot& slot = GetSubmitSlot(index);
+    slot.commandBuffer = commandBuffer;
+    slot.completionHandler = std::move(func);
+    slot.mode = mode;
+    slot.wait = wait;
+    slot.submissionHandler = std::move(onSubmitted);
+    slot.readySequence.store(index + 1);
+
+    DrainSubmitRing();
+}
 
-    const auto unsubmittedCommandBuffers = std::span(m_readyCommandBuffers).subspan(m_numSubmittedCommandBuffers);
-    const auto unsubmittedCompletionHandlers = std::span(m_completionHandlers).subspan(m_numSubmittedCommandBuffers);
+void GpuExecutor::SkipCommandBufferSlot(uint64 index)
+{
+    GetSubmitSlot(index).readySequence.store(index + 1);
 
-    const auto end = std::ranges::find(unsubmittedCommandBuffers, vk::CommandBuffer{});
-    const auto commandBuffersToSubmit = std::span(unsubmittedCommandBuffers.begin(), end);
+    DrainSubmitRing();
+}
 
-    if (!commandBuffersToSubmit.empty())
+void GpuExecutor::DrainSubmitRing()
+{
+    // Only one thread drains the ring at a time. If another thread is already draining, it will pick up the slot that
+    // was just published, because it checks for more work after releasing the flag. All operations are sequentially
+    // consistent so that one of the two threads is guaranteed to see the other's write.
+    bool drained = false;
+    while (!m_draining.test_and_set())
     {
-        std::vector<OnCompleteFunction> callbacks;
-        std::ranges::move(
-            unsubmittedCompletionHandlers | std::views::filter([](const auto& x) { return x != nullptr; }),
-            std::back_inserter(callbacks));
-        m_queue.Submit(commandBuffersToSubmit, [callbacks = std::move(callbacks)]() mutable {
-            for (auto&& callback : std::move(callbacks))
+        drained = true;
+        const uint64 first = m_numSubmittedCommandBuffers.load();
+        uint64 last = first;
+
+        // Gather the contiguous range of ready command buffers, into scratch space that is reused between drains.
+        // A semaphore wait only applies to the submission it is in, so a slot with a wait starts a new submission,
+        // and the command buffers before it don't wait along with it.
+        std::optional<uint64> submissionId;
+        for (; GetSubmitSlot(last).readySequence.load() == last + 1; last++)
+        {
+            SubmitSlot& slot = GetSubmitSlot(last);
+            if (slot.wait)
             {
-                callback();
+                if (const auto id = SubmitDrainedSlots())
+                {
+                    submissionId = id;
+                }
+                m_drainWaits.push_back(*std::exchange(slot.wait, std::nullopt));
             }
-        });
-        m_numSubmittedCommandBuffers += commandBuffersToSubmit.size();
+            if (slot.commandBuffer)
+            {
+                m_drainCommandBuffers.push_back(std::exchange(slot.commandBuffer, {}));
+            }
+            if (slot.completionHandler)
+            {
+                m_drainCallbacks.push_back({.function = std::exchange(slot.completionHandler, {}), .mode = slot.mode});
+            }
+            if (slot.submissionHandler)
+            {
+                m_drainSubmissionHandlers.push_back(std::exchange(slot.submissionHandler, {}));
+            }
+        }
+        if (const auto id = SubmitDrainedSlots())
+        {
+            submissionId = id;
+        }
+
+        if (last != first)
+        {
+            {
+                const auto lock = std::scoped_lock(m_frameMutex);
+                while (!m_endingFrames.empty() && m_endingFrames.front()->endSequenceIndex <= last)
+                {
+                    m_endingFrames.front()->lastSubmissionId = submissionId.value_or(m_queue.GetLastSubmission());
+                    m_endingFrames.pop_front();
+                }
+                m_numSubmittedCommandBuffers.store(last);
+            }
+            m_numSubmittedCommandBuffers.notify_all();
+        }
+
+        m_draining.clear();
+
+        if (GetSubmitSlot(last).readySequence.load() != last + 1)
+        {
+            break;
+        }
+    }
+
+    // Objects are released as soon as the GPU has finished with them, rather than waiting for the next frame, so that
+    // e.g. staging space can be reused by a stream of uploads. This isn't done when called from a submission handler
+    // inside another drain, so that destroying objects can't hold up submitting.
+    if (drained)
+    {
+        TryDestroyRetiredObjects();
+    }
+}
+
+std::optional<uint64> GpuExecutor::SubmitDrainedSlots()
+{
+    // Skipped slots have nothing to submit, but they still count as submitted
+    std::optional<uint64> submissionId;
+    if (!m_drainCommandBuffers.empty())
+    {
+        submissionId = m_queue.Submit(m_drainCommandBuffers, m_drainCallbacks, m_drainWaits);
+        for (auto& handler : m_drainSubmissionHandlers)
+        {
+            handler(*submissionId);
+        }
     }
+
+    m_drainCommandBuffers.clear();
+    m_drainCallbacks.clear();
+    m_drainWaits.clear();
+    m_drainSubmissionHandlers.clear();
+    return submissionId;
 }
 
 } // namespace Teide
@@ -5,12 +5,18 @@
 #include "Queue.h"
 
 #include "Teide/BasicTypes.h"
+#include "Teide/GraphicsSettings.h"
 #include "Teide/Util/FrameArray.h"
 #include "Teide/Util/ThreadUtils.h"
 
 #include <function2/function2.hpp>
 
+#include <atomic>
 #include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <vector>
 
 namespace Teide
@@ -20,8 +26,12 @@ class GpuExecutor
 {
 public:
     using OnCompleteFunction = fu2::unique_function<void()>;
+    using OnSubmittedFunction = fu2::unique_function<void(uint64 timelineValue)>;
 
-    GpuExecutor(uint32 numThreads, vk::Device device, vk::Queue queue, uint32 queueFamilyIndex);
+    GpuExecutor(
+        vk::Device device, vk::Queue queue, uint32 queueFamilyIndex,
+        Queue::CallbackDispatcher dispatcher = nullptr, std::optional<SubmitThreadSettings> submitThread = std::nullopt,
+        uint32 framesInFlight = DefaultFramesInFlight);
     ~GpuExecutor() noexcept;
 
     GpuExecutor(const GpuExecutor&) = delete;
@@ -29,22 +39,76 @@ public:
     GpuExecutor& operator=(const GpuExecutor&) = delete;
     GpuExecutor& operator=(GpuExecutor&&) = delete;
 
+    // The number of slots that can be waiting to be submitted at once
+    static constexpr uint64 SubmitRingSize = 1024;
+
+    // Move on to the next frame's command pools, first waiting for the GPU to finish the work that was submitted the
+    // last time they were used. Other threads can carry on recording while this is called. The pools are reset before
+    // they become current, once every slot that was added while they were last current has been submitted, so command
+    // buffers that are still being recorded into them are never reset. With a single frame in flight, the pools are
+    // reset while they are current, so nothing may be recording while this is called.
     void NextFrame();
 
-    uint32 AddCommandBufferSlot();
+    // Reserve the next position in the submission order. Command buffers are submitted to the queue in the order
+    // their slots were added, regardless of the order SubmitCommandBuffer is called in. If SubmitRingSize slots are
+    // already waiting to be submitted, this blocks until the oldest of them has been submitted, so it must not be
+    // called by a thread that the oldest slot is waiting on (e.g. while it is recording into an earlier slot).
+    uint64 AddCommandBufferSlot();
+    // Get a command buffer from the calling thread's pool for the current frame. The caller must already have added
+    // the slot that it will be submitted in, as that is what keeps NextFrame from resetting the pool under it.
     CommandBuffer& GetCommandBuffer();
-    void SubmitCommandBuffer(uint32 index, vk::CommandBuffer commandBuffer, OnCompleteFunction func = nullptr);
+    // Get a secondary command buffer that continues the given render pass. As with GetCommandBuffer, it must be
+    // executed by a primary command buffer whose slot had been added before this was called.
+    vk::CommandBuffer GetSecondaryCommandBuffer(const vk::CommandBufferInheritanceInfo& inheritanceInfo);
+    // If given, the command buffer waits on the GPU for another queue's semaphore, and onSubmitted is called with the
+    // value that this executor's timeline semaphore will be signalled with once the command buffer has completed.
+    void SubmitCommandBuffer(
+        uint64 index, vk::CommandBuffer commandBuffer, OnCompleteFunction func = nullptr,
+        Queue::CallbackMode mode = Queue::CallbackMode::Deferred, std::optional<Queue::SemaphoreWait> wait = std::nullopt,
+        OnSubmittedFunction onSubmitted = nullptr);
+    // As SubmitCommandBuffer, for a command buffer that the recording thread has already ended, so that it can be
+    // submitted from another thread while the recording thread goes on using its command pool
+    void SubmitEndedCommandBuffer(
+        uint64 index, vk::CommandBuffer commandBuffer, OnCompleteFunction func = nullptr,
+        Queue::CallbackMode mode = Queue::CallbackMode::Deferred, std::optional<Queue::SemaphoreWait> wait = std::nullopt,
+        OnSubmittedFunction onSubmitted = nullptr);
+    // Fill a slot without submitting anything, for work that was cancelled after its slot was added
+    void SkipCommandBufferSlot(uint64 index);
+
+    vk::Semaphore GetTimelineSemaphore() const { return m_queue.GetTimelineSemaphore(); }
+
+    QueueStatistics GetLastFrameStatistics() const { return m_queue.GetLastFrameStatistics(); }
+
+    // Keep an object alive until the GPU has finished all of the work that has been scheduled so far, including command
+    // buffers whose slots have been added but which haven't been recorded yet. Retired objects are destroyed by
+    // NextFrame and WaitForTasks, and by whichever thread submits command buffers once the GPU has finished with them.
+    template <class T>
+    void DestroyAfterScheduledWork(T object)
+    {
+        AddRetiringObject(std::make_shared<T>(std::move(object)));
+    }
 
     void WaitForTasks();
 
 private:
-    static constexpr uint32 MaxFramesInFlight = 2;
+    struct SubmitSlot
+    {
+        // Set to the slot's sequence index + 1 once the rest of the slot has been written
+        std::atomic<uint64> readySequence = 0;
+        vk::CommandBuffer commandBuffer; // null if the slot was skipped
+        OnCompleteFunction completionHandler;
+        Queue::CallbackMode mode = Queue::CallbackMode::Inline;
+        std::optional<Queue::SemaphoreWait> wait;
+        OnSubmittedFunction submissionHandler;
+    };
 
     struct ThreadResources
     {
         vk::UniqueCommandPool commandPool;
         std::deque<CommandBuffer> commandBuffers;
         uint32 numUsedCommandBuffers = 0;
+        std::vector<vk::UniqueCommandBuffer> secondaryCommandBuffers;
+        uint32 numUsedSecondaryCommandBuffers = 0;
         uint32 threadIndex = 0;
 
         ThreadResources(uint32& i, vk::Device device, uint32 queueFamilyIndex);
@@ -54,20 +118,65 @@ private:
 
     struct FrameResources
     {
-        explicit FrameResources(uint32 numThreads, vk::Device device, uint32 queueFamilyIndex, uint32 index);
+        explicit FrameResources(vk::Device device, uint32 queueFamilyIndex, uint32 index);
 
         ThreadMap<ThreadResources> threadResources;
+        // Every slot before this one might have used the frame's command pools
+        uint64 endSequenceIndex = 0;
+        // The submission containing the slot before endSequenceIndex, once it has been submitted
+        uint64 lastSubmissionId = 0;
     };
 
-    FrameArray<FrameResources, MaxFramesInFlight> m_frameResources;
+    struct RetiringObject
+    {
+        uint64 retirePoint = 0; // Sequence index until submitted, then submission ID
+        std::shared_ptr<void> object;
+    };
+
+    SubmitSlot& GetSubmitSlot(uint64 index) { return m_submitRing[index % SubmitRingSize]; }
+    void DrainSubmitRing();
+    // Submits the slots gathered so far by DrainSubmitRing. Returns the submission ID, if there was anything to submit.
+    std::optional<uint64> SubmitDrainedSlots();
+    // Waits for the frame's work to complete, then resets its command pools for reuse
+    void ResetFrame(FrameResources& frame);
+    void EndFrame(FrameResources& frame);
+    void WaitForFrame(const FrameResources& frame);
+
+    void AddRetiringObject(std::shared_ptr<void> object);
+    void DestroyRetiredObjects();
+    // As DestroyRetiredObjects, but does nothing if another thread is already destroying objects
+    void TryDestroyRetiredObjects();
+    // Unlocks the lock before destroying the objects
+    void DestroyRetiredObjects(std::unique_lock<std::mutex>& lock);
+
+    FrameArray<FrameResources> m_frameResources;
 
     const std::thread::id m_mainThread = std::this_thread::get_id();
 
     vk::Device m_device;
 
-    std::vector<vk::CommandBuffer> m_readyCommandBuffers;
-    std::vector<OnCompleteFunction> m_completionHandlers;
-    usize m_numSubmittedCommandBuffers = 0;
+    // Command buffers are published to the ring by whichever thread recorded them, and the ring is drained in order by
+    // whichever thread manages to acquire m_draining, so no thread ever waits on a lock to submit
+    std::unique_ptr<SubmitSlot[]> m_submitRing = std::make_unique<SubmitSlot[]>(SubmitRingSize);
+    std::atomic<uint64> m_nextSequenceIndex = 0;
+    std::atomic<uint64> m_numSubmittedCommandBuffers = 0;
+    std::atomic_flag m_draining;
+
+    // Only used by the thread that is draining the ring
+    std::vector<vk::CommandBuffer> m_drainCommandBuffers;
+    std::vector<Queue::CompletionCallback> m_drainCallbacks;
+    std::vector<Queue::SemaphoreWait> m_drainWaits;
+    std::vector<OnSubmittedFunction> m_drainSubmissionHandlers;
+
+    // Frames that have ended but whose last slot hasn't been submitted yet, oldest first. The submitted count is only
+    // updated with this locked, so that a frame's last submission is recorded exactly once.
+    std::mutex m_frameMutex;
+    std::deque<FrameResources*> m_endingFrames;
+
+    // Objects wait for every slot added before them to be submitted, and then for that submission to complete
+    std::mutex m_retireMutex;
+    std::deque<RetiringObject> m_unsubmittedObjects;
+    std::deque<RetiringObject> m_submittedObjects;
 
     Queue m_queue;
 };
@@ -8,128 +8,404 @@
 #include <fmt/chrono.h>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
 #include <chrono>
-#include <ranges>
+#include <iterator>
+#include <span>
 #include <stop_token>
 #include <utility>
+#include <vector>
 
 namespace Teide
 {
 
+namespace
+{
+    const vk::Optional<const vk::AllocationCallbacks> s_allocator = nullptr;
+
+    vk::UniqueSemaphore CreateTimelineSemaphore(vk::Device device)
+    {
+        const vk::StructureChain createInfo = {
+            vk::SemaphoreCreateInfo{},
+            vk::SemaphoreTypeCreateInfo{
+                .semaphoreType = vk::SemaphoreType::eTimeline,
+                .initialValue = 0,
+            },
+        };
+
+        auto ret = device.createSemaphoreUnique(createInfo.get<vk::SemaphoreCreateInfo>(), s_allocator);
+        SetDebugName(ret, "QueueTimeline");
+        return ret;
+    }
+
+    // Wait semaphores in the separate arrays that VkSubmitInfo wants
+    struct SubmitWaits
+    {
+        std::vector<vk::Semaphore> semaphores;
+        std::vector<uint64> values;
+        std::vector<vk::PipelineStageFlags> stages;
+
+        explicit SubmitWaits(std::span<const Queue::SemaphoreWait> waits)
+        {
+            semaphores.reserve(waits.size());
+            values.reserve(waits.size());
+            stages.reserve(waits.size());
+            for (const auto& wait : waits)
+            {
+                semaphores.push_back(wait.semaphore);
+                values.push_back(wait.value);
+                stages.push_back(wait.stages);
+            }
+        }
+    };
+} // namespace
+
 Queue::SubmitSender::SubmitSender(CommandsRef commands, Queue& queue) : m_commands{commands}, m_queue{queue}
 {}
 
-Queue::Queue(vk::Device device, vk::Queue queue) :
-    m_device{device}, m_queue{queue}, m_schedulerThread([this](const std::stop_token& stop) {
+Queue::Queue(
+    vk::Device device, vk::Queue queue, CallbackDispatcher dispatcher, std::optional<SubmitThreadSettings> submitThread) :
+    m_device{device},
+    m_queue{queue},
+    m_timelineSemaphore{CreateTimelineSemaphore(device)},
+    m_dispatcher{std::move(dispatcher)},
+    m_submitSettings{submitThread},
+    m_schedulerThread([this](const std::stop_token& stop) {
         SetCurrentTheadName("GpuExecutor");
-        constexpr auto timeout = std::chrono::milliseconds{2};
+
+        // Upper bound on how long a stop request can go unnoticed while the GPU is busy
+        constexpr auto timeout = std::chrono::milliseconds{100};
 
         while (!stop.stop_requested())
         {
-            const auto fences = GetInFlightFences();
-
-            if (fences.empty())
+            // Sleep until there is a submission to wait on
+            uint64 nextSubmissionId = 0;
             {
-                // If there are no fences to wait on, sleep for a bit and try again
-                std::this_thread::sleep_for(timeout);
-            }
-            else
-            {
-                // If there are fences, wait on them and see if any are signalled
-                try
+                auto lock = std::unique_lock(m_mutex);
+                if (!m_submitCondition.wait(lock, stop, [this] { return !m_inFlightSubmits.empty(); }))
                 {
-                    if (m_device.waitForFences(fences, false, Timeout(timeout)) == vk::Result::eSuccess)
-                    {
-                        Flush();
-                    }
+                    break;
                 }
-                catch (const vk::DeviceLostError&)
+                nextSubmissionId = m_inFlightSubmits.front().submissionId;
+            }
+
+            // Block until the GPU signals the timeline semaphore, then retire everything that has completed so far
+            try
+            {
+                if (WaitForSubmission(nextSubmissionId, timeout))
                 {
-                    spdlog::critical("Device lost while waiting for fences");
-                    std::abort();
+                    Flush();
                 }
             }
+            catch (const vk::DeviceLostError&)
+            {
+                spdlog::critical("Device lost while waiting for timeline semaphore");
+                std::abort();
+            }
         }
 
         WaitForTasks();
     })
-{}
-
-std::vector<vk::Fence> Queue::GetInFlightFences() const
 {
-    auto _ = std::unique_lock(m_mutex);
+    if (m_submitSettings)
+    {
+        m_submitThread = std::jthread([this](const std::stop_token& stop) {
+            SetCurrentTheadName("GpuSubmit");
+
+            while (!stop.stop_requested())
+            {
+                {
+                    auto lock = std::unique_lock(m_mutex);
+                    if (!m_pendingCondition.wait(lock, stop, [this] { return !m_pendingSubmits.empty(); }))
+                    {
+                        break;
+                    }
 
-    return m_inFlightSubmits //
-        | std::views::transform(&InFlightSubmit::GetFence)
-        | std::ranges::to<std::vector>();
+                    // Give the flush policy a chance to collect more command buffers. Only the per-frame policy
+                    // ignores the deadline, and waits for the frame to end.
+                    if (m_submitSettings->flushPolicy == SubmitFlushPolicy::PerFrame)
+                    {
+                        if (!m_pendingCondition.wait(lock, stop, [this] { return IsFlushDue(); }))
+                        {
+                            break;
+                        }
+                    }
+                    else
+                    {
+                        const auto deadline = m_pendingSubmits.front().queueTime + m_submitSettings->deadline;
+                        m_pendingCondition.wait_until(lock, stop, deadline, [this] { return IsFlushDue(); });
+                    }
+                }
+
+                SubmitPending();
+            }
+        });
+    }
 }
 
 void Queue::Flush()
 {
-    auto _ = std::unique_lock(m_mutex);
+    // Only collect the completed submissions while holding the lock, so that callbacks can't hold up Submit
+    {
+        auto _ = std::unique_lock(m_mutex);
+
+        const uint64 completedSubmissionId = GetCompletedSubmission();
+
+        // Submissions are in order, so everything up to the completed ID is done
+        const auto completedEnd = std::ranges::find_if(
+            m_inFlightSubmits, [=](const InFlightSubmit& submit) { return submit.submissionId > completedSubmissionId; });
+        std::ranges::move(m_inFlightSubmits.begin(), completedEnd, std::back_inserter(m_completedSubmits));
+        m_inFlightSubmits.erase(m_inFlightSubmits.begin(), completedEnd);
+    }
 
-    // Iterate the fences to find out which have been signalled
-    for (auto& [fence, callback] : m_inFlightSubmits)
+    for (auto& [submissionId, callback, mode] : m_completedSubmits)
     {
-        if (m_device.waitForFences(fence.get(), false, 0) == vk::Result::eSuccess)
+        if (!callback)
         {
-            // Found one, call the attached callbacks (if any)
-            std::exchange(callback, {})();
+            continue;
+        }
 
-            // Reuse the fence for later and mark the task as done
-            m_device.resetFences(fence.get());
-            m_unusedSubmitFences.push(std::exchange(fence, {}));
+        if (mode == CallbackMode::Deferred && m_dispatcher)
+        {
+            m_dispatcher(std::move(callback));
+        }
+        else
+        {
+            callback();
         }
     }
+    m_completedSubmits.clear();
+}
 
-    // Remove done tasks
-    std::erase_if(m_inFlightSubmits, [](const auto& entry) { return !entry.fence; });
+uint64 Queue::Submit(CommandsRef commands, OnCompleteFunction callback, CallbackMode mode, std::span<const SemaphoreWait> waits)
+{
+    auto completionCallback = CompletionCallback{.function = std::move(callback), .mode = mode};
+    return Submit(commands, std::span(&completionCallback, 1), waits);
 }
 
-void Queue::Submit(CommandsRef commands, OnCompleteFunction callback)
+uint64 Queue::Submit(CommandsRef commands, std::span<CompletionCallback> callbacks, std::span<const SemaphoreWait> waits)
 {
-    auto _ = std::unique_lock(m_mutex);
+    uint64 submissionId = 0;
+    {
+        auto _ = std::unique_lock(m_mutex);
 
-    auto fence = GetFence();
+        // Signal values must increase in submission order, so allocate the ID and submit (or queue) under the same lock
+        submissionId = ++m_lastSubmissionId;
 
-    const vk::SubmitInfo submitInfo = {
-        .commandBufferCount = size32(commands),
-        .pCommandBuffers = data(commands),
-    };
-    m_queue.submit(submitInfo, fence.get());
+        if (m_submitSettings)
+        {
+            m_pendingSubmits.emplace_back(
+                submissionId, std::vector(commands.begin(), commands.end()), std::chrono::steady_clock::now(),
+                std::vector(waits.begin(), waits.end()));
+            m_numPendingCommandBuffers += size32(commands);
+        }
+        else
+        {
+            const auto submitWaits = SubmitWaits(waits);
+            const vk::StructureChain submitInfo = {
+                vk::SubmitInfo{
+                    .waitSemaphoreCount = size32(submitWaits.semaphores),
+                    .pWaitSemaphores = data(submitWaits.semaphores),
+                    .pWaitDstStageMask = data(submitWaits.stages),
+                    .commandBufferCount = size32(commands),
+                    .pCommandBuffers = data(commands),
+                    .signalSemaphoreCount = 1,
+                    .pSignalSemaphores = &m_timelineSemaphore.get(),
+                },
+                vk::TimelineSemaphoreSubmitInfo{
+                    .waitSemaphoreValueCount = size32(submitWaits.values),
+                    .pWaitSemaphoreValues = data(submitWaits.values),
+                    .signalSemaphoreValueCount = 1,
+                    .pSignalSemaphoreValues = &submissionId,
+                },
+            };
 
-    m_inFlightSubmits.emplace_back(std::move(fence), std::move(callback));
-}
+            const auto start = std::chrono::steady_clock::now();
+            m_queue.submit(submitInfo.get<vk::SubmitInfo>());
+            RecordSubmit(1, size32(commands), std::chrono::steady_clock::now() - start);
+        }
 
-auto Queue::LazySubmit(CommandsRef commands) -> SubmitSender
-{
-    return SubmitSender(commands, *this);
+        // A submission without callbacks still needs an entry, so that the scheduler thread waits for it
+        if (callbacks.empty())
+        {
+            m_inFlightSubmits.emplace_back(submissionId, nullptr, CallbackMode::Inline);
+        }
+        for (auto& [function, mode] : callbacks)
+        {
+            m_inFlightSubmits.emplace_back(submissionId, std::move(function), mode);
+        }
+    }
+
+    if (m_submitSettings)
+    {
+        m_pendingCondition.notify_one();
+    }
+    m_submitCondition.notify_one();
+    return submissionId;
 }
 
-void Queue::WaitForTasks()
+void Queue::SubmitPending()
 {
-    const auto fences = GetInFlightFences();
+    const auto submitLock = std::unique_lock(m_submitMutex);
 
-    if (!fences.empty())
+    const auto pendingSubmits = [this] {
+        auto _ = std::unique_lock(m_mutex);
+        m_flushRequested = false;
+        m_numPendingCommandBuffers = 0;
+        return std::exchange(m_pendingSubmits, {});
+    }();
+
+    if (pendingSubmits.empty())
     {
-        constexpr auto timeout = std::chrono::seconds{4};
-        if (m_device.waitForFences(fences, true, Timeout(timeout)) == vk::Result::eTimeout)
+        return;
+    }
+
+    // Consecutive submissions are merged into one VkSubmitInfo, which signals the last of their IDs. The timeline
+    // semaphore's value only increases, so that signals the earlier IDs too. A submission that waits on a semaphore
+    // starts a new VkSubmitInfo, so that the wait doesn't hold up the command buffers submitted before it.
+    std::vector<SubmitWaits> submitWaits;
+    std::vector<std::vector<vk::CommandBuffer>> commandBuffers;
+    std::vector<uint64> signalValues;
+
+    uint32 numCommandBuffers = 0;
+    for (const auto& pending : pendingSubmits)
+    {
+        if (commandBuffers.empty() || !pending.waits.empty())
         {
-            spdlog::error("Timeout (>{}) while waiting for command buffer execution to complete!", timeout);
+            submitWaits.emplace_back(pending.waits);
+            commandBuffers.emplace_back();
+            signalValues.emplace_back();
         }
+
+        commandBuffers.back().insert(
+            commandBuffers.back().end(), pending.commandBuffers.begin(), pending.commandBuffers.end());
+        signalValues.back() = pending.submissionId;
+        numCommandBuffers += size32(pending.commandBuffers);
+    }
+
+    std::vector<vk::TimelineSemaphoreSubmitInfo> timelineInfos;
+    std::vector<vk::SubmitInfo> submitInfos;
+    timelineInfos.reserve(commandBuffers.size());
+    submitInfos.reserve(commandBuffers.size());
+    for (usize i = 0; i < commandBuffers.size(); i++)
+    {
+        const auto& waits = submitWaits[i];
+        const auto& timelineInfo = timelineInfos.emplace_back(vk::TimelineSemaphoreSubmitInfo{
+            .waitSemaphoreValueCount = size32(waits.values),
+            .pWaitSemaphoreValues = data(waits.values),
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &signalValues[i],
+        });
+        submitInfos.push_back({
+            .pNext = &timelineInfo,
+            .waitSemaphoreCount = size32(waits.semaphores),
+            .pWaitSemaphores = data(waits.semaphores),
+            .pWaitDstStageMask = data(waits.stages),
+            .commandBufferCount = size32(commandBuffers[i]),
+            .pCommandBuffers = data(commandBuffers[i]),
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &m_timelineSemaphore.get(),
+        });
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    m_queue.submit(submitInfos);
+    const auto driverTime = std::chrono::steady_clock::now() - start;
+
+    auto _ = std::unique_lock(m_mutex);
+    RecordSubmit(size32(submitInfos), numCommandBuffers, driverTime);
+}
+
+bool Queue::IsFlushDue() const
+{
+    if (m_flushRequested)
+    {
+        return true;
+    }
+
+    switch (m_submitSettings->flushPolicy)
+    {
+        case SubmitFlushPolicy::BatchSize: return m_numPendingCommandBuffers >= m_submitSettings->batchSize;
+        case SubmitFlushPolicy::PerFrame:
+        case SubmitFlushPolicy::Deadline: return false;
+    }
+    return false;
+}
+
+void Queue::RecordSubmit(uint32 numBatches, uint32 numCommandBuffers, std::chrono::nanoseconds driverTime)
+{
+    m_frameStatistics.submitCalls++;
+    m_frameStatistics.submitBatches += numBatches;
+    m_frameStatistics.commandBuffers += numCommandBuffers;
+    m_frameStatistics.driverTime += driverTime;
+}
+
+void Queue::FlushSubmits()
+{
+    if (m_submitSettings)
+    {
+        SubmitPending();
     }
 }
 
-vk::UniqueFence Queue::GetFence()
+void Queue::NextFrame()
 {
-    if (m_unusedSubmitFences.empty())
     {
-        return m_device.createFenceUnique({});
+        auto _ = std::unique_lock(m_mutex);
+        m_lastFrameStatistics = std::exchange(m_frameStatistics, {});
+        m_flushRequested = m_submitSettings.has_value();
     }
 
-    auto nextFence = std::move(m_unusedSubmitFences.front());
-    m_unusedSubmitFences.pop();
-    return nextFence;
-};
+    if (m_submitSettings)
+    {
+        m_pendingCondition.notify_one();
+    }
+}
+
+QueueStatistics Queue::GetLastFrameStatistics() const
+{
+    auto _ = std::unique_lock(m_mutex);
+    return m_lastFrameStatistics;
+}
+
+auto Queue::LazySubmit(CommandsRef commands) -> SubmitSender
+{
+    return SubmitSender(commands, *this);
+}
+
+uint64 Queue::GetCompletedSubmission() const
+{
+    return m_device.getSemaphoreCounterValue(m_timelineSemaphore.get());
+}
+
+uint64 Queue::GetLastSubmission() const
+{
+    auto _ = std::unique_lock(m_mutex);
+    return m_lastSubmissionId;
+}
+
+bool Queue::WaitForSubmission(uint64 submissionId, std::chrono::nanoseconds timeout) const
+{
+    const vk::SemaphoreWaitInfo waitInfo = {
+        .semaphoreCount = 1,
+        .pSemaphores = &m_timelineSemaphore.get(),
+        .pValues = &submissionId,
+    };
+    return m_device.waitSemaphores(waitInfo, Timeout(timeout)) == vk::Result::eSuccess;
+}
+
+void Queue::WaitForTasks()
+{
+    FlushSubmits();
+
+    const auto lastSubmissionId = GetLastSubmission();
+
+    // Callers go on to destroy what the command buffers use, so this keeps waiting however long it takes
+    constexpr auto timeout = std::chrono::seconds{4};
+    while (!WaitForSubmission(lastSubmissionId, timeout))
+    {
+        spdlog::error("Timeout (>{}) while waiting for command buffer execution to complete! Still waiting", timeout);
+    }
+}
 
 } // namespace Teide
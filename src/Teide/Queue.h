@@ -1,14 +1,18 @@
 
 #pragma once
 
+#include "Teide/BasicTypes.h"
+#include "Teide/GraphicsSettings.h"
 #include "Teide/Util/TypeHelpers.h"
 
 #include <function2/function2.hpp>
 #include <stdexec/execution.hpp>
 #include <vulkan/vulkan.hpp>
 
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
-#include <queue>
+#include <optional>
 #include <span>
 #include <thread>
 #include <vector>
@@ -18,6 +22,14 @@ namespace Teide
 
 namespace ex = stdexec;
 
+struct QueueStatistics
+{
+    uint32 submitCalls = 0;    // Number of calls to vkQueueSubmit
+    uint32 submitBatches = 0;  // Number of VkSubmitInfos passed to vkQueueSubmit
+    uint32 commandBuffers = 0; // Number of command buffers submitted
+    std::chrono::nanoseconds driverTime{}; // Time spent inside vkQueueSubmit
+};
+
 class Queue
 {
 public:
@@ -62,35 +74,116 @@ public:
     };
 
     using OnCompleteFunction = fu2::unique_function<void()>;
+    using CallbackDispatcher = fu2::unique_function<void(OnCompleteFunction)>;
 
-    explicit Queue(vk::Device device, vk::Queue queue);
+    enum class CallbackMode : uint8
+    {
+        Deferred, // Hand the callback to the dispatcher, for callbacks that do real work (e.g. reading back data)
+        Inline,   // Call directly on the completion thread, for callbacks that only e.g. fulfil a promise
+    };
 
-    std::vector<vk::Fence> GetInFlightFences() const;
+    // Deferred callbacks are passed to the dispatcher (e.g. to run on a thread pool). If there is no dispatcher they
+    // are called on the completion thread. Callbacks are never called with the queue's mutex held.
+    // If submit thread settings are given, Submit only queues the command buffers, and a dedicated thread passes them
+    // to the Vulkan queue in batches.
+    explicit Queue(
+        vk::Device device, vk::Queue queue, CallbackDispatcher dispatcher = nullptr,
+        std::optional<SubmitThreadSettings> submitThread = std::nullopt);
 
-    void Submit(CommandsRef commands, OnCompleteFunction callback);
+    // Makes a submission wait on the GPU until another queue's timeline semaphore reaches a value
+    struct SemaphoreWait
+    {
+        vk::Semaphore semaphore;
+        uint64 value = 0;
+        vk::PipelineStageFlags stages;
+    };
+
+    struct CompletionCallback
+    {
+        OnCompleteFunction function;
+        CallbackMode mode = CallbackMode::Deferred;
+    };
+
+    // Submit command buffers and return the submission's ID. IDs increase monotonically from 1, and the GPU signals
+    // the queue's timeline semaphore with the ID when the submission is complete.
+    uint64 Submit(
+        CommandsRef commands, OnCompleteFunction callback, CallbackMode mode = CallbackMode::Deferred,
+        std::span<const SemaphoreWait> waits = {});
+    // As above, with any number of callbacks, which are moved from. Each is called in its own mode.
+    uint64 Submit(
+        CommandsRef commands, std::span<CompletionCallback> callbacks, std::span<const SemaphoreWait> waits = {});
+
+    // The semaphore that is signalled with each submission's ID, for other queues to wait on
+    vk::Semaphore GetTimelineSemaphore() const { return m_timelineSemaphore.get(); }
 
     auto LazySubmit(CommandsRef commands) -> SubmitSender;
 
+    // Returns the ID of the latest submission known to have completed on the GPU (0 if none have completed)
+    uint64 GetCompletedSubmission() const;
+    // Returns the ID of the latest submission, whether or not it has been passed to Vulkan yet (0 if there are none)
+    uint64 GetLastSubmission() const;
+
+    // Wait until the submission with the given ID has completed. Returns false on timeout.
+    bool WaitForSubmission(uint64 submissionId, std::chrono::nanoseconds timeout) const;
+
+    // Submit any command buffers queued for the submit thread straight away
+    void FlushSubmits();
+
+    // Flush queued command buffers (if using a submit thread) and start collecting statistics for a new frame
+    void NextFrame();
+
+    QueueStatistics GetLastFrameStatistics() const;
+
     void WaitForTasks();
 
 private:
     void Flush();
-    vk::UniqueFence GetFence();
+    void SubmitPending();
+    bool IsFlushDue() const;
+    void RecordSubmit(uint32 numBatches, uint32 numCommandBuffers, std::chrono::nanoseconds driverTime);
 
     struct InFlightSubmit
     {
-        vk::Fence GetFence() const { return fence.get(); }
-
-        vk::UniqueFence fence;
+        uint64 submissionId;
         OnCompleteFunction callback;
+        CallbackMode mode;
+    };
+
+    struct PendingSubmit
+    {
+        uint64 submissionId;
+        std::vector<vk::CommandBuffer> commandBuffers;
+        std::chrono::steady_clock::time_point queueTime;
+        std::vector<SemaphoreWait> waits;
     };
 
     vk::Device m_device;
     vk::Queue m_queue;
+    vk::UniqueSemaphore m_timelineSemaphore;
+    CallbackDispatcher m_dispatcher;
 
     mutable std::mutex m_mutex;
-    std::queue<vk::UniqueFence> m_unusedSubmitFences;
+    std::condition_variable_any m_submitCondition;
+    uint64 m_lastSubmissionId = 0;
+    // In submission order. A vector rather than a deque, so that its storage is reused rather than reallocated as
+    // submissions complete.
     std::vector<InFlightSubmit> m_inFlightSubmits;
+    std::vector<InFlightSubmit> m_completedSubmits; // only used by Flush, on the scheduler thread
+
+    QueueStatistics m_frameStatistics;
+    QueueStatistics m_lastFrameStatistics;
+
+    // Submit thread state (all guarded by m_mutex)
+    std::optional<SubmitThreadSettings> m_submitSettings;
+    std::condition_variable_any m_pendingCondition;
+    std::vector<PendingSubmit> m_pendingSubmits; // in submission order
+    uint32 m_numPendingCommandBuffers = 0;
+    bool m_flushRequested = false;
+
+    // Held while taking pending submits and passing them to Vulkan, so that batches can't overtake each other
+    std::mutex m_submitMutex;
+
+    std::jthread m_submitThread;
 
     // Must be the last member so it is destroyed first!
     std::jthread m_schedulerThread;
@@ -0,0 +1,79 @@
+
+#include "SamplerCache.h"
+
+#include "Vulkan.h"
+
+#include <spdlog/spdlog.h>
+
+#include <utility>
+
+namespace Teide
+{
+
+namespace
+{
+    const vk::Optional<const vk::AllocationCallbacks> s_allocator = nullptr;
+
+    vk::UniqueSampler CreateSampler(vk::Device device, const SamplerState& ss)
+    {
+        const vk::SamplerCreateInfo samplerInfo = {
+            .magFilter = ToVulkan(ss.magFilter),
+            .minFilter = ToVulkan(ss.minFilter),
+            .mipmapMode = ToVulkan(ss.mipmapMode),
+            .addressModeU = ToVulkan(ss.addressModeU),
+            .addressModeV = ToVulkan(ss.addressModeV),
+            .addressModeW = ToVulkan(ss.addressModeW),
+            .anisotropyEnable = ss.maxAnisotropy.has_value(),
+            .maxAnisotropy = ss.maxAnisotropy.value_or(0.0f),
+            .compareEnable = ss.compareOp.has_value(),
+            .compareOp = ToVulkan(ss.compareOp.value_or(CompareOp::Never)),
+            .minLod = 0,
+            .maxLod = VK_LOD_CLAMP_NONE,
+        };
+        return device.createSamplerUnique(samplerInfo, s_allocator);
+    }
+} // namespace
+
+SamplerPtr SamplerCache::Get(const SamplerState& samplerState)
+{
+    const auto lock = std::scoped_lock(m_mutex);
+
+    auto& cached = m_samplers[samplerState];
+    if (auto sampler = cached.lock())
+    {
+        return sampler;
+    }
+
+    // Either there's never been a sampler with this state, or the last one has been destroyed (but hasn't been
+    // removed yet, as that happens after the last reference is released)
+    spdlog::debug("Creating sampler {}", m_createdCount);
+    auto newSampler = CreateSampler(m_device, samplerState);
+    SetDebugName(newSampler, "Sampler{}", m_createdCount++);
+
+    auto sampler = SamplerPtr(new vk::UniqueSampler(std::move(newSampler)), [this, samplerState](const auto* s) {
+        Remove(samplerState);
+        delete s;
+    });
+    cached = sampler;
+    return sampler;
+}
+
+usize SamplerCache::GetSize()
+{
+    const auto lock = std::scoped_lock(m_mutex);
+    return m_samplers.size();
+}
+
+void SamplerCache::Remove(const SamplerState& samplerState)
+{
+    const auto lock = std::scoped_lock(m_mutex);
+
+    // Unless it has already been replaced by a new sampler
+    const auto it = m_samplers.find(samplerState);
+    if (it != m_samplers.end() && it->second.expired())
+    {
+        m_samplers.erase(it);
+    }
+}
+
+} // namespace Teide
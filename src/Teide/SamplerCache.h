@@ -0,0 +1,43 @@
+
+#pragma once
+
+#include "Teide/Hash.h"
+#include "Teide/TextureData.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace Teide
+{
+
+using SamplerPtr = std::shared_ptr<const vk::UniqueSampler>;
+
+// Shares one sampler between every texture with the same sampler state, as there are usually only a handful of
+// different states, and implementations limit how many samplers can exist. A sampler is destroyed when the last
+// texture using it is, which is once the GPU has finished with the texture. Thread safe.
+class SamplerCache
+{
+public:
+    explicit SamplerCache(vk::Device device) : m_device{device} {}
+
+    SamplerCache(const SamplerCache&) = delete;
+    SamplerCache& operator=(const SamplerCache&) = delete;
+
+    SamplerPtr Get(const SamplerState& samplerState);
+
+    usize GetSize();
+
+private:
+    void Remove(const SamplerState& samplerState);
+
+    vk::Device m_device;
+
+    std::mutex m_mutex;
+    std::unordered_map<SamplerState, std::weak_ptr<const vk::UniqueSampler>, Hash<SamplerState>> m_samplers;
+    usize m_createdCount = 0; // For naming samplers
+};
+
+} // namespace Teide
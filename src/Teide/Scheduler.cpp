@@ -6,13 +6,44 @@
 namespace Teide
 {
 
-Scheduler::Scheduler(uint32 numThreads, vk::Device device, vk::Queue queue, uint32 queueFamilyIndex) :
-    m_cpuExecutor(numThreads), m_gpuExecutor(numThreads, device, queue, queueFamilyIndex)
-{}
+Scheduler::Scheduler(
+    uint32 numThreads, vk::Device device, vk::Queue queue, uint32 queueFamilyIndex,
+    std::optional<SubmitThreadSettings> submitThread, std::optional<AsyncQueue> transferQueue,
+    std::optional<AsyncQueue> computeQueue, uint32 framesInFlight) :
+    m_cpuExecutor(numThreads),
+    m_gpuExecutor(
+        device, queue, queueFamilyIndex,
+        [this](Queue::OnCompleteFunction callback) { m_cpuExecutor.LaunchTask(std::move(callback)); },
+        submitThread, framesInFlight)
+{
+    if (transferQueue)
+    {
+        m_transferExecutor.emplace(
+            device, transferQueue->queue, transferQueue->queueFamilyIndex,
+            [this](Queue::OnCompleteFunction callback) { m_cpuExecutor.LaunchTask(std::move(callback)); },
+            submitThread, framesInFlight);
+    }
+    if (computeQueue)
+    {
+        m_computeExecutor.emplace(
+            device, computeQueue->queue, computeQueue->queueFamilyIndex,
+            [this](Queue::OnCompleteFunction callback) { m_cpuExecutor.LaunchTask(std::move(callback)); },
+            submitThread, framesInFlight);
+    }
+}
 
 void Scheduler::NextFrame()
 {
-    m_gpuExecutor.Lock(&GpuExecutor::NextFrame);
+    m_cpuExecutor.NextFrame();
+    m_gpuExecutor.NextFrame();
+    if (m_transferExecutor)
+    {
+        m_transferExecutor->NextFrame();
+    }
+    if (m_computeExecutor)
+    {
+        m_computeExecutor->NextFrame();
+    }
 }
 
 void Scheduler::WaitForCpu()
@@ -23,7 +54,15 @@ void Scheduler::WaitForCpu()
 void Scheduler::WaitForGpu()
 {
     WaitForCpu();
-    m_gpuExecutor.Lock(&GpuExecutor::WaitForTasks);
+    if (m_transferExecutor)
+    {
+        m_transferExecutor->WaitForTasks();
+    }
+    if (m_computeExecutor)
+    {
+        m_computeExecutor->WaitForTasks();
+    }
+    m_gpuExecutor.WaitForTasks();
 }
 
 } // namespace Teide
@@ -5,7 +5,8 @@
 #include "CpuExecutor.h"
 #include "GpuExecutor.h"
 
-#include "Util/ThreadUtils.h"
+#include <optional>
+#include <stop_token>
 
 namespace Teide
 {
@@ -13,61 +14,215 @@ namespace Teide
 class Scheduler
 {
 public:
-    Scheduler(uint32 numThreads, vk::Device device, vk::Queue queue, uint32 queueFamilyIndex);
+    // A queue other than the graphics one, for work that can overlap with rendering
+    struct AsyncQueue
+    {
+        vk::Queue queue;
+        uint32 queueFamilyIndex = 0;
+    };
+
+    Scheduler(
+        uint32 numThreads, vk::Device device, vk::Queue queue, uint32 queueFamilyIndex,
+        std::optional<SubmitThreadSettings> submitThread = std::nullopt,
+        std::optional<AsyncQueue> transferQueue = std::nullopt, std::optional<AsyncQueue> computeQueue = std::nullopt,
+        uint32 framesInFlight = DefaultFramesInFlight);
 
     void NextFrame();
 
+    // Work scheduled with a stop token is skipped if stop is requested before it starts, and its task fails with
+    // TaskCancelled. Anything the callable holds on to (e.g. staging buffers) is released as soon as it is skipped.
     template <std::invocable<> F>
-    auto Schedule(F&& f) -> TaskForCallable<F>
+    auto Schedule(F&& f, TaskPriority priority = TaskPriority::Normal, std::stop_token stopToken = {})
+        -> TaskForCallable<F>
     {
-        return m_cpuExecutor.LaunchTask(std::forward<F>(f));
+        return m_cpuExecutor.LaunchTask(std::forward<F>(f), priority, std::move(stopToken));
     }
 
+    // The priority only affects when the command buffer is recorded. It is still submitted in scheduling order.
+    // Cancelled work is skipped before a command buffer is taken for it.
     template <std::invocable<CommandBuffer&> F>
-    auto ScheduleGpu(F&& f) -> TaskForCallable<F, CommandBuffer&> // NOLINT(cppcoreguidelines-missing-std-forward)
+    // NOLINTNEXTLINE(cppcoreguidelines-missing-std-forward)
+    auto ScheduleGpu(F&& f, TaskPriority priority = TaskPriority::Normal, std::stop_token stopToken = {})
+        -> TaskForCallable<F, CommandBuffer&>
     {
-        const uint32 sequenceIndex = m_gpuExecutor.Lock(&GpuExecutor::AddCommandBufferSlot);
-
         using FRet = std::invoke_result_t<F, CommandBuffer&>;
 
-        auto promise = std::make_shared<std::promise<FRet>>();
-        auto future = promise->get_future();
+        auto promise = TaskPromise<FRet>();
+        auto task = promise.GetTask();
 
-        m_cpuExecutor.LaunchTask([this, sequenceIndex, f = std::forward<F>(f), promise = std::move(promise)]() mutable {
-            // TODO: This is dangerous as we're passing references to an asynchronous callback.
-            // If the GPU executor is destroyed while this task is still alive it will crash.
-            // Try to refactor so this isn't possible!
-            CommandBuffer& commandBuffer = m_gpuExecutor.Lock(&GpuExecutor::GetCommandBuffer);
+        if (stopToken.stop_requested())
+        {
+            promise.SetCancelled();
+            return task;
+        }
 
-            if constexpr (std::is_void_v<FRet>)
-            {
-                std::forward<F>(f)(commandBuffer); // call the callback
-                auto callback = [promise = std::move(promise)]() mutable { promise->set_value(); };
-                m_gpuExecutor.Lock(&GpuExecutor::SubmitCommandBuffer, sequenceIndex, commandBuffer, std::move(callback));
-            }
-            else
+        const uint64 sequenceIndex = m_gpuExecutor.AddCommandBufferSlot();
+
+        m_cpuExecutor.LaunchTask(
+            [this, sequenceIndex, f = std::forward<F>(f), promise = std::move(promise),
+             stopToken = std::move(stopToken)]() mutable {
+                if (stopToken.stop_requested())
+                {
+                    // The slot still has to be filled, or nothing scheduled after it could be submitted
+                    m_gpuExecutor.SkipCommandBufferSlot(sequenceIndex);
+                    promise.SetCancelled();
+                    return;
+                }
+
+                // TODO: This is dangerous as we're passing references to an asynchronous callback.
+                // If the GPU executor is destroyed while this task is still alive it will crash.
+                // Try to refactor so this isn't possible!
+                CommandBuffer& commandBuffer = m_gpuExecutor.GetCommandBuffer();
+
+                // Fulfilling the promise only schedules the task's continuations, so it is cheap enough to run inline
+                if constexpr (std::is_void_v<FRet>)
+                {
+                    std::forward<F>(f)(commandBuffer); // call the callback
+                    auto callback = [promise = std::move(promise)]() mutable { promise.SetValue(); };
+                    m_gpuExecutor.SubmitCommandBuffer(
+                        sequenceIndex, commandBuffer, std::move(callback), Queue::CallbackMode::Inline);
+                }
+                else
+                {
+                    FRet ret = std::forward<F>(f)(commandBuffer); // call the callback
+                    auto callback = [promise = std::move(promise), ret = std::move(ret)]() mutable {
+                        promise.SetValue(std::move(ret));
+                    };
+                    m_gpuExecutor.SubmitCommandBuffer(
+                        sequenceIndex, commandBuffer, std::move(callback), Queue::CallbackMode::Inline);
+                }
+            },
+            priority);
+
+        return task;
+    }
+
+    // Schedule a copy on the transfer queue (if there is one), so that it can overlap with graphics work.
+    //  - release is recorded on the graphics queue, to give up ownership of resources that the transfer reads
+    //  - transfer is recorded on the transfer queue, and its return value is the task's result
+    //  - acquire is recorded on the graphics queue, to take ownership of the resources that the transfer wrote
+    // Each stage waits for the one before on the GPU, and graphics work scheduled after this is submitted after the
+    // acquire. Without a transfer queue, all three stages are recorded into the same graphics command buffer.
+    // The acquire waits for the transfer at acquireStages, which should be the stages that first use what the transfer
+    // wrote. The acquire's barriers must use the same stages as their source stages, to chain with the wait.
+    // If stop is requested before the release is recorded, none of the stages run and the task fails with
+    // TaskCancelled. Once the release has been recorded, ownership has moved, so the other stages always follow.
+    template <
+        std::invocable<CommandBuffer&> Release, std::invocable<CommandBuffer&> Transfer,
+        std::invocable<CommandBuffer&> Acquire>
+    auto ScheduleTransfer(
+        Release&& release, Transfer&& transfer, Acquire&& acquire,
+        vk::PipelineStageFlags acquireStages = vk::PipelineStageFlagBits::eAllCommands, std::stop_token stopToken = {})
+        -> TaskForCallable<Transfer, CommandBuffer&>
+    {
+        return ScheduleOnQueue(
+            m_transferExecutor ? &*m_transferExecutor : nullptr, vk::PipelineStageFlagBits::eTransfer, acquireStages,
+            std::move(stopToken), std::forward<Release>(release), std::forward<Transfer>(transfer),
+            std::forward<Acquire>(acquire));
+    }
+
+    // As above, for transfers that only write resources (e.g. uploads), so nothing needs to be released first
+    template <std::invocable<CommandBuffer&> Transfer, std::invocable<CommandBuffer&> Acquire>
+    auto ScheduleTransfer(
+        Transfer&& transfer, Acquire&& acquire,
+        vk::PipelineStageFlags acquireStages = vk::PipelineStageFlagBits::eAllCommands, std::stop_token stopToken = {})
+        -> TaskForCallable<Transfer, CommandBuffer&>
+    {
+        if (!m_transferExecutor)
+        {
+            return ScheduleTransfer(
+                [](CommandBuffer&) {}, std::forward<Transfer>(transfer), std::forward<Acquire>(acquire), acquireStages,
+                std::move(stopToken));
+        }
+
+        using Result = std::invoke_result_t<Transfer, CommandBuffer&>;
+
+        auto promise = TaskPromise<Result>();
+        auto task = promise.GetTask();
+
+        if (stopToken.stop_requested())
+        {
+            promise.SetCancelled();
+            return task;
+        }
+
+        const uint64 transferIndex = m_transferExecutor->AddCommandBufferSlot();
+        const uint64 acquireIndex = m_gpuExecutor.AddCommandBufferSlot();
+
+        m_cpuExecutor.LaunchTask([this, transferIndex, acquireIndex, acquireStages,
+                                  transfer = std::forward<Transfer>(transfer), acquire = std::forward<Acquire>(acquire),
+                                  promise = std::move(promise), stopToken = std::move(stopToken)]() mutable {
+            if (stopToken.stop_requested())
             {
-                FRet ret = std::forward<F>(f)(commandBuffer); // call the callback
-                auto callback = [promise = std::move(promise), ret = std::move(ret)]() mutable {
-                    promise->set_value(std::move(ret));
-                };
-                m_gpuExecutor.Lock(&GpuExecutor::SubmitCommandBuffer, sequenceIndex, commandBuffer, std::move(callback));
+                m_transferExecutor->SkipCommandBufferSlot(transferIndex);
+                m_gpuExecutor.SkipCommandBufferSlot(acquireIndex);
+                promise.SetCancelled();
+                return;
             }
+
+            RecordQueueStage(
+                *m_transferExecutor, transferIndex, acquireIndex, acquireStages, std::move(transfer),
+                std::move(acquire), std::move(promise), std::nullopt);
         });
 
-        return future;
+        return task;
     }
 
+    // Schedule compute work on the async compute queue (if there is one), so that it can overlap with graphics work.
+    // The stages are the same as for ScheduleTransfer, with the compute stage running on the compute queue.
+    template <
+        std::invocable<CommandBuffer&> Release, std::invocable<CommandBuffer&> Compute,
+        std::invocable<CommandBuffer&> Acquire>
+    auto ScheduleCompute(
+        Release&& release, Compute&& compute, Acquire&& acquire,
+        vk::PipelineStageFlags acquireStages = vk::PipelineStageFlagBits::eAllCommands, std::stop_token stopToken = {})
+        -> TaskForCallable<Compute, CommandBuffer&>
+    {
+        return ScheduleOnQueue(
+            m_computeExecutor ? &*m_computeExecutor : nullptr, vk::PipelineStageFlagBits::eComputeShader, acquireStages,
+            std::move(stopToken), std::forward<Release>(release), std::forward<Compute>(compute),
+            std::forward<Acquire>(acquire));
+    }
+
+    bool HasTransferQueue() const { return m_transferExecutor.has_value(); }
+    bool HasComputeQueue() const { return m_computeExecutor.has_value(); }
+
+    // If the dependency was cancelled, the task fails with TaskCancelled too
     template <std::invocable<> F>
-    auto ScheduleAfter(Task<> dependency, F&& f) -> TaskForCallable<F>
+    auto ScheduleAfter(
+        Task<> dependency, F&& f, TaskPriority priority = TaskPriority::Normal, std::stop_token stopToken = {})
+        -> TaskForCallable<F>
     {
-        return m_cpuExecutor.LaunchTask(std::forward<F>(f), std::move(dependency));
+        return m_cpuExecutor.LaunchTask(std::forward<F>(f), std::move(dependency), priority, std::move(stopToken));
     }
 
     template <class T, std::invocable<T> F>
-    auto ScheduleAfter(Task<T> dependency, F&& f) -> TaskForCallable<F, T>
+    auto ScheduleAfter(
+        Task<T> dependency, F&& f, TaskPriority priority = TaskPriority::Normal, std::stop_token stopToken = {})
+        -> TaskForCallable<F, T>
+    {
+        return m_cpuExecutor.LaunchTask(std::forward<F>(f), std::move(dependency), priority, std::move(stopToken));
+    }
+
+    // Get a secondary command buffer for the calling worker thread, which continues the given render pass
+    vk::CommandBuffer GetSecondaryCommandBuffer(const vk::CommandBufferInheritanceInfo& inheritanceInfo)
     {
-        return m_cpuExecutor.LaunchTask(std::forward<F>(f), std::move(dependency));
+        return m_gpuExecutor.GetSecondaryCommandBuffer(inheritanceInfo);
+    }
+
+    // Wait for a task from inside a task that was scheduled with Schedule or ScheduleGpu
+    template <class T>
+    void WaitInTask(const Task<T>& task)
+    {
+        m_cpuExecutor.WaitInWorker(task);
+    }
+
+    // Keep an object alive until the GPU has finished all of the work scheduled before this is called. Transfer and
+    // compute work is always followed by work on the graphics queue, so only the graphics queue needs to be tracked.
+    template <class T>
+    void DestroyAfterGpuWork(T object)
+    {
+        m_gpuExecutor.DestroyAfterScheduledWork(std::move(object));
     }
 
     void WaitForCpu();
@@ -75,9 +230,152 @@ public:
 
     uint32 GetThreadCount() const { return m_cpuExecutor.GetThreadCount(); }
 
+    // Schedules CPU work in sender pipelines. GPU work is scheduled with ScheduleGpu, whose tasks are also senders.
+    TaskScheduler GetCpuScheduler() { return m_cpuExecutor.GetScheduler(); }
+
+    QueueStatistics GetLastFrameSubmitStatistics() const { return m_gpuExecutor.GetLastFrameStatistics(); }
+    TaskStatistics GetLastFrameTaskStatistics() const { return m_cpuExecutor.GetLastFrameStatistics(); }
+
 private:
+    // Implements ScheduleTransfer and ScheduleCompute. The middle stage runs on the given executor if there is one,
+    // after waiting for the release at waitStages, and the acquire waits for the middle stage at acquireStages.
+    template <class Release, class Work, class Acquire>
+    auto ScheduleOnQueue(
+        GpuExecutor* executor, vk::PipelineStageFlags waitStages, vk::PipelineStageFlags acquireStages,
+        std::stop_token stopToken, Release&& release, Work&& work, Acquire&& acquire)
+        -> TaskForCallable<Work, CommandBuffer&>
+    {
+        using Result = std::invoke_result_t<Work, CommandBuffer&>;
+
+        if (!executor)
+        {
+            return ScheduleGpu(
+                [release = std::forward<Release>(release), work = std::forward<Work>(work),
+                 acquire = std::forward<Acquire>(acquire)](CommandBuffer& commandBuffer) mutable {
+                    release(commandBuffer);
+                    if constexpr (std::is_void_v<Result>)
+                    {
+                        work(commandBuffer);
+                        acquire(commandBuffer);
+                    }
+                    else
+                    {
+                        Result ret = work(commandBuffer);
+                        acquire(commandBuffer);
+                        return ret;
+                    }
+                },
+                TaskPriority::Normal, std::move(stopToken));
+        }
+
+        auto promise = TaskPromise<Result>();
+        auto task = promise.GetTask();
+
+        if (stopToken.stop_requested())
+        {
+            promise.SetCancelled();
+            return task;
+        }
+
+        // Reserve all of the slots up front, so that the stages keep their place in each queue's submission order.
+        // Graphics work scheduled after this may use what the middle stage writes, so it has to be submitted after the
+        // acquire, which therefore can't take a slot any later than this.
+        const uint64 releaseIndex = m_gpuExecutor.AddCommandBufferSlot();
+        const uint64 workIndex = executor->AddCommandBufferSlot();
+        const uint64 acquireIndex = m_gpuExecutor.AddCommandBufferSlot();
+
+        auto workStage = [this, executor, workIndex, acquireIndex, acquireStages, work = std::forward<Work>(work),
+                          acquire = std::forward<Acquire>(acquire)](
+                             TaskPromise<Result> promise, std::optional<Queue::SemaphoreWait> wait) mutable {
+            RecordQueueStage(
+                *executor, workIndex, acquireIndex, acquireStages, std::move(work), std::move(acquire),
+                std::move(promise), wait);
+        };
+
+        m_cpuExecutor.LaunchTask([this, executor, releaseIndex, workIndex, acquireIndex, waitStages,
+                                  release = std::forward<Release>(release), workStage = std::move(workStage),
+                                  promise = std::move(promise), stopToken = std::move(stopToken)]() mutable {
+            if (stopToken.stop_requested())
+            {
+                // Every reserved slot still has to be filled, or nothing scheduled after them could be submitted
+                m_gpuExecutor.SkipCommandBufferSlot(releaseIndex);
+                executor->SkipCommandBufferSlot(workIndex);
+                m_gpuExecutor.SkipCommandBufferSlot(acquireIndex);
+                promise.SetCancelled();
+                return;
+            }
+
+            CommandBuffer& commandBuffer = m_gpuExecutor.GetCommandBuffer();
+            release(commandBuffer);
+            m_gpuExecutor.SubmitCommandBuffer(
+                releaseIndex, commandBuffer, nullptr, Queue::CallbackMode::Inline, std::nullopt,
+                [this, waitStages, workStage = std::move(workStage),
+                 promise = std::move(promise)](uint64 releaseValue) mutable {
+                    const auto wait = Queue::SemaphoreWait{
+                        .semaphore = m_gpuExecutor.GetTimelineSemaphore(),
+                        .value = releaseValue,
+                        .stages = waitStages,
+                    };
+                    m_cpuExecutor.LaunchTask(
+                        [wait, workStage = std::move(workStage), promise = std::move(promise)]() mutable {
+                            workStage(std::move(promise), wait);
+                        });
+                });
+        });
+
+        return task;
+    }
+
+    // Records and submits the middle stage of ScheduleOnQueue, along with the acquire stage. The acquire is recorded
+    // straight after the middle stage, rather than in a task of its own once the middle stage has been submitted, so
+    // that the graphics work queued behind the acquire's slot is held up for as short a time as possible. It only needs
+    // the middle stage's semaphore value, so it is submitted as soon as that is known.
+    template <class Work, class Acquire, class Result = std::invoke_result_t<Work, CommandBuffer&>>
+    void RecordQueueStage(
+        GpuExecutor& executor, uint64 workIndex, uint64 acquireIndex, vk::PipelineStageFlags acquireStages, Work work,
+        Acquire acquire, TaskPromise<Result> promise, std::optional<Queue::SemaphoreWait> wait)
+    {
+        CommandBuffer& commandBuffer = executor.GetCommandBuffer();
+
+        // The task completes once the acquire has completed, when the results are visible to the graphics queue
+        GpuExecutor::OnCompleteFunction onComplete;
+        if constexpr (std::is_void_v<Result>)
+        {
+            work(commandBuffer);
+            onComplete = [promise = std::move(promise)]() mutable { promise.SetValue(); };
+        }
+        else
+        {
+            onComplete = [promise = std::move(promise), ret = work(commandBuffer)]() mutable {
+                promise.SetValue(std::move(ret));
+            };
+        }
+
+        // Ended here, as the acquire is submitted from whichever thread submits the middle stage
+        CommandBuffer& acquireCommandBuffer = m_gpuExecutor.GetCommandBuffer();
+        acquire(acquireCommandBuffer);
+        acquireCommandBuffer->end();
+
+        executor.SubmitCommandBuffer(
+            workIndex, commandBuffer, nullptr, Queue::CallbackMode::Inline, wait,
+            [this, &executor, acquireIndex, acquireStages,
+             acquireCommandBuffer = vk::CommandBuffer{acquireCommandBuffer},
+             onComplete = std::move(onComplete)](uint64 workValue) mutable {
+                const auto acquireWait = Queue::SemaphoreWait{
+                    .semaphore = executor.GetTimelineSemaphore(),
+                    .value = workValue,
+                    .stages = acquireStages,
+                };
+                m_gpuExecutor.SubmitEndedCommandBuffer(
+                    acquireIndex, acquireCommandBuffer, std::move(onComplete), Queue::CallbackMode::Inline,
+                    acquireWait);
+            });
+    }
+
     CpuExecutor m_cpuExecutor;
-    Synchronized<GpuExecutor> m_gpuExecutor;
+    GpuExecutor m_gpuExecutor; // thread safe, apart from NextFrame
+    std::optional<GpuExecutor> m_transferExecutor;
+    std::optional<GpuExecutor> m_computeExecutor;
 };
 
 } // namespace Teide
@@ -104,6 +104,27 @@ bool IsResourceType(ShaderVariableType::BaseType type)
     Unreachable();
 }
 
+Format GetKernelOutputFormat(ShaderVariableType type)
+{
+    TEIDE_ASSERT(type.arraySize == 0, "Kernel outputs can't be arrays");
+
+    using enum ShaderVariableType::BaseType;
+    switch (type.baseType)
+    {
+        case Float: return Format::Float1;
+        case Vector2: return Format::Float2;
+        case Vector3:
+        case Vector4: return Format::Float4;
+
+        case Matrix4:
+        case Texture2D:
+        case Texture2DShadow:
+        case RWTexture2D: break;
+    }
+    TEIDE_ASSERT(false, "Kernel outputs must be float scalars or vectors");
+    return Format::Unknown;
+}
+
 std::ostream& operator<<(std::ostream& os, ShaderVariableType::BaseType type)
 {
     return os << ToString(type);
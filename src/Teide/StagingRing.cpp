@@ -0,0 +1,124 @@
+
+#include "StagingRing.h"
+
+#include "Vulkan.h"
+
+#include "Teide/Assert.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace Teide
+{
+
+namespace
+{
+    constexpr auto StagingAllocationFlags
+        = vma::AllocationCreateFlagBits::eMapped | vma::AllocationCreateFlagBits::eHostAccessSequentialWrite;
+}
+
+StagingRing::Range::~Range()
+{
+    Release();
+}
+
+StagingRing::Range::Range(Range&& other) noexcept :
+    m_ring{std::exchange(other.m_ring, nullptr)},
+    m_buffer{other.m_buffer},
+    m_offset{other.m_offset},
+    m_size{other.m_size},
+    m_overflowBuffer{std::move(other.m_overflowBuffer)}
+{}
+
+auto StagingRing::Range::operator=(Range&& other) noexcept -> Range&
+{
+    if (this != &other)
+    {
+        Release();
+        m_ring = std::exchange(other.m_ring, nullptr);
+        m_buffer = other.m_buffer;
+        m_offset = other.m_offset;
+        m_size = other.m_size;
+        m_overflowBuffer = std::move(other.m_overflowBuffer);
+    }
+    return *this;
+}
+
+void StagingRing::Range::Write(vk::DeviceSize offset, BytesView data)
+{
+    TEIDE_ASSERT(m_ring);
+    TEIDE_ASSERT(offset + data.size() <= m_size);
+
+    auto& buffer = IsOverflow() ? m_overflowBuffer : m_ring->m_buffer;
+    const auto bufferOffset = IsOverflow() ? offset : m_offset + offset;
+    std::ranges::copy(data, buffer.mappedData.subspan(bufferOffset).begin());
+    m_ring->m_allocator.flushAllocation(buffer.allocation.get(), bufferOffset, data.size());
+}
+
+void StagingRing::Range::Release()
+{
+    // Overflow buffers are destroyed along with the range
+    if (m_ring && !IsOverflow())
+    {
+        m_ring->Free(m_offset);
+    }
+    m_ring = nullptr;
+}
+
+StagingRing::StagingRing(
+    vk::Device device, vma::Allocator allocator, MemoryCounter& memoryCounter, vk::DeviceSize size) :
+    m_device{device},
+    m_allocator{allocator},
+    m_memoryCounter{memoryCounter},
+    m_ringAllocator{size}
+{
+    // A size of 0 means there is no ring, and every upload gets a staging buffer of its own
+    if (size == 0)
+    {
+        return;
+    }
+
+    m_buffer = CreateBufferUninitialized(
+        size, vk::BufferUsageFlagBits::eTransferSrc, StagingAllocationFlags, vma::MemoryUsage::eAuto, device,
+        m_allocator);
+    m_buffer.memory = m_memoryCounter.Add(size);
+    SetDebugName(m_buffer.buffer, "StagingRing");
+}
+
+auto StagingRing::Allocate(vk::DeviceSize size, vk::DeviceSize alignment) -> Range
+{
+    TEIDE_ASSERT(alignment > 0);
+
+    Range ret;
+    ret.m_ring = this;
+    ret.m_size = size;
+
+    {
+        const auto lock = std::scoped_lock(m_mutex);
+        if (const auto offset = m_ringAllocator.Allocate(size, alignment))
+        {
+            ret.m_buffer = m_buffer.buffer.get();
+            ret.m_offset = *offset;
+            return ret;
+        }
+    }
+
+    // The ring is full of data that the GPU hasn't finished copying yet (or the data is bigger than the whole ring)
+    spdlog::debug("Staging ring full, creating a staging buffer of size {}", size);
+    ret.m_overflowBuffer = CreateBufferUninitialized(
+        size, vk::BufferUsageFlagBits::eTransferSrc, StagingAllocationFlags, vma::MemoryUsage::eAuto, m_device,
+        m_allocator);
+    ret.m_overflowBuffer.memory = m_memoryCounter.Add(size);
+    ret.m_buffer = ret.m_overflowBuffer.buffer.get();
+    return ret;
+}
+
+void StagingRing::Free(vk::DeviceSize offset)
+{
+    const auto lock = std::scoped_lock(m_mutex);
+    m_ringAllocator.Free(offset);
+}
+
+} // namespace Teide
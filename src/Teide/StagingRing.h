@@ -0,0 +1,73 @@
+
+#pragma once
+
+#include "VulkanBuffer.h"
+
+#include "Teide/BasicTypes.h"
+#include "Teide/Util/MemoryCounter.h"
+#include "Teide/Util/RingAllocator.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <mutex>
+#include <optional>
+
+namespace Teide
+{
+
+// A persistently mapped buffer that upload data is written to before it is copied to device-local resources. Space is
+// handed out in order and comes back when the ranges are destroyed, which should be once the GPU has retired the copies
+// that read them, so uploads don't need to create (or map) buffers of their own. Allocating is thread safe.
+class StagingRing
+{
+public:
+    // Space in the ring, or a staging buffer of its own if there wasn't enough space in the ring
+    class Range
+    {
+    public:
+        Range() = default;
+        ~Range();
+
+        Range(const Range&) = delete;
+        Range(Range&& other) noexcept;
+        Range& operator=(const Range&) = delete;
+        Range& operator=(Range&& other) noexcept;
+
+        vk::Buffer GetBuffer() const { return m_buffer; }
+        vk::DeviceSize GetOffset() const { return m_offset; }
+        vk::DeviceSize GetSize() const { return m_size; }
+        bool IsOverflow() const { return static_cast<bool>(m_overflowBuffer.buffer); }
+
+        // Copies data to the given offset (relative to the start of the range) and flushes it to the device
+        void Write(vk::DeviceSize offset, BytesView data);
+
+    private:
+        friend class StagingRing;
+
+        void Release();
+
+        StagingRing* m_ring = nullptr;
+        vk::Buffer m_buffer;
+        vk::DeviceSize m_offset = 0;
+        vk::DeviceSize m_size = 0;
+        VulkanBufferData m_overflowBuffer;
+    };
+
+    StagingRing(vk::Device device, vma::Allocator allocator, MemoryCounter& memoryCounter, vk::DeviceSize size);
+
+    // The alignment doesn't need to be a power of two, so that texture data can be aligned to its texel size
+    Range Allocate(vk::DeviceSize size, vk::DeviceSize alignment);
+
+private:
+    void Free(vk::DeviceSize offset);
+
+    vk::Device m_device;
+    vma::Allocator m_allocator;
+    MemoryCounter& m_memoryCounter; // Counts the ring and overflow buffers
+    VulkanBufferData m_buffer;
+
+    std::mutex m_mutex;
+    RingAllocator m_ringAllocator;
+};
+
+} // namespace Teide
@@ -0,0 +1,101 @@
+
+#include "TextureResidency.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace Teide
+{
+
+auto TextureResidency::Track(uint64 handleIndex, uint64 size, TextureData source) -> std::shared_ptr<Entry>
+{
+    auto entry = std::make_shared<Entry>();
+    entry->handleIndex = handleIndex;
+    entry->size = size;
+    entry->source = std::move(source);
+    MarkUsed(*entry);
+
+    const auto lock = std::scoped_lock(m_mutex);
+    m_entries.push_back(entry);
+    return entry;
+}
+
+auto TextureResidency::AddUse(std::shared_ptr<Entry> entry) -> Use
+{
+    const auto lock = std::scoped_lock(m_mutex);
+    entry->pendingUses.fetch_add(1, std::memory_order_relaxed);
+    return Use(std::move(entry));
+}
+
+uint64 TextureResidency::Evict(uint64 bytesToFree, const std::function<bool(Entry&)>& evict)
+{
+    const auto lock = std::scoped_lock(m_mutex);
+
+    // Forget textures that have been destroyed
+    std::erase_if(m_entries, [](const auto& entry) { return entry.expired(); });
+
+    const uint64 currentFrame = GetCurrentFrame();
+    std::vector<std::shared_ptr<Entry>> candidates;
+    for (const auto& weakEntry : m_entries)
+    {
+        auto entry = weakEntry.lock();
+        if (entry && entry->resident && entry->pendingUses.load(std::memory_order_acquire) == 0
+            && entry->lastUsedFrame.load(std::memory_order_relaxed) + m_framesInFlight < currentFrame)
+        {
+            candidates.push_back(std::move(entry));
+        }
+    }
+    std::ranges::sort(candidates, {}, [](const auto& entry) {
+        return entry->lastUsedFrame.load(std::memory_order_relaxed);
+    });
+
+    uint64 bytesFreed = 0;
+    for (const auto& entry : candidates)
+    {
+        if (bytesFreed >= bytesToFree)
+        {
+            break;
+        }
+        if (evict(*entry))
+        {
+            entry->resident = false;
+            bytesFreed += entry->size;
+        }
+    }
+
+    spdlog::debug("Evicted {} bytes of textures ({} requested)", bytesFreed, bytesToFree);
+    return bytesFreed;
+}
+
+bool TextureResidency::MakeResident(Entry& entry, const std::function<void(Entry&)>& reload)
+{
+    const auto lock = std::scoped_lock(m_mutex);
+    if (entry.resident)
+    {
+        return false;
+    }
+
+    reload(entry);
+    entry.resident = true;
+    entry.residentEpoch.store(m_epoch.fetch_add(1, std::memory_order_release) + 1, std::memory_order_relaxed);
+    return true;
+}
+
+uint64 TextureResidency::GetResidentSize()
+{
+    const auto lock = std::scoped_lock(m_mutex);
+
+    uint64 size = 0;
+    for (const auto& weakEntry : m_entries)
+    {
+        if (const auto entry = weakEntry.lock(); entry && entry->resident)
+        {
+            size += entry->size;
+        }
+    }
+    return size;
+}
+
+} // namespace Teide
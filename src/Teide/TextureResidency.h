@@ -0,0 +1,128 @@
+
+#pragma once
+
+#include "Teide/BasicTypes.h"
+#include "Teide/TextureData.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Teide
+{
+
+// Keeps track of when textures were last used, so that when device memory is over budget, the textures that haven't
+// been used for longest can be evicted (their images destroyed), and made resident again from their source data the
+// next time they are used. Only decides what to evict and reload; the caller does the work.
+class TextureResidency
+{
+public:
+    struct Entry
+    {
+        uint64 handleIndex = 0; // Identifies the texture without holding a reference to it
+        uint64 size = 0;        // Bytes of device memory used by the texture while it is resident
+        TextureData source;     // To make the texture resident again
+        std::atomic<uint64> lastUsedFrame = 0;
+
+        bool resident = true; // Guarded by the TextureResidency's mutex
+        std::atomic<uint64> residentEpoch = 0; // The epoch in which the texture was last made resident again
+
+        // Uses of the texture by work that has been scheduled but might not have run yet. The first use is only added
+        // with the mutex locked, so that Evict can't see no uses and then evict a texture that is about to be used.
+        std::atomic<uint32> pendingUses = 0;
+    };
+
+    // Keeps a texture from being evicted while it lives, so that work that has been scheduled can read the texture's
+    // image without it being moved out from under it. Copying a use doesn't need the mutex, as the texture already
+    // has one.
+    class Use
+    {
+    public:
+        Use() = default;
+        ~Use() { Release(); }
+
+        Use(const Use& other) : m_entry{other.m_entry}
+        {
+            if (m_entry)
+            {
+                m_entry->pendingUses.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        Use(Use&& other) noexcept : m_entry{std::exchange(other.m_entry, nullptr)} {}
+        Use& operator=(const Use& other)
+        {
+            if (this != &other)
+            {
+                *this = Use(other);
+            }
+            return *this;
+        }
+        Use& operator=(Use&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Release();
+                m_entry = std::exchange(other.m_entry, nullptr);
+            }
+            return *this;
+        }
+
+    private:
+        friend class TextureResidency;
+
+        explicit Use(std::shared_ptr<Entry> entry) : m_entry{std::move(entry)} {}
+
+        void Release()
+        {
+            if (m_entry)
+            {
+                m_entry->pendingUses.fetch_sub(1, std::memory_order_release);
+                m_entry = nullptr;
+            }
+        }
+
+        std::shared_ptr<Entry> m_entry;
+    };
+
+    explicit TextureResidency(uint32 framesInFlight) : m_framesInFlight{framesInFlight} {}
+
+    std::shared_ptr<Entry> Track(uint64 handleIndex, uint64 size, TextureData source);
+
+    void NextFrame() { m_currentFrame.fetch_add(1, std::memory_order_relaxed); }
+    uint64 GetCurrentFrame() const { return m_currentFrame.load(std::memory_order_relaxed); }
+
+    // Incremented whenever a texture is made resident again, so that anything that refers to textures' images (e.g. a
+    // descriptor set) can tell whether it might need updating
+    uint64 GetEpoch() const { return m_epoch.load(std::memory_order_acquire); }
+
+    void MarkUsed(Entry& entry) const { entry.lastUsedFrame.store(GetCurrentFrame(), std::memory_order_relaxed); }
+
+    // Keeps the texture from being evicted until the use is released. Taken before the texture is made resident, so
+    // that it can't be evicted again in between.
+    [[nodiscard]] Use AddUse(std::shared_ptr<Entry> entry);
+
+    // Calls evict on resident textures, least recently used first, until it has freed at least the given number of
+    // bytes. Textures used in the last framesInFlight frames are never evicted, as the GPU might still be using them,
+    // and neither are textures with uses, as work on other threads might still be reading them.
+    // evict returns false if it couldn't evict the texture (e.g. because it has been destroyed). Returns the number of
+    // bytes freed.
+    uint64 Evict(uint64 bytesToFree, const std::function<bool(Entry&)>& evict);
+
+    // Calls reload if the texture has been evicted. Returns whether it did.
+    bool MakeResident(Entry& entry, const std::function<void(Entry&)>& reload);
+
+    uint64 GetResidentSize();
+
+private:
+    uint32 m_framesInFlight;
+    std::atomic<uint64> m_currentFrame = 0;
+    std::atomic<uint64> m_epoch = 0;
+
+    std::mutex m_mutex;
+    std::vector<std::weak_ptr<Entry>> m_entries;
+};
+
+} // namespace Teide
@@ -0,0 +1,70 @@
+
+#include "UniformAllocator.h"
+
+#include "Vulkan.h"
+
+#include "Teide/Assert.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+namespace Teide
+{
+
+UniformAllocator::UniformAllocator(
+    vk::Device device, vma::Allocator allocator, MemoryCounter& memoryCounter, vk::DeviceSize alignment,
+    vk::DeviceSize blockSize) :
+    m_device{device},
+    m_allocator{allocator},
+    m_memoryCounter{memoryCounter},
+    m_alignment{std::max<vk::DeviceSize>(alignment, 1)},
+    m_blockSize{blockSize}
+{}
+
+auto UniformAllocator::Allocate(vk::DeviceSize size, BytesView data) -> Allocation
+{
+    TEIDE_ASSERT(data.size() <= size);
+
+    vk::DeviceSize offset = (m_offset + m_alignment - 1) / m_alignment * m_alignment;
+    while (m_currentBlock < m_blocks.size() && offset + size > m_blocks[m_currentBlock].size)
+    {
+        m_currentBlock++;
+        offset = 0;
+    }
+    if (m_currentBlock == m_blocks.size())
+    {
+        // Data that is bigger than a block gets a block of its own
+        AddBlock(std::max(size, m_blockSize));
+    }
+
+    auto& block = m_blocks[m_currentBlock];
+    const auto range = block.mappedData.subspan(offset, size);
+    const auto end = std::ranges::copy(data, range.begin()).out;
+    std::fill(end, range.end(), byte{});
+    m_allocator.flushAllocation(block.allocation.get(), offset, size);
+
+    m_offset = offset + size;
+    return {.buffer = block.buffer.get(), .offset = static_cast<uint32>(offset)};
+}
+
+void UniformAllocator::Reset()
+{
+    m_currentBlock = 0;
+    m_offset = 0;
+}
+
+VulkanBufferData& UniformAllocator::AddBlock(vk::DeviceSize size)
+{
+    spdlog::debug("Adding uniform block {} of size {}", m_blocks.size(), size);
+
+    auto& block = m_blocks.emplace_back(CreateBufferUninitialized(
+        size, vk::BufferUsageFlagBits::eUniformBuffer,
+        vma::AllocationCreateFlagBits::eMapped | vma::AllocationCreateFlagBits::eHostAccessSequentialWrite,
+        vma::MemoryUsage::eAuto, m_device, m_allocator));
+    block.memory = m_memoryCounter.Add(size);
+    SetDebugName(block.buffer, "UniformBlock{}", m_blocks.size() - 1);
+    return block;
+}
+
+} // namespace Teide
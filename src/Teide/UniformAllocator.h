@@ -0,0 +1,55 @@
+
+#pragma once
+
+#include "VulkanBuffer.h"
+
+#include "Teide/BasicTypes.h"
+#include "Teide/Util/MemoryCounter.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+
+namespace Teide
+{
+
+// Suballocates uniform data that only lives for a frame from persistently mapped buffers ("blocks"), one after another.
+// The blocks are kept when the allocator is reset, so that once it has grown to fit a frame, nothing is created, and
+// descriptor sets that refer to the blocks can be reused from frame to frame. Not thread safe.
+class UniformAllocator
+{
+public:
+    static constexpr vk::DeviceSize DefaultBlockSize = 256 * 1024;
+
+    // Where some uniform data was written. The offset is 32 bits, as it is used as a dynamic offset.
+    struct Allocation
+    {
+        vk::Buffer buffer;
+        uint32 offset = 0;
+    };
+
+    UniformAllocator(
+        vk::Device device, vma::Allocator allocator, MemoryCounter& memoryCounter, vk::DeviceSize alignment,
+        vk::DeviceSize blockSize = DefaultBlockSize);
+
+    // Writes the data to the start of a new range of the given size. The rest of the range is filled with zeros.
+    Allocation Allocate(vk::DeviceSize size, BytesView data);
+
+    // Must only be called once the GPU has finished with everything allocated since the last reset
+    void Reset();
+
+private:
+    VulkanBufferData& AddBlock(vk::DeviceSize size);
+
+    vk::Device m_device;
+    vma::Allocator m_allocator;
+    MemoryCounter& m_memoryCounter; // Counts the blocks
+    vk::DeviceSize m_alignment;
+    vk::DeviceSize m_blockSize;
+
+    std::vector<VulkanBufferData> m_blocks;
+    usize m_currentBlock = 0;
+    vk::DeviceSize m_offset = 0; // Next free byte in the current block
+};
+
+} // namespace Teide
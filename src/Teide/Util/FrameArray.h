@@ -1,21 +1,42 @@
-
 #pragma once
 
+#include "Teide/Assert.h"
 #include "Teide/BasicTypes.h"
 
+#include <atomic>
+#include <memory>
+
 namespace Teide
 {
 
-template <class T, usize N>
+// A ring of per-frame resources, with the number of frames chosen at runtime (see GraphicsSettings::framesInFlight).
+// Each element is constructed with the given arguments followed by its index in the ring.
+template <class T>
 class FrameArray
 {
 public:
     template <class... Args>
-    explicit FrameArray(Args&&... args) // NOLINT(cppcoreguidelines-pro-type-member-init, cppcoreguidelines-missing-std-forward)
+    // NOLINTNEXTLINE(cppcoreguidelines-missing-std-forward)
+    explicit FrameArray(uint32 numFrames, Args&&... args) :
+        m_numFrames{numFrames}, m_storage{std::allocator<T>().allocate(numFrames)}
     {
-        for (uint32 i = 0; i < N; i++)
+        TEIDE_ASSERT(numFrames > 0);
+
+        // The elements usually aren't movable (they hold mutexes and pools), so they are constructed in place, and if
+        // one throws, the ones before it have to be cleaned up here, as the destructor won't run
+        uint32 numConstructed = 0;
+        try
+        {
+            for (; numConstructed < m_numFrames; numConstructed++)
+            {
+                std::construct_at(m_storage + numConstructed, args..., numConstructed);
+            }
+        }
+        catch (...)
         {
-            new (m_storage + i * sizeof(T)) T(args..., i);
+            std::destroy_n(m_storage, numConstructed);
+            std::allocator<T>().deallocate(m_storage, m_numFrames);
+            throw;
         }
     }
 
@@ -26,23 +47,28 @@ public:
 
     ~FrameArray()
     {
-        for (usize i = 0; i < N; i++)
-        {
-            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-            reinterpret_cast<T*>(m_storage + i * sizeof(T))->~T();
-        }
+        std::destroy_n(m_storage, m_numFrames);
+        std::allocator<T>().deallocate(m_storage, m_numFrames);
     }
 
-    void NextFrame() { m_frameNumber = (m_frameNumber + 1) % N; }
+    uint32 Size() const { return m_numFrames; }
+
+    void NextFrame() { m_frameNumber.store((GetFrameNumber() + 1) % m_numFrames); }
 
-    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-    T& Current() { return *reinterpret_cast<T*>(m_storage + m_frameNumber * sizeof(T)); }
-    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-    const T& Current() const { return *reinterpret_cast<const T*>(m_storage + m_frameNumber * sizeof(T)); }
+    T& Current() { return m_storage[GetFrameNumber()]; }
+    const T& Current() const { return m_storage[GetFrameNumber()]; }
+
+    // The frame that NextFrame will move on to, so that it can be prepared before anything else can use it
+    T& Next() { return m_storage[(GetFrameNumber() + 1) % m_numFrames]; }
 
 private:
-    alignas(T[N]) std::byte m_storage[sizeof(T) * N];
-    uint32_t m_frameNumber = 0;
+    uint32 GetFrameNumber() const { return m_frameNumber.load(); }
+
+    uint32 m_numFrames;
+    T* m_storage;
+    // Atomic so that worker threads can read it without a lock, and sequentially consistent so that users can order it
+    // with their own atomics (e.g. GpuExecutor's slots)
+    std::atomic<uint32> m_frameNumber = 0;
 };
 
 } // namespace Teide
@@ -0,0 +1,94 @@
+
+#pragma once
+
+#include "Teide/Assert.h"
+#include "Teide/BasicTypes.h"
+
+#include <iterator>
+#include <map>
+#include <optional>
+
+namespace Teide
+{
+
+// Allocates ranges of a fixed-size block of memory (e.g. a buffer), without touching the memory itself. Free ranges are
+// kept in offset order, so that a range can be merged with its neighbours when it is freed. Not thread safe.
+class FreeListAllocator
+{
+public:
+    explicit FreeListAllocator(uint64 size) : m_size{size}, m_freeSpace{size}
+    {
+        if (size > 0)
+        {
+            m_freeRanges.emplace(0, size);
+        }
+    }
+
+    // Returns the offset of the first range that fits, or nullopt if there isn't one. The alignment doesn't have to be
+    // a power of two (e.g. vertex strides).
+    std::optional<uint64> Allocate(uint64 size, uint64 alignment = 1)
+    {
+        TEIDE_ASSERT(size > 0 && alignment > 0);
+
+        for (auto it = m_freeRanges.begin(); it != m_freeRanges.end(); ++it)
+        {
+            const auto [rangeOffset, rangeSize] = *it;
+            const uint64 offset = (rangeOffset + alignment - 1) / alignment * alignment;
+            const uint64 rangeEnd = rangeOffset + rangeSize;
+            if (offset + size > rangeEnd)
+            {
+                continue;
+            }
+
+            // Whatever is left either side of the allocation stays free
+            m_freeRanges.erase(it);
+            if (offset > rangeOffset)
+            {
+                m_freeRanges.emplace(rangeOffset, offset - rangeOffset);
+            }
+            if (offset + size < rangeEnd)
+            {
+                m_freeRanges.emplace(offset + size, rangeEnd - offset - size);
+            }
+
+            m_freeSpace -= size;
+            return offset;
+        }
+
+        return std::nullopt;
+    }
+
+    void Free(uint64 offset, uint64 size)
+    {
+        TEIDE_ASSERT(offset + size <= m_size);
+
+        auto [it, inserted] = m_freeRanges.emplace(offset, size);
+        TEIDE_ASSERT(inserted, "Range at {} freed twice", offset);
+        m_freeSpace += size;
+
+        if (const auto next = std::next(it); next != m_freeRanges.end() && offset + size == next->first)
+        {
+            it->second += next->second;
+            m_freeRanges.erase(next);
+        }
+        if (it != m_freeRanges.begin())
+        {
+            if (const auto prev = std::prev(it); prev->first + prev->second == offset)
+            {
+                prev->second += it->second;
+                m_freeRanges.erase(it);
+            }
+        }
+    }
+
+    uint64 GetSize() const { return m_size; }
+    uint64 GetFreeSpace() const { return m_freeSpace; }
+    bool IsEmpty() const { return m_freeSpace == m_size; }
+
+private:
+    uint64 m_size;
+    uint64 m_freeSpace;
+    std::map<uint64, uint64> m_freeRanges; // offset -> size
+};
+
+} // namespace Teide
@@ -0,0 +1,91 @@
+
+#pragma once
+
+#include "Teide/BasicTypes.h"
+
+#include <atomic>
+#include <utility>
+
+namespace Teide
+{
+
+// Counts how many bytes of some kind of memory are allocated, in how many allocations, and the most bytes that have
+// been allocated at once. Allocations are counted for as long as the handle returned by Add lives. Thread safe.
+class MemoryCounter
+{
+public:
+    class Allocation
+    {
+    public:
+        Allocation() = default;
+        ~Allocation() { Release(); }
+
+        Allocation(const Allocation&) = delete;
+        Allocation(Allocation&& other) noexcept :
+            m_counter{std::exchange(other.m_counter, nullptr)}, m_size{std::exchange(other.m_size, 0)}
+        {}
+        Allocation& operator=(const Allocation&) = delete;
+        Allocation& operator=(Allocation&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Release();
+                m_counter = std::exchange(other.m_counter, nullptr);
+                m_size = std::exchange(other.m_size, 0);
+            }
+            return *this;
+        }
+
+        uint64 GetSize() const { return m_size; }
+
+    private:
+        friend class MemoryCounter;
+
+        Allocation(MemoryCounter& counter, uint64 size) : m_counter{&counter}, m_size{size} {}
+
+        void Release()
+        {
+            if (m_counter)
+            {
+                m_counter->Remove(m_size);
+                m_counter = nullptr;
+            }
+        }
+
+        MemoryCounter* m_counter = nullptr;
+        uint64 m_size = 0;
+    };
+
+    MemoryCounter() = default;
+    MemoryCounter(const MemoryCounter&) = delete;
+    MemoryCounter& operator=(const MemoryCounter&) = delete;
+
+    [[nodiscard]] Allocation Add(uint64 size)
+    {
+        const uint64 bytes = m_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+        m_count.fetch_add(1, std::memory_order_relaxed);
+
+        uint64 peak = m_peakBytes.load(std::memory_order_relaxed);
+        while (bytes > peak && !m_peakBytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed))
+        {}
+
+        return Allocation(*this, size);
+    }
+
+    uint64 GetBytes() const { return m_bytes.load(std::memory_order_relaxed); }
+    uint64 GetCount() const { return m_count.load(std::memory_order_relaxed); }
+    uint64 GetPeakBytes() const { return m_peakBytes.load(std::memory_order_relaxed); }
+
+private:
+    void Remove(uint64 size)
+    {
+        m_bytes.fetch_sub(size, std::memory_order_relaxed);
+        m_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64> m_bytes = 0;
+    std::atomic<uint64> m_count = 0;
+    std::atomic<uint64> m_peakBytes = 0;
+};
+
+} // namespace Teide
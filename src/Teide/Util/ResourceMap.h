@@ -1,94 +1,197 @@
 
 #pragma once
 
+#include "Teide/Assert.h"
 #include "Teide/BasicTypes.h"
 #include "Teide/Handle.h"
-#include "Teide/Util/ThreadUtils.h"
+#include "Teide/Util/SegmentedArray.h"
 
 #include <spdlog/spdlog.h>
 
-#include <deque>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 namespace Teide
 {
 
+struct ResourceMapStatistics
+{
+    uint32 liveSlots = 0;  // Number of slots holding a resource
+    uint32 totalSlots = 0; // Number of slots allocated, including free ones waiting to be reused
+};
+
+// Handles are made of a slot index in the low 32 bits, and the slot's generation in the high 32 bits. A slot's
+// generation is incremented whenever its resource is destroyed, so the slot can be reused without handles (or indices
+// kept from them) to the old resource being mistaken for handles to the new one.
+//
+// Slots never move once allocated and their reference counts are atomic, so copying handles and looking up resources
+// don't need a lock. The mutex is only taken to create and destroy resources.
+//
+// When the last handle to a resource is released, the resource is passed to the destroy function (if there is one),
+// which can keep it alive for longer, e.g. until the GPU has finished using it. Its slot is free to be reused straight
+// away.
 template <class HandleT, class ResourceT>
 class ResourceMap : public RefCounter
 {
 public:
-    explicit ResourceMap(std::string_view resourceType) : m_impl(Impl(resourceType)) {}
+    using DestroyFunction = std::function<void(ResourceT&&)>;
+
+    explicit ResourceMap(std::string_view resourceType, DestroyFunction destroy = nullptr) :
+        m_resourceType{resourceType}, m_destroy{std::move(destroy)}
+    {}
 
     HandleT Insert(ResourceT resource)
     {
-        const auto& [index, slot] = m_impl.Lock(&Impl::Insert, std::move(resource));
-        if constexpr (HasProperties<HandleT>)
+        const auto lock = std::scoped_lock(m_mutex);
+
+        uint32 slotIndex = 0;
+        if (m_freeSlots.empty())
         {
-            return HandleT(index, *this, slot.resource.properties);
+            slotIndex = m_numSlots;
+            m_slots.GetOrAllocate(slotIndex);
+            m_numSlots++;
         }
         else
         {
-            return HandleT(index, *this);
+            slotIndex = m_freeSlots.back();
+            m_freeSlots.pop_back();
         }
-    }
 
-    ResourceT& Get(const HandleT& handle) { return m_impl.Lock(&Impl::Get, handle); }
+        auto& slot = *m_slots.TryGet(slotIndex);
+        const auto generation = slot.generation.load(std::memory_order_relaxed);
+        spdlog::debug("Creating {} {} (generation {})", m_resourceType, slotIndex, generation);
+        slot.resource = std::move(resource);
+        slot.refCount.store(1, std::memory_order_release);
 
-    void AddRef(uint64 index) noexcept override { m_impl.Lock(&Impl::AddRef, index); }
+        return MakeHandle(MakeHandleIndex(slotIndex, generation), slot);
+    }
 
-    void DecRef(uint64 index) noexcept override { m_impl.Lock(&Impl::DecRef, index); }
+    ResourceT& Get(const HandleT& handle) { return GetSlot(static_cast<uint64>(handle)).resource; }
 
-private:
-    struct Slot
+    // Returns a new handle from an index kept from an earlier one (like std::weak_ptr::lock), or nullopt if the
+    // resource has been destroyed since
+    std::optional<HandleT> Lock(uint64 index)
     {
-        uint32 refCount = 1;
-        ResourceT resource;
-    };
+        Slot* const slot = m_slots.TryGet(GetSlotIndex(index));
+        if (!slot)
+        {
+            return std::nullopt;
+        }
 
-    class Impl
-    {
-    public:
-        explicit Impl(std::string_view resourceType) : m_resourceType{resourceType} {}
+        // A reference can only be added while the slot holds a resource, so it can't be destroyed in the meantime
+        uint32 refCount = slot->refCount.load(std::memory_order_relaxed);
+        do
+        {
+            if (refCount == 0)
+            {
+                return std::nullopt;
+            }
+        } while (!slot->refCount.compare_exchange_weak(
+            refCount, refCount + 1, std::memory_order_acquire, std::memory_order_relaxed));
 
-        std::pair<uint64, const Slot&> Insert(ResourceT resource)
+        // ...but it might be a newer resource that has reused the slot
+        const auto generation = slot->generation.load(std::memory_order_relaxed);
+        if (generation != GetGeneration(index))
         {
-            const auto index = static_cast<uint64>(m_list.size());
-            spdlog::debug("Creating {} {}", m_resourceType, index);
-            const auto& slot = m_list.emplace_back(Slot{.resource = std::move(resource)});
-            return {index, slot};
+            DecRef(MakeHandleIndex(GetSlotIndex(index), generation));
+            return std::nullopt;
         }
 
-        ResourceT& Get(const HandleT& handle)
+        return MakeHandle(index, *slot);
+    }
+
+    void AddRef(uint64 index) noexcept override
+    {
+        // The caller already holds a reference, so the slot can't be destroyed underneath it
+        GetSlot(index).refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void DecRef(uint64 index) noexcept override
+    {
+        auto& slot = GetSlot(index);
+        if (slot.refCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
         {
-            const auto index = static_cast<uint64>(handle);
-            return m_list.at(index).resource;
+            return;
         }
 
-        void AddRef(uint64 index) noexcept
+        // That was the last reference, so no other thread can be using the slot until it is put on the free list
+        auto resource = std::exchange(slot.resource, {});
         {
-            auto& resource = m_list[index];
-            ++resource.refCount;
+            const auto lock = std::scoped_lock(m_mutex);
+            const auto slotIndex = GetSlotIndex(index);
+            spdlog::debug("Destroying {} {} (generation {})", m_resourceType, slotIndex, GetGeneration(index));
+            slot.generation.fetch_add(1, std::memory_order_relaxed);
+            m_freeSlots.push_back(slotIndex);
         }
 
-        void DecRef(uint64 index) noexcept
+        // Destroying a resource can release handles to other resources, so it is done without holding the lock
+        if (m_destroy)
         {
-            auto& resource = m_list[index];
-            --resource.refCount;
-            if (resource.refCount == 0)
-            {
-                // Add resource to unused pool
-                spdlog::debug("Destroying {} {}", m_resourceType, index);
-                resource = {};
-            }
+            m_destroy(std::move(resource));
         }
+    }
+
+    ResourceMapStatistics GetStatistics()
+    {
+        const auto lock = std::scoped_lock(m_mutex);
+        return {
+            .liveSlots = m_numSlots - static_cast<uint32>(m_freeSlots.size()),
+            .totalSlots = m_numSlots,
+        };
+    }
 
-    private:
-        std::string m_resourceType;
-        std::deque<Slot> m_list;
+private:
+    struct Slot
+    {
+        std::atomic<uint32> refCount = 0;
+        std::atomic<uint32> generation = 0;
+        ResourceT resource;
     };
 
-    Synchronized<Impl> m_impl;
+    HandleT MakeHandle(uint64 index, Slot& slot)
+    {
+        if constexpr (HasProperties<HandleT>)
+        {
+            return HandleT(index, *this, slot.resource.properties);
+        }
+        else
+        {
+            return HandleT(index, *this);
+        }
+    }
+
+    static uint64 MakeHandleIndex(uint32 slotIndex, uint32 generation)
+    {
+        return (static_cast<uint64>(generation) << 32) | slotIndex;
+    }
+
+    static uint32 GetSlotIndex(uint64 index) { return static_cast<uint32>(index); }
+    static uint32 GetGeneration(uint64 index) { return static_cast<uint32>(index >> 32); }
+
+    Slot& GetSlot(uint64 index)
+    {
+        Slot* const slot = m_slots.TryGet(GetSlotIndex(index));
+        TEIDE_ASSERT(slot, "Invalid {} handle {}", m_resourceType, GetSlotIndex(index));
+        TEIDE_ASSERT(
+            slot->generation.load(std::memory_order_relaxed) == GetGeneration(index)
+                && slot->refCount.load(std::memory_order_relaxed) > 0,
+            "Stale {} handle {}", m_resourceType, GetSlotIndex(index));
+        return *slot;
+    }
+
+    std::string m_resourceType;
+    DestroyFunction m_destroy;
+    SegmentedArray<Slot> m_slots;
+
+    std::mutex m_mutex; // Guards creating and destroying resources
+    uint32 m_numSlots = 0;
+    std::vector<uint32> m_freeSlots;
 };
 
 } // namespace Teide
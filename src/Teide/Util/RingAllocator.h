@@ -0,0 +1,97 @@
+
+#pragma once
+
+#include "Teide/Assert.h"
+#include "Teide/BasicTypes.h"
+
+#include <algorithm>
+#include <deque>
+#include <optional>
+
+namespace Teide
+{
+
+// Allocates ranges of a fixed-size block of memory (e.g. a buffer) one after another, wrapping around to the start when
+// it reaches the end. Ranges can be freed in any order, but space is only reused once every range allocated before it
+// has been freed, which suits memory that is released as the GPU retires work in submission order. Not thread safe.
+class RingAllocator
+{
+public:
+    explicit RingAllocator(uint64 size) : m_size{size} {}
+
+    // Returns the offset of the new range, or nullopt if there isn't enough space until earlier ranges are freed
+    std::optional<uint64> Allocate(uint64 size, uint64 alignment = 1)
+    {
+        TEIDE_ASSERT(size > 0 && alignment > 0);
+
+        if (m_size == 0)
+        {
+            return std::nullopt;
+        }
+
+        // Positions count up forever, so that the used space is always [m_tail, m_head)
+        const uint64 headOffset = m_head % m_size;
+        uint64 offset = (headOffset + alignment - 1) / alignment * alignment;
+        uint64 begin = m_head + (offset - headOffset);
+        if (offset + size > m_size)
+        {
+            // Doesn't fit before the end, so skip the rest of the block. The gap is reused along with this range.
+            offset = 0;
+            begin = m_head + (m_size - headOffset);
+        }
+
+        const uint64 end = begin + size;
+        if (end - m_tail > m_size)
+        {
+            return std::nullopt;
+        }
+
+        m_ranges.push_back({.begin = begin, .end = end});
+        m_head = end;
+        return offset;
+    }
+
+    void Free(uint64 offset)
+    {
+        // Live ranges are all within one lap of the tail
+        uint64 position = m_tail - m_tail % m_size + offset;
+        if (position < m_tail)
+        {
+            position += m_size;
+        }
+
+        const auto it = std::ranges::lower_bound(m_ranges, position, {}, &Range::begin);
+        TEIDE_ASSERT(it != m_ranges.end() && it->begin == position, "No range allocated at {}", offset);
+        TEIDE_ASSERT(!it->freed, "Range at {} freed twice", offset);
+        it->freed = true;
+
+        while (!m_ranges.empty() && m_ranges.front().freed)
+        {
+            m_tail = m_ranges.front().end;
+            m_ranges.pop_front();
+        }
+        if (m_ranges.empty())
+        {
+            m_tail = m_head;
+        }
+    }
+
+    uint64 GetSize() const { return m_size; }
+    uint64 GetUsedSpace() const { return m_head - m_tail; }
+    bool IsEmpty() const { return m_ranges.empty(); }
+
+private:
+    struct Range
+    {
+        uint64 begin;
+        uint64 end;
+        bool freed = false;
+    };
+
+    uint64 m_size;
+    uint64 m_head = 0; // Position of the end of the newest range
+    uint64 m_tail = 0; // Position up to which everything has been freed
+    std::deque<Range> m_ranges;
+};
+
+} // namespace Teide
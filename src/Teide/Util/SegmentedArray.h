@@ -0,0 +1,103 @@
+
+#pragma once
+
+#include "Teide/BasicTypes.h"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <span>
+#include <stdexcept>
+
+namespace Teide
+{
+
+// An array that grows in segments that double in size, so that elements never move once allocated. Elements can be
+// looked up without a lock while another thread grows the array, but growing must be serialised by the caller.
+template <class T>
+class SegmentedArray
+{
+public:
+    SegmentedArray() = default;
+
+    ~SegmentedArray()
+    {
+        for (auto& segment : m_segments)
+        {
+            delete[] segment.load(std::memory_order_relaxed);
+        }
+    }
+
+    SegmentedArray(const SegmentedArray&) = delete;
+    SegmentedArray(SegmentedArray&&) = delete;
+    SegmentedArray& operator=(const SegmentedArray&) = delete;
+    SegmentedArray& operator=(SegmentedArray&&) = delete;
+
+    // Returns null if the element's segment hasn't been allocated
+    T* TryGet(usize index) const
+    {
+        const usize segmentIndex = GetSegmentIndex(index);
+        if (segmentIndex >= NumSegments)
+        {
+            return nullptr;
+        }
+
+        T* const segment = m_segments[segmentIndex].load(std::memory_order_acquire);
+        return segment ? &segment[index - GetSegmentStart(segmentIndex)] : nullptr;
+    }
+
+    // Allocates the element's segment (and any before it) if needed. New elements are default constructed.
+    T& GetOrAllocate(usize index)
+    {
+        const usize segmentIndex = GetSegmentIndex(index);
+        if (segmentIndex >= NumSegments)
+        {
+            throw std::length_error("Exceeded capacity of SegmentedArray");
+        }
+
+        // Segments are allocated in order, so that ForEach can stop at the first missing one
+        for (usize i = 0; i <= segmentIndex; i++)
+        {
+            if (!m_segments[i].load(std::memory_order_relaxed))
+            {
+                m_segments[i].store(new T[GetSegmentSize(i)], std::memory_order_release);
+            }
+        }
+
+        return m_segments[segmentIndex].load(std::memory_order_relaxed)[index - GetSegmentStart(segmentIndex)];
+    }
+
+    // Calls f on every allocated element. Must not be called while another thread is growing the array.
+    template <class F>
+    void ForEach(const F& f)
+    {
+        for (usize segmentIndex = 0; segmentIndex < NumSegments; segmentIndex++)
+        {
+            T* const segment = m_segments[segmentIndex].load(std::memory_order_relaxed);
+            if (!segment)
+            {
+                break;
+            }
+
+            for (T& element : std::span(segment, GetSegmentSize(segmentIndex)))
+            {
+                f(element);
+            }
+        }
+    }
+
+private:
+    static constexpr usize FirstSegmentSize = 8;
+    static constexpr usize NumSegments = 24;
+
+    static constexpr usize GetSegmentIndex(usize index) { return std::bit_width(index / FirstSegmentSize + 1) - 1; }
+    static constexpr usize GetSegmentStart(usize segmentIndex)
+    {
+        return FirstSegmentSize * ((usize{1} << segmentIndex) - 1);
+    }
+    static constexpr usize GetSegmentSize(usize segmentIndex) { return FirstSegmentSize << segmentIndex; }
+
+    std::array<std::atomic<T*>, NumSegments> m_segments = {};
+};
+
+} // namespace Teide
@@ -1,6 +1,71 @@
 
 #include "Teide/Util/ThreadUtils.h"
 
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+namespace Teide
+{
+
+namespace
+{
+    class ThreadIndexAllocator
+    {
+    public:
+        uint32 Acquire()
+        {
+            const auto lock = std::scoped_lock(m_mutex);
+            if (m_freeIndices.empty())
+            {
+                return m_numIndices++;
+            }
+
+            // Reuse the lowest free index, to keep the indices dense
+            const uint32 index = m_freeIndices.top();
+            m_freeIndices.pop();
+            return index;
+        }
+
+        void Release(uint32 index)
+        {
+            const auto lock = std::scoped_lock(m_mutex);
+            m_freeIndices.push(index);
+        }
+
+    private:
+        std::mutex m_mutex;
+        uint32 m_numIndices = 0;
+        std::priority_queue<uint32, std::vector<uint32>, std::greater<>> m_freeIndices;
+    };
+
+    ThreadIndexAllocator s_threadIndexAllocator;
+
+    // Gives the index back when the thread exits. Thread-local objects are destroyed before static ones, so the
+    // allocator is still alive, even for the main thread.
+    struct ThreadIndex
+    {
+        uint32 value = s_threadIndexAllocator.Acquire();
+
+        ThreadIndex() = default;
+        ~ThreadIndex() { s_threadIndexAllocator.Release(value); }
+
+        ThreadIndex(const ThreadIndex&) = delete;
+        ThreadIndex(ThreadIndex&&) = delete;
+        ThreadIndex& operator=(const ThreadIndex&) = delete;
+        ThreadIndex& operator=(ThreadIndex&&) = delete;
+    };
+} // namespace
+
+uint32 GetCurrentThreadIndex()
+{
+    thread_local const ThreadIndex index;
+    return index.value;
+}
+
+} // namespace Teide
+
 #if defined(NDEBUG)
 void Teide::SetCurrentTheadName(const std::string& name [[maybe_unused]])
 {}
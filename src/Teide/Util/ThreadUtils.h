@@ -2,14 +2,13 @@
 #pragma once
 
 #include "Teide/BasicTypes.h"
+#include "Teide/Util/SegmentedArray.h"
 
-#include <algorithm>
 #include <atomic>
 #include <functional>
 #include <mutex>
-#include <span>
+#include <optional>
 #include <string>
-#include <thread>
 #include <type_traits>
 
 namespace Teide
@@ -46,65 +45,84 @@ private:
     std::mutex m_mutex;
 };
 
+// Dense, process-wide index of the calling thread, for per-thread lookups. A thread is given an index the first time it
+// asks for one, and the index is reused by another thread once it has exited, so indices stay close to the number of
+// live threads.
+uint32 GetCurrentThreadIndex();
+
+// One object per thread, looked up by GetCurrentThreadIndex. Each thread's object is created the first time the thread
+// uses the map, so worker threads and application threads that call into the renderer are treated alike.
+// Only creating objects takes a lock. A thread uses its own object without one, so the map gives no mutual exclusion:
+// ForEach must only be called while no other thread can be using the map.
 template <class T>
 class ThreadMap
 {
 public:
-    explicit ThreadMap(uint32 threadCount)
+    ThreadMap()
         requires std::is_default_constructible_v<T>
-        : ThreadMap(threadCount, [] { return T(); })
+        : ThreadMap([] { return T(); })
     {}
 
-    explicit ThreadMap(uint32 threadCount, std::function<T()> initFunc) : m_initFunc{std::move(initFunc)}
-    {
-        m_entries.reserve(threadCount);
-        for (uint32 i = 0; i < threadCount; i++)
-        {
-            m_entries.emplace_back(std::this_thread::get_id(), m_initFunc());
-        }
-    }
+    explicit ThreadMap(std::function<T()> initFunc) : m_initFunc{std::move(initFunc)} {}
 
+    // Calls the callable with the calling thread's object, creating it if needed
     template <class F, class... Args>
-    decltype(auto) LockCurrent(const F& callable, Args&&... args)
+    decltype(auto) WithCurrent(const F& callable, Args&&... args)
     {
         auto& object = GetCurrentObject();
         return std::invoke(callable, object, std::forward<Args>(args)...);
     }
 
+    // Calls the callable with every thread's object. This only excludes threads that are creating their objects, not
+    // ones that are using them, so the caller must make sure that nothing can be using the objects meanwhile (e.g. by
+    // only calling it on a frame's resources before the frame becomes current).
     template <class F, class... Args>
-    void LockAll(const F& callable, const Args&... args)
+    void ForEach(const F& callable, const Args&... args)
     {
-        for (Entry& entry : m_entries)
-        {
-            std::invoke(callable, entry.second, args...);
-        }
+        const auto lock = std::scoped_lock(m_mutex);
+        m_slots.ForEach([&](Slot& slot) {
+            if (slot.object)
+            {
+                std::invoke(callable, *slot.object, args...);
+            }
+        });
+    }
+
+    // The number of threads that have used the map, including any that have since exited
+    usize Size()
+    {
+        const auto lock = std::scoped_lock(m_mutex);
+        usize size = 0;
+        m_slots.ForEach([&size](const Slot& slot) { size += slot.object ? 1 : 0; });
+        return size;
     }
 
 private:
-    using Entry = std::pair<std::thread::id, T>;
+    struct Slot
+    {
+        std::atomic<bool> created = false;
+        std::optional<T> object;
+    };
 
     T& GetCurrentObject()
     {
-        const auto usedEntries = std::span(m_entries).subspan(0, std::min(m_size.load(), m_entries.size()));
-        const auto it = std::ranges::find(usedEntries, std::this_thread::get_id(), &Entry::first);
-        if (it != usedEntries.end())
-        {
-            return it->second;
-        }
+        const usize index = GetCurrentThreadIndex();
 
-        const auto index = m_size.fetch_add(1);
-        if (index >= m_entries.size())
+        // Only the calling thread uses its slot, so once the object has been created it can be used without a lock
+        if (Slot* const slot = m_slots.TryGet(index); slot && slot->created.load(std::memory_order_acquire))
         {
-            --m_size;
-            throw std::length_error("Exceeded capacity of ThreadMap");
+            return *slot->object;
         }
 
-        m_entries[index].first = std::this_thread::get_id();
-        return m_entries[index].second;
+        const auto lock = std::scoped_lock(m_mutex);
+        Slot& slot = m_slots.GetOrAllocate(index);
+        slot.object.emplace(m_initFunc());
+        slot.created.store(true, std::memory_order_release);
+        return *slot.object;
     }
 
-    std::atomic<usize> m_size = 0;
-    std::vector<Entry> m_entries;
+    std::mutex m_mutex;
+    SegmentedArray<Slot> m_slots;
     std::function<T()> m_initFunc;
 };
 
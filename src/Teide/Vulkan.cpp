@@ -174,6 +174,7 @@ namespace
                 return Access::eDepthStencilAttachmentRead | Access::eDepthStencilAttachmentWrite;
 
             case eShaderReadOnlyOptimal: return Access::eShaderRead;
+            case eGeneral: return Access::eShaderRead | Access::eShaderWrite;
             case eTransferSrcOptimal: return Access::eTransferRead;
             case eDepthStencilReadOnlyOptimal: return Access::eShaderRead;
             case ePresentSrcKHR: return Access::eNoneKHR;
@@ -245,9 +246,12 @@ vk::DebugUtilsMessengerCreateInfoEXT GetDebugCreateInfo()
     };
 }
 
-vma::UniqueAllocator CreateAllocator(VulkanLoader& loader, vk::Instance instance, vk::Device device, vk::PhysicalDevice physicalDevice)
+vma::UniqueAllocator CreateAllocator(
+    VulkanLoader& loader, vk::Instance instance, vk::Device device, vk::PhysicalDevice physicalDevice,
+    vma::AllocatorCreateFlags flags)
 {
     return vma::createAllocatorUnique({
+        .flags = flags,
         .physicalDevice = physicalDevice,
         .device = device,
         .pAllocationCallbacks = s_allocator,
@@ -257,13 +261,12 @@ vma::UniqueAllocator CreateAllocator(VulkanLoader& loader, vk::Instance instance
     });
 }
 
-void TransitionImageLayout(
-    vk::CommandBuffer cmdBuffer, vk::Image image, Format format, uint32_t mipLevelCount, vk::ImageLayout oldLayout,
-    vk::ImageLayout newLayout, vk::PipelineStageFlags srcStageMask, vk::PipelineStageFlags dstStageMask)
+vk::ImageMemoryBarrier MakeImageTransitionBarrier(
+    vk::Image image, Format format, uint32_t mipLevelCount, vk::ImageLayout oldLayout, vk::ImageLayout newLayout)
 {
     const auto accessMasks = GetTransitionAccessMasks(oldLayout, newLayout);
 
-    const vk::ImageMemoryBarrier barrier = {
+    return {
         .srcAccessMask = accessMasks.source,
         .dstAccessMask = accessMasks.destination,
         .oldLayout = oldLayout,
@@ -279,7 +282,13 @@ void TransitionImageLayout(
             .layerCount = 1,
         },
     };
+}
 
+void TransitionImageLayout(
+    vk::CommandBuffer cmdBuffer, vk::Image image, Format format, uint32_t mipLevelCount, vk::ImageLayout oldLayout,
+    vk::ImageLayout newLayout, vk::PipelineStageFlags srcStageMask, vk::PipelineStageFlags dstStageMask)
+{
+    const auto barrier = MakeImageTransitionBarrier(image, format, mipLevelCount, oldLayout, newLayout);
     cmdBuffer.pipelineBarrier(srcStageMask, dstStageMask, {}, {}, {}, barrier);
 }
 
@@ -311,11 +320,13 @@ vk::ImageAspectFlags GetImageAspect(Format format)
     return vk::ImageAspectFlagBits::eColor;
 }
 
-void CopyBufferToImage(vk::CommandBuffer cmdBuffer, vk::Buffer source, vk::Image destination, Format imageFormat, vk::Extent3D imageExtent)
+void CopyBufferToImage(
+    vk::CommandBuffer cmdBuffer, vk::Buffer source, vk::Image destination, Format imageFormat, vk::Extent3D imageExtent,
+    vk::DeviceSize sourceOffset)
 {
     const auto copyRegion = vk::BufferImageCopy
     {
-        .bufferOffset = 0,
+        .bufferOffset = sourceOffset,
         .bufferRowLength = 0,
         .bufferImageHeight = 0,
         .imageSubresource = {
@@ -43,6 +43,7 @@ struct QueueFamilies
 {
     uint32 graphicsFamily = 0;
     uint32 transferFamily = 0;
+    uint32 computeFamily = 0;
     std::optional<uint32> presentFamily;
 };
 
@@ -78,8 +79,9 @@ enum class FramebufferUsage : uint8
 
 vk::DebugUtilsMessengerCreateInfoEXT GetDebugCreateInfo();
 
-vma::UniqueAllocator
-CreateAllocator(VulkanLoader& loader, vk::Instance instance, vk::Device device, vk::PhysicalDevice physicalDevice);
+vma::UniqueAllocator CreateAllocator(
+    VulkanLoader& loader, vk::Instance instance, vk::Device device, vk::PhysicalDevice physicalDevice,
+    vma::AllocatorCreateFlags flags = {});
 
 template <class T>
 inline uint32_t size32(const T& cont)
@@ -87,10 +89,32 @@ inline uint32_t size32(const T& cont)
     return static_cast<uint32_t>(std::ranges::size(cont));
 }
 
+vk::ImageMemoryBarrier MakeImageTransitionBarrier(
+    vk::Image image, Format format, uint32_t mipLevelCount, vk::ImageLayout oldLayout, vk::ImageLayout newLayout);
 void TransitionImageLayout(
     vk::CommandBuffer cmdBuffer, vk::Image image, Format format, uint32_t mipLevelCount, vk::ImageLayout oldLayout,
     vk::ImageLayout newLayout, vk::PipelineStageFlags srcStageMask, vk::PipelineStageFlags dstStageMask);
 
+// Turn a barrier into one half of a queue family ownership transfer. The release half is recorded on the source queue
+// and the acquire half on the destination queue, and both halves must describe the same layout transition.
+template <class Barrier>
+Barrier MakeReleaseBarrier(Barrier barrier, uint32 srcQueueFamily, uint32 dstQueueFamily)
+{
+    barrier.dstAccessMask = {};
+    barrier.srcQueueFamilyIndex = srcQueueFamily;
+    barrier.dstQueueFamilyIndex = dstQueueFamily;
+    return barrier;
+}
+
+template <class Barrier>
+Barrier MakeAcquireBarrier(Barrier barrier, uint32 srcQueueFamily, uint32 dstQueueFamily)
+{
+    barrier.srcAccessMask = {};
+    barrier.srcQueueFamilyIndex = srcQueueFamily;
+    barrier.dstQueueFamilyIndex = dstQueueFamily;
+    return barrier;
+}
+
 vk::UniqueCommandPool CreateCommandPool(uint32_t queueFamilyIndex, vk::Device device, const char* debugName = "");
 
 template <class... Args>
@@ -170,7 +194,8 @@ private:
 vk::ImageAspectFlags GetImageAspect(Format format);
 
 void CopyBufferToImage(
-    vk::CommandBuffer cmdBuffer, vk::Buffer source, vk::Image destination, Format imageFormat, vk::Extent3D imageExtent);
+    vk::CommandBuffer cmdBuffer, vk::Buffer source, vk::Image destination, Format imageFormat, vk::Extent3D imageExtent,
+    vk::DeviceSize sourceOffset = 0);
 void CopyImageToBuffer(
     vk::CommandBuffer cmdBuffer, vk::Image source, vk::Buffer destination, Format imageFormat, vk::Extent3D imageExtent,
     uint32 numMipLevels);
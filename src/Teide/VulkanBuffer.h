@@ -4,6 +4,7 @@
 #include "Vulkan.h"
 
 #include "Teide/Buffer.h"
+#include "Teide/Util/MemoryCounter.h"
 #include "Teide/VulkanMemAlloc.h"
 
 namespace Teide
@@ -15,6 +16,7 @@ struct VulkanBufferData
     vk::UniqueBuffer buffer;
     vma::UniqueAllocation allocation;
     std::span<byte> mappedData;
+    MemoryCounter::Allocation memory;
 };
 
 struct VulkanBuffer : public Buffer, VulkanBufferData
@@ -29,9 +29,13 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <numeric>
+#include <memory>
 #include <optional>
 #include <ranges>
 #include <string>
+#include <string_view>
+#include <variant>
 
 namespace Teide
 {
@@ -101,16 +105,25 @@ namespace
             return std::nullopt;
         }
 
-        if (const auto index = FindQueueFamily(queueFamilies, [](uint32, const vk::QueueFamilyProperties& qf) {
-                return (qf.queueFlags & vk::QueueFlagBits::eTransfer) != vk::QueueFlagBits{};
-            }))
-        {
-            ret.transferFamily = *index;
-        }
-        else
-        {
-            return std::nullopt;
-        }
+        // Prefer a transfer-only family (usually backed by a DMA engine), then any other family that isn't the
+        // graphics one, so that transfers can run alongside rendering. Graphics families always support transfers.
+        const auto isTransferOnly = [](uint32, const vk::QueueFamilyProperties& qf) {
+            const auto otherWork = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute;
+            return (qf.queueFlags & vk::QueueFlagBits::eTransfer) && !(qf.queueFlags & otherWork);
+        };
+        const auto isSeparateTransfer = [&](uint32 i, const vk::QueueFamilyProperties& qf) {
+            return i != ret.graphicsFamily && (qf.queueFlags & vk::QueueFlagBits::eTransfer);
+        };
+        ret.transferFamily = FindQueueFamily(queueFamilies, isTransferOnly)
+                                 .or_else([&] { return FindQueueFamily(queueFamilies, isSeparateTransfer); })
+                                 .value_or(ret.graphicsFamily);
+
+        // Prefer a compute family without graphics, whose queue can run compute work asynchronously to rendering.
+        // Graphics families always support compute.
+        const auto isAsyncCompute = [](uint32, const vk::QueueFamilyProperties& qf) {
+            return (qf.queueFlags & vk::QueueFlagBits::eCompute) && !(qf.queueFlags & vk::QueueFlagBits::eGraphics);
+        };
+        ret.computeFamily = FindQueueFamily(queueFamilies, isAsyncCompute).value_or(ret.graphicsFamily);
 
         if (surface)
         {
@@ -227,13 +240,16 @@ namespace
 
     PhysicalDevice FindPhysicalDevice(
         vk::Instance instance, std::vector<DeviceExtensionName> requiredExtensions,
-        std::span<const DeviceExtensionName> optionalExtensions, vk::SurfaceKHR surface = {})
+        std::vector<DeviceExtensionName> optionalExtensions, vk::SurfaceKHR surface = {})
     {
         // Add essential extensions
         requiredExtensions.push_back("VK_EXT_descriptor_indexing");
         requiredExtensions.push_back("VK_KHR_depth_stencil_resolve");
         requiredExtensions.push_back("VK_KHR_create_renderpass2");
 
+        // Lets the allocator report how much device memory is available, for deciding when to evict textures
+        optionalExtensions.push_back("VK_EXT_memory_budget");
+
         const auto makePhysicalDevice = [&](vk::PhysicalDevice pd) -> std::optional<PhysicalDevice> {
             const auto [extensions, missingReq, missingOpt]
                 = GetDeviceExtensions(pd, requiredExtensions, optionalExtensions);
@@ -290,7 +306,8 @@ namespace
 
         auto ret = physicalDevices.front();
 
-        ret.queueFamilyIndices = {ret.queueFamilies.graphicsFamily, ret.queueFamilies.transferFamily};
+        ret.queueFamilyIndices = {
+            ret.queueFamilies.graphicsFamily, ret.queueFamilies.transferFamily, ret.queueFamilies.computeFamily};
         if (ret.queueFamilies.presentFamily)
         {
             ret.queueFamilyIndices.push_back(*ret.queueFamilies.presentFamily);
@@ -304,11 +321,178 @@ namespace
         return ret;
     }
 
-    void CopyBuffer(vk::CommandBuffer cmdBuffer, vk::Buffer source, vk::Buffer destination, vk::DeviceSize size)
+    MemoryCounter& GetBufferMemoryCounter(BufferUsage usage, VulkanDevice::MemoryCounters& memoryCounters)
+    {
+        using enum BufferUsage;
+        switch (usage)
+        {
+            case Vertex:
+            case Index: return memoryCounters.meshes;
+            case Uniform: return memoryCounters.uniformBuffers;
+            case Generic: return memoryCounters.buffers;
+        }
+        return memoryCounters.buffers;
+    }
+
+    MemoryCategoryStatistics GetMemoryCategoryStatistics(const MemoryCounter& memoryCounter)
+    {
+        return {
+            .bytes = memoryCounter.GetBytes(),
+            .allocationCount = memoryCounter.GetCount(),
+            .peakBytes = memoryCounter.GetPeakBytes(),
+        };
+    }
+
+    bool HasExtension(const PhysicalDevice& physicalDevice, std::string_view extension)
+    {
+        return std::ranges::contains(physicalDevice.extensions, extension, [](const char* name) {
+            return std::string_view(name);
+        });
+    }
+
+    bool UsesTransferQueue(const QueueFamilies& queueFamilies, const GraphicsSettings& settings)
+    {
+        return settings.useTransferQueue && queueFamilies.transferFamily != queueFamilies.graphicsFamily;
+    }
+
+    bool UsesComputeQueue(const QueueFamilies& queueFamilies, const GraphicsSettings& settings)
+    {
+        // Only one queue is created per family, and a queue can't be shared between executors, so if the transfer
+        // queue is already using the compute family then compute work stays on the graphics queue
+        const bool sharesTransferQueue
+            = UsesTransferQueue(queueFamilies, settings) && queueFamilies.computeFamily == queueFamilies.transferFamily;
+        return settings.useComputeQueue && queueFamilies.computeFamily != queueFamilies.graphicsFamily
+            && !sharesTransferQueue;
+    }
+
+    std::optional<Scheduler::AsyncQueue>
+    GetTransferQueue(vk::Device device, const QueueFamilies& queueFamilies, const GraphicsSettings& settings)
+    {
+        if (!UsesTransferQueue(queueFamilies, settings))
+        {
+            return std::nullopt;
+        }
+
+        return Scheduler::AsyncQueue{
+            .queue = device.getQueue(queueFamilies.transferFamily, 0),
+            .queueFamilyIndex = queueFamilies.transferFamily,
+        };
+    }
+
+    // The geometry heap is shared with the transfer queue (if it is used), which uploads meshes into it
+    std::vector<uint32>
+    GetGeometryHeapQueueFamilies(const QueueFamilies& queueFamilies, const GraphicsSettings& settings)
+    {
+        if (UsesTransferQueue(queueFamilies, settings))
+        {
+            return {queueFamilies.graphicsFamily, queueFamilies.transferFamily};
+        }
+        return {queueFamilies.graphicsFamily};
+    }
+
+    std::optional<Scheduler::AsyncQueue>
+    GetComputeQueue(vk::Device device, const QueueFamilies& queueFamilies, const GraphicsSettings& settings)
+    {
+        if (!UsesComputeQueue(queueFamilies, settings))
+        {
+            return std::nullopt;
+        }
+
+        return Scheduler::AsyncQueue{
+            .queue = device.getQueue(queueFamilies.computeFamily, 0),
+            .queueFamilyIndex = queueFamilies.computeFamily,
+        };
+    }
+
+    SharedDescriptorPool MakeDescriptorPool(vk::Device device, const GraphicsSettings& settings)
+    {
+        // TODO: Don't hardcode descriptor pool sizes
+        const uint32 framesInFlight = settings.framesInFlight;
+        auto poolSizes = std::vector{
+            vk::DescriptorPoolSize{
+                .type = vk::DescriptorType::eUniformBuffer,
+                .descriptorCount = framesInFlight * 10,
+            },
+            vk::DescriptorPoolSize{
+                .type = vk::DescriptorType::eCombinedImageSampler,
+                .descriptorCount = framesInFlight * 10,
+            },
+        };
+
+        // One shard per worker thread, plus one for the thread that owns the device
+        return SharedDescriptorPool(device, settings.numThreads + 1, std::move(poolSizes), framesInFlight * 10);
+    }
+
+    vk::BufferMemoryBarrier MakeUploadedBufferBarrier(const VulkanDevice::BufferUpload& upload)
+    {
+        return {
+            .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+            .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = upload.target,
+            .offset = upload.targetOffset,
+            .size = upload.size,
+        };
+    }
+
+    // Uploaded images stay in the transfer layout while they change queues, as mipmap generation needs them there
+    vk::ImageMemoryBarrier MakeUploadedImageBarrier(const VulkanTexture& texture)
+    {
+        return MakeImageTransitionBarrier(
+            texture.image.get(), texture.properties.format, texture.properties.mipLevelCount,
+            vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferDstOptimal);
+    }
+
+    // The stages that first use uploaded resources on the graphics queue: vertex input and shaders for buffers, shaders
+    // for textures, and transfers to generate mipmaps. The acquire waits for the upload at these stages.
+    constexpr auto UploadAcquireStages = vk::PipelineStageFlagBits::eVertexInput
+        | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader
+        | vk::PipelineStageFlagBits::eTransfer;
+
+    // Staged data is aligned to at least this much, which suits buffer copies and most texel sizes
+    constexpr vk::DeviceSize StagingAlignment = 16;
+
+    // Buffer to image copies need offsets that are a multiple of the texel size, which isn't always a power of two
+    // (e.g. 12 bytes for Float3), so texture data is aligned to a multiple of both
+    vk::DeviceSize GetStagingAlignment(Format format)
+    {
+        return std::lcm(StagingAlignment, vk::DeviceSize{std::max(GetFormatElementSize(format), 1u)});
+    }
+
+    constexpr vk::DeviceSize AlignStagingOffset(vk::DeviceSize offset, vk::DeviceSize alignment = StagingAlignment)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    std::optional<std::string> GetItemName(const char* name, usize index)
+    {
+        if (!name)
+        {
+            return std::nullopt;
+        }
+        return fmt::format("{}[{}]", name, index);
+    }
+
+    const char* CStr(const std::optional<std::string>& str)
+    {
+        return str ? str->c_str() : nullptr;
+    }
+
+    // A mesh only has one vertex buffer, which is bound to binding 0
+    uint32 GetMeshVertexStride(const VertexLayout& layout)
+    {
+        const auto it = std::ranges::find(layout.bufferBindings, 0u, &VertexBufferBinding::binding);
+        return it == layout.bufferBindings.end() ? 0 : it->stride;
+    }
+
+    void CopyBuffer(
+        vk::CommandBuffer cmdBuffer, vk::Buffer source, vk::DeviceSize sourceOffset, vk::Buffer destination,
+        vk::DeviceSize destinationOffset, vk::DeviceSize size)
     {
         const vk::BufferCopy copyRegion = {
-            .srcOffset = 0,
-            .dstOffset = 0,
+            .srcOffset = sourceOffset,
+            .dstOffset = destinationOffset,
             .size = size,
         };
         cmdBuffer.copyBuffer(source, destination, copyRegion);
@@ -596,6 +780,10 @@ vk::UniqueDevice CreateDevice(VulkanLoader& loader, const PhysicalDevice& physic
         vk::PhysicalDeviceVulkan13Features{
             .synchronization2 = true,
         },
+        vk::PhysicalDeviceTimelineSemaphoreFeatures{
+            // Used by Queue to track submission completion
+            .timelineSemaphore = true,
+        },
         vk::PhysicalDeviceDescriptorIndexingFeatures{
             // Enable non uniform array indexing
             // (#extension GL_EXT_nonuniform_qualifier : require)
@@ -714,15 +902,27 @@ VulkanDevice::VulkanDevice(
     m_device{CreateDevice(m_loader, m_physicalDevice)},
     m_settings{settings},
     m_graphicsQueue{m_device->getQueue(m_physicalDevice.queueFamilies.graphicsFamily, 0)},
-    m_workerDescriptorPools(settings.numThreads),
+    m_descriptorPool{MakeDescriptorPool(m_device.get(), settings)},
     m_setupCommandPool{CreateCommandPool(m_physicalDevice.queueFamilies.graphicsFamily, m_device.get(), "SetupCommandPool")},
     m_surfaceCommandPool{
         CreateCommandPool(m_physicalDevice.queueFamilies.graphicsFamily, m_device.get(), "SurfaceCommandPool")},
-    m_allocator{CreateAllocator(m_loader, m_instance.get(), m_device.get(), m_physicalDevice.physicalDevice)},
-    m_textures{"texture"},
-    m_kernels{"kernel"},
-    m_parameterBlocks{"parameter block"},
-    m_scheduler(m_settings.numThreads, m_device.get(), m_graphicsQueue, m_physicalDevice.queueFamilies.graphicsFamily)
+    m_allocator{CreateAllocator(
+        m_loader, m_instance.get(), m_device.get(), m_physicalDevice.physicalDevice,
+        HasExtension(m_physicalDevice, "VK_EXT_memory_budget") ? vma::AllocatorCreateFlagBits::eExtMemoryBudget
+                                                               : vma::AllocatorCreateFlags{})},
+    m_geometryHeap{
+        m_device.get(), m_allocator.get(), m_memoryCounters.meshes,
+        GetGeometryHeapQueueFamilies(m_physicalDevice.queueFamilies, m_settings)},
+    m_stagingRing{m_device.get(), m_allocator.get(), m_memoryCounters.staging, m_settings.stagingRingSize},
+    m_textureResidency{m_settings.framesInFlight},
+    m_samplerCache{m_device.get()},
+    m_scheduler(
+        m_settings.numThreads, m_device.get(), m_graphicsQueue, m_physicalDevice.queueFamilies.graphicsFamily,
+        m_settings.submitThread, GetTransferQueue(m_device.get(), m_physicalDevice.queueFamilies, m_settings),
+        GetComputeQueue(m_device.get(), m_physicalDevice.queueFamilies, m_settings), m_settings.framesInFlight),
+    m_textures{"texture", MakeDeferredDestroy<VulkanTexture>()},
+    m_kernels{"kernel", MakeDeferredDestroy<VulkanKernel>()},
+    m_parameterBlocks{"parameter block", MakeDeferredDestroy<VulkanParameterBlock>()}
 {
     if constexpr (IsDebugBuild)
     {
@@ -731,109 +931,267 @@ VulkanDevice::VulkanDevice(
             m_debugMessenger = m_instance->createDebugUtilsMessengerEXTUnique(GetDebugCreateInfo(), s_allocator);
         }
     }
-
-    // TODO: Don't hardcode descriptor pool sizes
-    const std::array poolSizes = {
-        vk::DescriptorPoolSize{
-            .type = vk::DescriptorType::eUniformBuffer,
-            .descriptorCount = MaxFramesInFlight * 10,
-        },
-        vk::DescriptorPoolSize{
-            .type = vk::DescriptorType::eCombinedImageSampler,
-            .descriptorCount = MaxFramesInFlight * 10,
-        },
-    };
-
-    const vk::DescriptorPoolCreateInfo poolCreateInfo = {
-        .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-        .maxSets = MaxFramesInFlight * 10,
-        .poolSizeCount = size32(poolSizes),
-        .pPoolSizes = data(poolSizes),
-    };
-
-    m_mainDescriptorPool = m_device->createDescriptorPoolUnique(poolCreateInfo, s_allocator);
-    SetDebugName(m_mainDescriptorPool, "DescriptorPool");
-
-    int i = 0;
-    for (auto& pool : m_workerDescriptorPools)
-    {
-        pool = m_device->createDescriptorPoolUnique(poolCreateInfo, s_allocator);
-        SetDebugName(pool, "WorkerDescriptorPool{}", i);
-        i++;
-    }
 }
 
 VulkanDevice::~VulkanDevice()
 {
+    // Tasks can use the resource maps, which are destroyed before the scheduler
+    m_scheduler.WaitForGpu();
     m_device->waitIdle();
 }
 
 VulkanBufferData VulkanDevice::CreateBufferUninitialized(
-    vk::DeviceSize size, vk::BufferUsageFlags usage, vma::AllocationCreateFlags allocationFlags, vma::MemoryUsage memoryUsage)
+    vk::DeviceSize size, vk::BufferUsageFlags usage, MemoryCounter& memoryCounter,
+    vma::AllocationCreateFlags allocationFlags, vma::MemoryUsage memoryUsage)
 {
-    return Teide::CreateBufferUninitialized(size, usage, allocationFlags, memoryUsage, m_device.get(), m_allocator.get());
+    auto ret = Teide::CreateBufferUninitialized(
+        size, usage, allocationFlags, memoryUsage, m_device.get(), m_allocator.get());
+    ret.memory = memoryCounter.Add(size);
+    return ret;
 }
 
 VulkanBuffer
-VulkanDevice::CreateBufferWithData(BytesView data, BufferUsage usage, ResourceLifetime lifetime, CommandBuffer& cmdBuffer)
+VulkanDevice::CreateBufferWithData(BytesView data, BufferUsage usage, ResourceLifetime lifetime, PendingUploads& uploads)
 {
     const vk::BufferUsageFlags usageFlags = GetBufferUsageFlags(usage);
+    auto& memoryCounter = GetBufferMemoryCounter(usage, m_memoryCounters);
 
     if (lifetime == ResourceLifetime::Transient)
     {
         auto ret = VulkanBuffer{CreateBufferUninitialized(
-            data.size(), usageFlags | vk::BufferUsageFlagBits::eTransferDst,
-            vma::AllocationCreateFlagBits::eHostAccessSequentialWrite)};
+            data.size(), usageFlags | vk::BufferUsageFlagBits::eTransferDst, memoryCounter,
+            vma::AllocationCreateFlagBits::eMapped | vma::AllocationCreateFlagBits::eHostAccessSequentialWrite)};
         SetBufferData(ret, data);
         return ret;
     }
 
-    // Create staging buffer
-    auto stagingBuffer = std::make_shared<VulkanBuffer>(CreateBufferUninitialized(
-        data.size(), vk::BufferUsageFlagBits::eTransferSrc, vma::AllocationCreateFlagBits::eHostAccessSequentialWrite));
-    cmdBuffer.AddReference(stagingBuffer);
-    SetBufferData(*stagingBuffer, data);
+    const auto source = StageData(uploads, data, StagingAlignment);
 
-    // Create device-local buffer
-    auto ret = VulkanBuffer{CreateBufferUninitialized(data.size(), usageFlags | vk::BufferUsageFlagBits::eTransferDst)};
-    CopyBuffer(cmdBuffer, stagingBuffer->buffer.get(), ret.buffer.get(), data.size());
-
-    // Add pipeline barrier to make the buffer usable in shader
-    cmdBuffer->pipelineBarrier(
-        vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexShader, {}, {},
-        vk::BufferMemoryBarrier{
-            .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
-            .dstAccessMask = vk::AccessFlagBits::eShaderRead,
-            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-            .buffer = ret.buffer.get(),
-            .offset = 0,
-            .size = VK_WHOLE_SIZE,
-        },
-        {});
+    // Create device-local buffer, to be copied into once the upload is recorded
+    auto ret = VulkanBuffer{
+        CreateBufferUninitialized(data.size(), usageFlags | vk::BufferUsageFlagBits::eTransferDst, memoryCounter)};
+    uploads.buffers.push_back({.source = source, .target = ret.buffer.get(), .size = data.size()});
     return ret;
 }
 
-vk::UniqueSampler VulkanDevice::CreateSampler(const SamplerState& ss)
-{
-    const vk::SamplerCreateInfo samplerInfo = {
-        .magFilter = ToVulkan(ss.magFilter),
-        .minFilter = ToVulkan(ss.minFilter),
-        .mipmapMode = ToVulkan(ss.mipmapMode),
-        .addressModeU = ToVulkan(ss.addressModeU),
-        .addressModeV = ToVulkan(ss.addressModeV),
-        .addressModeW = ToVulkan(ss.addressModeW),
-        .anisotropyEnable = ss.maxAnisotropy.has_value(),
-        .maxAnisotropy = ss.maxAnisotropy.value_or(0.0f),
-        .compareEnable = ss.compareOp.has_value(),
-        .compareOp = ToVulkan(ss.compareOp.value_or(CompareOp::Never)),
-        .minLod = 0,
-        .maxLod = VK_LOD_CLAMP_NONE,
+void VulkanDevice::ReserveStagingSpace(PendingUploads& uploads, vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    if (size > 0)
+    {
+        uploads.staging.push_back(m_stagingRing.Allocate(size, alignment));
+        uploads.stagingOffset = 0;
+    }
+}
+
+auto VulkanDevice::StageData(PendingUploads& uploads, BytesView data, vk::DeviceSize alignment) -> StagingRange
+{
+    // The alignment is of the offset into the buffer, which the start of the range might not be aligned to
+    const auto GetAlignedOffset = [&] {
+        const auto rangeOffset = uploads.staging.back().GetOffset();
+        return AlignStagingOffset(rangeOffset + uploads.stagingOffset, alignment) - rangeOffset;
     };
-    return m_device->createSamplerUnique(samplerInfo, s_allocator);
+
+    auto offset = uploads.staging.empty() ? 0 : GetAlignedOffset();
+    if (uploads.staging.empty() || offset + data.size() > uploads.staging.back().GetSize())
+    {
+        // No reserved space left, so give this data a staging range of its own
+        ReserveStagingSpace(uploads, std::max<vk::DeviceSize>(data.size(), StagingAlignment), alignment);
+        offset = 0;
+    }
+
+    auto& staging = uploads.staging.back();
+    staging.Write(offset, data);
+
+    uploads.stagingOffset = offset + data.size();
+    return {.buffer = staging.GetBuffer(), .offset = staging.GetOffset() + offset};
+}
+
+void VulkanDevice::RecordUploadCopies(PendingUploads& uploads, CommandBuffer& cmdBuffer)
+{
+    const auto& queueFamilies = m_physicalDevice.queueFamilies;
+
+    // Each stage of the uploads is recorded for all resources at once, so that they share pipeline barriers
+    if (!uploads.buffers.empty())
+    {
+        std::vector<vk::BufferMemoryBarrier> barriers;
+        barriers.reserve(uploads.buffers.size());
+
+        for (const auto& upload : uploads.buffers)
+        {
+            CopyBuffer(
+                cmdBuffer, upload.source.buffer, upload.source.offset, upload.target, upload.targetOffset, upload.size);
+
+            // Buffers that are shared between the queues don't change ownership. The semaphore that the graphics
+            // queue waits on is enough to make the copy visible to it.
+            if (!IsTransferringOwnership() || !upload.concurrent)
+            {
+                barriers.push_back(MakeUploadedBufferBarrier(upload));
+            }
+        }
+
+        if (IsTransferringOwnership())
+        {
+            for (auto& barrier : barriers)
+            {
+                barrier = MakeReleaseBarrier(barrier, queueFamilies.transferFamily, queueFamilies.graphicsFamily);
+            }
+            if (!barriers.empty())
+            {
+                cmdBuffer->pipelineBarrier(
+                    vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, barriers,
+                    {});
+            }
+        }
+        else
+        {
+            // Add pipeline barrier to make the buffers usable in shaders
+            cmdBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexShader, {}, {}, barriers, {});
+        }
+    }
+
+    if (!uploads.textures.empty())
+    {
+        std::vector<vk::ImageMemoryBarrier> barriers;
+        barriers.reserve(uploads.textures.size());
+
+        // Prepare all of the images that have data to be copied into them
+        for (const auto& [handle, state, source] : uploads.textures)
+        {
+            if (source)
+            {
+                const auto& texture = GetImpl(handle);
+                barriers.push_back(MakeImageTransitionBarrier(
+                    texture.image.get(), texture.properties.format, texture.properties.mipLevelCount, state.layout,
+                    vk::ImageLayout::eTransferDstOptimal));
+            }
+        }
+        if (!barriers.empty())
+        {
+            cmdBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, barriers);
+        }
+
+        // Copy the staging buffers to the images
+        barriers.clear();
+        for (auto& [handle, state, source] : uploads.textures)
+        {
+            if (source)
+            {
+                const auto& texture = GetImpl(handle);
+                const auto& props = texture.properties;
+                const auto imageExtent = vk::Extent3D{.width = props.size.x, .height = props.size.y, .depth = 1};
+                CopyBufferToImage(
+                    cmdBuffer, source->buffer, texture.image.get(), props.format, imageExtent, source->offset);
+                state = {
+                    .layout = vk::ImageLayout::eTransferDstOptimal,
+                    .lastPipelineStageUsage = vk::PipelineStageFlagBits::eTransfer,
+                };
+
+                if (IsTransferringOwnership())
+                {
+                    barriers.push_back(MakeReleaseBarrier(
+                        MakeUploadedImageBarrier(texture), queueFamilies.transferFamily, queueFamilies.graphicsFamily));
+                }
+            }
+        }
+        if (!barriers.empty())
+        {
+            cmdBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {}, barriers);
+        }
+    }
+
+    // The staging space is reused once the copies have been retired
+    for (auto& staging : uploads.staging)
+    {
+        m_scheduler.DestroyAfterGpuWork(std::move(staging));
+    }
+    uploads.staging.clear();
 }
 
-TextureState VulkanDevice::CreateTextureImpl(VulkanTexture& texture)
+void VulkanDevice::RecordUploadTransitions(PendingUploads& uploads, CommandBuffer& cmdBuffer)
+{
+    const auto& queueFamilies = m_physicalDevice.queueFamilies;
+
+    if (IsTransferringOwnership())
+    {
+        std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+        bufferBarriers.reserve(uploads.buffers.size());
+        for (const auto& upload : uploads.buffers)
+        {
+            if (!upload.concurrent)
+            {
+                bufferBarriers.push_back(MakeAcquireBarrier(
+                    MakeUploadedBufferBarrier(upload), queueFamilies.transferFamily, queueFamilies.graphicsFamily));
+            }
+        }
+
+        std::vector<vk::ImageMemoryBarrier> imageBarriers;
+        imageBarriers.reserve(uploads.textures.size());
+        for (const auto& [handle, state, source] : uploads.textures)
+        {
+            if (source)
+            {
+                imageBarriers.push_back(MakeAcquireBarrier(
+                    MakeUploadedImageBarrier(GetImpl(handle)), queueFamilies.transferFamily,
+                    queueFamilies.graphicsFamily));
+            }
+        }
+
+        if (!bufferBarriers.empty() || !imageBarriers.empty())
+        {
+            cmdBuffer->pipelineBarrier(UploadAcquireStages, UploadAcquireStages, {}, {}, bufferBarriers, imageBarriers);
+        }
+    }
+
+    // Transition into samplable images. Mipmap generation needs barriers between mip levels, so those textures
+    // are done separately (and the mipmap generation leaves them samplable).
+    std::vector<vk::ImageMemoryBarrier> barriers;
+    vk::PipelineStageFlags srcStages;
+    for (auto& [handle, state, source] : uploads.textures)
+    {
+        auto& texture = GetImpl(handle);
+        if (texture.properties.mipLevelCount > 1)
+        {
+            texture.GenerateMipmaps(state, cmdBuffer);
+        }
+        else
+        {
+            barriers.push_back(MakeImageTransitionBarrier(
+                texture.image.get(), texture.properties.format, texture.properties.mipLevelCount, state.layout,
+                texture.GetShaderInputLayout()));
+            srcStages |= state.lastPipelineStageUsage;
+        }
+    }
+    if (!barriers.empty())
+    {
+        cmdBuffer->pipelineBarrier(srcStages, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {}, barriers);
+    }
+}
+
+template <class T>
+PendingResource<T> VulkanDevice::ScheduleUploads(T resource, PendingUploads uploads, std::stop_token stopToken)
+{
+    if (uploads.buffers.empty() && uploads.textures.empty() && uploads.staging.empty())
+    {
+        auto promise = TaskPromise<>();
+        promise.SetValue();
+        return {.resource = std::move(resource), .uploaded = promise.GetTask()};
+    }
+
+    // Work scheduled after this will be submitted after it, so the resource doesn't need to wait for the upload.
+    // The copies are recorded before the transitions, so the two halves can share the uploads. If the upload is
+    // cancelled, both halves are dropped unrecorded, which releases the staging range.
+    auto sharedUploads = std::make_shared<PendingUploads>(std::move(uploads));
+    auto uploaded = m_scheduler.ScheduleTransfer(
+        [this, sharedUploads](CommandBuffer& cmdBuffer) { RecordUploadCopies(*sharedUploads, cmdBuffer); },
+        [this, sharedUploads](CommandBuffer& cmdBuffer) { RecordUploadTransitions(*sharedUploads, cmdBuffer); },
+        UploadAcquireStages, std::move(stopToken));
+    return {.resource = std::move(resource), .uploaded = std::move(uploaded)};
+}
+
+TextureState VulkanDevice::CreateTextureImpl(VulkanTexture& texture, MemoryCounter& memoryCounter)
 {
     // For now, all textures will be created with TransferSrc so they can be copied from
     texture.usage |= vk::ImageUsageFlagBits::eTransferSrc;
@@ -868,6 +1226,7 @@ TextureState VulkanDevice::CreateTextureImpl(VulkanTexture& texture)
 
         texture.image = vk::UniqueImage(image.release(), m_device.get());
         texture.allocation = std::move(allocation);
+        texture.memory = memoryCounter.Add(m_allocator->getAllocationInfo(texture.allocation.get()).size);
     }
 
     // Create image view if needed (determined by usage)
@@ -911,22 +1270,18 @@ TextureState VulkanDevice::CreateTextureImpl(VulkanTexture& texture)
         {
             SetDebugName(texture.imageView, "{}:View", props.name);
         }
-        SetDebugName(texture.sampler, "{}:Sampler", props.name);
     }
 
     return initialState;
 }
 
-void VulkanDevice::SetBufferData(VulkanBuffer& buffer, BytesView data)
+void VulkanDevice::SetBufferData(VulkanBufferData& buffer, BytesView data)
 {
-    const auto allocation = buffer.allocation.get();
-    TEIDE_ASSERT(m_allocator->getAllocationInfo(allocation).size >= data.size());
+    // Buffers that are written by the CPU are persistently mapped
+    TEIDE_ASSERT(buffer.mappedData.size() >= data.size());
 
-    void* const mappedData = m_allocator->mapMemory(allocation);
-
-    std::memcpy(mappedData, data.data(), data.size());
-
-    m_allocator->unmapMemory(allocation);
+    std::ranges::copy(data, buffer.mappedData.begin());
+    m_allocator->flushAllocation(buffer.allocation.get(), 0, data.size());
 }
 
 RendererPtr VulkanDevice::CreateRenderer(ShaderEnvironmentPtr shaderEnvironment)
@@ -935,12 +1290,19 @@ RendererPtr VulkanDevice::CreateRenderer(ShaderEnvironmentPtr shaderEnvironment)
 }
 
 BufferPtr VulkanDevice::CreateBuffer(const BufferData& data, const char* name)
+{
+    auto [buffer, uploaded] = CreateBufferAsync(data, name);
+    uploaded.get();
+    return buffer;
+}
+
+PendingResource<BufferPtr>
+VulkanDevice::CreateBufferAsync(const BufferData& data, const char* name, std::stop_token stopToken)
 {
     spdlog::debug("Creating buffer '{}' of size {}", name, data.data.size());
-    auto task = m_scheduler.ScheduleGpu([data, name, this](CommandBuffer& cmdBuffer) { //
-        return CreateBuffer(data, name, cmdBuffer);
-    });
-    return task.get();
+    PendingUploads uploads;
+    auto buffer = CreateBuffer(data, name, uploads);
+    return ScheduleUploads(std::move(buffer), std::move(uploads), std::move(stopToken));
 }
 
 SurfacePtr VulkanDevice::CreateSurface(vk::UniqueSurfaceKHR surface, Geo::Size2i size, bool multisampled)
@@ -951,20 +1313,21 @@ SurfacePtr VulkanDevice::CreateSurface(vk::UniqueSurfaceKHR surface, Geo::Size2i
     const auto queue = m_device->getQueue(m_physicalDevice.queueFamilies.presentFamily.value(), 0);
 
     return std::make_unique<VulkanSurface>(
-        size, std::move(surface), m_device.get(), m_physicalDevice, m_allocator.get(), queue, multisampled);
+        size, std::move(surface), m_device.get(), m_physicalDevice, m_allocator.get(), queue, multisampled,
+        m_settings.framesInFlight);
 }
 
-BufferPtr VulkanDevice::CreateBuffer(const BufferData& data, const char* name, CommandBuffer& cmdBuffer)
+BufferPtr VulkanDevice::CreateBuffer(const BufferData& data, const char* name, PendingUploads& uploads)
 {
-    auto ret = CreateBufferWithData(data.data, data.usage, data.lifetime, cmdBuffer);
+    auto ret = CreateBufferWithData(data.data, data.usage, data.lifetime, uploads);
     SetDebugName(ret.buffer, name);
-    return std::make_shared<const VulkanBuffer>(std::move(ret));
+    return MakeGpuShared<VulkanBuffer>(std::move(ret));
 }
 
 VulkanBuffer VulkanDevice::CreateTransientBuffer(const BufferData& data, const char* name)
 {
-    auto nullCmdBuffer = CommandBuffer(vk::UniqueCommandBuffer{nullptr});
-    auto ret = CreateBufferWithData(data.data, data.usage, ResourceLifetime::Transient, nullCmdBuffer);
+    PendingUploads noUploads; // transient buffers are written directly
+    auto ret = CreateBufferWithData(data.data, data.usage, ResourceLifetime::Transient, noUploads);
     SetDebugName(ret.buffer, name);
     return ret;
 }
@@ -974,7 +1337,7 @@ ShaderEnvironmentPtr VulkanDevice::CreateShaderEnvironment(const ShaderEnvironme
     spdlog::debug("Creating shader environment");
     auto shader = VulkanShaderEnvironmentBase{
         .scenePblockLayout = CreateParameterBlockLayout(data.scenePblock, 0),
-        .viewPblockLayout = CreateParameterBlockLayout(data.viewPblock, 1),
+        .viewPblockLayout = CreateViewParameterBlockLayout(data.viewPblock),
     };
 
     return std::make_shared<const VulkanShaderEnvironment>(std::move(shader));
@@ -997,7 +1360,7 @@ ShaderPtr VulkanDevice::CreateShader(const ShaderData& data, const char* name)
         .pixelShader = m_device->createShaderModuleUnique(pixelCreateInfo, s_allocator),
         .vertexShaderInputs = data.vertexShader.inputs,
         .scenePblockLayout = CreateParameterBlockLayout(data.environment.scenePblock, 0),
-        .viewPblockLayout = CreateParameterBlockLayout(data.environment.viewPblock, 1),
+        .viewPblockLayout = CreateViewParameterBlockLayout(data.environment.viewPblock),
         .materialPblockLayout = CreateParameterBlockLayout(data.materialPblock, 2),
         .objectPblockLayout = CreateParameterBlockLayout(data.objectPblock, 3),
     };
@@ -1027,7 +1390,7 @@ Kernel VulkanDevice::CreateKernel(const KernelData& data, const char* name)
         .inputs = data.computeShader.inputs,
         .outputs = data.computeShader.outputs,
         .scenePblockLayout = CreateParameterBlockLayout(data.environment.scenePblock, 0),
-        .viewPblockLayout = CreateParameterBlockLayout(data.environment.viewPblock, 1),
+        .viewPblockLayout = CreateViewParameterBlockLayout(data.environment.viewPblock),
         .paramsPblockLayout = CreateParameterBlockLayout(data.paramsPblock, 2),
     };
 
@@ -1045,23 +1408,58 @@ Kernel VulkanDevice::CreateKernel(const KernelData& data, const char* name)
 }
 
 Texture VulkanDevice::CreateTexture(const TextureData& data, const char* name)
+{
+    auto [texture, uploaded] = CreateTextureAsync(data, name);
+    uploaded.get();
+    return texture;
+}
+
+PendingResource<Texture>
+VulkanDevice::CreateTextureAsync(const TextureData& data, const char* name, std::stop_token stopToken)
 {
     spdlog::debug("Creating texture '{}' of size {}x{}", name, data.size.x, data.size.y);
-    auto task = m_scheduler.ScheduleGpu([data, name, this](CommandBuffer& cmdBuffer) { //
-        return CreateTexture(data, name, cmdBuffer);
-    });
-    return task.get();
+    PendingUploads uploads;
+    auto texture = CreateTexture(data, name, uploads);
+    return ScheduleUploads(std::move(texture), std::move(uploads), std::move(stopToken));
+}
+
+PendingResource<std::vector<Texture>>
+VulkanDevice::CreateTextures(std::span<const TextureData> data, const char* name, std::stop_token stopToken)
+{
+    spdlog::debug("Creating {} textures '{}'", data.size(), name);
+
+    // The range is aligned to every texture's alignment, so that aligning offsets within it aligns them in the buffer
+    vk::DeviceSize stagingSize = 0;
+    vk::DeviceSize stagingAlignment = StagingAlignment;
+    for (const auto& textureData : data)
+    {
+        const auto alignment = GetStagingAlignment(textureData.format);
+        stagingSize = AlignStagingOffset(stagingSize, alignment) + textureData.pixels.size();
+        stagingAlignment = std::lcm(stagingAlignment, alignment);
+    }
+
+    PendingUploads uploads;
+    ReserveStagingSpace(uploads, stagingSize, stagingAlignment);
+
+    std::vector<Texture> textures;
+    textures.reserve(data.size());
+    for (usize i = 0; i < data.size(); i++)
+    {
+        textures.push_back(CreateTexture(data[i], CStr(GetItemName(name, i)), uploads));
+    }
+
+    return ScheduleUploads(std::move(textures), std::move(uploads), std::move(stopToken));
 }
 
 Texture VulkanDevice::AllocateTexture(const TextureProperties& props, const SamplerState& samplerState)
 {
     return m_textures.Insert({
-        .sampler = CreateSampler(samplerState),
+        .sampler = m_samplerCache.Get(samplerState),
         .properties = props,
     });
 }
 
-Texture VulkanDevice::CreateTexture(const TextureData& data, const char* name, CommandBuffer& cmdBuffer)
+Texture VulkanDevice::CreateTexture(const TextureData& data, const char* name, PendingUploads& uploads)
 {
     vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eSampled;
 
@@ -1094,65 +1492,36 @@ Texture VulkanDevice::CreateTexture(const TextureData& data, const char* name, C
         .sampleCount = data.sampleCount,
         .name = name,
     };
-    texture.sampler = CreateSampler(data.samplerState);
+    texture.sampler = m_samplerCache.Get(data.samplerState);
 
-    auto state = CreateTextureImpl(texture);
+    const auto state = CreateTextureImpl(texture, m_memoryCounters.textures);
 
+    std::optional<StagingRange> source;
     if (!data.pixels.empty())
     {
-        const auto imageExtent = vk::Extent3D{.width = data.size.x, .height = data.size.y, .depth = 1};
-
-        // Create staging buffer
-        auto stagingBuffer = VulkanBuffer{CreateBufferUninitialized(
-            data.pixels.size(), vk::BufferUsageFlagBits::eTransferSrc,
-            vma::AllocationCreateFlagBits::eHostAccessSequentialWrite)};
-        SetBufferData(stagingBuffer, data.pixels);
-
-        // Copy staging buffer to image
-        TransitionImageLayout(
-            cmdBuffer, texture.image.get(), data.format, data.mipLevelCount, state.layout,
-            vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTopOfPipe,
-            vk::PipelineStageFlagBits::eTransfer);
-        state = {
-            .layout = vk::ImageLayout::eTransferDstOptimal,
-            .lastPipelineStageUsage = vk::PipelineStageFlagBits::eTransfer,
-        };
-        CopyBufferToImage(cmdBuffer, stagingBuffer.buffer.get(), texture.image.get(), data.format, imageExtent);
-
-        cmdBuffer.TakeOwnership(std::move(stagingBuffer.buffer));
-        cmdBuffer.TakeOwnership(std::move(stagingBuffer.allocation));
+        source = StageData(uploads, data.pixels, GetStagingAlignment(data.format));
     }
 
-    if (data.mipLevelCount > 1)
-    {
-        texture.GenerateMipmaps(state, cmdBuffer);
-    }
-    else
+    auto handle = m_textures.Insert(std::move(texture));
+
+    if (m_settings.textureMemoryBudget && !data.pixels.empty())
     {
-        // Transition into samplable image, but only if mipmaps were not generated
-        // (if so, the mipmap generation already transitioned to image to be samplable)
-        texture.TransitionToShaderInput(state, cmdBuffer);
+        // The texture's data is kept, so that it can be evicted and made resident again later
+        auto& textureImpl = GetImpl(handle);
+        const auto size = textureImpl.memory.GetSize();
+        textureImpl.residency = m_textureResidency.Track(static_cast<uint64>(handle), size, data);
+        uploads.textureUses.push_back(m_textureResidency.AddUse(textureImpl.residency));
     }
-
-    auto handle = m_textures.Insert(std::move(texture));
-    cmdBuffer.AddReference(handle);
+    uploads.textures.push_back({.texture = handle, .state = state, .source = source});
     return handle;
 }
 
 Texture VulkanDevice::CreateRenderableTexture(const TextureData& data, const char* name)
 {
     spdlog::debug("Creating renderable texture '{}' of size {}x{}", name, data.size.x, data.size.y);
-    auto task = m_scheduler.ScheduleGpu([data, name, this](CommandBuffer& cmdBuffer) { //
-        return CreateRenderableTexture(data, name, cmdBuffer);
-    });
-    return task.get();
-}
 
-Texture VulkanDevice::CreateRenderableTexture(const TextureData& data, const char* name, CommandBuffer& cmdBuffer)
-{
-    const bool isColorTarget = !HasDepthOrStencilComponent(data.format);
-    const auto renderUsage
-        = isColorTarget ? vk::ImageUsageFlagBits::eColorAttachment : vk::ImageUsageFlagBits::eDepthStencilAttachment;
+    const auto renderUsage = HasDepthOrStencilComponent(data.format) ? vk::ImageUsageFlagBits::eDepthStencilAttachment
+                                                                     : vk::ImageUsageFlagBits::eColorAttachment;
 
     VulkanTexture texture;
     texture.usage = renderUsage | vk::ImageUsageFlagBits::eSampled;
@@ -1163,69 +1532,165 @@ Texture VulkanDevice::CreateRenderableTexture(const TextureData& data, const cha
         .sampleCount = data.sampleCount,
         .name = name,
     };
-    texture.sampler = CreateSampler(data.samplerState);
+    texture.sampler = m_samplerCache.Get(data.samplerState);
 
-    auto state = CreateTextureImpl(texture);
+    // Whatever renders to the texture first transitions it out of its initial layout, in the same command buffer, so
+    // there's no separate task for the transition that could fail without anyone waiting on it
+    CreateTextureImpl(texture, m_memoryCounters.renderTargets);
+    return m_textures.Insert(std::move(texture));
+}
 
-    if (isColorTarget)
-    {
-        texture.TransitionToColorTarget(state, cmdBuffer);
-    }
-    else
-    {
-        texture.TransitionToDepthStencilTarget(state, cmdBuffer);
-    }
+Texture VulkanDevice::CreateStorageTexture(const TextureData& data, const char* name)
+{
+    spdlog::debug("Creating storage texture '{}' of size {}x{}", name, data.size.x, data.size.y);
 
-    auto handle = m_textures.Insert(std::move(texture));
-    cmdBuffer.AddReference(handle);
-    return handle;
+    VulkanTexture texture;
+    texture.usage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled;
+    texture.properties = {
+        .size = data.size,
+        .format = data.format,
+        .mipLevelCount = data.mipLevelCount,
+        .sampleCount = data.sampleCount,
+        .name = name,
+    };
+    texture.sampler = m_samplerCache.Get(data.samplerState);
+
+    // Whatever writes to the texture transitions it out of its initial layout, on whichever queue it runs on
+    CreateTextureImpl(texture, m_memoryCounters.renderTargets);
+    return m_textures.Insert(std::move(texture));
 }
 
 MeshPtr VulkanDevice::CreateMesh(const MeshData& data, const char* name)
+{
+    auto [mesh, uploaded] = CreateMeshAsync(data, name);
+    uploaded.get();
+    return mesh;
+}
+
+PendingResource<MeshPtr>
+VulkanDevice::CreateMeshAsync(const MeshData& data, const char* name, std::stop_token stopToken)
 {
     spdlog::debug("Creating mesh '{}' with {} vertices and {} indices", name, data.vertexCount, data.indexData.size() / 2);
-    auto task = m_scheduler.ScheduleGpu([data, name, this](CommandBuffer& cmdBuffer) { //
-        return CreateMesh(data, name, cmdBuffer);
-    });
-    return task.get();
+    PendingUploads uploads;
+    auto mesh = CreateMesh(data, name, uploads);
+    return ScheduleUploads(std::move(mesh), std::move(uploads), std::move(stopToken));
 }
 
-MeshPtr VulkanDevice::CreateMesh(const MeshData& data, const char* name, CommandBuffer& cmdBuffer)
+PendingResource<std::vector<MeshPtr>>
+VulkanDevice::CreateMeshes(std::span<const MeshData> data, const char* name, std::stop_token stopToken)
 {
-    VulkanMesh mesh;
+    spdlog::debug("Creating {} meshes '{}'", data.size(), name);
 
-    mesh.vertexLayout = data.vertexLayout;
+    vk::DeviceSize stagingSize = 0;
+    for (const auto& meshData : data)
+    {
+        if (meshData.lifetime == ResourceLifetime::Permanent)
+        {
+            stagingSize = AlignStagingOffset(stagingSize) + meshData.vertexData.size();
+            stagingSize = AlignStagingOffset(stagingSize) + meshData.indexData.size();
+        }
+    }
 
-    mesh.vertexBuffer = std::make_shared<VulkanBuffer>(
-        CreateBufferWithData(data.vertexData, BufferUsage::Vertex, data.lifetime, cmdBuffer));
-    if (name)
+    PendingUploads uploads;
+    ReserveStagingSpace(uploads, stagingSize, StagingAlignment);
+
+    std::vector<MeshPtr> meshes;
+    meshes.reserve(data.size());
+    for (usize i = 0; i < data.size(); i++)
     {
-        SetDebugName(mesh.vertexBuffer->buffer, "{}:vbuffer", name);
+        meshes.push_back(CreateMesh(data[i], CStr(GetItemName(name, i)), uploads));
     }
+
+    return ScheduleUploads(std::move(meshes), std::move(uploads), std::move(stopToken));
+}
+
+MeshPtr VulkanDevice::CreateMesh(const MeshData& data, const char* name, PendingUploads& uploads)
+{
+    VulkanMesh mesh;
+
+    mesh.vertexLayout = data.vertexLayout;
     mesh.vertexCount = data.vertexCount;
+    mesh.aabb = data.aabb;
 
     if (!data.indexData.empty())
     {
-        mesh.indexBuffer = std::make_shared<VulkanBuffer>(
-            CreateBufferWithData(data.indexData, BufferUsage::Index, data.lifetime, cmdBuffer));
+        mesh.indexCount = static_cast<uint32>(data.indexData.size()) / sizeof(uint16);
+    }
+
+    if (data.lifetime == ResourceLifetime::Transient)
+    {
+        // Transient meshes are written directly, so they get host-visible buffers of their own rather than going in
+        // the (device-local) geometry heap
+        auto vertexBuffer = MakeGpuShared<VulkanBuffer>(
+            CreateBufferWithData(data.vertexData, BufferUsage::Vertex, data.lifetime, uploads));
         if (name)
         {
-            SetDebugName(mesh.indexBuffer->buffer, "{}:ibuffer", name);
+            SetDebugName(vertexBuffer->buffer, "{}:vbuffer", name);
         }
-        mesh.indexCount = static_cast<uint32>(data.indexData.size()) / sizeof(uint16);
+        mesh.vertexBinding = {.buffer = vertexBuffer->buffer.get()};
+        mesh.vertexBuffer = std::move(vertexBuffer);
+
+        if (!data.indexData.empty())
+        {
+            auto indexBuffer = MakeGpuShared<VulkanBuffer>(
+                CreateBufferWithData(data.indexData, BufferUsage::Index, data.lifetime, uploads));
+            if (name)
+            {
+                SetDebugName(indexBuffer->buffer, "{}:ibuffer", name);
+            }
+            mesh.indexBinding = {.buffer = indexBuffer->buffer.get()};
+            mesh.indexBuffer = std::move(indexBuffer);
+        }
+
+        return std::make_shared<VulkanMesh>(std::move(mesh));
     }
 
-    mesh.aabb = data.aabb;
+    // Aligning the vertex data to the stride lets draws address it with a vertex offset from the start of the block,
+    // so that meshes in the same block share a binding
+    const uint32 stride = GetMeshVertexStride(data.vertexLayout);
+    auto vertexRange = CreateGeometryRange(data.vertexData, std::max(stride, 1u), uploads);
+    if (stride > 0)
+    {
+        mesh.vertexBinding = {.buffer = vertexRange->GetBuffer()};
+        mesh.vertexOffset = static_cast<int32>(vertexRange->GetOffset() / stride);
+    }
+    else
+    {
+        mesh.vertexBinding = {.buffer = vertexRange->GetBuffer(), .offset = vertexRange->GetOffset()};
+    }
+    mesh.vertexBuffer = std::move(vertexRange);
+
+    if (!data.indexData.empty())
+    {
+        auto indexRange = CreateGeometryRange(data.indexData, sizeof(uint16), uploads);
+        mesh.indexBinding = {.buffer = indexRange->GetBuffer()};
+        mesh.firstIndex = static_cast<uint32>(indexRange->GetOffset() / sizeof(uint16));
+        mesh.indexBuffer = std::move(indexRange);
+    }
 
     return std::make_shared<VulkanMesh>(std::move(mesh));
 }
 
+std::shared_ptr<GeometryHeap::Range>
+VulkanDevice::CreateGeometryRange(BytesView data, vk::DeviceSize alignment, PendingUploads& uploads)
+{
+    auto range = MakeGpuShared<GeometryHeap::Range>(m_geometryHeap.Allocate(data.size(), alignment));
+    uploads.buffers.push_back({
+        .source = StageData(uploads, data, StagingAlignment),
+        .target = range->GetBuffer(),
+        .targetOffset = range->GetOffset(),
+        .size = data.size(),
+        .concurrent = m_geometryHeap.IsConcurrent(),
+    });
+    return range;
+}
+
 PipelinePtr VulkanDevice::CreatePipeline(const PipelineData& data)
 {
     spdlog::debug("Creating pipeline");
     const auto shaderImpl = GetImpl(data.shader);
 
-    const auto pipeline = std::make_shared<VulkanPipeline>(shaderImpl);
+    const auto pipeline = MakeGpuShared<VulkanPipeline>(shaderImpl);
 
     for (const auto& renderPass : data.renderPasses)
     {
@@ -1236,56 +1701,70 @@ PipelinePtr VulkanDevice::CreatePipeline(const PipelineData& data)
     return pipeline;
 }
 
-vk::UniqueDescriptorSet VulkanDevice::CreateUniqueDescriptorSet(
-    vk::DescriptorPool pool, vk::DescriptorSetLayout layout, const Buffer* uniformBuffer,
-    std::span<const Texture> textures, const char* name)
+bool VulkanDevice::WriteDescriptorSet(
+    const VulkanParameterBlockLayout& layout, vk::DescriptorSet descriptorSet, const Buffer* uniformBuffer,
+    std::span<const Texture> textures)
 {
-    const vk::DescriptorSetAllocateInfo allocInfo = {
-        .descriptorPool = pool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &layout,
-    };
-
-    auto descriptorSet = std::move(m_device->allocateDescriptorSetsUnique(allocInfo).front());
-    SetDebugName(descriptorSet, name);
-
-    WriteDescriptorSet(descriptorSet.get(), uniformBuffer, textures);
+    std::optional<vk::DescriptorBufferInfo> bufferInfo;
+    if (uniformBuffer)
+    {
+        const auto& uniformBufferImpl = GetImpl(*uniformBuffer);
+        bufferInfo = vk::DescriptorBufferInfo{
+            .buffer = uniformBufferImpl.buffer.get(),
+            .offset = 0,
+            .range = uniformBufferImpl.size,
+        };
+    }
 
-    return descriptorSet;
+    return WriteDescriptorSet(layout, descriptorSet, bufferInfo, textures);
 }
 
-bool VulkanDevice::WriteDescriptorSet(vk::DescriptorSet descriptorSet, const Buffer* uniformBuffer, std::span<const Texture> textures)
+bool VulkanDevice::WriteDynamicDescriptorSet(
+    const VulkanParameterBlockLayout& layout, vk::DescriptorSet descriptorSet, vk::Buffer uniformBuffer,
+    std::span<const Texture> textures)
 {
-    const auto numUniformBuffers = uniformBuffer ? 1 : 0;
-
-    std::vector<vk::WriteDescriptorSet> descriptorWrites;
-    descriptorWrites.reserve(numUniformBuffers + textures.size());
+    TEIDE_ASSERT(layout.dynamicUniforms);
 
-    vk::DescriptorBufferInfo bufferInfo;
+    std::optional<vk::DescriptorBufferInfo> bufferInfo;
     if (uniformBuffer)
     {
-        const auto& uniformBufferImpl = GetImpl(*uniformBuffer);
+        // The offset into the buffer is given when the descriptor set is bound
         bufferInfo = vk::DescriptorBufferInfo{
-            .buffer = uniformBufferImpl.buffer.get(),
+            .buffer = uniformBuffer,
             .offset = 0,
-            .range = uniformBufferImpl.size,
+            .range = layout.uniformBufferSize,
         };
+    }
 
-        if (uniformBufferImpl.size > 0)
-        {
-            descriptorWrites.push_back({
-                .dstSet = descriptorSet,
-                .dstBinding = 0,
-                .dstArrayElement = 0,
-                .descriptorCount = 1,
-                .descriptorType = vk::DescriptorType::eUniformBuffer,
-                .pBufferInfo = &bufferInfo,
-            });
-        }
+    return WriteDescriptorSet(layout, descriptorSet, bufferInfo, textures);
+}
+
+bool VulkanDevice::WriteDescriptorSet(
+    const VulkanParameterBlockLayout& layout, vk::DescriptorSet descriptorSet,
+    const std::optional<vk::DescriptorBufferInfo>& uniformBufferInfo, std::span<const Texture> textures)
+{
+    const auto numUniformBuffers = uniformBufferInfo ? 1 : 0;
+
+    std::vector<vk::WriteDescriptorSet> descriptorWrites;
+    descriptorWrites.reserve(numUniformBuffers + textures.size());
+
+    if (uniformBufferInfo && uniformBufferInfo->range > 0)
+    {
+        descriptorWrites.push_back({
+            .dstSet = descriptorSet,
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType
+            = layout.dynamicUniforms ? vk::DescriptorType::eUniformBufferDynamic : vk::DescriptorType::eUniformBuffer,
+            .pBufferInfo = &*uniformBufferInfo,
+        });
     }
 
+    // Textures are bound after the uniform buffer, in the same order as in the layout
     std::vector<vk::DescriptorImageInfo> imageInfos;
     imageInfos.reserve(textures.size());
+    uint32 binding = 1;
     for (const auto& texture : textures)
     {
         const VulkanTexture& textureImpl = GetImpl(texture);
@@ -1296,7 +1775,7 @@ bool VulkanDevice::WriteDescriptorSet(vk::DescriptorSet descriptorSet, const Buf
         }
 
         imageInfos.push_back({
-            .sampler = textureImpl.sampler.get(),
+            .sampler = textureImpl.sampler->get(),
             .imageView = textureImpl.imageView.get(),
             .imageLayout = HasDepthOrStencilComponent(textureImpl.properties.format)
                 ? vk::ImageLayout::eDepthStencilReadOnlyOptimal
@@ -1305,7 +1784,7 @@ bool VulkanDevice::WriteDescriptorSet(vk::DescriptorSet descriptorSet, const Buf
 
         descriptorWrites.push_back({
             .dstSet = descriptorSet,
-            .dstBinding = 1,
+            .dstBinding = binding++,
             .dstArrayElement = 0,
             .descriptorCount = 1,
             .descriptorType = vk::DescriptorType::eCombinedImageSampler,
@@ -1322,6 +1801,15 @@ VulkanParameterBlockLayoutPtr VulkanDevice::CreateParameterBlockLayout(const Par
     return std::make_shared<const VulkanParameterBlockLayout>(BuildParameterBlockLayout(desc, set), m_device.get());
 }
 
+VulkanParameterBlockLayoutPtr VulkanDevice::CreateViewParameterBlockLayout(const ParameterBlockDesc& desc)
+{
+    // View parameters change for every render list, so their uniforms are suballocated from a per-frame buffer, and
+    // selected with a dynamic offset when the descriptor set is bound
+    auto data = BuildParameterBlockLayout(desc, 1);
+    data.dynamicUniforms = true;
+    return std::make_shared<const VulkanParameterBlockLayout>(data, m_device.get());
+}
+
 vk::DescriptorSet VulkanDevice::GetDescriptorSet(const ParameterBlock& parameterBlock)
 {
     auto& parameterBlockImpl = GetImpl(parameterBlock);
@@ -1329,6 +1817,219 @@ vk::DescriptorSet VulkanDevice::GetDescriptorSet(const ParameterBlock& parameter
     return parameterBlockImpl.descriptorSet.get();
 }
 
+void VulkanDevice::NextFrame()
+{
+    m_scheduler.NextFrame();
+    UpdatePeakHeapUsage(m_allocator->getHeapBudgets());
+
+    if (m_settings.textureMemoryBudget)
+    {
+        m_textureResidency.NextFrame();
+        EvictTextures();
+    }
+}
+
+MemoryStatistics VulkanDevice::GetMemoryStatistics()
+{
+    MemoryStatistics ret = {
+        .textures = GetMemoryCategoryStatistics(m_memoryCounters.textures),
+        .renderTargets = GetMemoryCategoryStatistics(m_memoryCounters.renderTargets),
+        .meshes = GetMemoryCategoryStatistics(m_memoryCounters.meshes),
+        .uniformBuffers = GetMemoryCategoryStatistics(m_memoryCounters.uniformBuffers),
+        .staging = GetMemoryCategoryStatistics(m_memoryCounters.staging),
+        .buffers = GetMemoryCategoryStatistics(m_memoryCounters.buffers),
+    };
+
+    const auto& memoryProperties = *m_allocator->getMemoryProperties();
+    const auto heapBudgets = m_allocator->getHeapBudgets();
+    const auto totals = m_allocator->calculateStatistics();
+    UpdatePeakHeapUsage(heapBudgets);
+
+    const auto lock = std::scoped_lock(m_peakHeapUsageMutex);
+    for (uint32 i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+        const auto& heap = totals.memoryHeap[i];
+        const auto flags = memoryProperties.memoryHeaps[i].flags;
+        ret.heaps.push_back({
+            .size = memoryProperties.memoryHeaps[i].size,
+            .deviceLocal = static_cast<bool>(flags & vk::MemoryHeapFlagBits::eDeviceLocal),
+            .usage = heapBudgets[i].usage,
+            .budget = heapBudgets[i].budget,
+            .peakUsage = m_peakHeapUsage[i],
+            .blockBytes = heap.statistics.blockBytes,
+            .blockCount = heap.statistics.blockCount,
+            .allocationBytes = heap.statistics.allocationBytes,
+            .allocationCount = heap.statistics.allocationCount,
+            .unusedRangeCount = heap.unusedRangeCount,
+            .largestUnusedRange = heap.unusedRangeCount > 0 ? heap.unusedRangeSizeMax : 0,
+        });
+    }
+    return ret;
+}
+
+std::string VulkanDevice::DumpMemoryStatistics(bool detailed)
+{
+    char* const json = m_allocator->buildStatsString(detailed);
+    auto ret = std::string(json);
+    m_allocator->freeStatsString(json);
+    return ret;
+}
+
+void VulkanDevice::UpdatePeakHeapUsage(std::span<const vma::Budget> heapBudgets)
+{
+    const auto lock = std::scoped_lock(m_peakHeapUsageMutex);
+    m_peakHeapUsage.resize(heapBudgets.size());
+    for (usize i = 0; i < heapBudgets.size(); i++)
+    {
+        m_peakHeapUsage[i] = std::max(m_peakHeapUsage[i], heapBudgets[i].usage);
+    }
+}
+
+void VulkanDevice::EvictTextures()
+{
+    // Without VK_EXT_memory_budget, the allocator estimates usage from its own allocations and the budget from the
+    // heap sizes
+    const auto& memoryProperties = *m_allocator->getMemoryProperties();
+    const auto heapBudgets = m_allocator->getHeapBudgets();
+
+    uint64 usage = 0;
+    uint64 budget = 0;
+    for (uint32 i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+        if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+        {
+            usage += heapBudgets[i].usage;
+            budget += heapBudgets[i].budget;
+        }
+    }
+    budget = std::min(budget, *m_settings.textureMemoryBudget);
+    if (usage <= budget)
+    {
+        return;
+    }
+
+    m_textureResidency.Evict(usage - budget, [this](TextureResidency::Entry& entry) {
+        // The tracker doesn't keep the texture alive, so it might be being destroyed
+        const auto texture = m_textures.Lock(entry.handleIndex);
+        if (!texture)
+        {
+            return false;
+        }
+
+        // No work that hasn't run yet holds a use of the texture, so nothing on another thread is reading its image.
+        // The GPU might still be using it though, so the image is destroyed once the GPU has finished that work.
+        auto& textureImpl = GetImpl(*texture);
+        spdlog::debug("Evicting texture '{}'", textureImpl.properties.name);
+        VulkanTexture evicted;
+        evicted.image = std::move(textureImpl.image);
+        evicted.allocation = std::move(textureImpl.allocation);
+        evicted.imageView = std::move(textureImpl.imageView);
+        evicted.memory = std::move(textureImpl.memory);
+        m_scheduler.DestroyAfterGpuWork(std::move(evicted));
+        return true;
+    });
+}
+
+auto VulkanDevice::PrepareTextures(std::span<const Texture> textures) -> TextureUses
+{
+    if (!m_settings.textureMemoryBudget)
+    {
+        return {};
+    }
+
+    PendingUploads uploads;
+    TextureUses uses;
+    PrepareTextures(textures, uploads, uses);
+    // Work that uses the textures is scheduled after this, so it will be submitted after the uploads
+    ScheduleUploads(std::monostate{}, std::move(uploads));
+    return uses;
+}
+
+auto VulkanDevice::PrepareRenderList(const RenderList& renderList) -> TextureUses
+{
+    if (!m_settings.textureMemoryBudget)
+    {
+        return {};
+    }
+
+    PendingUploads uploads;
+    TextureUses uses;
+    PrepareTextures(renderList.viewParameters.textures, uploads, uses);
+    for (const RenderObject& obj : renderList.objects)
+    {
+        PrepareParameterBlock(obj.materialParameters, uploads, uses);
+        PrepareTextures(obj.objectParameters.textures, uploads, uses);
+    }
+    ScheduleUploads(std::monostate{}, std::move(uploads));
+    return uses;
+}
+
+void VulkanDevice::PrepareTextures(std::span<const Texture> textures, PendingUploads& uploads, TextureUses& uses)
+{
+    for (const Texture& texture : textures)
+    {
+        auto& textureImpl = GetImpl(texture);
+        if (!textureImpl.residency)
+        {
+            continue;
+        }
+
+        m_textureResidency.MarkUsed(*textureImpl.residency);
+        uses.push_back(m_textureResidency.AddUse(textureImpl.residency));
+        const bool reloaded
+            = m_textureResidency.MakeResident(*textureImpl.residency, [&](TextureResidency::Entry& entry) {
+                  spdlog::debug("Making texture '{}' resident again", textureImpl.properties.name);
+                  const auto state = CreateTextureImpl(textureImpl, m_memoryCounters.textures);
+                  const auto source = StageData(uploads, entry.source.pixels, GetStagingAlignment(entry.source.format));
+                  uploads.textures.push_back({.texture = texture, .state = state, .source = source});
+              });
+        if (reloaded)
+        {
+            // The upload writes the new image, so it needs a use of its own in case it runs after the work
+            uploads.textureUses.push_back(uses.back());
+        }
+    }
+}
+
+void VulkanDevice::PrepareParameterBlock(
+    const ParameterBlock& parameterBlock, PendingUploads& uploads, TextureUses& uses)
+{
+    auto& pblock = GetImpl(parameterBlock);
+    PrepareTextures(pblock.textures, uploads, uses);
+
+    // The descriptor set refers to the textures' image views, so it needs rewriting if any of them have been made
+    // resident again since it was last checked. They hadn't been used for a while, so neither has the descriptor set.
+    const uint64 epoch = m_textureResidency.GetEpoch();
+    if (pblock.residencyEpoch == epoch)
+    {
+        return;
+    }
+
+    const bool reloaded = std::ranges::any_of(pblock.textures, [&](const Texture& texture) {
+        const auto& residency = GetImpl(texture).residency;
+        return residency && residency->residentEpoch.load(std::memory_order_relaxed) > pblock.residencyEpoch;
+    });
+    if (reloaded)
+    {
+        pblock.written = false;
+        InitParameterBlock(pblock);
+    }
+    pblock.residencyEpoch = epoch;
+}
+
+auto VulkanDevice::AddTextureUses(std::span<const Texture> textures) -> TextureUses
+{
+    TextureUses uses;
+    for (const Texture& texture : textures)
+    {
+        if (const auto& residency = GetImpl(texture).residency)
+        {
+            uses.push_back(m_textureResidency.AddUse(residency));
+        }
+    }
+    return uses;
+}
+
 void VulkanDevice::ExecCommandsSync(const std::function<void(vk::CommandBuffer)>& f)
 {
     GetScheduler().WaitForCpu();
@@ -1426,22 +2127,50 @@ Framebuffer VulkanDevice::CreateFramebuffer(
 }
 
 ParameterBlock VulkanDevice::CreateParameterBlock(const ParameterBlockData& data, const char* name)
+{
+    auto [parameterBlock, uploaded] = CreateParameterBlockAsync(data, name);
+    uploaded.get();
+    return parameterBlock;
+}
+
+PendingResource<ParameterBlock>
+VulkanDevice::CreateParameterBlockAsync(const ParameterBlockData& data, const char* name, std::stop_token stopToken)
 {
     spdlog::debug("Creating parameter block '{}'", name);
-    auto task = m_scheduler.ScheduleGpu([data, name, this](CommandBuffer& cmdBuffer) {
-        return CreateParameterBlock(data, name, cmdBuffer, m_mainDescriptorPool.get());
-    });
-    return task.get();
+    PendingUploads uploads;
+    auto parameterBlock = CreateParameterBlock(data, name, uploads);
+    return ScheduleUploads(std::move(parameterBlock), std::move(uploads), std::move(stopToken));
 }
 
-ParameterBlock
-VulkanDevice::CreateParameterBlock(const ParameterBlockData& data, const char* name, CommandBuffer& cmdBuffer, uint32 threadIndex)
+PendingResource<std::vector<ParameterBlock>> VulkanDevice::CreateParameterBlocks(
+    std::span<const ParameterBlockData> data, const char* name, std::stop_token stopToken)
 {
-    return CreateParameterBlock(data, name, cmdBuffer, m_workerDescriptorPools[threadIndex].get());
+    spdlog::debug("Creating {} parameter blocks '{}'", data.size(), name);
+
+    vk::DeviceSize stagingSize = 0;
+    for (const auto& pblockData : data)
+    {
+        const bool hasUniformBuffer = pblockData.layout && !GetImpl(*pblockData.layout).HasPushConstants();
+        if (hasUniformBuffer && pblockData.lifetime == ResourceLifetime::Permanent)
+        {
+            stagingSize = AlignStagingOffset(stagingSize) + pblockData.parameters.uniformData.size();
+        }
+    }
+
+    PendingUploads uploads;
+    ReserveStagingSpace(uploads, stagingSize, StagingAlignment);
+
+    std::vector<ParameterBlock> parameterBlocks;
+    parameterBlocks.reserve(data.size());
+    for (usize i = 0; i < data.size(); i++)
+    {
+        parameterBlocks.push_back(CreateParameterBlock(data[i], CStr(GetItemName(name, i)), uploads));
+    }
+
+    return ScheduleUploads(std::move(parameterBlocks), std::move(uploads), std::move(stopToken));
 }
 
-ParameterBlock VulkanDevice::CreateParameterBlock(
-    const ParameterBlockData& data, const char* name, CommandBuffer& cmdBuffer, vk::DescriptorPool descriptorPool)
+ParameterBlock VulkanDevice::CreateParameterBlock(const ParameterBlockData& data, const char* name, PendingUploads& uploads)
 {
     if (!data.layout)
     {
@@ -1452,27 +2181,24 @@ ParameterBlock VulkanDevice::CreateParameterBlock(
     const bool isPushConstant = layout.HasPushConstants();
     const auto setLayout = layout.setLayout.get();
 
-    VulkanParameterBlock ret{layout};
+    VulkanParameterBlock ret{GetImpl(data.layout)};
     ret.textures = data.parameters.textures;
+    ret.residencyEpoch = m_textureResidency.GetEpoch();
     if (setLayout)
     {
         if (!isPushConstant && !data.parameters.uniformData.empty())
         {
             ret.uniformBuffer = MakeHandle(
-                CreateBufferWithData(data.parameters.uniformData, BufferUsage::Uniform, data.lifetime, cmdBuffer));
+                CreateBufferWithData(data.parameters.uniformData, BufferUsage::Uniform, data.lifetime, uploads));
             SetDebugName(ret.uniformBuffer->buffer, "{}UniformBuffer", name);
         }
 
-        const vk::DescriptorSetAllocateInfo allocInfo = {
-            .descriptorPool = descriptorPool,
-            .descriptorSetCount = 1,
-            .pSetLayouts = &setLayout,
-        };
-
-        ret.descriptorSet = std::move(m_device->allocateDescriptorSetsUnique(allocInfo).front());
-        SetDebugName(ret.descriptorSet, "{}DescriptorSet", name);
+        // Parameter blocks can be created on any thread, so the descriptor set comes from the calling thread's pool
+        ret.descriptorSet = m_descriptorPool.Allocate(setLayout, DebugFormat("{}DescriptorSet", name).c_str());
 
-        ret.written = WriteDescriptorSet(ret.descriptorSet.get(), ret.uniformBuffer.get(), ret.textures);
+        // If a texture is evicted before this, the descriptor set is written when the texture is made resident again
+        const auto textureUses = AddTextureUses(ret.textures);
+        ret.written = WriteDescriptorSet(layout, ret.descriptorSet.get(), ret.uniformBuffer.get(), ret.textures);
     }
 
     if (isPushConstant)
@@ -1487,7 +2213,8 @@ void VulkanDevice::InitParameterBlock(VulkanParameterBlock& pblock)
 {
     if (pblock.descriptorSet && !pblock.written)
     {
-        pblock.written = WriteDescriptorSet(pblock.descriptorSet.get(), pblock.uniformBuffer.get(), pblock.textures);
+        pblock.written = WriteDescriptorSet(
+            *pblock.layout, pblock.descriptorSet.get(), pblock.uniformBuffer.get(), pblock.textures);
         TEIDE_ASSERT(pblock.written);
     }
 }
@@ -1522,7 +2249,7 @@ VulkanDevice::CreateTransientParameterBlock(const ParameterBlockData& data, cons
                 uniformBufferName.c_str()));
         }
         ret.descriptorSet = descriptorPool.Allocate(descriptorSetName.c_str());
-        WriteDescriptorSet(ret.descriptorSet, ret.uniformBuffer.get(), ret.textures);
+        WriteDescriptorSet(layout, ret.descriptorSet, ret.uniformBuffer.get(), ret.textures);
     }
 
     return ret;
@@ -1539,7 +2266,7 @@ void VulkanDevice::UpdateTransientParameterBlock(TransientParameterBlock& pblock
 
     if (pblock.descriptorSet)
     {
-        WriteDescriptorSet(pblock.descriptorSet, pblock.uniformBuffer.get(), pblock.textures);
+        WriteDescriptorSet(GetImpl(*data.layout), pblock.descriptorSet, pblock.uniformBuffer.get(), pblock.textures);
     }
 }
 
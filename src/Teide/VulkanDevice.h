@@ -2,7 +2,11 @@
 #pragma once
 
 #include "CommandBuffer.h"
+#include "GeometryHeap.h"
+#include "SamplerCache.h"
 #include "Scheduler.h"
+#include "StagingRing.h"
+#include "TextureResidency.h"
 #include "Vulkan.h"
 #include "VulkanBuffer.h"
 #include "VulkanKernel.h"
@@ -15,13 +19,22 @@
 #include "Teide/Hash.h"
 #include "Teide/Renderer.h"
 #include "Teide/Surface.h"
+#include "Teide/Util/MemoryCounter.h"
 #include "Teide/Util/ResourceMap.h"
 
 #include <vulkan/vulkan_hash.hpp>
 
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
 #include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace Teide
 {
@@ -69,6 +82,8 @@ public:
 
     RendererPtr CreateRenderer(ShaderEnvironmentPtr shaderEnvironment) override;
 
+    TaskScheduler GetTaskScheduler() override { return m_scheduler.GetCpuScheduler(); }
+
     BufferPtr CreateBuffer(const BufferData& data, const char* name) override;
 
     ShaderEnvironmentPtr CreateShaderEnvironment(const ShaderEnvironmentData& data, const char* name) override;
@@ -79,12 +94,36 @@ public:
     PipelinePtr CreatePipeline(const PipelineData& data) override;
     ParameterBlock CreateParameterBlock(const ParameterBlockData& data, const char* name) override;
 
+    PendingResource<BufferPtr>
+    CreateBufferAsync(const BufferData& data, const char* name, std::stop_token stopToken = {}) override;
+    PendingResource<Texture>
+    CreateTextureAsync(const TextureData& data, const char* name, std::stop_token stopToken = {}) override;
+    PendingResource<MeshPtr>
+    CreateMeshAsync(const MeshData& data, const char* name, std::stop_token stopToken = {}) override;
+    PendingResource<ParameterBlock> CreateParameterBlockAsync(
+        const ParameterBlockData& data, const char* name, std::stop_token stopToken = {}) override;
+
+    PendingResource<std::vector<Texture>>
+    CreateTextures(std::span<const TextureData> data, const char* name, std::stop_token stopToken = {}) override;
+    PendingResource<std::vector<MeshPtr>>
+    CreateMeshes(std::span<const MeshData> data, const char* name, std::stop_token stopToken = {}) override;
+    PendingResource<std::vector<ParameterBlock>> CreateParameterBlocks(
+        std::span<const ParameterBlockData> data, const char* name, std::stop_token stopToken = {}) override;
+
+    MemoryStatistics GetMemoryStatistics() override;
+    std::string DumpMemoryStatistics(bool detailed) override;
+
     // Internal
     vk::Device GetVulkanDevice() { return m_device.get(); }
     vk::Queue GetGraphicsQueue() { return m_graphicsQueue; }
     vma::Allocator& GetAllocator() { return m_allocator.get(); }
     Scheduler& GetScheduler() { return m_scheduler; }
     QueueFamilies GetQueueFamilies() const { return m_physicalDevice.queueFamilies; }
+    const GraphicsSettings& GetSettings() const { return m_settings; }
+    vk::DeviceSize GetUniformBufferAlignment() const
+    {
+        return m_physicalDevice.properties.limits.minUniformBufferOffsetAlignment;
+    }
 
     template <class T>
     auto& GetImpl(T& obj)
@@ -117,30 +156,96 @@ public:
         return std::dynamic_pointer_cast<const typename VulkanImpl<std::remove_const_t<T>>::type>(ptr);
     }
 
-    TextureState CreateTextureImpl(VulkanTexture& texture);
+    // One for each category in MemoryStatistics
+    struct MemoryCounters
+    {
+        MemoryCounter textures;
+        MemoryCounter renderTargets;
+        MemoryCounter meshes;
+        MemoryCounter uniformBuffers;
+        MemoryCounter staging;
+        MemoryCounter buffers;
+    };
+
+    MemoryCounters& GetMemoryCounters() { return m_memoryCounters; }
+
+    TextureState CreateTextureImpl(VulkanTexture& texture, MemoryCounter& memoryCounter);
+
+    // Somewhere in a staging buffer that has been filled with data to upload
+    struct StagingRange
+    {
+        vk::Buffer buffer;
+        vk::DeviceSize offset = 0;
+    };
+
+    // A copy out of a staging buffer that has been prepared, but not yet recorded into a command buffer
+    struct BufferUpload
+    {
+        StagingRange source;
+        vk::Buffer target;
+        vk::DeviceSize targetOffset = 0;
+        vk::DeviceSize size = 0;
+        bool concurrent = false; // The target is shared between queues, so its ownership isn't transferred
+    };
+
+    // A texture whose image has been created, with its initial contents (if any) waiting in a staging buffer
+    struct TextureUpload
+    {
+        Texture texture;
+        TextureState state;
+        std::optional<StagingRange> source;
+    };
+
+    // Resources are created (and their data copied to staging buffers) on the calling thread, so that their handles
+    // can be used straight away. The copies are recorded later, on whichever thread records the command buffer.
+    struct PendingUploads
+    {
+        std::vector<BufferUpload> buffers;
+        std::vector<TextureUpload> textures;
+        std::vector<StagingRing::Range> staging;
+        vk::DeviceSize stagingOffset = 0; // Next free byte in the last staging range
+        std::vector<TextureResidency::Use> textureUses; // Textures that are being made resident again
+    };
+
+    // Reserve one staging range big enough for all of the data that is about to be staged
+    void ReserveStagingSpace(PendingUploads& uploads, vk::DeviceSize size, vk::DeviceSize alignment);
+    StagingRange StageData(PendingUploads& uploads, BytesView data, vk::DeviceSize alignment);
+    // Uploads are recorded in two halves: the copies, which can go on the transfer queue, and the transitions that
+    // make the resources usable for rendering, which go on the graphics queue. If the queues are different, the
+    // halves also release and acquire ownership of the resources.
+    void RecordUploadCopies(PendingUploads& uploads, CommandBuffer& cmdBuffer);
+    void RecordUploadTransitions(PendingUploads& uploads, CommandBuffer& cmdBuffer);
+    bool IsTransferringOwnership() const { return m_scheduler.HasTransferQueue(); }
+
+    template <class T>
+    PendingResource<T> ScheduleUploads(T resource, PendingUploads uploads, std::stop_token stopToken = {});
 
     VulkanBufferData CreateBufferUninitialized(
-        vk::DeviceSize size, vk::BufferUsageFlags usage, vma::AllocationCreateFlags allocationFlags = {},
-        vma::MemoryUsage memoryUsage = vma::MemoryUsage::eAuto);
-    VulkanBuffer CreateBufferWithData(BytesView data, BufferUsage usage, ResourceLifetime lifetime, CommandBuffer& cmdBuffer);
-    void SetBufferData(VulkanBuffer& buffer, BytesView data);
+        vk::DeviceSize size, vk::BufferUsageFlags usage, MemoryCounter& memoryCounter,
+        vma::AllocationCreateFlags allocationFlags = {}, vma::MemoryUsage memoryUsage = vma::MemoryUsage::eAuto);
+    VulkanBuffer
+    CreateBufferWithData(BytesView data, BufferUsage usage, ResourceLifetime lifetime, PendingUploads& uploads);
+    void SetBufferData(VulkanBufferData& buffer, BytesView data);
 
     SurfacePtr CreateSurface(vk::UniqueSurfaceKHR surface, Geo::Size2i size, bool multisampled);
-    BufferPtr CreateBuffer(const BufferData& data, const char* name, CommandBuffer& cmdBuffer);
+    BufferPtr CreateBuffer(const BufferData& data, const char* name, PendingUploads& uploads);
     VulkanBuffer CreateTransientBuffer(const BufferData& data, const char* name);
     Texture AllocateTexture(const TextureProperties& props, const SamplerState& samplerState = {});
-    Texture CreateTexture(const TextureData& data, const char* name, CommandBuffer& cmdBuffer);
+    Texture CreateTexture(const TextureData& data, const char* name, PendingUploads& uploads);
     Texture CreateRenderableTexture(const TextureData& data, const char* name);
-    Texture CreateRenderableTexture(const TextureData& data, const char* name, CommandBuffer& cmdBuffer);
-    MeshPtr CreateMesh(const MeshData& data, const char* name, CommandBuffer& cmdBuffer);
-    ParameterBlock
-    CreateParameterBlock(const ParameterBlockData& data, const char* name, CommandBuffer& cmdBuffer, uint32 threadIndex);
-    ParameterBlock CreateParameterBlock(
-        const ParameterBlockData& data, const char* name, CommandBuffer& cmdBuffer, vk::DescriptorPool descriptorPool);
+    Texture CreateStorageTexture(const TextureData& data, const char* name);
+    MeshPtr CreateMesh(const MeshData& data, const char* name, PendingUploads& uploads);
+    std::shared_ptr<GeometryHeap::Range>
+    CreateGeometryRange(BytesView data, vk::DeviceSize alignment, PendingUploads& uploads);
+    ParameterBlock CreateParameterBlock(const ParameterBlockData& data, const char* name, PendingUploads& uploads);
     void InitParameterBlock(VulkanParameterBlock& pblock);
     TransientParameterBlock
     CreateTransientParameterBlock(const ParameterBlockData& data, const char* name, DescriptorPool& descriptorPool);
     void UpdateTransientParameterBlock(TransientParameterBlock& pblock, const ParameterBlockData& data);
+    // For layouts with dynamic uniforms, where the offset into the uniform buffer is given when the set is bound
+    bool WriteDynamicDescriptorSet(
+        const VulkanParameterBlockLayout& layout, vk::DescriptorSet descriptorSet, vk::Buffer uniformBuffer,
+        std::span<const Texture> textures);
 
     vk::RenderPass CreateRenderPassLayout(const FramebufferLayout& framebufferLayout);
     vk::RenderPass CreateRenderPass(
@@ -150,9 +255,21 @@ public:
         vk::RenderPass renderPass, const FramebufferLayout& layout, Geo::Size2i size, std::vector<vk::ImageView> attachments);
 
     VulkanParameterBlockLayoutPtr CreateParameterBlockLayout(const ParameterBlockDesc& desc, int set);
+    // The view layout's uniforms are dynamic, so that render lists can share a descriptor set
+    VulkanParameterBlockLayoutPtr CreateViewParameterBlockLayout(const ParameterBlockDesc& desc);
 
     vk::DescriptorSet GetDescriptorSet(const ParameterBlock& parameterBlock);
 
+    // Called at the start of each frame. Evicts textures if device memory is over budget.
+    void NextFrame();
+    // Must be called (on the thread that schedules the work) before scheduling work that uses the textures, so that
+    // any that have been evicted are made resident again first, and parameter blocks that use them are rewritten.
+    // The work must hold the returned uses until it has run, so that the textures aren't evicted while it reads them.
+    using TextureUses = std::vector<TextureResidency::Use>;
+    [[nodiscard]] TextureUses PrepareTextures(std::span<const Texture> textures);
+    [[nodiscard]] TextureUses PrepareRenderList(const RenderList& renderList);
+    uint64 GetTextureResidencyEpoch() const { return m_textureResidency.GetEpoch(); }
+
     /**
      * Record a one-shot command buffer, submit it immediately, and wait for the GPU to finish executing it.
      *
@@ -181,12 +298,35 @@ private:
         void Visit(auto f) const { return f(renderPass, size, attachments); }
     };
 
-    vk::UniqueSampler CreateSampler(const SamplerState& ss);
+    // Resources are destroyed once the GPU has finished any work that was scheduled before they were released
+    template <class T>
+    auto MakeDeferredDestroy()
+    {
+        return [this](T&& resource) { m_scheduler.DestroyAfterGpuWork(std::move(resource)); };
+    }
 
-    vk::UniqueDescriptorSet CreateUniqueDescriptorSet(
-        vk::DescriptorPool pool, vk::DescriptorSetLayout layout, const Buffer* uniformBuffer,
-        std::span<const Texture> textures, const char* name);
-    bool WriteDescriptorSet(vk::DescriptorSet descriptorSet, const Buffer* uniformBuffer, std::span<const Texture> textures);
+    template <class T, class... Args>
+    std::shared_ptr<T> MakeGpuShared(Args&&... args)
+    {
+        return std::shared_ptr<T>(new T(std::forward<Args>(args)...), [this](T* object) {
+            m_scheduler.DestroyAfterGpuWork(std::unique_ptr<T>(object));
+        });
+    }
+
+    void EvictTextures();
+    void UpdatePeakHeapUsage(std::span<const vma::Budget> heapBudgets);
+    void PrepareTextures(std::span<const Texture> textures, PendingUploads& uploads, TextureUses& uses);
+    void PrepareParameterBlock(const ParameterBlock& parameterBlock, PendingUploads& uploads, TextureUses& uses);
+    // Keeps the textures from being evicted, without making them resident
+    TextureUses AddTextureUses(std::span<const Texture> textures);
+
+    // The uniform buffer's descriptor type comes from the layout
+    bool WriteDescriptorSet(
+        const VulkanParameterBlockLayout& layout, vk::DescriptorSet descriptorSet, const Buffer* uniformBuffer,
+        std::span<const Texture> textures);
+    bool WriteDescriptorSet(
+        const VulkanParameterBlockLayout& layout, vk::DescriptorSet descriptorSet,
+        const std::optional<vk::DescriptorBufferInfo>& uniformBufferInfo, std::span<const Texture> textures);
 
     VulkanLoader m_loader;
     vk::UniqueInstance m_instance;
@@ -202,12 +342,24 @@ private:
     std::unordered_map<FramebufferDesc, vk::UniqueFramebuffer, Hash<FramebufferDesc>> m_framebufferCache;
 
     vk::Queue m_graphicsQueue;
-    vk::UniqueDescriptorPool m_mainDescriptorPool;
-    std::vector<vk::UniqueDescriptorPool> m_workerDescriptorPools;
+    SharedDescriptorPool m_descriptorPool;
     vk::UniqueCommandPool m_setupCommandPool;
     vk::UniqueCommandPool m_surfaceCommandPool;
 
+    // The counters outlive everything that is counted
+    MemoryCounters m_memoryCounters;
+    std::mutex m_peakHeapUsageMutex;
+    std::vector<uint64> m_peakHeapUsage;
+
     vma::UniqueAllocator m_allocator;
+    GeometryHeap m_geometryHeap;
+    StagingRing m_stagingRing;
+    TextureResidency m_textureResidency;
+    SamplerCache m_samplerCache;
+
+    // The scheduler outlives the resource maps, so that resources released while the maps are destroyed (e.g. a
+    // parameter block's textures) can still be handed to it
+    Scheduler m_scheduler;
 
     ResourceMap<Texture, VulkanTexture> m_textures;
     ResourceMap<Kernel, VulkanKernel> m_kernels;
@@ -218,8 +370,6 @@ private:
         &VulkanDevice::m_kernels,
         &VulkanDevice::m_parameterBlocks,
     };
-
-    Scheduler m_scheduler;
 };
 
 using VulkanDevicePtr = std::unique_ptr<VulkanDevice>;
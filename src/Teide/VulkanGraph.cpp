@@ -60,7 +60,7 @@ void VulkanGraph::WriteNode::Process(VulkanGraph& graph, VulkanDevice& device, v
     spdlog::info("Size: {}", sourceNode.data.pixels.size());
     const auto bufferSize = GetByteSize(sourceNode.data);
     stagingBuffer = device.CreateBufferUninitialized(
-        bufferSize, vk::BufferUsageFlagBits::eTransferSrc,
+        bufferSize, vk::BufferUsageFlagBits::eTransferSrc, device.GetMemoryCounters().staging,
         vma::AllocationCreateFlagBits::eMapped | vma::AllocationCreateFlagBits::eHostAccessSequentialWrite);
     std::ranges::fill(stagingBuffer.mappedData, std::byte{0xab});
 
@@ -101,7 +101,7 @@ void VulkanGraph::ReadNode::Process(VulkanGraph& graph, VulkanDevice& device, vk
     const auto bufferSize = GetByteSize(data);
     spdlog::info("Size: {}", bufferSize);
     stagingBuffer = device.CreateBufferUninitialized(
-        bufferSize, vk::BufferUsageFlagBits::eTransferDst,
+        bufferSize, vk::BufferUsageFlagBits::eTransferDst, device.GetMemoryCounters().staging,
         vma::AllocationCreateFlagBits::eMapped | vma::AllocationCreateFlagBits::eHostAccessRandom);
     std::ranges::fill(stagingBuffer.mappedData, std::byte{0xef});
 
@@ -425,7 +425,7 @@ namespace
         {
             VulkanTexture& texture = device.GetImpl(node.texture);
             texture.usage = node.usage;
-            device.CreateTextureImpl(texture);
+            device.CreateTextureImpl(texture, device.GetMemoryCounters().renderTargets);
         }
 
         // Record command buffers
@@ -10,11 +10,28 @@ namespace Teide
 
 class MemoryAllocator;
 
+// Where a mesh's data is bound from
+struct VulkanBufferBinding
+{
+    vk::Buffer buffer;
+    vk::DeviceSize offset = 0;
+
+    bool operator==(const VulkanBufferBinding&) const = default;
+};
+
 struct VulkanMesh : public Mesh
 {
     VertexLayout vertexLayout;
-    std::shared_ptr<VulkanBuffer> vertexBuffer;
-    std::shared_ptr<VulkanBuffer> indexBuffer;
+    // Usually ranges of the device's GeometryHeap, whose buffers are shared with other meshes. Transient meshes have
+    // buffers of their own.
+    BufferPtr vertexBuffer;
+    BufferPtr indexBuffer;
+    VulkanBufferBinding vertexBinding;
+    VulkanBufferBinding indexBinding;
+    // Meshes in the geometry heap are bound from the start of their block, and their draws start at these offsets
+    // instead, so that consecutive draws from the same block don't need to rebind
+    int32 vertexOffset = 0;
+    uint32 firstIndex = 0;
     uint32 vertexCount = 0;
     uint32 indexCount = 0;
     vk::IndexType indexType = vk::IndexType::eUint16;
@@ -9,6 +9,7 @@
 #include <vulkan/vulkan.hpp>
 
 #include <ranges>
+#include <utility>
 
 namespace Teide
 {
@@ -31,7 +32,8 @@ namespace
     }
 } // namespace
 
-VulkanParameterBlockLayout::VulkanParameterBlockLayout(const ParameterBlockLayoutData& data, vk::Device device)
+VulkanParameterBlockLayout::VulkanParameterBlockLayout(const ParameterBlockLayoutData& data, vk::Device device) :
+    dynamicUniforms{data.dynamicUniforms}
 {
     std::optional<vk::DescriptorSetLayoutBinding> uniformBinding;
 
@@ -49,7 +51,8 @@ VulkanParameterBlockLayout::VulkanParameterBlockLayout(const ParameterBlockLayou
         {
             uniformBinding = {
                 .binding = 0,
-                .descriptorType = vk::DescriptorType::eUniformBuffer,
+                .descriptorType
+                = dynamicUniforms ? vk::DescriptorType::eUniformBufferDynamic : vk::DescriptorType::eUniformBuffer,
                 .descriptorCount = 1,
                 .stageFlags = GetShaderStageFlags(data.uniformsStages),
             };
@@ -91,11 +94,12 @@ bool VulkanParameterBlockLayout::HasPushConstants() const
     return pushConstantRange.has_value();
 }
 
-VulkanParameterBlock::VulkanParameterBlock(const VulkanParameterBlockLayout& layout)
+VulkanParameterBlock::VulkanParameterBlock(VulkanParameterBlockLayoutPtr layout) : layout{std::move(layout)}
 {
-    if (layout.pushConstantRange.has_value())
+    const auto& pushConstantRange = this->layout->pushConstantRange;
+    if (pushConstantRange.has_value())
     {
-        pushConstantData.resize(layout.pushConstantRange->size - layout.pushConstantRange->offset);
+        pushConstantData.resize(pushConstantRange->size - pushConstantRange->offset);
     }
 }
 
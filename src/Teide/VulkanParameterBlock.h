@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include "DescriptorPool.h"
 #include "Vulkan.h"
 #include "VulkanBuffer.h"
 
@@ -28,6 +29,7 @@ struct VulkanParameterBlockLayout : public ParameterBlockLayout
     uint32 uniformBufferSize = 0;
     std::optional<vk::PushConstantRange> pushConstantRange;
     vk::ShaderStageFlags uniformsStages;
+    bool dynamicUniforms = false; // The uniform buffer is bound with a dynamic offset
 
     VulkanParameterBlockLayout() = default;
     explicit VulkanParameterBlockLayout(const ParameterBlockLayoutData& data, vk::Device device);
@@ -47,14 +49,16 @@ struct VulkanImpl<ParameterBlockLayout>
 
 struct VulkanParameterBlock
 {
+    VulkanParameterBlockLayoutPtr layout;
     std::shared_ptr<VulkanBuffer> uniformBuffer;
     std::vector<Texture> textures;
-    vk::UniqueDescriptorSet descriptorSet;
+    PooledDescriptorSet descriptorSet;
     std::vector<byte> pushConstantData;
     bool written = false;
+    uint64 residencyEpoch = 0; // The texture residency epoch when the descriptor set was last checked
 
     VulkanParameterBlock() = default;
-    explicit VulkanParameterBlock(const VulkanParameterBlockLayout& layout);
+    explicit VulkanParameterBlock(VulkanParameterBlockLayoutPtr layout);
 
     usize GetUniformBufferSize() const;
     usize GetPushConstantSize() const;
@@ -67,6 +71,15 @@ struct TransientParameterBlock
     vk::DescriptorSet descriptorSet;
 };
 
+// A descriptor set for a layout with dynamic uniforms, along with where its uniforms are in the uniform buffer
+struct DynamicDescriptorSet
+{
+    vk::DescriptorSet descriptorSet;
+    std::optional<uint32> uniformOffset;
+
+    explicit operator bool() const { return static_cast<bool>(descriptorSet); }
+};
+
 template <>
 struct VulkanImpl<ParameterBlock>
 {
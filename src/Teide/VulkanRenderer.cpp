@@ -4,6 +4,7 @@
 #include "Vulkan.h"
 #include "VulkanBuffer.h"
 #include "VulkanDevice.h"
+#include "VulkanKernel.h"
 #include "VulkanMesh.h"
 #include "VulkanParameterBlock.h"
 #include "VulkanPipeline.h"
@@ -21,7 +22,12 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <iterator>
 #include <ranges>
+#include <span>
+#include <utility>
+#include <vector>
 
 namespace Teide
 {
@@ -29,9 +35,16 @@ namespace Teide
 namespace
 {
     constexpr uint32 ViewDescriptorPoolSize = 8;
+    constexpr uint32 KernelDescriptorPoolSize = 4;
 
     const vk::Optional<const vk::AllocationCallbacks> s_allocator = nullptr;
 
+    VulkanParameterBlockLayoutPtr
+    GetViewPblockLayout(VulkanDevice& device, const ShaderEnvironmentPtr& shaderEnvironment)
+    {
+        return shaderEnvironment ? device.GetImpl(shaderEnvironment->GetViewPblockLayout()) : nullptr;
+    }
+
     vk::Viewport MakeViewport(Geo::Size2i size, const ViewportRegion& region = {})
     {
         return {
@@ -69,6 +82,30 @@ namespace
         return clearValues;
     }
 
+    void SetViewportAndScissor(vk::CommandBuffer commandBuffer, const RenderList& renderList, const Framebuffer& framebuffer)
+    {
+        const auto viewport = MakeViewport(framebuffer.size, renderList.viewportRegion);
+        commandBuffer.setViewport(0, viewport);
+        const auto scissor = renderList.scissor
+            ? ToVulkan(*renderList.scissor)
+            : vk::Rect2D{.extent = {.width = framebuffer.size.x, .height = framebuffer.size.y}};
+        commandBuffer.setScissor(0, scissor);
+    }
+
+    void BeginRenderPass(
+        vk::CommandBuffer commandBuffer, const RenderList& renderList, vk::RenderPass renderPass,
+        const Framebuffer& framebuffer, vk::SubpassContents contents)
+    {
+        const vkex::RenderPassBeginInfo renderPassBegin = {
+            .renderPass = renderPass,
+            .framebuffer = framebuffer.framebuffer,
+            .renderArea = {.offset = {.x = 0, .y = 0}, .extent = {.width = framebuffer.size.x, .height = framebuffer.size.y}},
+            .clearValues = MakeClearValues(framebuffer, renderList.clearState),
+        };
+
+        commandBuffer.beginRenderPass(renderPassBegin, contents);
+    }
+
     DescriptorPool MakeSceneDescriptorPool(VulkanDevice& device, const ShaderEnvironmentPtr& shaderEnvironment)
     {
         const auto vkdevice = device.GetVulkanDevice();
@@ -76,17 +113,81 @@ namespace
         if (shaderEnvironment)
         {
             const auto scenePblockLayout = device.GetImpl(shaderEnvironment->GetScenePblockLayout());
-            return DescriptorPool(vkdevice, *scenePblockLayout, MaxFramesInFlight);
+            return DescriptorPool(vkdevice, *scenePblockLayout, device.GetSettings().framesInFlight);
+        }
+
+        return DescriptorPool(vkdevice, {}, device.GetSettings().framesInFlight);
+    }
+
+    std::vector<vk::ImageMemoryBarrier> MakeReleaseBarriers(
+        std::span<const vk::ImageMemoryBarrier> barriers, uint32 srcQueueFamily, uint32 dstQueueFamily)
+    {
+        return barriers | std::views::transform([=](const vk::ImageMemoryBarrier& barrier) {
+                   return MakeReleaseBarrier(barrier, srcQueueFamily, dstQueueFamily);
+               })
+            | std::ranges::to<std::vector>();
+    }
+
+    std::vector<vk::ImageMemoryBarrier> MakeAcquireBarriers(
+        std::span<const vk::ImageMemoryBarrier> barriers, uint32 srcQueueFamily, uint32 dstQueueFamily)
+    {
+        return barriers | std::views::transform([=](const vk::ImageMemoryBarrier& barrier) {
+                   return MakeAcquireBarrier(barrier, srcQueueFamily, dstQueueFamily);
+               })
+            | std::ranges::to<std::vector>();
+    }
+
+    // Kernel texture inputs are bound as sampled images after the uniform buffer, followed by the outputs as storage
+    // images, each in the order the kernel declares them
+    void WriteKernelResources(
+        VulkanDevice& device, vk::DescriptorSet descriptorSet, std::span<const Texture> inputs,
+        std::span<const Texture> outputs)
+    {
+        std::vector<vk::DescriptorImageInfo> imageInfos;
+        imageInfos.reserve(inputs.size() + outputs.size());
+        std::vector<vk::WriteDescriptorSet> descriptorWrites;
+        descriptorWrites.reserve(inputs.size() + outputs.size());
+        for (const auto& input : inputs)
+        {
+            const VulkanTexture& textureImpl = device.GetImpl(input);
+            imageInfos.push_back({
+                .sampler = textureImpl.sampler->get(),
+                .imageView = textureImpl.imageView.get(),
+                .imageLayout = textureImpl.GetShaderInputLayout(),
+            });
+            descriptorWrites.push_back({
+                .dstSet = descriptorSet,
+                .dstBinding = size32(descriptorWrites) + 1,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+                .pImageInfo = &imageInfos.back(),
+            });
+        }
+        for (const auto& output : outputs)
+        {
+            imageInfos.push_back({
+                .imageView = device.GetImpl(output).imageView.get(),
+                .imageLayout = vk::ImageLayout::eGeneral,
+            });
+            descriptorWrites.push_back({
+                .dstSet = descriptorSet,
+                .dstBinding = size32(descriptorWrites) + 1,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = vk::DescriptorType::eStorageImage,
+                .pImageInfo = &imageInfos.back(),
+            });
         }
 
-        return DescriptorPool(vkdevice, {}, MaxFramesInFlight);
+        device.GetVulkanDevice().updateDescriptorSets(descriptorWrites, {});
     }
 
 } // namespace
 
 /*
 This is how CPU-GPU synchronisation works, using an example where the application is GPU-bound.
-The frame number is modded with the MaxFramesInFlight (2 in this example).
+The frame number is modded with GraphicsSettings::framesInFlight (2 in this example).
 
  1. The CPU processes frame 0 and submits it to the GPU
  2. The CPU immediately moves on to frame 1 while the GPU starts processing frame 0
@@ -114,7 +215,7 @@ VulkanRenderer::VulkanRenderer(VulkanDevice& device, const QueueFamilies& queueF
     m_graphicsQueue{device.GetVulkanDevice().getQueue(queueFamilies.graphicsFamily, 0)},
     m_shaderEnvironment{std::move(shaderEnvironment)},
     m_sceneDescriptorPool(MakeSceneDescriptorPool(device, m_shaderEnvironment)),
-    m_frameResources(device, m_sceneDescriptorPool, m_shaderEnvironment)
+    m_frameResources(device.GetSettings().framesInFlight, device, m_sceneDescriptorPool, m_shaderEnvironment)
 {
     using std::ranges::generate;
     const auto vkdevice = device.GetVulkanDevice();
@@ -132,7 +233,7 @@ VulkanRenderer::~VulkanRenderer()
 
     // Wait for all frames' fences
     constexpr auto timeout = std::chrono::seconds{1};
-    for (usize i = 0; i < MaxFramesInFlight; i++)
+    for (uint32 i = 0; i < m_frameResources.Size(); i++)
     {
         const vk::Fence fence = m_frameResources.Current().inFlightFence.get();
         m_frameResources.NextFrame();
@@ -153,21 +254,23 @@ void VulkanRenderer::BeginFrame(ShaderParameters sceneParameters)
     [[maybe_unused]] const auto waitResult = m_device.GetVulkanDevice().waitForFences(inFlightFence, true, timeout);
     TEIDE_ASSERT(waitResult == vk::Result::eSuccess); // TODO check if waitForFences can fail with no timeout
 
-    m_device.GetScheduler().NextFrame();
-
+    // The scene's descriptor set is used by everything in the frame, so its textures are kept until the GPU has
+    // finished the frame. This frame's last textures can be evicted now.
     auto& frameResources = m_frameResources.Current();
+    frameResources.sceneTextureUses.clear();
+
+    m_device.NextFrame();
+
+    frameResources.sceneTextureUses = m_device.PrepareTextures(sceneParameters.textures);
     const ParameterBlockData pblockData = {
         .layout = m_shaderEnvironment ? m_shaderEnvironment->GetScenePblockLayout() : nullptr,
         .lifetime = ResourceLifetime::Transient,
         .parameters = std::move(sceneParameters),
     };
     m_device.UpdateTransientParameterBlock(frameResources.sceneParameters, pblockData);
-    frameResources.threadResources.LockAll([](ThreadResources& threadResources) {
-        if (threadResources.viewDescriptorPool)
-        {
-            threadResources.viewDescriptorPool->Reset();
-        }
-        threadResources.viewParameters.clear();
+    frameResources.threadResources.ForEach([](ThreadResources& threadResources) {
+        threadResources.ResetViewParameters();
+        threadResources.kernelDescriptorPools.clear();
     });
 }
 
@@ -179,6 +282,13 @@ void VulkanRenderer::EndFrame()
 
     WaitForCpu();
 
+    m_lastFrameStatistics = {
+        .recordedChunks = m_recordedChunks.Lock([](auto& chunks) { return std::exchange(chunks, {}); }),
+    };
+    m_frameResources.Current().threadResources.ForEach([this](ThreadResources& threadResources) {
+        m_lastFrameStatistics.viewDescriptorSetWrites += std::exchange(threadResources.viewDescriptorSetWrites, 0);
+    });
+
     std::vector<SurfaceImage> images = m_surfacesToPresent.Lock([&](auto& s) { return std::exchange(s, {}); });
     if (images.empty())
     {
@@ -218,7 +328,8 @@ void VulkanRenderer::WaitForGpu()
     m_device.GetVulkanDevice().waitIdle();
 }
 
-RenderToTextureResult VulkanRenderer::RenderToTexture(const RenderTargetInfo& renderTarget, RenderList renderList)
+RenderToTextureResult
+VulkanRenderer::RenderToTexture(const RenderTargetInfo& renderTarget, RenderList renderList, std::stop_token stopToken)
 {
     TEIDE_ASSERT(
         renderTarget.framebufferLayout.captureColor || renderTarget.framebufferLayout.captureDepthStencil,
@@ -263,50 +374,55 @@ RenderToTextureResult VulkanRenderer::RenderToTexture(const RenderTargetInfo& re
             : std::nullopt,
     };
 
-    ScheduleGpu([this, renderList = std::move(renderList), rt, renderTarget](CommandBuffer& commandBuffer) mutable {
-        const auto viewParameters = CreateViewParameters(renderList);
-
-        const auto sceneParameters = GetSceneParameterBlock().descriptorSet;
-
-        std::vector<vk::ImageView> attachments;
+    auto textureUses = m_device.PrepareRenderList(renderList);
+    auto rendered = ScheduleGpu(
+        [this, renderList = std::move(renderList), textureUses = std::move(textureUses), rt,
+         renderTarget](CommandBuffer& commandBuffer) mutable {
+            const auto viewParameters = CreateViewParameters(renderList);
 
-        const auto addAttachment = [&](const std::optional<Texture>& texture) {
-            spdlog::debug("texture: {}", texture ? texture->GetName() : "null");
-            if (texture.has_value())
-            {
-                const auto& textureImpl = m_device.GetImpl(*texture);
-                TextureState textureState{};
-                textureImpl.TransitionToRenderTarget(textureState, commandBuffer);
-                attachments.push_back(textureImpl.imageView.get());
-            }
-        };
+            const auto sceneParameters = GetSceneParameterBlock().descriptorSet;
 
-        addAttachment(rt.color);
-        addAttachment(rt.depthStencil);
-        addAttachment(rt.colorResolved);
-        addAttachment(rt.depthStencilResolved);
+            std::vector<vk::ImageView> attachments;
+
+            const auto addAttachment = [&](const std::optional<Texture>& texture) {
+                spdlog::debug("texture: {}", texture ? texture->GetName() : "null");
+                if (texture.has_value())
+                {
+                    const auto& textureImpl = m_device.GetImpl(*texture);
+                    // The texture was created for this render, so this is its transition out of its initial layout
+                    TextureState textureState{};
+                    textureImpl.TransitionToRenderTarget(textureState, commandBuffer);
+                    attachments.push_back(textureImpl.imageView.get());
+                }
+            };
 
-        const RenderPassDesc renderPassDesc = {
-            .framebufferLayout = renderTarget.framebufferLayout,
-            .renderOverrides = renderList.renderOverrides,
-        };
+            addAttachment(rt.color);
+            addAttachment(rt.depthStencil);
+            addAttachment(rt.colorResolved);
+            addAttachment(rt.depthStencilResolved);
 
-        const auto renderPass = m_device.CreateRenderPass(
-            renderTarget.framebufferLayout, renderList.clearState, FramebufferUsage::ShaderInput);
-        const auto framebuffer
-            = m_device.CreateFramebuffer(renderPass, renderTarget.framebufferLayout, renderTarget.size, attachments);
+            const RenderPassDesc renderPassDesc = {
+                .framebufferLayout = renderTarget.framebufferLayout,
+                .renderOverrides = renderList.renderOverrides,
+            };
 
-        RecordRenderListCommands(
-            m_device, commandBuffer, renderList, renderPass, renderPassDesc, framebuffer, sceneParameters, viewParameters);
+            const auto renderPass = m_device.CreateRenderPass(
+                renderTarget.framebufferLayout, renderList.clearState, FramebufferUsage::ShaderInput);
+            const auto framebuffer = m_device.CreateFramebuffer(
+                renderPass, renderTarget.framebufferLayout, renderTarget.size, attachments);
 
-        commandBuffer.TakeOwnership(std::move(renderList));
-    });
+            RecordRenderList(
+                commandBuffer, renderList, renderPass, renderPassDesc, framebuffer, sceneParameters, viewParameters);
+            textureUses.clear();
+        },
+        std::move(stopToken));
 
     const auto& colorRet = rt.colorResolved ? rt.colorResolved : rt.color;
     const auto& depthRet = rt.depthStencilResolved ? rt.depthStencilResolved : rt.depthStencil;
     return {
         .colorTexture = renderTarget.framebufferLayout.captureColor ? colorRet : std::nullopt,
         .depthStencilTexture = renderTarget.framebufferLayout.captureDepthStencil ? depthRet : std::nullopt,
+        .rendered = std::move(rendered),
     };
 }
 
@@ -319,7 +435,9 @@ void VulkanRenderer::RenderToSurface(Surface& surface, RenderList renderList)
 
         const auto framebuffer = surfaceImage.framebuffer;
 
-        ScheduleGpu([this, renderList = std::move(renderList), framebuffer](CommandBuffer& commandBuffer) mutable {
+        auto textureUses = m_device.PrepareRenderList(renderList);
+        ScheduleGpu([this, renderList = std::move(renderList), textureUses = std::move(textureUses),
+                     framebuffer](CommandBuffer& commandBuffer) mutable {
             const auto renderPassDesc = RenderPassDesc{
                 .framebufferLayout = framebuffer.layout,
                 .renderOverrides = renderList.renderOverrides,
@@ -334,18 +452,18 @@ void VulkanRenderer::RenderToSurface(Surface& surface, RenderList renderList)
 
             const auto sceneParameters = GetSceneParameterBlock().descriptorSet;
 
-            RecordRenderListCommands(
-                m_device, commandBuffer, renderList, renderPass, renderPassDesc, framebuffer, sceneParameters, viewParameters);
-
-            commandBuffer.TakeOwnership(std::move(renderList));
+            RecordRenderList(
+                commandBuffer, renderList, renderPass, renderPassDesc, framebuffer, sceneParameters, viewParameters);
+            textureUses.clear();
         });
     }
 }
 
-Task<TextureData> VulkanRenderer::CopyTextureData(Texture texture)
+Task<TextureData> VulkanRenderer::CopyTextureData(Texture texture, std::stop_token stopToken)
 {
     TEIDE_ASSERT(texture.GetSampleCount() == 1, "Cannot copy data of a multisampled texture");
 
+    auto textureUses = m_device.PrepareTextures(std::span(&texture, 1));
     const VulkanTexture& textureImpl = m_device.GetImpl(texture);
 
     const TextureData textureData = {
@@ -357,21 +475,49 @@ Task<TextureData> VulkanRenderer::CopyTextureData(Texture texture)
 
     const auto bufferSize = GetByteSize(textureData);
 
-    auto task = ScheduleGpu([this, texture = std::move(texture), bufferSize](CommandBuffer& commandBuffer) {
+    // The graphics queue makes the image a transfer source and back again. If the copy runs on the transfer queue,
+    // ownership of the image goes there and back along with those transitions.
+    const auto queueFamilies = m_device.GetQueueFamilies();
+    const bool transferOwnership = m_device.GetScheduler().HasTransferQueue();
+    const auto makeBarrier = [&textureImpl](vk::ImageLayout oldLayout, vk::ImageLayout newLayout) {
+        return MakeImageTransitionBarrier(
+            textureImpl.image.get(), textureImpl.properties.format, textureImpl.properties.mipLevelCount, oldLayout,
+            newLayout);
+    };
+    const auto shaderInputLayout = textureImpl.GetShaderInputLayout();
+    const auto toTransferSrc = makeBarrier(shaderInputLayout, vk::ImageLayout::eTransferSrcOptimal);
+    const auto toShaderInput = makeBarrier(vk::ImageLayout::eTransferSrcOptimal, shaderInputLayout);
+
+    const auto release = [=](CommandBuffer& commandBuffer) {
+        if (transferOwnership)
+        {
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {},
+                MakeReleaseBarrier(toTransferSrc, queueFamilies.graphicsFamily, queueFamilies.transferFamily));
+        }
+        else
+        {
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
+                toTransferSrc);
+        }
+    };
+
+    // The texture mustn't be evicted until the copy has been recorded
+    const auto copy = [=, this, textureUses = std::move(textureUses)](CommandBuffer& commandBuffer) {
         auto buffer = m_device.CreateBufferUninitialized(
-            bufferSize, vk::BufferUsageFlagBits::eTransferDst,
+            bufferSize, vk::BufferUsageFlagBits::eTransferDst, m_device.GetMemoryCounters().staging,
             vma::AllocationCreateFlagBits::eMapped | vma::AllocationCreateFlagBits::eHostAccessRandom);
 
         const VulkanTexture& textureImpl = m_device.GetImpl(texture);
 
-        commandBuffer.AddReference(texture);
+        if (transferOwnership)
+        {
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
+                MakeAcquireBarrier(toTransferSrc, queueFamilies.graphicsFamily, queueFamilies.transferFamily));
+        }
 
-        const bool isDepthStencil = HasDepthOrStencilComponent(textureImpl.properties.format);
-        TextureState textureState = {
-            .layout = isDepthStencil ? vk::ImageLayout::eDepthStencilReadOnlyOptimal : vk::ImageLayout::eShaderReadOnlyOptimal,
-            .lastPipelineStageUsage = vk::PipelineStageFlagBits::eFragmentShader,
-        };
-        textureImpl.TransitionToTransferSrc(textureState, commandBuffer);
         const vk::Extent3D extent = {
             .width = textureImpl.properties.size.x,
             .height = textureImpl.properties.size.y,
@@ -380,92 +526,338 @@ Task<TextureData> VulkanRenderer::CopyTextureData(Texture texture)
         CopyImageToBuffer(
             commandBuffer, textureImpl.image.get(), buffer.buffer.get(), textureImpl.properties.format, extent,
             textureImpl.properties.mipLevelCount);
-        textureImpl.TransitionToShaderInput(textureState, commandBuffer);
+
+        if (transferOwnership)
+        {
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {},
+                MakeReleaseBarrier(toShaderInput, queueFamilies.transferFamily, queueFamilies.graphicsFamily));
+        }
 
         return std::make_shared<VulkanBuffer>(std::move(buffer));
-    });
+    };
 
-    return m_device.GetScheduler().ScheduleAfter(task, [this, textureData](const BufferPtr& buffer) {
-        const auto& data = m_device.GetImpl(*buffer).mappedData;
+    const auto acquire = [=](CommandBuffer& commandBuffer) {
+        if (transferOwnership)
+        {
+            // The source stage matches the stage that the acquire waits for the transfer at
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {},
+                MakeAcquireBarrier(toShaderInput, queueFamilies.transferFamily, queueFamilies.graphicsFamily));
+        }
+        else
+        {
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {},
+                toShaderInput);
+        }
+    };
 
-        TextureData ret = textureData;
-        ret.pixels.resize(data.size());
-        std::ranges::copy(data, ret.pixels.data());
-        return ret;
-    });
+    auto task = m_device.GetScheduler().ScheduleTransfer(
+        release, copy, acquire, vk::PipelineStageFlagBits::eFragmentShader, std::move(stopToken));
+
+    // Copying the pixels out of the readback buffer can take a while for large textures, so it mustn't hold up frames
+    return m_device.GetScheduler().ScheduleAfter(
+        task,
+        [this, textureData](const BufferPtr& buffer) {
+            const auto& data = m_device.GetImpl(*buffer).mappedData;
+
+            TextureData ret = textureData;
+            ret.pixels.resize(data.size());
+            std::ranges::copy(data, ret.pixels.data());
+            return ret;
+        },
+        TaskPriority::Background);
 }
 
-auto VulkanRenderer::CreateViewParameters(const RenderList& renderList) -> vk::DescriptorSet
+std::vector<Texture> VulkanRenderer::Dispatch(Kernel kernel, DispatchInfo info)
 {
-    const auto viewPblockLayout = m_shaderEnvironment ? m_shaderEnvironment->GetViewPblockLayout() : nullptr;
+    auto textureUses = m_device.PrepareTextures(info.inputs);
 
-    const ParameterBlockData viewParamsData = {
-        .layout = viewPblockLayout,
-        .lifetime = ResourceLifetime::Transient,
-        .parameters = renderList.viewParameters,
+    const auto& kernelInputs = m_device.GetImpl(kernel).inputs;
+    const auto numTextureInputs = std::ranges::count_if(
+        kernelInputs, [](const ShaderVariable& input) { return IsResourceType(input.type.baseType); });
+    TEIDE_ASSERT(
+        std::cmp_equal(info.inputs.size(), numTextureInputs), "Kernel has {} texture inputs, but {} were given",
+        numTextureInputs, info.inputs.size());
+
+    const auto& kernelOutputs = m_device.GetImpl(kernel).outputs;
+    std::vector<Texture> outputs;
+    outputs.reserve(kernelOutputs.size());
+    for (const auto& output : kernelOutputs)
+    {
+        const TextureData data = {
+            .size = info.outputSize,
+            .format = GetKernelOutputFormat(output.type),
+            .mipLevelCount = 1,
+            .sampleCount = 1,
+            .samplerState = info.outputSamplerState,
+        };
+        const auto textureName = fmt::format("{}:{}", info.name, output.name);
+        outputs.push_back(m_device.CreateStorageTexture(data, textureName.c_str()));
+    }
+
+    // Inputs stay in the shader input layout. If the kernel runs on the compute queue, they are lent to it and then
+    // given back. Outputs start out undefined on whichever queue runs the kernel, and end up on the graphics queue in
+    // the shader input layout.
+    const auto queueFamilies = m_device.GetQueueFamilies();
+    const auto graphicsFamily = queueFamilies.graphicsFamily;
+    const auto computeFamily = queueFamilies.computeFamily;
+    const bool transferOwnership = m_device.GetScheduler().HasComputeQueue();
+    const auto makeBarrier = [this](const Texture& texture, vk::ImageLayout oldLayout, vk::ImageLayout newLayout) {
+        const VulkanTexture& textureImpl = m_device.GetImpl(texture);
+        return MakeImageTransitionBarrier(
+            textureImpl.image.get(), textureImpl.properties.format, textureImpl.properties.mipLevelCount, oldLayout,
+            newLayout);
     };
-    const auto viewParamsName = fmt::format("{}:View", renderList.name);
-
-    return m_shaderEnvironment
-        ? m_frameResources.Current()
-              .threadResources
-              .LockCurrent(&ThreadResources::CreateViewParameterBlock, m_device, viewParamsData, viewParamsName.c_str())
-              ->descriptorSet
-        : vk::DescriptorSet{};
+
+    const auto inputs = std::move(info.inputs);
+    std::vector<vk::ImageMemoryBarrier> inputBarriers;
+    for (const auto& input : inputs)
+    {
+        const auto layout = m_device.GetImpl(input).GetShaderInputLayout();
+        inputBarriers.push_back(makeBarrier(input, layout, layout));
+    }
+    std::vector<vk::ImageMemoryBarrier> toGeneral;
+    std::vector<vk::ImageMemoryBarrier> toShaderInput;
+    for (const auto& output : outputs)
+    {
+        toGeneral.push_back(makeBarrier(output, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral));
+        toShaderInput.push_back(
+            makeBarrier(output, vk::ImageLayout::eGeneral, vk::ImageLayout::eShaderReadOnlyOptimal));
+    }
+
+    const auto release = [=](CommandBuffer& commandBuffer) {
+        if (inputBarriers.empty())
+        {
+            return;
+        }
+        if (transferOwnership)
+        {
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {},
+                MakeReleaseBarriers(inputBarriers, graphicsFamily, computeFamily));
+        }
+        else
+        {
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eComputeShader, {}, {}, {},
+                inputBarriers);
+        }
+    };
+
+    // The inputs mustn't be evicted until the kernel has been recorded
+    const auto compute = [=, this, name = std::move(info.name), groupCount = info.groupCount,
+                          textureUses = std::move(textureUses)](CommandBuffer& commandBuffer) {
+        if (transferOwnership && !inputBarriers.empty())
+        {
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eComputeShader, {}, {}, {},
+                MakeAcquireBarriers(inputBarriers, graphicsFamily, computeFamily));
+        }
+        if (!toGeneral.empty())
+        {
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eComputeShader, {}, {}, {},
+                toGeneral);
+        }
+
+        const VulkanKernel& kernelImpl = m_device.GetImpl(kernel);
+        commandBuffer->bindPipeline(vk::PipelineBindPoint::eCompute, kernelImpl.pipeline.get());
+
+        if (m_shaderEnvironment && kernelImpl.scenePblockLayout->HasDescriptors())
+        {
+            commandBuffer->bindDescriptorSets(
+                vk::PipelineBindPoint::eCompute, kernelImpl.pipelineLayout.get(), 0,
+                GetSceneParameterBlock().descriptorSet, {});
+        }
+        if (kernelImpl.paramsPblockLayout->HasDescriptors())
+        {
+            const auto descriptorSetName = fmt::format("{}:Params", name);
+            const auto descriptorSet = m_frameResources.Current().threadResources.WithCurrent(
+                &ThreadResources::AllocateKernelDescriptorSet, m_device, *kernelImpl.paramsPblockLayout,
+                descriptorSetName.c_str());
+            WriteKernelResources(m_device, descriptorSet, inputs, outputs);
+            commandBuffer->bindDescriptorSets(
+                vk::PipelineBindPoint::eCompute, kernelImpl.pipelineLayout.get(), 2, descriptorSet, {});
+        }
+
+        commandBuffer->dispatch(groupCount.x, groupCount.y, groupCount.z);
+
+        if (!toShaderInput.empty())
+        {
+            if (transferOwnership)
+            {
+                commandBuffer->pipelineBarrier(
+                    vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {},
+                    MakeReleaseBarriers(toShaderInput, computeFamily, graphicsFamily));
+            }
+            else
+            {
+                commandBuffer->pipelineBarrier(
+                    vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {},
+                    toShaderInput);
+            }
+        }
+        if (transferOwnership && !inputBarriers.empty())
+        {
+            commandBuffer->pipelineBarrier(
+                vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {},
+                MakeReleaseBarriers(inputBarriers, computeFamily, graphicsFamily));
+        }
+    };
+
+    const auto acquire = [=](CommandBuffer& commandBuffer) {
+        if (transferOwnership)
+        {
+            auto barriers = MakeAcquireBarriers(toShaderInput, computeFamily, graphicsFamily);
+            std::ranges::copy(
+                MakeAcquireBarriers(inputBarriers, computeFamily, graphicsFamily), std::back_inserter(barriers));
+            if (!barriers.empty())
+            {
+                // The source stage matches the stage that the acquire waits for the kernel at
+                commandBuffer->pipelineBarrier(
+                    vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {},
+                    barriers);
+            }
+        }
+    };
+
+    m_device.GetScheduler().ScheduleCompute(release, compute, acquire, vk::PipelineStageFlagBits::eFragmentShader);
+
+    return outputs;
+}
+
+auto VulkanRenderer::CreateViewParameters(const RenderList& renderList) -> DynamicDescriptorSet
+{
+    if (!m_shaderEnvironment)
+    {
+        return {};
+    }
+
+    const auto viewPblockLayout = m_device.GetImpl(m_shaderEnvironment->GetViewPblockLayout());
+    return m_frameResources.Current().threadResources.WithCurrent(
+        &ThreadResources::GetViewParameters, m_device, *viewPblockLayout, renderList.viewParameters, renderList.name);
 }
 
 void VulkanRenderer::RecordRenderListCommands(
     VulkanDevice& device, vk::CommandBuffer commandBuffer, const RenderList& renderList, vk::RenderPass renderPass,
     const RenderPassDesc& renderPassDesc, const Framebuffer& framebuffer, vk::DescriptorSet sceneParameters,
-    vk::DescriptorSet viewParameters)
+    const DynamicDescriptorSet& viewParameters)
 {
-    const vkex::RenderPassBeginInfo renderPassBegin = {
+    SetViewportAndScissor(commandBuffer, renderList, framebuffer);
+    BeginRenderPass(commandBuffer, renderList, renderPass, framebuffer, vk::SubpassContents::eInline);
+    RecordDrawCommands(device, commandBuffer, renderList.objects, renderPassDesc, sceneParameters, viewParameters);
+    commandBuffer.endRenderPass();
+}
+
+void VulkanRenderer::RecordRenderList(
+    vk::CommandBuffer commandBuffer, const RenderList& renderList, vk::RenderPass renderPass,
+    const RenderPassDesc& renderPassDesc, const Framebuffer& framebuffer, vk::DescriptorSet sceneParameters,
+    const DynamicDescriptorSet& viewParameters)
+{
+    const auto& settings = m_device.GetSettings().parallelRecording;
+    auto& scheduler = m_device.GetScheduler();
+
+    const auto numObjects = size32(renderList.objects);
+    const auto numChunks = std::min(scheduler.GetThreadCount(), numObjects / std::max(settings.minChunkSize, 1u));
+    if (numObjects < settings.minObjects || numChunks < 2)
+    {
+        RecordRenderListCommands(
+            m_device, commandBuffer, renderList, renderPass, renderPassDesc, framebuffer, sceneParameters, viewParameters);
+        return;
+    }
+
+    const vk::CommandBufferInheritanceInfo inheritanceInfo = {
         .renderPass = renderPass,
+        .subpass = 0,
         .framebuffer = framebuffer.framebuffer,
-        .renderArea = {.offset = {.x = 0, .y = 0}, .extent = {.width = framebuffer.size.x, .height = framebuffer.size.y}},
-        .clearValues = MakeClearValues(framebuffer, renderList.clearState),
     };
 
-    const auto viewport = MakeViewport(framebuffer.size, renderList.viewportRegion);
-    commandBuffer.setViewport(0, viewport);
-    const auto scissor = renderList.scissor
-        ? ToVulkan(*renderList.scissor)
-        : vk::Rect2D{.extent = {.width = framebuffer.size.x, .height = framebuffer.size.y}};
-    commandBuffer.setScissor(0, scissor);
+    // Secondary command buffers don't inherit dynamic state or bound descriptor sets, so each chunk sets its own
+    std::vector<Task<vk::CommandBuffer>> chunkTasks;
+    chunkTasks.reserve(numChunks);
+    for (uint32 i = 0; i < numChunks; i++)
+    {
+        const auto first = static_cast<uint32>(uint64{numObjects} * i / numChunks);
+        const auto last = static_cast<uint32>(uint64{numObjects} * (i + 1) / numChunks);
+
+        chunkTasks.push_back(scheduler.Schedule(
+            [&, first, last] {
+                const auto start = std::chrono::steady_clock::now();
+
+                const auto secondary = scheduler.GetSecondaryCommandBuffer(inheritanceInfo);
+                SetViewportAndScissor(secondary, renderList, framebuffer);
+                const auto objects = std::span(renderList.objects).subspan(first, last - first);
+                RecordDrawCommands(m_device, secondary, objects, renderPassDesc, sceneParameters, viewParameters);
+                secondary.end();
+
+                const RecordedChunk chunk = {
+                    .renderListName = renderList.name,
+                    .firstObject = first,
+                    .objectCount = last - first,
+                    .recordTime = std::chrono::steady_clock::now() - start,
+                };
+                m_recordedChunks.Lock([&chunk](auto& chunks) { chunks.push_back(chunk); });
+
+                return secondary;
+            },
+            TaskPriority::FrameCritical));
+    }
 
-    commandBuffer.beginRenderPass(renderPassBegin, vk::SubpassContents::eInline);
+    // The chunks refer to locals, so they must all have finished before returning, even if one of them failed
+    scheduler.WaitInTask(when_all(chunkTasks));
 
-    if (!renderList.objects.empty())
+    std::vector<vk::CommandBuffer> secondaries;
+    secondaries.reserve(numChunks);
+    for (const auto& task : chunkTasks)
     {
-        const auto& firstPipeline = device.GetImpl(*renderList.objects.front().pipeline);
+        secondaries.push_back(task.get());
+    }
 
-        if (sceneParameters)
-        {
-            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, firstPipeline.layout, 0, sceneParameters, {});
-        }
-        if (viewParameters)
-        {
-            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, firstPipeline.layout, 1, viewParameters, {});
-        }
+    BeginRenderPass(commandBuffer, renderList, renderPass, framebuffer, vk::SubpassContents::eSecondaryCommandBuffers);
+    commandBuffer.executeCommands(secondaries);
+    commandBuffer.endRenderPass();
+}
 
-        for (const RenderObject& obj : renderList.objects)
-        {
-            RecordRenderObjectCommands(device, commandBuffer, obj, renderPassDesc);
-        }
+void VulkanRenderer::RecordDrawCommands(
+    VulkanDevice& device, vk::CommandBuffer commandBuffer, std::span<const RenderObject> objects,
+    const RenderPassDesc& renderPassDesc, vk::DescriptorSet sceneParameters,
+    const DynamicDescriptorSet& viewParameters)
+{
+    if (objects.empty())
+    {
+        return;
     }
 
-    commandBuffer.endRenderPass();
+    const auto& firstPipeline = device.GetImpl(*objects.front().pipeline);
+
+    if (sceneParameters)
+    {
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, firstPipeline.layout, 0, sceneParameters, {});
+    }
+    if (viewParameters)
+    {
+        const auto dynamicOffsets = viewParameters.uniformOffset
+            ? vk::ArrayProxy<const uint32>(*viewParameters.uniformOffset)
+            : vk::ArrayProxy<const uint32>();
+        commandBuffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eGraphics, firstPipeline.layout, 1, viewParameters.descriptorSet, dynamicOffsets);
+    }
+
+    BoundGeometry boundGeometry;
+    for (const RenderObject& obj : objects)
+    {
+        RecordRenderObjectCommands(device, commandBuffer, obj, renderPassDesc, boundGeometry);
+    }
 }
 
 void VulkanRenderer::RecordRenderObjectCommands(
-    VulkanDevice& device, vk::CommandBuffer commandBuffer, const RenderObject& obj, const RenderPassDesc& renderPassDesc)
+    VulkanDevice& device, vk::CommandBuffer commandBuffer, const RenderObject& obj, const RenderPassDesc& renderPassDesc,
+    BoundGeometry& boundGeometry)
 {
     const auto& pipeline = device.GetImpl(*obj.pipeline);
 
-    // commandBufferWrapper.AddReference(obj.mesh);
-    // commandBufferWrapper.AddReference(obj.materialParameters);
-    // commandBufferWrapper.AddReference(obj.pipeline);
-
     if (const auto dset = device.GetDescriptorSet(obj.materialParameters))
     {
         commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline.layout, 2, dset, {});
@@ -473,8 +865,13 @@ void VulkanRenderer::RecordRenderObjectCommands(
 
     commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetPipeline(renderPassDesc));
 
+    // Meshes from the same geometry heap block share their bindings
     const auto& meshImpl = device.GetImpl(*obj.mesh);
-    commandBuffer.bindVertexBuffers(0, meshImpl.vertexBuffer->buffer.get(), vk::DeviceSize{0});
+    if (meshImpl.vertexBinding != boundGeometry.vertices)
+    {
+        commandBuffer.bindVertexBuffers(0, meshImpl.vertexBinding.buffer, meshImpl.vertexBinding.offset);
+        boundGeometry.vertices = meshImpl.vertexBinding;
+    }
 
     if (pipeline.shader->objectPblockLayout && pipeline.shader->objectPblockLayout->pushConstantRange.has_value())
     {
@@ -485,12 +882,17 @@ void VulkanRenderer::RecordRenderObjectCommands(
 
     if (meshImpl.indexBuffer)
     {
-        commandBuffer.bindIndexBuffer(meshImpl.indexBuffer->buffer.get(), vk::DeviceSize{0}, meshImpl.indexType);
-        commandBuffer.drawIndexed(meshImpl.indexCount, 1, 0, 0, 0);
+        if (meshImpl.indexBinding != boundGeometry.indices)
+        {
+            commandBuffer.bindIndexBuffer(
+                meshImpl.indexBinding.buffer, meshImpl.indexBinding.offset, meshImpl.indexType);
+            boundGeometry.indices = meshImpl.indexBinding;
+        }
+        commandBuffer.drawIndexed(meshImpl.indexCount, 1, meshImpl.firstIndex, meshImpl.vertexOffset, 0);
     }
     else
     {
-        commandBuffer.draw(meshImpl.vertexCount, 1, 0, 0);
+        commandBuffer.draw(meshImpl.vertexCount, 1, static_cast<uint32>(meshImpl.vertexOffset), 0);
     }
 }
 
@@ -512,21 +914,95 @@ std::optional<SurfaceImage> VulkanRenderer::AddSurfaceToPresent(VulkanSurface& s
     });
 }
 
-TransientParameterBlock* VulkanRenderer::ThreadResources::CreateViewParameterBlock(
-    VulkanDevice& device, const ParameterBlockData& data, const char* name)
+DynamicDescriptorSet VulkanRenderer::ThreadResources::GetViewParameters(
+    VulkanDevice& device, const VulkanParameterBlockLayout& layout, const ShaderParameters& parameters,
+    std::string_view renderListName)
 {
     if (!viewDescriptorPool.has_value())
     {
-        return nullptr;
+        return {};
+    }
+
+    UniformAllocator::Allocation uniforms;
+    std::optional<uint32> uniformOffset;
+    if (layout.uniformBufferSize > 0)
+    {
+        uniforms = viewUniforms->Allocate(layout.uniformBufferSize, parameters.uniformData);
+        uniformOffset = uniforms.offset;
+    }
+
+    auto key = ViewDescriptorKey{
+        .uniformBuffer = uniforms.buffer,
+        .textures = parameters.textures,
+        .residencyEpoch = device.GetTextureResidencyEpoch(),
+    };
+    auto [it, inserted] = viewDescriptorSets.try_emplace(std::move(key));
+    auto& cached = it->second;
+    if (inserted)
+    {
+        const auto name = DebugFormat("{}:ViewDescriptorSet", renderListName);
+        cached.descriptorSet = viewDescriptorPool->Allocate(name.c_str());
+        viewDescriptorSetWrites++;
+        if (!device.WriteDynamicDescriptorSet(layout, cached.descriptorSet, it->first.uniformBuffer, it->first.textures))
+        {
+            // Not all of the textures are ready, so write it again next time
+            const auto descriptorSet = cached.descriptorSet;
+            viewDescriptorSets.erase(it);
+            return {.descriptorSet = descriptorSet, .uniformOffset = uniformOffset};
+        }
     }
+    cached.used = true;
 
-    auto p = device.CreateTransientParameterBlock(data, name, *viewDescriptorPool);
-    return &viewParameters.emplace_back(std::move(p));
+    return {.descriptorSet = cached.descriptorSet, .uniformOffset = uniformOffset};
+}
+
+void VulkanRenderer::ThreadResources::ResetViewParameters()
+{
+    if (viewUniforms)
+    {
+        viewUniforms->Reset();
+    }
+
+    // Descriptor sets are kept from frame to frame while they are all still being used, so that a steady state doesn't
+    // write any. Sets can't be freed individually, so once any have gone stale, they are all recreated.
+    const bool allUsed = std::ranges::all_of(viewDescriptorSets, [](const auto& entry) { return entry.second.used; });
+    if (!allUsed && viewDescriptorPool)
+    {
+        viewDescriptorPool->Reset();
+        viewDescriptorSets.clear();
+    }
+    for (auto& [key, cached] : viewDescriptorSets)
+    {
+        cached.used = false;
+    }
+}
+
+vk::DescriptorSet VulkanRenderer::ThreadResources::AllocateKernelDescriptorSet(
+    VulkanDevice& device, const VulkanParameterBlockLayout& layout, const char* name)
+{
+    auto it = kernelDescriptorPools.find(&layout);
+    if (it == kernelDescriptorPools.end())
+    {
+        it = kernelDescriptorPools.try_emplace(&layout, device.GetVulkanDevice(), layout, KernelDescriptorPoolSize).first;
+    }
+    return it->second.Allocate(name);
 }
 
 VulkanRenderer::FrameResources::FrameResources(
-    VulkanDevice& device, DescriptorPool& sceneDescriptorPool, const ShaderEnvironmentPtr& shaderEnvironment, uint32 index) :
-    threadResources(device.GetScheduler().GetThreadCount())
+    VulkanDevice& device, DescriptorPool& sceneDescriptorPool, const ShaderEnvironmentPtr& shaderEnvironment,
+    uint32 index) :
+    // Each thread's resources are created the first time it records work for the frame
+    threadResources{[&device, viewPblockLayout = GetViewPblockLayout(device, shaderEnvironment)] {
+        ThreadResources ret;
+        if (viewPblockLayout && viewPblockLayout->HasDescriptors())
+        {
+            ret.viewDescriptorPool.emplace(device.GetVulkanDevice(), *viewPblockLayout, ViewDescriptorPoolSize);
+            ret.viewUniforms.emplace(
+                device.GetVulkanDevice(), device.GetAllocator(), device.GetMemoryCounters().uniformBuffers,
+                device.GetUniformBufferAlignment());
+        }
+        return ret;
+    }}
 {
     const auto vkdevice = device.GetVulkanDevice();
 
@@ -537,8 +1013,6 @@ VulkanRenderer::FrameResources::FrameResources(
     if (shaderEnvironment)
     {
         const auto scenePblockLayout = device.GetImpl(shaderEnvironment->GetScenePblockLayout());
-        const auto viewPblockLayout = device.GetImpl(shaderEnvironment->GetViewPblockLayout());
-
         if (scenePblockLayout->HasDescriptors())
         {
             const ParameterBlockData pblockData = {
@@ -547,13 +1021,6 @@ VulkanRenderer::FrameResources::FrameResources(
             };
             sceneParameters = device.CreateTransientParameterBlock(pblockData, "Scene", sceneDescriptorPool);
         }
-
-        threadResources.LockAll([&vkdevice, &viewPblockLayout](ThreadResources& threadResources) {
-            if (viewPblockLayout->HasDescriptors())
-            {
-                threadResources.viewDescriptorPool.emplace(vkdevice, *viewPblockLayout, ViewDescriptorPoolSize);
-            }
-        });
     }
 }
 
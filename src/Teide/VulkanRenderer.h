@@ -3,18 +3,25 @@
 
 #include "CommandBuffer.h"
 #include "DescriptorPool.h"
+#include "UniformAllocator.h"
 #include "Vulkan.h"
 #include "VulkanDevice.h"
+#include "VulkanMesh.h"
 #include "VulkanParameterBlock.h"
 #include "VulkanSurface.h"
 
 #include "Teide/BasicTypes.h"
 #include "Teide/ForwardDeclare.h"
+#include "Teide/Hash.h"
 #include "Teide/Surface.h"
 #include "Teide/Util/FrameArray.h"
 #include "Teide/Util/ThreadUtils.h"
 
 #include <optional>
+#include <span>
+#include <stop_token>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace Teide
@@ -46,38 +53,91 @@ public:
     void WaitForCpu() override;
     void WaitForGpu() override;
 
-    RenderToTextureResult RenderToTexture(const RenderTargetInfo& renderTarget, RenderList renderList) override;
+    RenderToTextureResult RenderToTexture(
+        const RenderTargetInfo& renderTarget, RenderList renderList, std::stop_token stopToken = {}) override;
     void RenderToSurface(Surface& surface, RenderList renderList) override;
 
-    Task<TextureData> CopyTextureData(Texture texture) override;
+    Task<TextureData> CopyTextureData(Texture texture, std::stop_token stopToken = {}) override;
+
+    std::vector<Texture> Dispatch(Kernel kernel, DispatchInfo info) override;
+
+    RendererStatistics GetLastFrameStatistics() const override { return m_lastFrameStatistics; }
 
     static void RecordRenderListCommands(
         VulkanDevice& device, vk::CommandBuffer commandBuffer, const RenderList& renderList, vk::RenderPass renderPass,
         const RenderPassDesc& renderPassDesc, const Framebuffer& framebuffer, vk::DescriptorSet sceneParameters = {},
-        vk::DescriptorSet viewParameters = {});
+        const DynamicDescriptorSet& viewParameters = {});
 
 private:
+    // Render lists are recorded ahead of any other CPU work, as the frame can't finish until they have been
     template <std::invocable<CommandBuffer&> F>
-    auto ScheduleGpu(F&& f) -> TaskForCallable<F, CommandBuffer&>
+    auto ScheduleGpu(F&& f, std::stop_token stopToken = {}) -> TaskForCallable<F, CommandBuffer&>
     {
-        return m_device.GetScheduler().ScheduleGpu(std::forward<F>(f));
+        return m_device.GetScheduler().ScheduleGpu(
+            std::forward<F>(f), TaskPriority::FrameCritical, std::move(stopToken));
     }
 
     const TransientParameterBlock& GetSceneParameterBlock() const { return m_frameResources.Current().sceneParameters; }
-    auto CreateViewParameters(const RenderList& renderList) -> vk::DescriptorSet;
+    auto CreateViewParameters(const RenderList& renderList) -> DynamicDescriptorSet;
+
+    // Like RecordRenderListCommands, but large lists are recorded in parallel. Must be called from a GPU task.
+    void RecordRenderList(
+        vk::CommandBuffer commandBuffer, const RenderList& renderList, vk::RenderPass renderPass,
+        const RenderPassDesc& renderPassDesc, const Framebuffer& framebuffer, vk::DescriptorSet sceneParameters,
+        const DynamicDescriptorSet& viewParameters);
+
+    // The vertex and index buffers that are currently bound in a command buffer
+    struct BoundGeometry
+    {
+        VulkanBufferBinding vertices;
+        VulkanBufferBinding indices;
+    };
 
+    static void RecordDrawCommands(
+        VulkanDevice& device, vk::CommandBuffer commandBuffer, std::span<const RenderObject> objects,
+        const RenderPassDesc& renderPassDesc, vk::DescriptorSet sceneParameters,
+        const DynamicDescriptorSet& viewParameters);
     static void RecordRenderObjectCommands(
-        VulkanDevice& device, vk::CommandBuffer commandBuffer, const RenderObject& obj, const RenderPassDesc& renderPassDesc);
+        VulkanDevice& device, vk::CommandBuffer commandBuffer, const RenderObject& obj, const RenderPassDesc& renderPassDesc,
+        BoundGeometry& boundGeometry);
 
     std::optional<SurfaceImage> AddSurfaceToPresent(VulkanSurface& surface);
 
+    // View descriptor sets only depend on which uniform block and textures they refer to, as the uniforms' offset is
+    // given when the set is bound. A texture's image changes when it is made resident again, which changes the epoch.
+    struct ViewDescriptorKey
+    {
+        vk::Buffer uniformBuffer;
+        std::vector<Texture> textures;
+        uint64 residencyEpoch = 0;
+
+        bool operator==(const ViewDescriptorKey&) const = default;
+        void Visit(auto f) const { return f(uniformBuffer, textures, residencyEpoch); }
+    };
+
+    struct CachedDescriptorSet
+    {
+        vk::DescriptorSet descriptorSet;
+        bool used = false; // Since the start of the frame
+    };
+
     struct ThreadResources
     {
         std::optional<DescriptorPool> viewDescriptorPool;
-        std::vector<TransientParameterBlock> viewParameters;
-
-        TransientParameterBlock*
-        CreateViewParameterBlock(VulkanDevice& device, const ParameterBlockData& data, const char* name);
+        std::optional<UniformAllocator> viewUniforms;
+        std::unordered_map<ViewDescriptorKey, CachedDescriptorSet, Hash<ViewDescriptorKey>> viewDescriptorSets;
+        uint32 viewDescriptorSetWrites = 0; // Since the end of the last frame
+
+        // Kernels each have their own parameter block layout, so they get a pool per layout. The pools are
+        // destroyed rather than reset at the start of the frame, as the kernels might have been destroyed.
+        std::unordered_map<const VulkanParameterBlockLayout*, DescriptorPool> kernelDescriptorPools;
+
+        DynamicDescriptorSet GetViewParameters(
+            VulkanDevice& device, const VulkanParameterBlockLayout& layout, const ShaderParameters& parameters,
+            std::string_view renderListName);
+        void ResetViewParameters();
+        vk::DescriptorSet
+        AllocateKernelDescriptorSet(VulkanDevice& device, const VulkanParameterBlockLayout& layout, const char* name);
     };
 
     struct FrameResources
@@ -90,6 +150,7 @@ private:
         vk::UniqueFence inFlightFence;
 
         TransientParameterBlock sceneParameters;
+        VulkanDevice::TextureUses sceneTextureUses;
         ThreadMap<ThreadResources> threadResources;
     };
 
@@ -102,7 +163,10 @@ private:
     Synchronized<std::vector<SurfaceImage>> m_surfacesToPresent;
 
     DescriptorPool m_sceneDescriptorPool;
-    FrameArray<FrameResources, MaxFramesInFlight> m_frameResources;
+    FrameArray<FrameResources> m_frameResources;
+
+    Synchronized<std::vector<RecordedChunk>> m_recordedChunks;
+    RendererStatistics m_lastFrameStatistics;
 };
 
 template <>
@@ -8,6 +8,7 @@
 #include <spdlog/spdlog.h>
 
 #include <algorithm>
+#include <array>
 #include <span>
 
 namespace Teide
@@ -177,13 +178,14 @@ namespace
 
 VulkanSurface::VulkanSurface(
     Geo::Size2i extent, vk::UniqueSurfaceKHR surface, vk::Device device, const PhysicalDevice& physicalDevice,
-    vma::Allocator allocator, vk::Queue presentQueue, bool multisampled) :
+    vma::Allocator allocator, vk::Queue presentQueue, bool multisampled, uint32 framesInFlight) :
     m_device{device},
     m_physicalDevice{physicalDevice},
     m_allocator{allocator},
     m_presentQueue{presentQueue},
     m_surface{std::move(surface)},
-    m_surfaceExtent{extent}
+    m_surfaceExtent{extent},
+    m_imageAvailable(framesInFlight)
 {
     std::ranges::generate(m_imageAvailable, [=] { return device.createSemaphoreUnique({}, s_allocator); });
 
@@ -270,7 +272,7 @@ void VulkanSurface::PresentImage(const SurfaceImage& image, vk::Semaphore waitSe
 vk::Semaphore VulkanSurface::GetNextSemaphore()
 {
     const auto index = m_nextSemaphoreIndex;
-    m_nextSemaphoreIndex = (m_nextSemaphoreIndex + 1) % MaxFramesInFlight;
+    m_nextSemaphoreIndex = (m_nextSemaphoreIndex + 1) % size32(m_imageAvailable);
     return m_imageAvailable[index].get();
 }
 
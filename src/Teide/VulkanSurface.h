@@ -6,15 +6,12 @@
 #include "GeoLib/Vector.h"
 #include "Teide/Surface.h"
 
-#include <array>
 #include <optional>
 #include <vector>
 
 namespace Teide
 {
 
-constexpr uint32_t MaxFramesInFlight = 2;
-
 class VulkanSurface;
 
 struct SurfaceImage
@@ -31,7 +28,7 @@ class VulkanSurface : public Surface
 public:
     VulkanSurface(
         Geo::Size2i extent, vk::UniqueSurfaceKHR surface, vk::Device device, const PhysicalDevice& physicalDevice,
-        vma::Allocator allocator, vk::Queue presentQueue, bool multisampled);
+        vma::Allocator allocator, vk::Queue presentQueue, bool multisampled, uint32 framesInFlight);
 
     Geo::Size2i GetExtent() const override { return m_surfaceExtent; }
     Format GetColorFormat() const override { return m_framebufferLayout.colorFormat.value(); }
@@ -78,7 +75,7 @@ private:
     std::vector<vk::UniqueFramebuffer> m_swapchainFramebuffers;
     vk::UniqueRenderPass m_renderPass;
 
-    std::array<vk::UniqueSemaphore, MaxFramesInFlight> m_imageAvailable;
+    std::vector<vk::UniqueSemaphore> m_imageAvailable;
     uint32_t m_nextSemaphoreIndex = 0;
     std::vector<vk::Fence> m_imagesInFlight;
     vk::Image m_lastPresentedImage;
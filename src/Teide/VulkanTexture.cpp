@@ -98,14 +98,18 @@ void VulkanTexture::GenerateMipmaps(TextureState& state, vk::CommandBuffer cmdBu
     state.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
 }
 
-void VulkanTexture::TransitionToShaderInput(TextureState& state, vk::CommandBuffer cmdBuffer) const
+vk::ImageLayout VulkanTexture::GetShaderInputLayout() const
 {
-    auto newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
     if (HasDepthOrStencilComponent(properties.format))
     {
-        newLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+        return vk::ImageLayout::eDepthStencilReadOnlyOptimal;
     }
-    DoTransition(state, cmdBuffer, newLayout, vk::PipelineStageFlagBits::eFragmentShader);
+    return vk::ImageLayout::eShaderReadOnlyOptimal;
+}
+
+void VulkanTexture::TransitionToShaderInput(TextureState& state, vk::CommandBuffer cmdBuffer) const
+{
+    DoTransition(state, cmdBuffer, GetShaderInputLayout(), vk::PipelineStageFlagBits::eFragmentShader);
 }
 
 void VulkanTexture::TransitionToTransferSrc(TextureState& state, vk::CommandBuffer cmdBuffer) const
@@ -1,10 +1,13 @@
 
 #pragma once
 
+#include "SamplerCache.h"
+#include "TextureResidency.h"
 #include "Vulkan.h"
 
 #include "GeoLib/Vector.h"
 #include "Teide/Texture.h"
+#include "Teide/Util/MemoryCounter.h"
 
 namespace Teide
 {
@@ -28,12 +31,16 @@ struct VulkanTexture
     vk::UniqueImage image;
     vma::UniqueAllocation allocation;
     vk::UniqueImageView imageView;
-    vk::UniqueSampler sampler;
+    SamplerPtr sampler; // Shared with other textures that have the same sampler state
     vk::ImageUsageFlags usage;
     TextureProperties properties;
+    std::shared_ptr<TextureResidency::Entry> residency; // Only for textures that can be evicted
+    MemoryCounter::Allocation memory;
 
     void GenerateMipmaps(TextureState& state, vk::CommandBuffer cmdBuffer);
 
+    vk::ImageLayout GetShaderInputLayout() const;
+
     void Transition(vk::CommandBuffer cmdBuffer, TextureStateTransition transition) const;
 
     void TransitionToShaderInput(TextureState& state, vk::CommandBuffer cmdBuffer) const;
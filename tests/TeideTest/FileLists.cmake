@@ -19,13 +19,19 @@ set(sources
     src/Teide/SchedulerTest.cpp
     src/Teide/ShaderDataTest.cpp
     src/Teide/SurfaceTest.cpp
+    src/Teide/TaskTest.cpp
     src/Teide/TestData.h
     src/Teide/TestUtils.cpp
     src/Teide/TestUtils.h
     src/Teide/TestUtilsTest.cpp
     src/Teide/TextureDataTest.cpp
+    src/Teide/TextureResidencyTest.cpp
     src/Teide/TextureTest.cpp
+    src/Teide/Util/FreeListAllocatorTest.cpp
     src/Teide/Util/ListenSenderTest.cpp
+    src/Teide/Util/MemoryCounterTest.cpp
+    src/Teide/Util/RingAllocatorTest.cpp
+    src/Teide/Util/ThreadUtilsTest.cpp
     src/Teide/VulkanGraphTest.cpp
     src/Teide/VulkanInstanceTest.cpp
     src/Trace.cpp
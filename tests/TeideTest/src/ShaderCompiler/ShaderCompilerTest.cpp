@@ -120,3 +120,32 @@ TEST(ShaderCompilerTest, CompileSimpleKernel)
     EXPECT_THAT(result.environment.viewPblock.uniformsStages, Eq(Teide::ShaderStageFlags::None));
     EXPECT_THAT(result.paramsPblock.uniformsStages, Eq(Teide::ShaderStageFlags::None));
 }
+
+TEST(ShaderCompilerTest, CompileKernelWithTextureInput)
+{
+    const KernelSourceData kernel = {
+        .language = ShaderLanguage::Glsl,
+        .kernelShader = {
+            .inputs = {{
+                {"source", Type::Texture2D},
+            }},
+            .outputs = {{
+                {"result", Type::Vector2},
+            }},
+            .source = R"--(
+                void main() {
+                    result = texelFetch(source, ivec2(gl_GlobalInvocationID.xy), 0).rg;
+                }
+            )--",
+        },
+    };
+
+    const ShaderCompiler compiler;
+    const auto result = compiler.Compile(kernel);
+    EXPECT_THAT(result.computeShader.spirv, Not(IsEmpty()));
+    EXPECT_THAT(
+        result.paramsPblock.parameters,
+        ElementsAre(
+            Teide::ShaderVariable("source", Type::Texture2D),
+            Teide::ShaderVariable("_result_image_", Type::RWTexture2D)));
+}
@@ -1,11 +1,18 @@
 
 #include "Teide/CpuExecutor.h"
 
+#include <exec/task.hpp>
 #include <gmock/gmock.h>
+#include <stdexec/execution.hpp>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <memory>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <vector>
 
 using namespace testing;
 using namespace std::chrono_literals;
@@ -174,4 +181,176 @@ TEST(CpuExecutorTest, DISABLED_LaunchDependentTasksAndPassValues)
     EXPECT_THAT(result, Eq("21"));
 }
 
+TEST(CpuExecutorTest, DependentTaskRethrowsDependencyException)
+{
+    auto executor = CpuExecutor(2);
+
+    const auto task0 = executor.LaunchTask([]() -> int { throw std::runtime_error("task0 failed"); });
+
+    bool ran = false;
+    const auto task1 = executor.LaunchTask(
+        [&](int value) {
+            ran = true;
+            return value;
+        },
+        task0);
+
+    EXPECT_THROW(task1.get(), std::runtime_error);
+    EXPECT_FALSE(ran);
+}
+
+TEST(CpuExecutorTest, LongDependencyChain)
+{
+    auto executor = CpuExecutor(2);
+
+    auto task = executor.LaunchTask([] { return 0; });
+    for (int i = 0; i < 1000; i++)
+    {
+        task = executor.LaunchTask([](int value) { return value + 1; }, task);
+    }
+
+    EXPECT_THAT(task.get(), Eq(1000));
+}
+
+TEST(CpuExecutorTest, FrameCriticalTaskDoesNotWaitForBackgroundTasks)
+{
+    auto executor = CpuExecutor(2);
+
+    auto gate = TaskPromise<>();
+    const auto gateTask = gate.GetTask();
+    for (int i = 0; i < 4; i++)
+    {
+        executor.LaunchTask([&gateTask] { gateTask.wait(); }, TaskPriority::Background);
+    }
+
+    // The background tasks can't finish until the frame-critical one has, so it has to start ahead of them
+    const auto task = executor.LaunchTask([] { return 42; }, TaskPriority::FrameCritical);
+    EXPECT_THAT(task.get(), Eq(42));
+
+    gate.SetValue();
+    executor.WaitForTasks();
+}
+
+TEST(CpuExecutorTest, BackgroundTasksShareTheOnlyThread)
+{
+    auto executor = CpuExecutor(1);
+    EXPECT_THAT(executor.GetThreadCount(), Eq(1u));
+
+    const auto background = executor.LaunchTask([] { return 1; }, TaskPriority::Background);
+    const auto frameCritical = executor.LaunchTask([] { return 2; }, TaskPriority::FrameCritical);
+
+    EXPECT_THAT(background.get(), Eq(1));
+    EXPECT_THAT(frameCritical.get(), Eq(2));
+}
+
+TEST(CpuExecutorTest, ZeroThreadsStillHasOneWorker)
+{
+    auto executor = CpuExecutor(0);
+    EXPECT_THAT(executor.GetThreadCount(), Eq(1u));
+
+    const auto task = executor.LaunchTask([] { return 42; }, TaskPriority::Background);
+    EXPECT_THAT(task.get(), Eq(42));
+}
+
+TEST(CpuExecutorTest, LaunchTasksOfEveryPriorityFromManyThreads)
+{
+    auto executor = CpuExecutor(4);
+
+    constexpr int numThreads = 4;
+    constexpr int tasksPerThread = 1000;
+    std::atomic<int> numRun = 0;
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < numThreads; i++)
+        {
+            threads.emplace_back([&] {
+                for (int j = 0; j < tasksPerThread; j++)
+                {
+                    executor.LaunchTask([&] { numRun++; }, static_cast<TaskPriority>(j % TaskPriorityCount));
+                }
+            });
+        }
+    }
+    executor.WaitForTasks();
+
+    EXPECT_THAT(numRun.load(), Eq(numThreads * tasksPerThread));
+}
+
+TEST(CpuExecutorTest, ReportsTaskStatisticsPerPriority)
+{
+    auto executor = CpuExecutor(2);
+
+    executor.LaunchTask([] {}, TaskPriority::FrameCritical);
+    executor.LaunchTask([] {}, TaskPriority::Background);
+    executor.LaunchTask([] {}, TaskPriority::Background);
+    executor.WaitForTasks();
+    executor.NextFrame();
+
+    const auto statistics = executor.GetLastFrameStatistics();
+    EXPECT_THAT(statistics[static_cast<usize>(TaskPriority::FrameCritical)].launched, Eq(1u));
+    EXPECT_THAT(statistics[static_cast<usize>(TaskPriority::Normal)].launched, Eq(0u));
+    EXPECT_THAT(statistics[static_cast<usize>(TaskPriority::Background)].launched, Eq(2u));
+}
+
+TEST(CpuExecutorTest, CancelledTaskIsSkipped)
+{
+    auto executor = CpuExecutor(2);
+
+    auto stopSource = std::stop_source();
+    stopSource.request_stop();
+
+    bool ran = false;
+    const auto task = executor.LaunchTask([&] { ran = true; }, TaskPriority::Normal, stopSource.get_token());
+    const auto dependent = executor.LaunchTask([] { return 42; }, task);
+
+    EXPECT_THROW(task.get(), TaskCancelled);
+    EXPECT_THROW(dependent.get(), TaskCancelled);
+    EXPECT_THAT(task.IsCancelled(), IsTrue());
+    EXPECT_THAT(dependent.IsCancelled(), IsTrue());
+    EXPECT_FALSE(ran);
+}
+
+TEST(CpuExecutorTest, SchedulerRunsWorkOnExecutorThread)
+{
+    auto executor = CpuExecutor(2);
+    const auto scheduler = executor.GetScheduler();
+
+    auto sndr = stdexec::schedule(scheduler) | stdexec::then([] { return std::this_thread::get_id(); });
+    const auto [threadId] = stdexec::sync_wait(std::move(sndr)).value();
+
+    EXPECT_THAT(threadId, Ne(std::this_thread::get_id()));
+}
+
+TEST(CpuExecutorTest, SchedulerStartsWorkWithItsPriority)
+{
+    auto executor = CpuExecutor(2);
+    const auto scheduler = executor.GetScheduler(TaskPriority::FrameCritical);
+    EXPECT_THAT(scheduler.GetPriority(), Eq(TaskPriority::FrameCritical));
+
+    stdexec::sync_wait(stdexec::schedule(scheduler));
+    stdexec::sync_wait(stdexec::schedule(scheduler.WithPriority(TaskPriority::Background)));
+    executor.WaitForTasks();
+    executor.NextFrame();
+
+    const auto statistics = executor.GetLastFrameStatistics();
+    EXPECT_THAT(statistics[static_cast<usize>(TaskPriority::FrameCritical)].launched, Eq(1u));
+    EXPECT_THAT(statistics[static_cast<usize>(TaskPriority::Normal)].launched, Eq(0u));
+    EXPECT_THAT(statistics[static_cast<usize>(TaskPriority::Background)].launched, Eq(1u));
+}
+
+TEST(CpuExecutorTest, CoroutinePipeline)
+{
+    auto executor = CpuExecutor(2);
+
+    const auto pipeline = [](CpuExecutor& executor) -> exec::task<int> {
+        co_await stdexec::schedule(executor.GetScheduler());
+        const int value = co_await executor.LaunchTask([] { return 20; });
+        const auto task = executor.LaunchTask([value] { return value + 1; });
+        co_return co_await executor.LaunchTask([](int v) { return v + 21; }, task);
+    };
+
+    const auto [result] = stdexec::sync_wait(pipeline(executor)).value();
+    EXPECT_THAT(result, Eq(42));
+}
+
 } // namespace
@@ -10,9 +10,14 @@
 #include "Teide/Shader.h"
 #include "Teide/Texture.h"
 #include "Teide/TextureData.h"
+#include "Teide/VulkanMesh.h"
 
 #include <gmock/gmock.h>
 
+#include <stop_token>
+#include <thread>
+#include <vector>
+
 using namespace testing;
 using namespace Teide;
 
@@ -113,6 +118,25 @@ TEST_F(DeviceTest, CreateTexture)
     EXPECT_THAT(texture.GetSampleCount(), Eq(1u));
 }
 
+TEST_F(DeviceTest, TexturesWithSameSamplerStateShareSampler)
+{
+    TextureData textureData = {
+        .size = {2, 2},
+        .format = Format::Byte4Srgb,
+        .mipLevelCount = 1,
+        .sampleCount = 1,
+        .pixels = HexToBytes("ff 00 00 ff 00 ff 00 ff ff 00 ff ff 00 00 ff ff"),
+    };
+    const auto texture1 = m_device->CreateTexture(textureData, "Texture1");
+    const auto texture2 = m_device->CreateTexture(textureData, "Texture2");
+    textureData.samplerState.magFilter = Filter::Linear;
+    const auto texture3 = m_device->CreateTexture(textureData, "Texture3");
+
+    const auto& sampler1 = m_device->GetImpl(texture1).sampler;
+    EXPECT_THAT(m_device->GetImpl(texture2).sampler, Eq(sampler1));
+    EXPECT_THAT(m_device->GetImpl(texture3).sampler, Ne(sampler1));
+}
+
 TEST_F(DeviceTest, CreateMesh)
 {
     const MeshData meshData = {
@@ -160,6 +184,124 @@ TEST_F(DeviceTest, CreateMeshWithIndices)
     EXPECT_THAT(mesh->GetIndexCount(), 3);
 }
 
+TEST_F(DeviceTest, PermanentMeshesShareGeometryHeapBlock)
+{
+    // A stride that isn't a power of two, so the second mesh's vertices have to be aligned after the first's indices
+    const VertexLayout vertexLayout = {
+        .bufferBindings = {{.stride = sizeof(float) * 3}},
+        .attributes = {{.name = "inPosition", .format = Format::Float3}},
+    };
+    const MeshData meshData = {
+        .vertexLayout = vertexLayout,
+        .vertexData = MakeBytes<float>({1, 2, 3, 4, 5, 6, 7, 8, 9}),
+        .indexData = MakeBytes<std::uint16_t>({0, 1, 2}),
+        .vertexCount = 3,
+    };
+    const auto mesh1 = m_device->GetImpl(m_device->CreateMesh(meshData, "Mesh1"));
+    const auto mesh2 = m_device->GetImpl(m_device->CreateMesh(meshData, "Mesh2"));
+
+    // Both meshes are bound from the start of the same block, so they can be drawn one after another without rebinding
+    EXPECT_THAT(mesh2->vertexBinding, Eq(mesh1->vertexBinding));
+    EXPECT_THAT(mesh2->indexBinding, Eq(mesh1->indexBinding));
+    EXPECT_THAT(mesh1->vertexBinding.offset, Eq(0u));
+    EXPECT_THAT(mesh1->indexBinding.offset, Eq(0u));
+
+    // Their draws start at where their data is in the block instead
+    const auto checkOffsets = [](const VulkanMesh& mesh) {
+        const auto& vertexRange = dynamic_cast<const GeometryHeap::Range&>(*mesh.vertexBuffer);
+        const auto& indexRange = dynamic_cast<const GeometryHeap::Range&>(*mesh.indexBuffer);
+        EXPECT_THAT(vertexRange.GetOffset() % (sizeof(float) * 3), Eq(0u));
+        EXPECT_THAT(mesh.vertexOffset, Eq(static_cast<int32>(vertexRange.GetOffset() / (sizeof(float) * 3))));
+        EXPECT_THAT(mesh.firstIndex, Eq(static_cast<uint32>(indexRange.GetOffset() / sizeof(std::uint16_t))));
+    };
+    checkOffsets(*mesh1);
+    checkOffsets(*mesh2);
+
+    EXPECT_THAT(mesh2->vertexOffset, Ne(mesh1->vertexOffset));
+    EXPECT_THAT(mesh2->firstIndex, Ne(mesh1->firstIndex));
+}
+
+TEST_F(DeviceTest, CreateMeshAsync)
+{
+    const MeshData meshData = {
+        .vertexData = MakeBytes<float>({1, 2, 3, 4, 5, 6}),
+        .indexData = MakeBytes<std::uint16_t>({0, 1, 2}),
+        .vertexCount = 3,
+    };
+    const auto [mesh, uploaded] = m_device->CreateMeshAsync(meshData, "Mesh");
+    ASSERT_THAT(mesh.get(), NotNull());
+    EXPECT_THAT(mesh->GetVertexBuffer()->GetSize(), Eq(meshData.vertexData.size()));
+    EXPECT_THAT(mesh->GetIndexBuffer()->GetSize(), Eq(meshData.indexData.size()));
+
+    ASSERT_THAT(uploaded.valid(), IsTrue());
+    EXPECT_NO_THROW(uploaded.get());
+}
+
+TEST_F(DeviceTest, CreateManyTexturesAsync)
+{
+    const TextureData textureData = {
+        .size = {2, 2},
+        .format = Format::Byte4Srgb,
+        .mipLevelCount = 1,
+        .sampleCount = 1,
+        .pixels = HexToBytes("ff 00 00 ff 00 ff 00 ff ff 00 ff ff 00 00 ff ff"),
+    };
+
+    std::vector<Texture> textures;
+    std::vector<Task<>> uploads;
+    for (int i = 0; i < 100; i++)
+    {
+        auto [texture, uploaded] = m_device->CreateTextureAsync(textureData, "Texture");
+        textures.push_back(std::move(texture));
+        uploads.push_back(std::move(uploaded));
+    }
+
+    EXPECT_NO_THROW(when_all(uploads).get());
+    EXPECT_THAT(textures.back().GetSize(), Eq(Geo::Size2i{2, 2}));
+}
+
+TEST_F(DeviceTest, CancelledCreateTextureAsyncIsNotUploaded)
+{
+    const TextureData textureData = {
+        .size = {2, 2},
+        .format = Format::Byte4Srgb,
+        .mipLevelCount = 1,
+        .sampleCount = 1,
+        .pixels = HexToBytes("ff 00 00 ff 00 ff 00 ff ff 00 ff ff 00 00 ff ff"),
+    };
+
+    auto stopSource = std::stop_source();
+    stopSource.request_stop();
+
+    const auto [texture, uploaded] = m_device->CreateTextureAsync(textureData, "Texture", stopSource.get_token());
+    EXPECT_THAT(uploaded.IsCancelled(), IsTrue());
+    EXPECT_THROW(uploaded.get(), TaskCancelled);
+
+    // Uploads that aren't cancelled still go through
+    const auto [texture2, uploaded2] = m_device->CreateTextureAsync(textureData, "Texture");
+    EXPECT_NO_THROW(uploaded2.get());
+}
+
+TEST_F(DeviceTest, CreateMeshes)
+{
+    const auto meshData = std::vector<MeshData>{
+        {.vertexData = MakeBytes<float>({1, 2, 3, 4, 5, 6}), .vertexCount = 3},
+        {.vertexData = MakeBytes<float>({1, 2, 3, 4}), .indexData = MakeBytes<std::uint16_t>({0, 1}), .vertexCount = 2},
+        {.lifetime = ResourceLifetime::Transient, .vertexData = MakeBytes<float>({1, 2}), .vertexCount = 1},
+    };
+    const auto [meshes, uploaded] = m_device->CreateMeshes(meshData, "Mesh");
+    EXPECT_NO_THROW(uploaded.get());
+
+    ASSERT_THAT(meshes.size(), Eq(meshData.size()));
+    for (usize i = 0; i < meshes.size(); i++)
+    {
+        ASSERT_THAT(meshes[i].get(), NotNull());
+        EXPECT_THAT(meshes[i]->GetVertexBuffer()->GetSize(), Eq(meshData[i].vertexData.size()));
+        EXPECT_THAT(meshes[i]->GetVertexCount(), Eq(meshData[i].vertexCount));
+    }
+    EXPECT_THAT(meshes[1]->GetIndexCount(), Eq(2u));
+}
+
 TEST_F(DeviceTest, CreatePipeline)
 {
     const auto shaderData = CompileShader(SimpleShader);
@@ -218,4 +360,116 @@ TEST_F(DeviceTest, CreateParameterBlockWithPushConstants)
     EXPECT_THAT(pblockImpl.GetPushConstantSize(), Eq(64u));
 }
 
+TEST_F(DeviceTest, CreateParameterBlocksOnManyThreads)
+{
+    const auto shaderData = CompileShader(ShaderWithMaterialParams);
+    const auto shader = m_device->CreateShader(shaderData, "Shader");
+    const ParameterBlockData pblockData = {
+        .layout = shader->GetMaterialPblockLayout(),
+        .parameters = {
+            .uniformData = std::vector<std::byte>(16u, std::byte{}),
+            .textures = {},
+        },
+    };
+
+    // More than fit in one descriptor pool, created on several threads at once while others are being released
+    constexpr int numThreads = 4;
+    constexpr int numPerThread = 100;
+    std::vector<std::vector<ParameterBlock>> pblocks(numThreads);
+    {
+        std::vector<std::jthread> threads;
+        for (auto& threadPblocks : pblocks)
+        {
+            threads.emplace_back([&] {
+                for (int i = 0; i < numPerThread; i++)
+                {
+                    auto [pblock, uploaded] = m_device->CreateParameterBlockAsync(pblockData, "ParameterBlock");
+                    uploaded.get();
+                    threadPblocks.push_back(std::move(pblock));
+                    if (i % 2 == 0)
+                    {
+                        threadPblocks.erase(threadPblocks.begin());
+                    }
+                }
+            });
+        }
+    }
+
+    for (const auto& threadPblocks : pblocks)
+    {
+        EXPECT_THAT(threadPblocks, SizeIs(numPerThread / 2));
+        for (const auto& pblock : threadPblocks)
+        {
+            EXPECT_THAT(m_device->GetDescriptorSet(pblock), IsValidVkHandle());
+        }
+    }
+}
+
+TEST_F(DeviceTest, GetMemoryStatistics)
+{
+    const auto before = m_device->GetMemoryStatistics();
+
+    const TextureData textureData = {
+        .size = {2, 2},
+        .format = Format::Byte4Srgb,
+        .mipLevelCount = 1,
+        .sampleCount = 1,
+        .pixels = HexToBytes("ff 00 00 ff 00 ff 00 ff ff 00 ff ff 00 00 ff ff"),
+    };
+    const auto texture = m_device->CreateTexture(textureData, "Texture");
+
+    const auto after = m_device->GetMemoryStatistics();
+    EXPECT_THAT(after.textures.allocationCount, Eq(before.textures.allocationCount + 1));
+    EXPECT_THAT(after.textures.bytes, Gt(before.textures.bytes));
+    EXPECT_THAT(after.textures.peakBytes, Ge(after.textures.bytes));
+    EXPECT_THAT(after.renderTargets.bytes, Eq(before.renderTargets.bytes));
+    EXPECT_THAT(after.heaps, Not(IsEmpty()));
+    EXPECT_THAT(after.heaps, Contains(Field(&MemoryHeapStatistics::deviceLocal, IsTrue())));
+}
+
+TEST_F(DeviceTest, DumpMemoryStatistics)
+{
+    const auto json = m_device->DumpMemoryStatistics(true);
+    EXPECT_THAT(json, StartsWith("{"));
+}
+
+TEST(DeviceStagingTest, SteadyStateUploadsDontOverflowStagingRing)
+{
+    constexpr uint64 stagingRingSize = 64 * 1024;
+    const auto device = CreateTestDevice({.stagingRingSize = stagingRingSize});
+    const auto before = device->GetMemoryStatistics();
+
+    // Many times the size of the ring in total, but the ring is freed as the uploads complete, without a new frame
+    const BufferData bufferData = {
+        .usage = BufferUsage::Vertex,
+        .data = std::vector<byte>(stagingRingSize / 8),
+    };
+    for (int i = 0; i < 64; i++)
+    {
+        const auto [buffer, uploaded] = device->CreateBufferAsync(bufferData, "Buffer");
+        uploaded.get();
+    }
+
+    const auto after = device->GetMemoryStatistics();
+    EXPECT_THAT(after.staging.allocationCount, Eq(before.staging.allocationCount));
+    EXPECT_THAT(after.staging.peakBytes, Eq(before.staging.peakBytes));
+}
+
+TEST(DeviceStagingTest, UploadWithoutStagingRing)
+{
+    const auto device = CreateTestDevice({.stagingRingSize = 0});
+    const auto before = device->GetMemoryStatistics();
+    EXPECT_THAT(before.staging.peakBytes, Eq(0u));
+
+    const BufferData bufferData = {
+        .usage = BufferUsage::Vertex,
+        .data = std::vector<byte>(1024),
+    };
+    const auto [buffer, uploaded] = device->CreateBufferAsync(bufferData, "Buffer");
+    uploaded.get();
+
+    const auto after = device->GetMemoryStatistics();
+    EXPECT_THAT(after.staging.peakBytes, Ge(bufferData.data.size()));
+}
+
 } // namespace
@@ -9,6 +9,10 @@
 
 #include <gmock/gmock.h>
 
+#include <future>
+#include <span>
+#include <vector>
+
 using namespace testing;
 using namespace std::chrono_literals;
 using namespace Teide;
@@ -43,7 +47,7 @@ protected:
 
     GpuExecutor CreateGpuExecutor()
     {
-        return {2, GetDevice(), GetQueue(), m_physicalDevice.queueFamilies.transferFamily};
+        return {GetDevice(), GetQueue(), m_physicalDevice.queueFamilies.transferFamily};
     }
 
     vk::UniqueCommandBuffer CreateCommandBuffer(const char* debugName = nullptr)
@@ -64,7 +68,8 @@ protected:
             vma::MemoryUsage::eAutoPreferHost, m_device.get(), m_allocator.get());
     }
 
-    static std::future<void> SubmitCommandBuffer(GpuExecutor& executor, std::uint32_t index, vk::CommandBuffer commandBuffer)
+    static std::future<void>
+    SubmitCommandBuffer(GpuExecutor& executor, std::uint64_t index, vk::CommandBuffer commandBuffer)
     {
         std::promise<void> promise;
         std::future<void> future = promise.get_future();
@@ -237,4 +242,124 @@ TEST_F(GpuExecutorTest, SubmitMultipleCommandBuffers)
     }
 }
 
+TEST_F(GpuExecutorTest, DestroyObjectAfterScheduledWork)
+{
+    auto executor = CreateGpuExecutor();
+    auto cmdBuffer = CreateCommandBuffer();
+    auto buffer = CreateHostVisibleBuffer(12);
+    auto object = std::make_shared<int>(42);
+    const auto weakObject = std::weak_ptr(object);
+
+    // The slot is added before the object is released, so the object has to outlive the command buffer, even though
+    // nothing has been recorded yet
+    const auto slot = executor.AddCommandBufferSlot();
+    executor.DestroyAfterScheduledWork(std::move(object));
+    executor.WaitForTasks();
+    EXPECT_THAT(weakObject.expired(), IsFalse());
+
+    cmdBuffer->begin(vk::CommandBufferBeginInfo{});
+    cmdBuffer->fillBuffer(buffer.buffer.get(), 0, 12, 0x01010101);
+    const auto future = SubmitCommandBuffer(executor, slot, cmdBuffer.get());
+    future.wait();
+    executor.WaitForTasks();
+    EXPECT_THAT(weakObject.expired(), IsTrue());
+}
+
+TEST_F(GpuExecutorTest, DestroyObjectWhenLaterWorkIsSubmitted)
+{
+    auto executor = CreateGpuExecutor();
+    auto cmdBuffer = CreateCommandBuffer();
+    auto buffer = CreateHostVisibleBuffer(12);
+    auto object = std::make_shared<int>(42);
+    const auto weakObject = std::weak_ptr(object);
+
+    const auto slot = executor.AddCommandBufferSlot();
+    executor.DestroyAfterScheduledWork(std::move(object));
+    cmdBuffer->begin(vk::CommandBufferBeginInfo{});
+    cmdBuffer->fillBuffer(buffer.buffer.get(), 0, 12, 0x01010101);
+    SubmitCommandBuffer(executor, slot, cmdBuffer.get()).wait();
+
+    // Submitting anything else is enough to release the object, without waiting for the next frame
+    executor.SkipCommandBufferSlot(executor.AddCommandBufferSlot());
+    EXPECT_THAT(weakObject.expired(), IsTrue());
+}
+
+TEST_F(GpuExecutorTest, AddCommandBufferSlotWaitsWhileRingIsFull)
+{
+    auto executor = CreateGpuExecutor();
+    std::vector<uint64> slots;
+    for (uint64 i = 0; i < GpuExecutor::SubmitRingSize; i++)
+    {
+        slots.push_back(executor.AddCommandBufferSlot());
+    }
+
+    auto nextSlot = std::async(std::launch::async, [&] { return executor.AddCommandBufferSlot(); });
+    EXPECT_THAT(nextSlot.wait_for(100ms), Eq(std::future_status::timeout));
+
+    executor.SkipCommandBufferSlot(slots.front());
+    ASSERT_THAT(nextSlot.wait_for(5s), Eq(std::future_status::ready));
+    slots.push_back(nextSlot.get());
+    EXPECT_THAT(slots.back(), Eq(GpuExecutor::SubmitRingSize));
+
+    for (const uint64 slot : std::span(slots).subspan(1))
+    {
+        executor.SkipCommandBufferSlot(slot);
+    }
+    executor.WaitForTasks();
+}
+
+TEST_F(GpuExecutorTest, NextFrameWaitsForCommandBuffersBeingRecorded)
+{
+    auto executor = CreateGpuExecutor();
+    const auto slot = executor.AddCommandBufferSlot();
+    CommandBuffer& commandBuffer = executor.GetCommandBuffer();
+
+    // The command buffer's pool is reset when its frame comes round again, which mustn't happen until it is submitted
+    auto nextFrames = std::async(std::launch::async, [&] {
+        for (uint32 i = 0; i < DefaultFramesInFlight; i++)
+        {
+            executor.NextFrame();
+        }
+    });
+    EXPECT_THAT(nextFrames.wait_for(100ms), Eq(std::future_status::timeout));
+
+    const auto future = SubmitCommandBuffer(executor, slot, commandBuffer);
+    EXPECT_THAT(nextFrames.wait_for(5s), Eq(std::future_status::ready));
+    EXPECT_THAT(future.wait_for(5s), Eq(std::future_status::ready));
+}
+
+TEST_F(GpuExecutorTest, CommandBufferWithWaitStartsNewBatch)
+{
+    auto executor = CreateGpuExecutor();
+    auto cmdBuffer1 = CreateCommandBuffer("cmdBuffer1");
+    auto cmdBuffer2 = CreateCommandBuffer("cmdBuffer2");
+    auto cmdBuffer3 = CreateCommandBuffer("cmdBuffer3");
+    for (const auto& cmdBuffer : {cmdBuffer1.get(), cmdBuffer2.get(), cmdBuffer3.get()})
+    {
+        cmdBuffer.begin(vk::CommandBufferBeginInfo{});
+    }
+
+    const auto slot1 = executor.AddCommandBufferSlot();
+    const auto slot2 = executor.AddCommandBufferSlot();
+    const auto slot3 = executor.AddCommandBufferSlot();
+
+    // Submit the first slot last so that all three are drained together. The wait is for a value the semaphore has
+    // already reached, but the first command buffer mustn't be held behind it.
+    const auto wait = Queue::SemaphoreWait{
+        .semaphore = executor.GetTimelineSemaphore(),
+        .value = 0,
+        .stages = vk::PipelineStageFlagBits::eTopOfPipe,
+    };
+    executor.SubmitCommandBuffer(slot2, cmdBuffer2.get(), nullptr, Queue::CallbackMode::Deferred, wait);
+    const auto future3 = SubmitCommandBuffer(executor, slot3, cmdBuffer3.get());
+    const auto future1 = SubmitCommandBuffer(executor, slot1, cmdBuffer1.get());
+    EXPECT_THAT(future1.wait_for(5s), Eq(std::future_status::ready));
+    EXPECT_THAT(future3.wait_for(5s), Eq(std::future_status::ready));
+
+    executor.NextFrame();
+    const auto stats = executor.GetLastFrameStatistics();
+    EXPECT_THAT(stats.submitBatches, Eq(2u));
+    EXPECT_THAT(stats.commandBuffers, Eq(3u));
+}
+
 } // namespace
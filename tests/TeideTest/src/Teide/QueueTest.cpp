@@ -9,6 +9,8 @@
 
 #include <gmock/gmock.h>
 
+#include <future>
+
 using namespace testing;
 using namespace std::chrono_literals;
 using namespace Teide;
@@ -40,6 +42,7 @@ protected:
     vk::Device GetDevice() const { return m_device.get(); }
 
     Queue CreateQueue() { return Queue(GetDevice(), m_queue); }
+    Queue CreateQueue(SubmitThreadSettings settings) { return Queue(GetDevice(), m_queue, nullptr, settings); }
 
     vk::UniqueCommandBuffer CreateCommandBuffer(const char* debugName = nullptr)
     {
@@ -59,7 +62,8 @@ protected:
             vma::MemoryUsage::eAutoPreferHost, m_device.get(), m_allocator.get());
     }
 
-    static std::future<void> SubmitCommandBuffer(GpuExecutor& executor, std::uint32_t index, vk::CommandBuffer commandBuffer)
+    static std::future<void>
+    SubmitCommandBuffer(GpuExecutor& executor, std::uint64_t index, vk::CommandBuffer commandBuffer)
     {
         std::promise<void> promise;
         std::future<void> future = promise.get_future();
@@ -170,4 +174,135 @@ TEST_F(QueueTest, SubmitMultipleCommandBuffers)
     }
 }
 
+TEST_F(QueueTest, SubmissionIdsAreTrackedByTimeline)
+{
+    auto queue = CreateQueue();
+    auto cmdBuffer1 = CreateCommandBuffer("cmdBuffer1");
+    auto cmdBuffer2 = CreateCommandBuffer("cmdBuffer2");
+    auto buffer = CreateHostVisibleBuffer(12);
+
+    cmdBuffer1->begin(vk::CommandBufferBeginInfo{});
+    cmdBuffer1->fillBuffer(buffer.buffer.get(), 0, 12, 0x01010101);
+    cmdBuffer1->end();
+    cmdBuffer2->begin(vk::CommandBufferBeginInfo{});
+    cmdBuffer2->fillBuffer(buffer.buffer.get(), 0, 12, 0x02020202);
+    cmdBuffer2->end();
+
+    const auto id1 = queue.Submit(One(cmdBuffer1.get()), nullptr);
+    const auto id2 = queue.Submit(One(cmdBuffer2.get()), nullptr);
+    EXPECT_THAT(id1, Eq(1u));
+    EXPECT_THAT(id2, Eq(2u));
+
+    EXPECT_TRUE(queue.WaitForSubmission(id2, 1s));
+    EXPECT_THAT(queue.GetCompletedSubmission(), Ge(id2));
+}
+
+TEST_F(QueueTest, CompletionCallbackCanSubmit)
+{
+    auto queue = CreateQueue();
+    auto cmdBuffer1 = CreateCommandBuffer("cmdBuffer1");
+    auto cmdBuffer2 = CreateCommandBuffer("cmdBuffer2");
+    cmdBuffer1->begin(vk::CommandBufferBeginInfo{});
+    cmdBuffer1->end();
+    cmdBuffer2->begin(vk::CommandBufferBeginInfo{});
+    cmdBuffer2->end();
+
+    // If callbacks were called with the queue's mutex held, submitting from one would deadlock
+    std::promise<uint64> resubmitted;
+    auto future = resubmitted.get_future();
+    queue.Submit(
+        One(cmdBuffer1.get()),
+        [&] { resubmitted.set_value(queue.Submit(One(cmdBuffer2.get()), nullptr)); },
+        Queue::CallbackMode::Inline);
+
+    ASSERT_THAT(future.wait_for(1s), Eq(std::future_status::ready));
+    EXPECT_TRUE(queue.WaitForSubmission(future.get(), 1s));
+}
+
+TEST_F(QueueTest, SubmitThreadCoalescesSubmissions)
+{
+    auto queue = CreateQueue({.flushPolicy = SubmitFlushPolicy::BatchSize, .batchSize = 2, .deadline = 10s});
+    auto cmdBuffer1 = CreateCommandBuffer("cmdBuffer1");
+    auto cmdBuffer2 = CreateCommandBuffer("cmdBuffer2");
+    auto buffer = CreateHostVisibleBuffer(12);
+
+    cmdBuffer1->begin(vk::CommandBufferBeginInfo{});
+    cmdBuffer1->fillBuffer(buffer.buffer.get(), 0, 4, 0x01010101);
+    cmdBuffer1->end();
+    cmdBuffer2->begin(vk::CommandBufferBeginInfo{});
+    cmdBuffer2->fillBuffer(buffer.buffer.get(), 4, 8, 0x02020202);
+    cmdBuffer2->end();
+
+    queue.Submit(One(cmdBuffer1.get()), nullptr);
+    const auto id2 = queue.Submit(One(cmdBuffer2.get()), nullptr);
+    EXPECT_TRUE(queue.WaitForSubmission(id2, 1s));
+
+    queue.NextFrame();
+    const auto stats = queue.GetLastFrameStatistics();
+    EXPECT_THAT(stats.submitCalls, Eq(1u));
+    EXPECT_THAT(stats.submitBatches, Eq(1u));
+    EXPECT_THAT(stats.commandBuffers, Eq(2u));
+
+    InvalidateAllocation(buffer.allocation);
+    const auto result = std::vector(buffer.mappedData.begin(), buffer.mappedData.end());
+    const auto expected = HexToBytes("01 01 01 01 02 02 02 02 02 02 02 02");
+    EXPECT_THAT(result, Eq(expected));
+}
+
+TEST_F(QueueTest, SubmitThreadStartsNewBatchAtWait)
+{
+    auto queue = CreateQueue({.flushPolicy = SubmitFlushPolicy::BatchSize, .batchSize = 3, .deadline = 10s});
+    auto cmdBuffer1 = CreateCommandBuffer("cmdBuffer1");
+    auto cmdBuffer2 = CreateCommandBuffer("cmdBuffer2");
+    auto cmdBuffer3 = CreateCommandBuffer("cmdBuffer3");
+    for (const auto& cmdBuffer : {cmdBuffer1.get(), cmdBuffer2.get(), cmdBuffer3.get()})
+    {
+        cmdBuffer.begin(vk::CommandBufferBeginInfo{});
+        cmdBuffer.end();
+    }
+
+    // The second submission waits for the first, which is already signalled by the time the GPU gets to the wait
+    const auto id1 = queue.Submit(One(cmdBuffer1.get()), nullptr);
+    const auto wait = Queue::SemaphoreWait{
+        .semaphore = queue.GetTimelineSemaphore(),
+        .value = id1,
+        .stages = vk::PipelineStageFlagBits::eTopOfPipe,
+    };
+    queue.Submit(One(cmdBuffer2.get()), nullptr, Queue::CallbackMode::Deferred, One(wait));
+    const auto id3 = queue.Submit(One(cmdBuffer3.get()), nullptr);
+    EXPECT_TRUE(queue.WaitForSubmission(id3, 1s));
+
+    queue.NextFrame();
+    const auto stats = queue.GetLastFrameStatistics();
+    EXPECT_THAT(stats.submitCalls, Eq(1u));
+    EXPECT_THAT(stats.submitBatches, Eq(2u));
+    EXPECT_THAT(stats.commandBuffers, Eq(3u));
+}
+
+TEST_F(QueueTest, PerFrameSubmitThreadWaitsForEndOfFrame)
+{
+    auto queue = CreateQueue({.flushPolicy = SubmitFlushPolicy::PerFrame, .deadline = 1ms});
+    auto cmdBuffer = CreateCommandBuffer();
+    cmdBuffer->begin(vk::CommandBufferBeginInfo{});
+    cmdBuffer->end();
+
+    // The deadline would have submitted it by now with any other policy
+    const auto id = queue.Submit(One(cmdBuffer.get()), nullptr);
+    EXPECT_FALSE(queue.WaitForSubmission(id, 100ms));
+
+    queue.NextFrame();
+    EXPECT_TRUE(queue.WaitForSubmission(id, 1s));
+}
+
+TEST_F(QueueTest, DeadlineSubmitThreadDoesntWaitForEndOfFrame)
+{
+    auto queue = CreateQueue({.flushPolicy = SubmitFlushPolicy::Deadline, .deadline = 1ms});
+    auto cmdBuffer = CreateCommandBuffer();
+    cmdBuffer->begin(vk::CommandBufferBeginInfo{});
+    cmdBuffer->end();
+
+    const auto id = queue.Submit(One(cmdBuffer.get()), nullptr);
+    EXPECT_TRUE(queue.WaitForSubmission(id, 1s));
+}
+
 } // namespace
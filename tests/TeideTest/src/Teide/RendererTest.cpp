@@ -14,6 +14,10 @@
 #include <gmock/gmock-matchers.h>
 #include <gtest/gtest.h>
 
+#include <optional>
+#include <stop_token>
+#include <vector>
+
 using namespace testing;
 using namespace Teide;
 
@@ -22,8 +26,8 @@ namespace
 class RendererTest : public testing::Test
 {
 public:
-    RendererTest() :
-        m_device{CreateTestDevice()},
+    explicit RendererTest(const GraphicsSettings& settings = {}) :
+        m_device{CreateTestDevice(settings)},
         m_renderer{m_device->CreateRenderer(nullptr)},
         m_emptyParameters{m_device->CreateParameterBlock({}, "EmptyParams")}
     {}
@@ -58,6 +62,41 @@ protected:
         return RenderObject{.mesh = mesh, .pipeline = pipeline, .materialParameters = m_emptyParameters};
     };
 
+    // Creates a renderer whose view parameters have uniforms and two textures, and a fullscreen tri that uses them
+    RenderObject CreateViewParamsFullscreenTri(const Teide::RenderTargetInfo& renderTarget)
+    {
+        const auto vertices = MakeBytes<float>({-1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f});
+        const auto mesh = m_device->CreateMesh({.vertexData = vertices, .vertexCount = 3}, "Mesh");
+        const VertexLayout vertexLayout
+            = {.topology = PrimitiveTopology::TriangleList,
+               .bufferBindings = {{.stride = sizeof(float) * 2}},
+               .attributes = {{.name = "inPosition", .format = Format::Float2, .bufferIndex = 0, .offset = 0}}};
+
+        // The compiled environment says which stages use the uniforms, which the renderer's layout has to match
+        const auto shaderData = CompileShader(ViewParamsShader);
+        CreateRenderer(shaderData.environment);
+        const auto shader = m_device->CreateShader(shaderData, "ViewParamsShader");
+
+        const auto pipeline = m_device->CreatePipeline({
+            .shader = shader,
+            .vertexLayout = vertexLayout,
+            .renderPasses = {{.framebufferLayout = renderTarget.framebufferLayout}},
+        });
+
+        return RenderObject{.mesh = mesh, .pipeline = pipeline, .materialParameters = m_emptyParameters};
+    }
+
+    Texture CreateSolidTexture(uint8 value)
+    {
+        const TextureData textureData = {
+            .size = {2, 2},
+            .format = Format::Byte4Norm,
+            .pixels = MakeBytes<uint8>(
+                {value, value, value, 255, value, value, value, 255, value, value, value, 255, value, value, value, 255}),
+        };
+        return m_device->CreateTexture(textureData, "SolidTexture");
+    }
+
     RenderToTextureResult RenderFullscreenTri(const Teide::RenderTargetInfo& renderTarget)
     {
         const auto fullscreenTri = CreateFullscreenTri(renderTarget);
@@ -83,6 +122,14 @@ private:
     ShaderCompiler m_shaderCompiler;
 };
 
+// For tests that need the device created with particular settings. Each group of tests names the fixture with an alias
+// and is instantiated with the settings it needs.
+class RendererWithSettingsTest : public RendererTest, public WithParamInterface<GraphicsSettings>
+{
+public:
+    RendererWithSettingsTest() : RendererTest(GetParam()) {}
+};
+
 MATCHER_P(MatchesColorTarget, renderTarget, "")
 {
     (void)result_listener;
@@ -166,6 +213,166 @@ TEST_F(RendererTest, RenderNothing)
     EXPECT_THAT(outputData.pixels, BytesEq("ff 00 00 ff ff 00 00 ff ff 00 00 ff ff 00 00 ff"));
 }
 
+TEST_F(RendererTest, CopyTextureDataWithoutWaitingForUpload)
+{
+    const TextureData textureData = {
+        .size = {2, 2},
+        .format = Format::Byte4Srgb,
+        .mipLevelCount = 1,
+        .sampleCount = 1,
+        .pixels = HexToBytes("ff 00 00 ff 00 ff 00 ff ff 00 ff ff 00 00 ff ff"),
+    };
+
+    // The copy is scheduled after the upload, so it sees the uploaded pixels without waiting for them explicitly
+    const auto [texture, uploaded] = m_device->CreateTextureAsync(textureData, "Texture");
+    const TextureData outputData = m_renderer->CopyTextureData(texture).get();
+
+    EXPECT_THAT(uploaded.IsReady(), IsTrue());
+    EXPECT_THAT(outputData.pixels, BytesEq("ff 00 00 ff 00 ff 00 ff ff 00 ff ff 00 00 ff ff"));
+}
+
+TEST_F(RendererTest, CancelledCopyTextureDataIsSkipped)
+{
+    const TextureData textureData = {
+        .size = {2, 2},
+        .format = Format::Byte4Srgb,
+        .mipLevelCount = 1,
+        .sampleCount = 1,
+        .pixels = HexToBytes("ff 00 00 ff 00 ff 00 ff ff 00 ff ff 00 00 ff ff"),
+    };
+    const Texture texture = m_device->CreateTexture(textureData, "Texture");
+
+    auto stopSource = std::stop_source();
+    stopSource.request_stop();
+
+    const auto cancelled = m_renderer->CopyTextureData(texture, stopSource.get_token());
+    EXPECT_THROW(cancelled.get(), TaskCancelled);
+    EXPECT_THAT(cancelled.IsCancelled(), IsTrue());
+
+    // The texture is left as it was, so it can still be copied
+    const TextureData outputData = m_renderer->CopyTextureData(texture).get();
+    EXPECT_THAT(outputData.pixels, BytesEq("ff 00 00 ff 00 ff 00 ff ff 00 ff ff 00 00 ff ff"));
+}
+
+TEST_F(RendererTest, CancelledRenderToTextureIsSkipped)
+{
+    auto stopSource = std::stop_source();
+    stopSource.request_stop();
+
+    const auto renderTarget = RenderTargetInfo{
+        .size = {2, 2},
+        .framebufferLayout = {
+            .colorFormat = Format::Byte4Srgb,
+            .captureColor = true,
+        },
+    };
+    const auto result
+        = m_renderer->RenderToTexture(renderTarget, RenderList{.name = "Cancelled"}, stopSource.get_token());
+
+    ASSERT_THAT(result.colorTexture.has_value(), IsTrue());
+    EXPECT_THROW(result.rendered.get(), TaskCancelled);
+}
+
+using GraphicsQueueOnlyRendererTest = RendererWithSettingsTest;
+INSTANTIATE_TEST_SUITE_P(
+    NoAsyncQueues, GraphicsQueueOnlyRendererTest,
+    Values(GraphicsSettings{.useTransferQueue = false, .useComputeQueue = false}));
+
+TEST_P(GraphicsQueueOnlyRendererTest, CopyTextureData)
+{
+    const TextureData textureData = {
+        .size = {2, 2},
+        .format = Format::Byte4Srgb,
+        .mipLevelCount = 1,
+        .sampleCount = 1,
+        .pixels = HexToBytes("ff 00 00 ff 00 ff 00 ff ff 00 ff ff 00 00 ff ff"),
+    };
+    const auto texture = m_device->CreateTexture(textureData, "Texture");
+
+    const TextureData outputData = m_renderer->CopyTextureData(texture).get();
+
+    EXPECT_THAT(outputData.pixels, BytesEq("ff 00 00 ff 00 ff 00 ff ff 00 ff ff 00 00 ff ff"));
+}
+
+TEST_P(GraphicsQueueOnlyRendererTest, Dispatch)
+{
+    const auto kernel = m_device->CreateKernel(CompileKernel(SimpleKernel), "Kernel");
+
+    const auto outputs
+        = m_renderer->Dispatch(kernel, {.name = "Dispatch", .outputSize = {2, 1}, .groupCount = {2, 1, 1}});
+    ASSERT_THAT(outputs.size(), Eq(1u));
+
+    const TextureData outputData = m_renderer->CopyTextureData(outputs[0]).get();
+
+    EXPECT_THAT(outputData.format, Eq(Format::Float1));
+    EXPECT_THAT(outputData.pixels, BytesEq("00 00 28 42 00 00 28 42"));
+}
+
+TEST_F(RendererTest, Dispatch)
+{
+    const auto kernel = m_device->CreateKernel(CompileKernel(SimpleKernel), "Kernel");
+
+    const auto outputs
+        = m_renderer->Dispatch(kernel, {.name = "Dispatch", .outputSize = {2, 2}, .groupCount = {2, 2, 1}});
+    ASSERT_THAT(outputs.size(), Eq(1u));
+
+    const TextureData outputData = m_renderer->CopyTextureData(outputs[0]).get();
+
+    EXPECT_THAT(outputData.size, Eq(Geo::Size2i{2, 2}));
+    EXPECT_THAT(outputData.pixels, BytesEq("00 00 28 42 00 00 28 42 00 00 28 42 00 00 28 42"));
+}
+
+TEST_F(RendererTest, DispatchWithInput)
+{
+    const auto kernel = m_device->CreateKernel(CompileKernel(CopyTextureKernel), "Kernel");
+    const TextureData inputData = {
+        .size = {2, 1},
+        .format = Format::Byte4Norm,
+        .mipLevelCount = 1,
+        .sampleCount = 1,
+        .pixels = HexToBytes("ff 00 00 ff 00 ff 00 ff"),
+    };
+    const auto input = m_device->CreateTexture(inputData, "Input");
+
+    const auto outputs = m_renderer->Dispatch(
+        kernel, {.name = "Dispatch", .inputs = {input}, .outputSize = {2, 1}, .groupCount = {2, 1, 1}});
+    ASSERT_THAT(outputs.size(), Eq(1u));
+
+    const TextureData outputData = m_renderer->CopyTextureData(outputs[0]).get();
+
+    // The kernel reads each texel of the input, and the input is handed back to the graphics queue unchanged
+    EXPECT_THAT(outputData.format, Eq(Format::Float4));
+    EXPECT_THAT(
+        outputData.pixels,
+        BytesEq("00 00 80 3f 00 00 00 00 00 00 00 00 00 00 80 3f 00 00 00 00 00 00 80 3f 00 00 00 00 00 00 80 3f"));
+    EXPECT_THAT(m_renderer->CopyTextureData(input).get().pixels, BytesEq("ff 00 00 ff 00 ff 00 ff"));
+}
+
+TEST_F(RendererTest, CopyTextureDataOfTexturesCreatedTogether)
+{
+    const auto makeTextureData = [](std::string_view pixels) {
+        return TextureData{
+            .size = {1, 1},
+            .format = Format::Byte4Srgb,
+            .mipLevelCount = 1,
+            .sampleCount = 1,
+            .pixels = HexToBytes(pixels),
+        };
+    };
+    const auto textureData = std::vector{
+        makeTextureData("ff 00 00 ff"),
+        makeTextureData("00 ff 00 ff"),
+        makeTextureData("00 00 ff ff"),
+    };
+
+    const auto [textures, uploaded] = m_device->CreateTextures(textureData, "Texture");
+    ASSERT_THAT(textures.size(), Eq(3u));
+
+    EXPECT_THAT(m_renderer->CopyTextureData(textures[0]).get().pixels, BytesEq("ff 00 00 ff"));
+    EXPECT_THAT(m_renderer->CopyTextureData(textures[1]).get().pixels, BytesEq("00 ff 00 ff"));
+    EXPECT_THAT(m_renderer->CopyTextureData(textures[2]).get().pixels, BytesEq("00 00 ff ff"));
+}
+
 TEST_F(RendererTest, RenderFullscreenTri)
 {
     const RenderTargetInfo renderTarget = {
@@ -183,6 +390,67 @@ TEST_F(RendererTest, RenderFullscreenTri)
     EXPECT_THAT(outputData.pixels, BytesEq("ff ff ff ff ff ff ff ff ff ff ff ff ff ff ff ff"));
 }
 
+using ParallelRecordingTest = RendererWithSettingsTest;
+INSTANTIATE_TEST_SUITE_P(
+    FourThreads, ParallelRecordingTest,
+    Values(GraphicsSettings{.numThreads = 4, .parallelRecording = {.minObjects = 16, .minChunkSize = 4}}));
+
+TEST_P(ParallelRecordingTest, RenderLargeList)
+{
+    const RenderTargetInfo renderTarget = {
+        .size = {2,2},
+        .framebufferLayout = {
+            .colorFormat = Format::Byte4Srgb,
+            .captureColor = true,
+        },
+    };
+
+    const RenderList renderList = {
+        .name = "LargeList",
+        .clearState = {.colorValue = Color{1.0f, 0.0f, 0.0f, 1.0f}},
+        .objects = std::vector(32, CreateFullscreenTri(renderTarget)),
+    };
+
+    const Texture texture = m_renderer->RenderToTexture(renderTarget, renderList).colorTexture.value();
+    const TextureData outputData = m_renderer->CopyTextureData(texture).get();
+    m_renderer->EndFrame();
+
+    EXPECT_THAT(outputData.pixels, BytesEq("ff ff ff ff ff ff ff ff ff ff ff ff ff ff ff ff"));
+
+    const auto chunks = m_renderer->GetLastFrameStatistics().recordedChunks;
+    EXPECT_THAT(chunks, SizeIs(4));
+    EXPECT_THAT(chunks, Each(Field(&RecordedChunk::renderListName, Eq("LargeList"))));
+    EXPECT_THAT(chunks, Each(Field(&RecordedChunk::objectCount, Eq(8u))));
+}
+
+using FramesInFlightTest = RendererWithSettingsTest;
+INSTANTIATE_TEST_SUITE_P(ThreeFramesInFlight, FramesInFlightTest, Values(GraphicsSettings{.framesInFlight = 3}));
+
+TEST_P(FramesInFlightTest, RenderMoreFramesThanInFlight)
+{
+    const RenderTargetInfo renderTarget = {
+        .size = {2,2},
+        .framebufferLayout = {
+            .colorFormat = Format::Byte4Srgb,
+            .captureColor = true,
+        },
+    };
+
+    std::vector<Task<TextureData>> readbacks;
+    for (uint32 i = 0; i < 8; i++)
+    {
+        m_renderer->BeginFrame({});
+        const Texture texture = RenderFullscreenTri(renderTarget).colorTexture.value();
+        readbacks.push_back(m_renderer->CopyTextureData(texture));
+        m_renderer->EndFrame();
+    }
+
+    for (const auto& readback : readbacks)
+    {
+        EXPECT_THAT(readback.get().pixels, BytesEq("ff ff ff ff ff ff ff ff ff ff ff ff ff ff ff ff"));
+    }
+}
+
 TEST_F(RendererTest, RenderMultisampledFullscreenTri)
 {
     const RenderTargetInfo renderTarget = {
@@ -292,6 +560,176 @@ TEST_F(RendererTest, RenderWithViewParameters)
     EXPECT_THAT(outputData.pixels, BytesEq("15 15 15 ff 15 15 15 ff 15 15 15 ff 15 15 15 ff"));
 }
 
+TEST_F(RendererTest, RenderWithViewUniformsAndTextures)
+{
+    const RenderTargetInfo renderTarget = {
+        .size = {2,2},
+        .framebufferLayout = {
+            .colorFormat = Format::Byte4Norm,
+            .captureColor = true,
+        },
+    };
+
+    const auto fullscreenTri = CreateViewParamsFullscreenTri(renderTarget);
+
+    // Each texture is bound separately, so they must both be sampled
+    const RenderList renderList = {
+        .clearState = {.colorValue = Color{1.0f, 0.0f, 0.0f, 1.0f}},
+        .viewParameters = {
+            .uniformData = MakeBytes<float>({30.0f / 255.0f, 30.0f / 255.0f, 30.0f / 255.0f, 0.0f}),
+            .textures = {CreateSolidTexture(10), CreateSolidTexture(20)},
+        },
+        .objects = {fullscreenTri},
+    };
+
+    const auto texture = m_renderer->RenderToTexture(renderTarget, renderList).colorTexture.value();
+    const TextureData outputData = m_renderer->CopyTextureData(texture).get();
+
+    EXPECT_THAT(outputData, MatchesColorTarget(renderTarget));
+    EXPECT_THAT(outputData.pixels, BytesEq("3c 3c 3c ff 3c 3c 3c ff 3c 3c 3c ff 3c 3c 3c ff"));
+}
+
+// View descriptor sets are cached per thread, so with one thread, the frames after the first of each frame in flight
+// are a steady state
+using SingleThreadRendererTest = RendererWithSettingsTest;
+INSTANTIATE_TEST_SUITE_P(OneThread, SingleThreadRendererTest, Values(GraphicsSettings{.numThreads = 1}));
+
+TEST_P(SingleThreadRendererTest, SteadyStateViewParametersDontCreateBuffersOrWriteDescriptorSets)
+{
+    const RenderTargetInfo renderTarget = {
+        .size = {2,2},
+        .framebufferLayout = {
+            .colorFormat = Format::Byte4Norm,
+            .captureColor = true,
+        },
+    };
+
+    const auto fullscreenTri = CreateViewParamsFullscreenTri(renderTarget);
+    const auto textures = std::vector{CreateSolidTexture(10), CreateSolidTexture(20)};
+
+    // Returns the last render list's output
+    const auto renderFrame = [&](int frame) {
+        m_renderer->BeginFrame({});
+
+        // The uniforms are different every frame and for every render list, but are allocated from the same blocks
+        std::optional<Texture> output;
+        for (int i = 0; i < 4; i++)
+        {
+            const float tint = static_cast<float>(frame + i) / 255.0f;
+            const RenderList renderList = {
+                .clearState = {.colorValue = Color{1.0f, 0.0f, 0.0f, 1.0f}},
+                .viewParameters = {.uniformData = MakeBytes<float>({tint, tint, tint, 0.0f}), .textures = textures},
+                .objects = {fullscreenTri},
+            };
+            output = m_renderer->RenderToTexture(renderTarget, renderList).colorTexture;
+        }
+
+        m_renderer->EndFrame();
+        return output.value();
+    };
+
+    // Each frame in flight has its own descriptor sets and uniform blocks, which its first frame creates
+    const auto uniformBlocksBefore = m_device->GetMemoryStatistics().uniformBuffers.allocationCount;
+    int frame = 0;
+    for (; frame < static_cast<int>(DefaultFramesInFlight); frame++)
+    {
+        renderFrame(frame);
+        EXPECT_THAT(m_renderer->GetLastFrameStatistics().viewDescriptorSetWrites, Gt(0u)) << "Frame " << frame;
+    }
+
+    const auto uniformBlocks = m_device->GetMemoryStatistics().uniformBuffers.allocationCount;
+    EXPECT_THAT(uniformBlocks, Gt(uniformBlocksBefore));
+
+    std::optional<Texture> output;
+    for (; frame < 10; frame++)
+    {
+        output = renderFrame(frame);
+        EXPECT_THAT(m_renderer->GetLastFrameStatistics().viewDescriptorSetWrites, Eq(0u)) << "Frame " << frame;
+    }
+
+    EXPECT_THAT(m_device->GetMemoryStatistics().uniformBuffers.allocationCount, Eq(uniformBlocks));
+
+    // The last render list's tint was 12, and the textures add 10 and 20
+    const TextureData outputData = m_renderer->CopyTextureData(output.value()).get();
+    EXPECT_THAT(outputData.pixels, BytesEq("2a 2a 2a ff 2a 2a 2a ff 2a 2a 2a ff 2a 2a 2a ff"));
+}
+
+// With a budget this small, every texture that hasn't been used since the frames in flight is evicted at the start of
+// each frame
+using TextureEvictionTest = RendererWithSettingsTest;
+INSTANTIATE_TEST_SUITE_P(TinyBudget, TextureEvictionTest, Values(GraphicsSettings{.textureMemoryBudget = 1}));
+
+TEST_P(TextureEvictionTest, EvictedTexturesAreReloadedWhenUsed)
+{
+    const RenderTargetInfo renderTarget = {
+        .size = {2,2},
+        .framebufferLayout = {
+            .colorFormat = Format::Byte4Norm,
+            .captureColor = true,
+        },
+    };
+
+    const auto vertices = MakeBytes<float>({-1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f});
+    const auto mesh = m_device->CreateMesh({.vertexData = vertices, .vertexCount = 3}, "Mesh");
+    const VertexLayout vertexLayout
+        = {.topology = PrimitiveTopology::TriangleList,
+           .bufferBindings = {{.stride = sizeof(float) * 2}},
+           .attributes = {{.name = "inPosition", .format = Format::Float2, .bufferIndex = 0, .offset = 0}}};
+
+    const auto shaderData = CompileShader(ViewAndMaterialTextureShader);
+    CreateRenderer(ViewTextureEnvironment);
+    const auto shader = m_device->CreateShader(shaderData, "ViewAndMaterialTextureShader");
+
+    const auto pipeline = m_device->CreatePipeline({
+        .shader = shader,
+        .vertexLayout = vertexLayout,
+        .renderPasses = {{.framebufferLayout = renderTarget.framebufferLayout}},
+    });
+
+    const auto viewTexture = CreateSolidTexture(20);
+    const auto materialTexture = CreateSolidTexture(10);
+    const auto materialParameters = m_device->CreateParameterBlock(
+        {.layout = shader->GetMaterialPblockLayout(), .parameters = {.textures = {materialTexture}}}, "Material");
+
+    const RenderList renderList = {
+        .clearState = {.colorValue = Color{1.0f, 0.0f, 0.0f, 1.0f}},
+        .viewParameters = {.textures = {viewTexture}},
+        .objects = {RenderObject{.mesh = mesh, .pipeline = pipeline, .materialParameters = materialParameters}},
+    };
+
+    const auto renderFrame = [&] {
+        m_renderer->BeginFrame({});
+        const auto output = m_renderer->RenderToTexture(renderTarget, renderList).colorTexture.value();
+        m_renderer->EndFrame();
+        return m_renderer->CopyTextureData(output).get();
+    };
+    const auto evictUnusedTextures = [&] {
+        for (uint32 i = 0; i < DefaultFramesInFlight + 2; i++)
+        {
+            m_renderer->BeginFrame({});
+            m_renderer->EndFrame();
+        }
+        m_renderer->WaitForGpu();
+    };
+
+    EXPECT_THAT(renderFrame().pixels, BytesEq("1e 1e 1e ff 1e 1e 1e ff 1e 1e 1e ff 1e 1e 1e ff"));
+
+    evictUnusedTextures();
+    ASSERT_THAT(m_device->GetMemoryStatistics().textures.allocationCount, Eq(0u));
+
+    // Both textures are made resident again, and the material's and the view's descriptor sets are rewritten to use
+    // the new images
+    EXPECT_THAT(renderFrame().pixels, BytesEq("1e 1e 1e ff 1e 1e 1e ff 1e 1e 1e ff 1e 1e 1e ff"));
+    EXPECT_THAT(m_renderer->GetLastFrameStatistics().viewDescriptorSetWrites, Gt(0u));
+    EXPECT_THAT(m_device->GetMemoryStatistics().textures.allocationCount, Eq(2u));
+
+    // Copying an evicted texture reloads it from its data first
+    evictUnusedTextures();
+    ASSERT_THAT(m_device->GetMemoryStatistics().textures.allocationCount, Eq(0u));
+    const auto materialTextureData = m_renderer->CopyTextureData(materialTexture).get();
+    EXPECT_THAT(materialTextureData.pixels, BytesEq("0a 0a 0a ff 0a 0a 0a ff 0a 0a 0a ff 0a 0a 0a ff"));
+}
+
 TEST_F(RendererTest, RenderMultipleFramesWithViewParameters)
 {
     const RenderTargetInfo renderTarget = {
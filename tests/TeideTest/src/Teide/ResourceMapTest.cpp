@@ -3,6 +3,10 @@
 
 #include <gmock/gmock.h>
 
+#include <optional>
+#include <thread>
+#include <vector>
+
 using namespace testing;
 using namespace Teide;
 
@@ -138,4 +142,102 @@ TEST(ResourceMapTest, CompareHandles)
     EXPECT_THAT(handle1, Ne(handle3));
 }
 
+TEST(ResourceMapTest, ReuseSlotOfDestroyedResource)
+{
+    auto map = Map("test");
+    const TestHandle handle1 = map.Insert(TestResource{.properties = {1}});
+    std::optional<TestHandle> handle2 = map.Insert(TestResource{.properties = {2}});
+    const auto oldIndex = static_cast<uint64>(*handle2);
+    handle2.reset();
+
+    const TestHandle handle3 = map.Insert(TestResource{.properties = {3}});
+    EXPECT_THAT(map.GetStatistics().totalSlots, Eq(2u));
+    EXPECT_THAT(handle3->value, Eq(3));
+
+    // The slot has been reused, but the handle still differs from the one to the destroyed resource
+    EXPECT_THAT(static_cast<uint32>(static_cast<uint64>(handle3)), Eq(static_cast<uint32>(oldIndex)));
+    EXPECT_THAT(static_cast<uint64>(handle3), Ne(oldIndex));
+}
+
+TEST(ResourceMapTest, SlotsAreBoundedByLiveResources)
+{
+    auto map = Map("test");
+    const TestHandle handle = map.Insert({});
+    for (int i = 0; i < 100; i++)
+    {
+        const TestHandle temporary = map.Insert(TestResource{.properties = {i}});
+        EXPECT_THAT(temporary->value, Eq(i));
+    }
+
+    const auto statistics = map.GetStatistics();
+    EXPECT_THAT(statistics.liveSlots, Eq(1u));
+    EXPECT_THAT(statistics.totalSlots, Eq(2u));
+}
+
+TEST(ResourceMapTest, DestroyFunctionTakesResource)
+{
+    std::vector<TestResource> destroyed;
+    auto map = Map("test", [&](TestResource&& resource) { destroyed.push_back(std::move(resource)); });
+    std::optional<TestHandle> handle = map.Insert(TestResource{.properties = {42}, .hiddenValue = 102});
+    EXPECT_THAT(destroyed, IsEmpty());
+
+    handle.reset();
+    ASSERT_THAT(destroyed, SizeIs(1));
+    EXPECT_THAT(destroyed[0].properties.value, Eq(42));
+    EXPECT_THAT(destroyed[0].hiddenValue, Eq(102));
+    EXPECT_THAT(map.GetStatistics().liveSlots, Eq(0u));
+}
+
+TEST(ResourceMapTest, LockIndexOfLiveResource)
+{
+    auto map = Map("test");
+    const TestHandle handle = map.Insert(TestResource{.properties = {42}});
+
+    const auto locked = map.Lock(static_cast<uint64>(handle));
+    ASSERT_THAT(locked, Optional(Eq(handle)));
+    EXPECT_THAT(map.Get(*locked).properties.value, Eq(42));
+}
+
+TEST(ResourceMapTest, LockIndexOfDestroyedResource)
+{
+    auto map = Map("test");
+    std::optional<TestHandle> handle = map.Insert(TestResource{.properties = {1}});
+    const auto index = static_cast<uint64>(*handle);
+    handle.reset();
+    EXPECT_THAT(map.Lock(index), Eq(std::nullopt));
+
+    // Still fails once the slot has been reused
+    const TestHandle newHandle = map.Insert(TestResource{.properties = {2}});
+    EXPECT_THAT(map.Lock(index), Eq(std::nullopt));
+    EXPECT_THAT(map.GetStatistics().liveSlots, Eq(1u));
+    EXPECT_THAT(map.Get(newHandle).properties.value, Eq(2));
+}
+
+TEST(ResourceMapTest, CopyHandlesConcurrently)
+{
+    auto map = Map("test");
+    std::optional<TestHandle> handle = map.Insert(TestResource{.properties = {42}, .hiddenValue = 102});
+    const TestResource& resource = map.Get(*handle);
+
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < 4; i++)
+        {
+            threads.emplace_back([&] {
+                for (int j = 0; j < 10000; j++)
+                {
+                    const TestHandle copy = *handle;
+                    EXPECT_THAT(map.Get(copy).hiddenValue, Eq(102));
+                    static_cast<void>(map.Insert({}));
+                }
+            });
+        }
+    }
+
+    EXPECT_THAT(map.GetStatistics().liveSlots, Eq(1u));
+    handle.reset();
+    EXPECT_THAT(resource.hiddenValue, Eq(0));
+    EXPECT_THAT(map.GetStatistics().liveSlots, Eq(0u));
+}
+
 } // namespace
@@ -8,6 +8,10 @@
 
 #include <gmock/gmock.h>
 
+#include <stop_token>
+#include <string>
+#include <vector>
+
 using namespace testing;
 using namespace std::chrono_literals;
 using namespace Teide;
@@ -44,6 +48,23 @@ protected:
 
     Scheduler CreateScheduler() { return {2, GetDevice(), GetQueue(), m_physicalDevice.queueFamilies.transferFamily}; }
 
+    bool HasSeparateTransferQueue() const
+    {
+        return m_physicalDevice.queueFamilies.transferFamily != m_physicalDevice.queueFamilies.graphicsFamily;
+    }
+
+    Scheduler CreateSchedulerWithTransferQueue()
+    {
+        const auto& queueFamilies = m_physicalDevice.queueFamilies;
+        const auto transferQueue = Scheduler::AsyncQueue{
+            .queue = m_queue,
+            .queueFamilyIndex = queueFamilies.transferFamily,
+        };
+        return {
+            2, GetDevice(), m_device->getQueue(queueFamilies.graphicsFamily, 0), queueFamilies.graphicsFamily,
+            std::nullopt, transferQueue};
+    }
+
     VulkanBuffer CreateHostVisibleBuffer(vk::DeviceSize size)
     {
         return VulkanBuffer{CreateBufferUninitialized(
@@ -114,6 +135,39 @@ TEST_F(SchedulerTest, ScheduleGpu)
     EXPECT_THAT(buffer.mappedData, Each(Eq(std::byte{1})));
 }
 
+TEST_F(SchedulerTest, SchedulingDoesntAllocateInSteadyState)
+{
+    auto scheduler = CreateScheduler();
+
+    const auto scheduleTasks = [&scheduler] {
+        std::uint64_t allocations = 0;
+        for (int i = 0; i < 100; i++)
+        {
+            Task<> cpuTask;
+            Task<> gpuTask;
+            Task<> afterTask;
+            {
+                const auto counter = ThreadAllocationCounter();
+                cpuTask = scheduler.Schedule([] {});
+                gpuTask = scheduler.ScheduleGpu([](CommandBuffer&) {});
+                afterTask = scheduler.ScheduleAfter(cpuTask, [] {});
+                allocations += counter.GetCount();
+            }
+            gpuTask.wait();
+            afterTask.wait();
+            scheduler.NextFrame();
+        }
+        return allocations;
+    };
+
+    // Task states and command buffers are pooled, so the first tasks fill the pools
+    for (int i = 0; i < 5; i++)
+    {
+        scheduleTasks();
+    }
+    EXPECT_THAT(scheduleTasks(), Eq(0u));
+}
+
 TEST_F(SchedulerTest, ScheduleGpuWithReturn)
 {
     auto scheduler = CreateScheduler();
@@ -130,6 +184,37 @@ TEST_F(SchedulerTest, ScheduleGpuWithReturn)
     EXPECT_THAT(buffer.mappedData, Each(Eq(byte{1})));
 }
 
+TEST_F(SchedulerTest, CancelledScheduleGpuIsSkipped)
+{
+    auto buffer = CreateHostVisibleBuffer(4);
+
+    auto scheduler = CreateScheduler();
+
+    auto stopSource = std::stop_source();
+    auto gate = TaskPromise<>();
+    const auto gateTask = gate.GetTask();
+
+    // Keep both worker threads busy until after stop has been requested, so the work is skipped rather than recorded
+    const auto blocker1 = scheduler.Schedule([&gateTask] { gateTask.wait(); });
+    const auto blocker2 = scheduler.Schedule([&gateTask] { gateTask.wait(); });
+    bool recorded = false;
+    const auto cancelled = scheduler.ScheduleGpu(
+        [&](CommandBuffer&) { recorded = true; }, TaskPriority::Background, stopSource.get_token());
+    const auto after = scheduler.ScheduleGpu(
+        [&buffer](CommandBuffer& cmdBuffer) { cmdBuffer->fillBuffer(buffer.buffer.get(), 0, 4, 0x01010101); });
+
+    stopSource.request_stop();
+    gate.SetValue();
+
+    EXPECT_THROW(cancelled.get(), TaskCancelled);
+    EXPECT_FALSE(recorded);
+
+    // Work scheduled after the cancelled work is still submitted
+    after.wait();
+    InvalidateAllocation(buffer.allocation);
+    EXPECT_THAT(buffer.mappedData, Each(Eq(std::byte{1})));
+}
+
 TEST_F(SchedulerTest, ScheduleGpuAcrossMultipleFrames)
 {
     auto scheduler = CreateScheduler();
@@ -152,4 +237,113 @@ TEST_F(SchedulerTest, ScheduleGpuAcrossMultipleFrames)
     }
 }
 
+TEST_F(SchedulerTest, ScheduleTransferWithoutTransferQueue)
+{
+    auto buffer = CreateHostVisibleBuffer(12);
+    std::vector<std::string> stages;
+
+    auto scheduler = CreateScheduler();
+    const auto task = scheduler.ScheduleTransfer(
+        [&](CommandBuffer&) { stages.push_back("release"); },
+        [&](CommandBuffer& cmdBuffer) {
+            stages.push_back("transfer");
+            cmdBuffer->fillBuffer(buffer.buffer.get(), 0, 12, 0x01010101);
+            return 42;
+        },
+        [&](CommandBuffer&) { stages.push_back("acquire"); });
+
+    EXPECT_THAT(task.get(), Eq(42));
+    EXPECT_THAT(stages, ElementsAre("release", "transfer", "acquire"));
+
+    InvalidateAllocation(buffer.allocation);
+    EXPECT_THAT(buffer.mappedData, Each(Eq(std::byte{1})));
+}
+
+TEST_F(SchedulerTest, ScheduleTransferOnTransferQueue)
+{
+    if (!HasSeparateTransferQueue())
+    {
+        GTEST_SKIP() << "Device has no separate transfer queue";
+    }
+
+    auto buffer = CreateHostVisibleBuffer(12);
+    std::vector<std::string> stages;
+
+    auto scheduler = CreateSchedulerWithTransferQueue();
+    ASSERT_THAT(scheduler.HasTransferQueue(), IsTrue());
+
+    const auto task = scheduler.ScheduleTransfer(
+        [&](CommandBuffer&) { stages.push_back("release"); },
+        [&](CommandBuffer& cmdBuffer) {
+            stages.push_back("transfer");
+            cmdBuffer->fillBuffer(buffer.buffer.get(), 0, 12, 0x01010101);
+            return 42;
+        },
+        [&](CommandBuffer&) { stages.push_back("acquire"); });
+
+    EXPECT_THAT(task.get(), Eq(42));
+    EXPECT_THAT(stages, ElementsAre("release", "transfer", "acquire"));
+
+    InvalidateAllocation(buffer.allocation);
+    EXPECT_THAT(buffer.mappedData, Each(Eq(std::byte{1})));
+}
+
+TEST_F(SchedulerTest, CancelledScheduleTransferIsSkipped)
+{
+    auto buffer = CreateHostVisibleBuffer(4);
+    std::vector<std::string> stages;
+
+    auto scheduler = HasSeparateTransferQueue() ? CreateSchedulerWithTransferQueue() : CreateScheduler();
+
+    auto stopSource = std::stop_source();
+    auto gate = TaskPromise<>();
+    const auto gateTask = gate.GetTask();
+
+    // Keep both worker threads busy until after stop has been requested, so none of the stages are recorded
+    const auto blocker1 = scheduler.Schedule([&gateTask] { gateTask.wait(); });
+    const auto blocker2 = scheduler.Schedule([&gateTask] { gateTask.wait(); });
+    const auto cancelled = scheduler.ScheduleTransfer(
+        [&](CommandBuffer&) { stages.push_back("release"); }, [&](CommandBuffer&) { stages.push_back("transfer"); },
+        [&](CommandBuffer&) { stages.push_back("acquire"); }, vk::PipelineStageFlagBits::eAllCommands,
+        stopSource.get_token());
+    const auto after = scheduler.ScheduleGpu(
+        [&buffer](CommandBuffer& cmdBuffer) { cmdBuffer->fillBuffer(buffer.buffer.get(), 0, 4, 0x01010101); });
+
+    stopSource.request_stop();
+    gate.SetValue();
+
+    EXPECT_THROW(cancelled.get(), TaskCancelled);
+    EXPECT_THAT(cancelled.IsCancelled(), IsTrue());
+    EXPECT_THAT(stages, IsEmpty());
+
+    // Work scheduled after the cancelled transfer is still submitted, on both queues
+    after.wait();
+    InvalidateAllocation(buffer.allocation);
+    EXPECT_THAT(buffer.mappedData, Each(Eq(std::byte{1})));
+
+    const auto transferAfter = scheduler.ScheduleTransfer(
+        [&buffer](CommandBuffer& cmdBuffer) { cmdBuffer->fillBuffer(buffer.buffer.get(), 0, 4, 0x02020202); },
+        [](CommandBuffer&) {});
+    transferAfter.wait();
+    InvalidateAllocation(buffer.allocation);
+    EXPECT_THAT(buffer.mappedData, Each(Eq(std::byte{2})));
+}
+
+TEST_F(SchedulerTest, ScheduleTransferWithStopAlreadyRequestedDoesNothing)
+{
+    auto scheduler = CreateScheduler();
+
+    auto stopSource = std::stop_source();
+    stopSource.request_stop();
+
+    bool recorded = false;
+    const auto task = scheduler.ScheduleTransfer(
+        [&](CommandBuffer&) { recorded = true; }, [](CommandBuffer&) {}, vk::PipelineStageFlagBits::eAllCommands,
+        stopSource.get_token());
+
+    EXPECT_THAT(task.IsCancelled(), IsTrue());
+    scheduler.WaitForGpu();
+    EXPECT_THAT(recorded, IsFalse());
+}
+
 } // namespace
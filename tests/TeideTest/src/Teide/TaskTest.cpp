@@ -0,0 +1,204 @@
+#include "Teide/Task.h"
+
+#include "Teide/CpuExecutor.h"
+
+#include <gmock/gmock.h>
+#include <stdexec/execution.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+using namespace Teide;
+
+namespace
+{
+
+TEST(TaskTest, PromiseFulfilsTask)
+{
+    auto promise = TaskPromise<int>();
+    const auto task = promise.GetTask();
+    ASSERT_THAT(task.valid(), IsTrue());
+    EXPECT_THAT(task.wait_for(0s), Eq(std::future_status::timeout));
+
+    promise.SetValue(42);
+
+    EXPECT_THAT(task.wait_for(0s), Eq(std::future_status::ready));
+    EXPECT_THAT(task.get(), Eq(42));
+}
+
+TEST(TaskTest, AbandonedPromiseBreaksTask)
+{
+    auto task = [] {
+        auto promise = TaskPromise<int>();
+        return promise.GetTask();
+    }();
+
+    EXPECT_THROW(task.get(), std::future_error);
+}
+
+TEST(TaskTest, ThenRunsWhenTaskCompletes)
+{
+    auto promise = TaskPromise<int>();
+    const auto task = promise.GetTask().then([](const Task<int>& t) { return t.get() * 2; });
+    EXPECT_THAT(task.IsReady(), IsFalse());
+
+    promise.SetValue(21);
+
+    ASSERT_THAT(task.IsReady(), IsTrue());
+    EXPECT_THAT(task.get(), Eq(42));
+}
+
+TEST(TaskTest, ThenOnCompletedTaskRunsImmediately)
+{
+    auto promise = TaskPromise<void>();
+    promise.SetValue();
+
+    bool called = false;
+    const auto task = promise.GetTask().then([&](const Task<>&) { called = true; });
+
+    EXPECT_THAT(called, IsTrue());
+    EXPECT_THAT(task.IsReady(), IsTrue());
+}
+
+TEST(TaskTest, ThenPropagatesExceptions)
+{
+    auto promise = TaskPromise<int>();
+    const auto task = promise.GetTask().then([](const Task<int>& t) { return t.get() + 1; });
+
+    promise.SetException(std::make_exception_ptr(std::runtime_error("failed")));
+
+    EXPECT_THROW(task.get(), std::runtime_error);
+}
+
+TEST(TaskTest, ThenPropagatesCancellation)
+{
+    auto promise = TaskPromise<int>();
+    const auto task = promise.GetTask().then([](const Task<int>& t) { return t.get() + 1; });
+
+    promise.SetCancelled();
+
+    EXPECT_THAT(task.IsCancelled(), IsTrue());
+    EXPECT_THROW(task.get(), TaskCancelled);
+}
+
+TEST(TaskTest, FailedTaskIsNotCancelled)
+{
+    auto promise = TaskPromise<int>();
+    const auto task = promise.GetTask();
+    EXPECT_THAT(task.IsCancelled(), IsFalse());
+
+    promise.SetException(std::make_exception_ptr(std::runtime_error("failed")));
+
+    EXPECT_THAT(task.IsCancelled(), IsFalse());
+}
+
+TEST(TaskTest, WhenAllWaitsForAllTasks)
+{
+    auto promise1 = TaskPromise<int>();
+    auto promise2 = TaskPromise<void>();
+    const auto task = when_all(promise1.GetTask(), promise2.GetTask());
+
+    promise2.SetValue();
+    EXPECT_THAT(task.IsReady(), IsFalse());
+
+    promise1.SetValue(1);
+    EXPECT_THAT(task.IsReady(), IsTrue());
+    EXPECT_NO_THROW(task.get());
+}
+
+TEST(TaskTest, WhenAllOfVector)
+{
+    std::vector<TaskPromise<int>> promises(4);
+    std::vector<Task<int>> tasks;
+    for (auto& promise : promises)
+    {
+        tasks.push_back(promise.GetTask());
+    }
+    const auto task = when_all(tasks);
+
+    promises[3].SetValue(3);
+    promises[1].SetException(std::make_exception_ptr(std::runtime_error("failed")));
+    promises[0].SetValue(0);
+    EXPECT_THAT(task.IsReady(), IsFalse());
+
+    promises[2].SetValue(2);
+    ASSERT_THAT(task.IsReady(), IsTrue());
+    EXPECT_THROW(task.get(), std::runtime_error);
+}
+
+TEST(TaskTest, WhenAllKeepsReleasedTasksAlive)
+{
+    auto promise = TaskPromise<int>();
+
+    // Nothing else refers to the continuation once its task has been released
+    const auto task = when_all(promise.GetTask().then([](const Task<int>& t) -> int {
+        throw std::runtime_error(std::to_string(t.get()));
+    }));
+
+    promise.SetValue(1);
+    ASSERT_THAT(task.IsReady(), IsTrue());
+    EXPECT_THROW(task.get(), std::runtime_error);
+}
+
+TEST(TaskTest, WhenAllOfNothingIsReady)
+{
+    EXPECT_THAT(when_all().IsReady(), IsTrue());
+}
+
+TEST(TaskTest, WhenAllOfCancelledTaskIsCancelled)
+{
+    auto promise1 = TaskPromise<int>();
+    auto promise2 = TaskPromise<void>();
+    const auto task = when_all(promise1.GetTask(), promise2.GetTask());
+
+    promise1.SetValue(1);
+    promise2.SetCancelled();
+
+    EXPECT_THAT(task.IsCancelled(), IsTrue());
+    EXPECT_THROW(task.get(), TaskCancelled);
+}
+
+TEST(TaskTest, TaskIsASender)
+{
+    auto promise = TaskPromise<int>();
+    auto sndr = promise.GetTask() | stdexec::then([](int value) { return value * 2; });
+
+    auto thread = std::jthread([&promise] { promise.SetValue(21); });
+
+    const auto [result] = stdexec::sync_wait(std::move(sndr)).value();
+    EXPECT_THAT(result, Eq(42));
+}
+
+TEST(TaskTest, CompletedTaskIsASender)
+{
+    auto promise = TaskPromise<>();
+    const auto task = promise.GetTask();
+    promise.SetValue();
+
+    EXPECT_THAT(stdexec::sync_wait(task).has_value(), IsTrue());
+}
+
+TEST(TaskTest, FailedTaskSendsError)
+{
+    auto promise = TaskPromise<int>();
+    const auto task = promise.GetTask();
+    promise.SetException(std::make_exception_ptr(std::runtime_error("failed")));
+
+    EXPECT_THROW(stdexec::sync_wait(task), std::runtime_error);
+}
+
+TEST(TaskTest, CancelledTaskSendsStopped)
+{
+    auto promise = TaskPromise<int>();
+    const auto task = promise.GetTask();
+    promise.SetCancelled();
+
+    EXPECT_THAT(stdexec::sync_wait(task).has_value(), IsFalse());
+}
+
+} // namespace
@@ -26,6 +26,18 @@ void main() {
     outColor = vec4(lastColor + vec3(1.0/256.0), 1.0);
 })--";
 
+inline const std::string ViewParamsPixelShader = R"--(
+void main() {
+    vec3 color = texture(tex1, vec2(0.5, 0.5)).rgb + texture(tex2, vec2(0.5, 0.5)).rgb;
+    outColor = vec4(color + view.tint.rgb, 1.0);
+})--";
+
+inline const std::string ViewAndMaterialTexturePixelShader = R"--(
+void main() {
+    vec3 color = texture(tex, vec2(0.5, 0.5)).rgb + texture(materialTex, vec2(0.5, 0.5)).rgb;
+    outColor = vec4(color, 1.0);
+})--";
+
 inline const std::string PixelShaderWithMaterialParams = R"--(
 void main() {
     outColor = material.color;
@@ -133,6 +145,61 @@ inline const ShaderSourceData ViewTextureShader = {
     },
 };
 
+inline const ShaderSourceData ViewAndMaterialTextureShader = {
+    .language = ShaderLanguage::Glsl,
+    .environment = ViewTextureEnvironment,
+    .materialPblock = {
+        .parameters = {
+            {"materialTex", Type::Texture2D},
+        },
+    },
+    .vertexShader = {
+        .inputs = {{
+            {"inPosition", Type::Vector4},
+        }},
+        .outputs = {{
+            {"gl_Position", Type::Vector3},
+        }},
+        .source = SimpleVertexShader,
+    },
+    .pixelShader = {
+        .outputs = {{
+            {"outColor", Type::Vector4},
+        }},
+        .source = ViewAndMaterialTexturePixelShader,
+    },
+};
+
+inline const Teide::ShaderEnvironmentData ViewParamsEnvironment = {
+    .viewPblock = {
+        .parameters = {
+            {"tint", Type::Vector4},
+            {"tex1", Type::Texture2D},
+            {"tex2", Type::Texture2D},
+        },
+    }
+};
+
+inline const ShaderSourceData ViewParamsShader = {
+    .language = ShaderLanguage::Glsl,
+    .environment = ViewParamsEnvironment,
+    .vertexShader = {
+        .inputs = {{
+            {"inPosition", Type::Vector4},
+        }},
+        .outputs = {{
+            {"gl_Position", Type::Vector3},
+        }},
+        .source = SimpleVertexShader,
+    },
+    .pixelShader = {
+        .outputs = {{
+            {"outColor", Type::Vector4},
+        }},
+        .source = ViewParamsPixelShader,
+    },
+};
+
 const KernelSourceData SimpleKernel = {
     .language = ShaderLanguage::Glsl,
     .kernelShader = {
@@ -147,6 +214,23 @@ const KernelSourceData SimpleKernel = {
     },
 };
 
+const KernelSourceData CopyTextureKernel = {
+    .language = ShaderLanguage::Glsl,
+    .kernelShader = {
+        .inputs = {{
+            {"source", Type::Texture2D},
+        }},
+        .outputs = {{
+            {"result", Type::Vector4},
+        }},
+        .source = R"--(
+            void main() {
+                result = texelFetch(source, ivec2(gl_GlobalInvocationID.xy), 0);
+            }
+        )--",
+    },
+};
+
 inline const Teide::TextureData OnePixelWhiteTexture = {
     .size = {1, 1},
     .format = Teide::Format::Byte4Norm,
@@ -8,6 +8,8 @@
 #include "vkex/vkex.hpp"
 
 #include <charconv>
+#include <cstdlib>
+#include <new>
 #include <ranges>
 
 using namespace Teide;
@@ -28,13 +30,13 @@ vk::UniqueInstance CreateTestVulkanInstance(Teide::VulkanLoader& loader)
     return Teide::CreateInstance(loader, {.optionalExtensions = OptionalExtensions});
 }
 
-Teide::VulkanDevicePtr CreateTestDevice()
+Teide::VulkanDevicePtr CreateTestDevice(const Teide::GraphicsSettings& settings)
 {
     VulkanLoader loader;
     vk::UniqueInstance instance = CreateTestVulkanInstance(loader);
     auto physicalDevice = FindPhysicalDevice(instance.get());
 
-    return std::make_unique<VulkanDevice>(std::move(loader), std::move(instance), std::move(physicalDevice));
+    return std::make_unique<VulkanDevice>(std::move(loader), std::move(instance), std::move(physicalDevice), settings);
 }
 
 std::optional<std::uint32_t> GetTransferQueueIndex(vk::PhysicalDevice physicalDevice)
@@ -71,6 +73,43 @@ std::vector<std::byte> HexToBytes(std::string_view hexString)
     return ret;
 }
 
+namespace
+{
+thread_local std::uint64_t t_allocationCount = 0;
+}
+
+// Replaces the global allocation functions for the whole test executable, so that ThreadAllocationCounter can count
+// allocations
+void* operator new(std::size_t size)
+{
+    t_allocationCount++;
+    if (void* const ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t /*size*/) noexcept
+{
+    std::free(ptr);
+}
+
+ThreadAllocationCounter::ThreadAllocationCounter() : m_startCount{t_allocationCount}
+{}
+
+ThreadAllocationCounter::~ThreadAllocationCounter() = default;
+
+std::uint64_t ThreadAllocationCounter::GetCount() const
+{
+    return t_allocationCount - m_startCount;
+}
+
 auto GetPixelsSync(vk::Image image, Teide::TextureState state, Geo::Size2i size, Teide::Format format, Teide::VulkanDevice& device)
     -> std::vector<Teide::uint32>
 {
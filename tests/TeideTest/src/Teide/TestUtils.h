@@ -21,12 +21,28 @@ inline bool g_windowless = false;
 
 vk::UniqueInstance CreateTestVulkanInstance(Teide::VulkanLoader& loader);
 
-Teide::VulkanDevicePtr CreateTestDevice();
+Teide::VulkanDevicePtr CreateTestDevice(const Teide::GraphicsSettings& settings = {});
 
 std::optional<std::uint32_t> GetTransferQueueIndex(vk::PhysicalDevice physicalDevice);
 
 std::vector<std::byte> HexToBytes(std::string_view hexString);
 
+// Counts the heap allocations made by the calling thread for as long as it is alive
+class ThreadAllocationCounter
+{
+public:
+    ThreadAllocationCounter();
+    ~ThreadAllocationCounter();
+
+    ThreadAllocationCounter(const ThreadAllocationCounter&) = delete;
+    ThreadAllocationCounter& operator=(const ThreadAllocationCounter&) = delete;
+
+    std::uint64_t GetCount() const;
+
+private:
+    std::uint64_t m_startCount;
+};
+
 auto GetPixelsSync(vk::Image image, Teide::TextureState state, Geo::Size2i size, Teide::Format format, Teide::VulkanDevice& device)
     -> std::vector<Teide::uint32>;
 
@@ -115,7 +115,7 @@ TEST(TestUtilsTest, GetPixelsSyncInlined)
     const auto bufferSize = GetByteSize(textureData);
 
     auto buffer = device->CreateBufferUninitialized(
-        bufferSize, vk::BufferUsageFlagBits::eTransferDst,
+        bufferSize, vk::BufferUsageFlagBits::eTransferDst, device->GetMemoryCounters().staging,
         vma::AllocationCreateFlagBits::eMapped | vma::AllocationCreateFlagBits::eHostAccessRandom);
 
     device->ExecCommandsSync([&device, &texture, &buffer](vk::CommandBuffer commandBuffer) {
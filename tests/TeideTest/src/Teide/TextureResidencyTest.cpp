@@ -0,0 +1,136 @@
+#include "Teide/TextureResidency.h"
+
+#include <gmock/gmock.h>
+
+#include <vector>
+
+using namespace testing;
+using namespace Teide;
+
+namespace
+{
+
+constexpr uint32 FramesInFlight = 2;
+
+void AdvanceFrames(TextureResidency& residency, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        residency.NextFrame();
+    }
+}
+
+TEST(TextureResidencyTest, EvictLeastRecentlyUsed)
+{
+    auto residency = TextureResidency(FramesInFlight);
+    const auto older = residency.Track(1, 100, {});
+    residency.NextFrame();
+    const auto newer = residency.Track(2, 100, {});
+    AdvanceFrames(residency, 5);
+
+    std::vector<uint64> evicted;
+    const auto bytesFreed = residency.Evict(50, [&](TextureResidency::Entry& entry) {
+        evicted.push_back(entry.handleIndex);
+        return true;
+    });
+
+    EXPECT_THAT(bytesFreed, Eq(100u));
+    EXPECT_THAT(evicted, ElementsAre(1u));
+    EXPECT_THAT(older->resident, IsFalse());
+    EXPECT_THAT(newer->resident, IsTrue());
+    EXPECT_THAT(residency.GetResidentSize(), Eq(100u));
+}
+
+TEST(TextureResidencyTest, DontEvictTexturesInFlight)
+{
+    auto residency = TextureResidency(FramesInFlight);
+    const auto entry = residency.Track(1, 100, {});
+    AdvanceFrames(residency, 5);
+    residency.MarkUsed(*entry);
+    AdvanceFrames(residency, FramesInFlight);
+
+    const auto bytesFreed = residency.Evict(100, [](TextureResidency::Entry&) { return true; });
+    EXPECT_THAT(bytesFreed, Eq(0u));
+    EXPECT_THAT(entry->resident, IsTrue());
+}
+
+TEST(TextureResidencyTest, DontEvictTexturesWithUses)
+{
+    auto residency = TextureResidency(FramesInFlight);
+    const auto entry = residency.Track(1, 100, {});
+    AdvanceFrames(residency, 5);
+
+    auto use = residency.AddUse(entry);
+    const auto copy = use;
+    EXPECT_THAT(entry->pendingUses.load(), Eq(2u));
+
+    const auto evict = [](TextureResidency::Entry&) { return true; };
+    EXPECT_THAT(residency.Evict(100, evict), Eq(0u));
+
+    use = {};
+    EXPECT_THAT(residency.Evict(100, evict), Eq(0u));
+    EXPECT_THAT(entry->resident, IsTrue());
+}
+
+TEST(TextureResidencyTest, EvictTextureOnceUsesAreReleased)
+{
+    auto residency = TextureResidency(FramesInFlight);
+    const auto entry = residency.Track(1, 100, {});
+    AdvanceFrames(residency, 5);
+
+    {
+        const auto use = residency.AddUse(entry);
+        const auto copy = use;
+    }
+    EXPECT_THAT(entry->pendingUses.load(), Eq(0u));
+
+    EXPECT_THAT(residency.Evict(100, [](TextureResidency::Entry&) { return true; }), Eq(100u));
+    EXPECT_THAT(entry->resident, IsFalse());
+}
+
+TEST(TextureResidencyTest, SkipTexturesThatCantBeEvicted)
+{
+    auto residency = TextureResidency(FramesInFlight);
+    const auto first = residency.Track(1, 100, {});
+    const auto second = residency.Track(2, 100, {});
+    AdvanceFrames(residency, 5);
+
+    const auto bytesFreed
+        = residency.Evict(100, [](TextureResidency::Entry& entry) { return entry.handleIndex != 1; });
+    EXPECT_THAT(bytesFreed, Eq(100u));
+    EXPECT_THAT(first->resident, IsTrue());
+    EXPECT_THAT(second->resident, IsFalse());
+}
+
+TEST(TextureResidencyTest, ForgetDestroyedTextures)
+{
+    auto residency = TextureResidency(FramesInFlight);
+    auto entry = residency.Track(1, 100, {});
+    AdvanceFrames(residency, 5);
+    entry.reset();
+
+    const auto bytesFreed = residency.Evict(100, [](TextureResidency::Entry&) { return true; });
+    EXPECT_THAT(bytesFreed, Eq(0u));
+    EXPECT_THAT(residency.GetResidentSize(), Eq(0u));
+}
+
+TEST(TextureResidencyTest, MakeEvictedTextureResident)
+{
+    auto residency = TextureResidency(FramesInFlight);
+    const auto entry = residency.Track(1, 100, {});
+    AdvanceFrames(residency, 5);
+
+    int numReloads = 0;
+    const auto reload = [&](TextureResidency::Entry&) { numReloads++; };
+    EXPECT_THAT(residency.MakeResident(*entry, reload), IsFalse());
+    EXPECT_THAT(residency.GetEpoch(), Eq(0u));
+
+    residency.Evict(100, [](TextureResidency::Entry&) { return true; });
+    EXPECT_THAT(residency.MakeResident(*entry, reload), IsTrue());
+    EXPECT_THAT(numReloads, Eq(1));
+    EXPECT_THAT(entry->resident, IsTrue());
+    EXPECT_THAT(entry->residentEpoch.load(), Eq(residency.GetEpoch()));
+    EXPECT_THAT(residency.GetEpoch(), Eq(1u));
+}
+
+} // namespace
@@ -0,0 +1,97 @@
+
+#include "Teide/UniformAllocator.h"
+
+#include "TestUtils.h"
+
+#include "Teide/Buffer.h"
+#include "Teide/Util/MemoryCounter.h"
+
+#include <gmock/gmock.h>
+
+#include <vector>
+
+using namespace Teide;
+using namespace testing;
+
+namespace
+{
+class UniformAllocatorTest : public testing::Test
+{
+protected:
+    static constexpr vk::DeviceSize BlockSize = 4096;
+
+    UniformAllocator CreateAllocator()
+    {
+        return UniformAllocator(
+            m_device->GetVulkanDevice(), m_device->GetAllocator(), m_memoryCounter, m_alignment, BlockSize);
+    }
+
+    // NOLINTBEGIN(cppcoreguidelines-non-private-member-variables-in-classes)
+    VulkanDevicePtr m_device = CreateTestDevice();
+    vk::DeviceSize m_alignment = m_device->GetUniformBufferAlignment();
+    MemoryCounter m_memoryCounter;
+    // NOLINTEND(cppcoreguidelines-non-private-member-variables-in-classes)
+};
+
+TEST_F(UniformAllocatorTest, AllocationsAreAligned)
+{
+    auto allocator = CreateAllocator();
+
+    const auto data = MakeBytes<float>({1.0f});
+    const auto first = allocator.Allocate(data.size(), data);
+    const auto second = allocator.Allocate(data.size(), data);
+
+    EXPECT_THAT(first.buffer, IsValidVkHandle());
+    EXPECT_THAT(second.buffer, Eq(first.buffer));
+    EXPECT_THAT(first.offset, Eq(0u));
+    EXPECT_THAT(second.offset % m_alignment, Eq(0u));
+    EXPECT_THAT(second.offset, Ge(data.size()));
+}
+
+TEST_F(UniformAllocatorTest, AllocationsSpillIntoANewBlock)
+{
+    auto allocator = CreateAllocator();
+
+    const auto first = allocator.Allocate(BlockSize - m_alignment, {});
+    const auto second = allocator.Allocate(m_alignment * 2, {});
+
+    EXPECT_THAT(second.buffer, Ne(first.buffer));
+    EXPECT_THAT(second.offset, Eq(0u));
+    EXPECT_THAT(m_memoryCounter.GetCount(), Eq(2u));
+}
+
+TEST_F(UniformAllocatorTest, AllocationLargerThanABlockGetsItsOwn)
+{
+    auto allocator = CreateAllocator();
+
+    const auto allocation = allocator.Allocate(BlockSize * 2, {});
+
+    EXPECT_THAT(allocation.buffer, IsValidVkHandle());
+    EXPECT_THAT(allocation.offset, Eq(0u));
+    EXPECT_THAT(m_memoryCounter.GetBytes(), Eq(BlockSize * 2));
+}
+
+TEST_F(UniformAllocatorTest, ResetReusesBlocks)
+{
+    auto allocator = CreateAllocator();
+
+    std::vector<UniformAllocator::Allocation> firstFrame;
+    for (int i = 0; i < 8; i++)
+    {
+        firstFrame.push_back(allocator.Allocate(BlockSize / 2, {}));
+    }
+    const auto blockCount = m_memoryCounter.GetCount();
+    ASSERT_THAT(blockCount, Gt(1u));
+
+    allocator.Reset();
+
+    for (const auto& expected : firstFrame)
+    {
+        const auto allocation = allocator.Allocate(BlockSize / 2, {});
+        EXPECT_THAT(allocation.buffer, Eq(expected.buffer));
+        EXPECT_THAT(allocation.offset, Eq(expected.offset));
+    }
+    EXPECT_THAT(m_memoryCounter.GetCount(), Eq(blockCount));
+}
+
+} // namespace
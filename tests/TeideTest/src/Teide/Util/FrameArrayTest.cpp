@@ -0,0 +1,55 @@
+#include "Teide/Util/FrameArray.h"
+
+#include <gmock/gmock.h>
+
+#include <stdexcept>
+#include <vector>
+
+using namespace testing;
+using namespace Teide;
+
+namespace
+{
+
+struct Element
+{
+    Element(std::vector<uint32>& destroyed, uint32 throwAt, uint32 index) : destroyed{destroyed}, index{index}
+    {
+        if (index == throwAt)
+        {
+            throw std::runtime_error("Element constructor failed");
+        }
+    }
+
+    Element(const Element&) = delete;
+    Element(Element&&) = delete;
+    Element& operator=(const Element&) = delete;
+    Element& operator=(Element&&) = delete;
+
+    ~Element() { destroyed.push_back(index); }
+
+    std::vector<uint32>& destroyed;
+    uint32 index;
+};
+
+TEST(FrameArrayTest, ConstructsEachElementWithItsIndex)
+{
+    std::vector<uint32> destroyed;
+    auto frames = FrameArray<Element>(3, destroyed, 99u);
+    EXPECT_THAT(frames.Size(), Eq(3u));
+    EXPECT_THAT(frames.Current().index, Eq(0u));
+    frames.NextFrame();
+    EXPECT_THAT(frames.Current().index, Eq(1u));
+    frames.NextFrame();
+    frames.NextFrame();
+    EXPECT_THAT(frames.Current().index, Eq(0u));
+}
+
+TEST(FrameArrayTest, DestroysConstructedElementsIfAConstructorThrows)
+{
+    std::vector<uint32> destroyed;
+    EXPECT_THROW(FrameArray<Element>(4, destroyed, 2u), std::runtime_error);
+    EXPECT_THAT(destroyed, UnorderedElementsAre(0u, 1u));
+}
+
+} // namespace
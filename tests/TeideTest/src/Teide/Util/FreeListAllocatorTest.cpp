@@ -0,0 +1,65 @@
+#include "Teide/Util/FreeListAllocator.h"
+
+#include <gmock/gmock.h>
+
+using namespace testing;
+using namespace Teide;
+
+namespace
+{
+
+TEST(FreeListAllocatorTest, AllocateFromStart)
+{
+    auto allocator = FreeListAllocator(100);
+    EXPECT_THAT(allocator.Allocate(10), Optional(0u));
+    EXPECT_THAT(allocator.Allocate(20), Optional(10u));
+    EXPECT_THAT(allocator.GetFreeSpace(), Eq(70u));
+}
+
+TEST(FreeListAllocatorTest, AllocateWhenFull)
+{
+    auto allocator = FreeListAllocator(100);
+    EXPECT_THAT(allocator.Allocate(100), Optional(0u));
+    EXPECT_THAT(allocator.Allocate(1), Eq(std::nullopt));
+}
+
+TEST(FreeListAllocatorTest, AllocateWithAlignment)
+{
+    auto allocator = FreeListAllocator(100);
+    EXPECT_THAT(allocator.Allocate(5), Optional(0u));
+    EXPECT_THAT(allocator.Allocate(12, 12), Optional(12u));
+
+    // The padding before the aligned allocation can still be used
+    EXPECT_THAT(allocator.Allocate(7), Optional(5u));
+    EXPECT_THAT(allocator.GetFreeSpace(), Eq(76u));
+}
+
+TEST(FreeListAllocatorTest, ReuseFreedRange)
+{
+    auto allocator = FreeListAllocator(100);
+    const auto first = allocator.Allocate(50);
+    ASSERT_THAT(first, Optional(0u));
+    EXPECT_THAT(allocator.Allocate(50), Optional(50u));
+
+    allocator.Free(*first, 50);
+    EXPECT_THAT(allocator.Allocate(30), Optional(0u));
+}
+
+TEST(FreeListAllocatorTest, MergeNeighboursWhenFreed)
+{
+    auto allocator = FreeListAllocator(90);
+    const auto a = allocator.Allocate(30);
+    const auto b = allocator.Allocate(30);
+    const auto c = allocator.Allocate(30);
+    ASSERT_THAT(a.has_value() && b.has_value() && c.has_value(), IsTrue());
+
+    allocator.Free(*a, 30);
+    allocator.Free(*c, 30);
+    EXPECT_THAT(allocator.Allocate(60), Eq(std::nullopt));
+
+    allocator.Free(*b, 30);
+    EXPECT_THAT(allocator.IsEmpty(), IsTrue());
+    EXPECT_THAT(allocator.Allocate(90), Optional(0u));
+}
+
+} // namespace
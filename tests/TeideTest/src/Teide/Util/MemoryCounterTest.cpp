@@ -0,0 +1,60 @@
+
+#include "Teide/Util/MemoryCounter.h"
+
+#include <gmock/gmock.h>
+
+#include <optional>
+
+using namespace testing;
+using namespace Teide;
+
+namespace
+{
+
+TEST(MemoryCounterTest, CountAllocations)
+{
+    auto counter = MemoryCounter();
+    const auto a = counter.Add(10);
+    const auto b = counter.Add(20);
+    EXPECT_THAT(counter.GetBytes(), Eq(30u));
+    EXPECT_THAT(counter.GetCount(), Eq(2u));
+}
+
+TEST(MemoryCounterTest, DestroyingAllocationRemovesIt)
+{
+    auto counter = MemoryCounter();
+    const auto a = counter.Add(10);
+    {
+        const auto b = counter.Add(20);
+    }
+    EXPECT_THAT(counter.GetBytes(), Eq(10u));
+    EXPECT_THAT(counter.GetCount(), Eq(1u));
+}
+
+TEST(MemoryCounterTest, MovedAllocationIsCountedOnce)
+{
+    auto counter = MemoryCounter();
+    auto a = std::optional(counter.Add(10));
+    auto b = std::move(*a);
+    a.reset();
+    EXPECT_THAT(counter.GetBytes(), Eq(10u));
+    EXPECT_THAT(counter.GetCount(), Eq(1u));
+
+    b = MemoryCounter::Allocation();
+    EXPECT_THAT(counter.GetBytes(), Eq(0u));
+    EXPECT_THAT(counter.GetCount(), Eq(0u));
+}
+
+TEST(MemoryCounterTest, PeakBytes)
+{
+    auto counter = MemoryCounter();
+    {
+        const auto a = counter.Add(10);
+        const auto b = counter.Add(20);
+    }
+    const auto c = counter.Add(5);
+    EXPECT_THAT(counter.GetBytes(), Eq(5u));
+    EXPECT_THAT(counter.GetPeakBytes(), Eq(30u));
+}
+
+} // namespace
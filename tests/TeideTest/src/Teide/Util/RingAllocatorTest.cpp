@@ -0,0 +1,110 @@
+#include "Teide/Util/RingAllocator.h"
+
+#include <gmock/gmock.h>
+
+using namespace testing;
+using namespace Teide;
+
+namespace
+{
+
+TEST(RingAllocatorTest, AllocateInOrder)
+{
+    auto allocator = RingAllocator(100);
+    EXPECT_THAT(allocator.Allocate(10), Optional(0u));
+    EXPECT_THAT(allocator.Allocate(20), Optional(10u));
+    EXPECT_THAT(allocator.GetUsedSpace(), Eq(30u));
+}
+
+TEST(RingAllocatorTest, AllocateWithAlignment)
+{
+    auto allocator = RingAllocator(100);
+    EXPECT_THAT(allocator.Allocate(5), Optional(0u));
+    EXPECT_THAT(allocator.Allocate(12, 12), Optional(12u));
+    EXPECT_THAT(allocator.GetUsedSpace(), Eq(24u));
+}
+
+TEST(RingAllocatorTest, AllocateWithNonPowerOfTwoAlignmentAfterWrapping)
+{
+    auto allocator = RingAllocator(200);
+    const auto first = allocator.Allocate(50);
+    ASSERT_THAT(first, Optional(0u));
+    EXPECT_THAT(allocator.Allocate(100, 48), Optional(96u));
+
+    allocator.Free(*first);
+    EXPECT_THAT(allocator.Allocate(20, 48), Optional(0u));
+    EXPECT_THAT(allocator.Allocate(10, 24), Optional(24u));
+}
+
+TEST(RingAllocatorTest, AllocateWhenFull)
+{
+    auto allocator = RingAllocator(100);
+    EXPECT_THAT(allocator.Allocate(100), Optional(0u));
+    EXPECT_THAT(allocator.Allocate(1), Eq(std::nullopt));
+}
+
+TEST(RingAllocatorTest, AllocateTooBig)
+{
+    auto allocator = RingAllocator(100);
+    EXPECT_THAT(allocator.Allocate(101), Eq(std::nullopt));
+    EXPECT_THAT(allocator.IsEmpty(), IsTrue());
+}
+
+TEST(RingAllocatorTest, AllocateWithZeroSize)
+{
+    auto allocator = RingAllocator(0);
+    EXPECT_THAT(allocator.Allocate(1), Eq(std::nullopt));
+    EXPECT_THAT(allocator.IsEmpty(), IsTrue());
+}
+
+TEST(RingAllocatorTest, WrapAroundWhenStartIsFreed)
+{
+    auto allocator = RingAllocator(100);
+    const auto first = allocator.Allocate(40);
+    ASSERT_THAT(first, Optional(0u));
+    EXPECT_THAT(allocator.Allocate(40), Optional(40u));
+
+    // Doesn't fit in the 20 bytes at the end, and the start is still in use
+    EXPECT_THAT(allocator.Allocate(30), Eq(std::nullopt));
+
+    allocator.Free(*first);
+    EXPECT_THAT(allocator.Allocate(30), Optional(0u));
+    EXPECT_THAT(allocator.GetUsedSpace(), Eq(90u)); // Includes the gap that was skipped at the end
+}
+
+TEST(RingAllocatorTest, ReuseSpaceOnlyWhenEarlierRangesAreFreed)
+{
+    auto allocator = RingAllocator(90);
+    const auto a = allocator.Allocate(30);
+    const auto b = allocator.Allocate(30);
+    const auto c = allocator.Allocate(30);
+    ASSERT_THAT(a.has_value() && b.has_value() && c.has_value(), IsTrue());
+
+    allocator.Free(*b);
+    EXPECT_THAT(allocator.Allocate(30), Eq(std::nullopt));
+
+    allocator.Free(*a);
+    EXPECT_THAT(allocator.Allocate(60), Optional(0u));
+
+    allocator.Free(*c);
+    allocator.Free(0);
+    EXPECT_THAT(allocator.IsEmpty(), IsTrue());
+    EXPECT_THAT(allocator.GetUsedSpace(), Eq(0u));
+}
+
+TEST(RingAllocatorTest, FreeAfterManyLaps)
+{
+    auto allocator = RingAllocator(100);
+    for (int i = 0; i < 10; i++)
+    {
+        const auto first = allocator.Allocate(70);
+        ASSERT_THAT(first.has_value(), IsTrue());
+        const auto second = allocator.Allocate(20);
+        ASSERT_THAT(second.has_value(), IsTrue());
+        allocator.Free(*second);
+        allocator.Free(*first);
+    }
+    EXPECT_THAT(allocator.IsEmpty(), IsTrue());
+}
+
+} // namespace
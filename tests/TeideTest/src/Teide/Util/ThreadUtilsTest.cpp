@@ -0,0 +1,84 @@
+
+#include "Teide/Util/ThreadUtils.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <latch>
+#include <thread>
+#include <vector>
+
+using namespace Teide;
+using namespace testing;
+
+namespace
+{
+
+TEST(ThreadUtilsTest, ThreadIndexIsStablePerThread)
+{
+    EXPECT_THAT(GetCurrentThreadIndex(), Eq(GetCurrentThreadIndex()));
+
+    uint32 otherIndex = GetCurrentThreadIndex();
+    std::jthread([&otherIndex] { otherIndex = GetCurrentThreadIndex(); }).join();
+
+    EXPECT_THAT(otherIndex, Ne(GetCurrentThreadIndex()));
+}
+
+TEST(ThreadUtilsTest, ThreadMapHasObjectPerThread)
+{
+    auto map = ThreadMap<int>();
+    map.WithCurrent([](int& value) { value = 1; });
+
+    // The threads are kept alive until they have all used the map, so that none of them can reuse another's index
+    constexpr int numThreads = 16;
+    std::vector<int*> objects(numThreads);
+    {
+        std::latch allUsed(numThreads);
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < numThreads; i++)
+        {
+            threads.emplace_back([&map, &objects, &allUsed, i] {
+                objects[i] = map.WithCurrent([](int& value) {
+                    value += 2;
+                    return &value;
+                });
+                allUsed.arrive_and_wait();
+            });
+        }
+    }
+
+    std::ranges::sort(objects);
+    EXPECT_THAT(std::ranges::adjacent_find(objects), Eq(objects.end()));
+
+    int total = 0;
+    map.ForEach([&total](int& value) { total += value; });
+    map.WithCurrent([](int& value) { EXPECT_THAT(value, Eq(1)); });
+    EXPECT_THAT(total, Eq(1 + 2 * numThreads));
+}
+
+TEST(ThreadUtilsTest, ThreadMapGrowsForMoreThreads)
+{
+    auto map = ThreadMap<int>();
+
+    constexpr int numThreads = 64;
+    {
+        std::latch allUsed(numThreads);
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < numThreads; i++)
+        {
+            threads.emplace_back([&map, &allUsed] {
+                map.WithCurrent([](int& value) { value++; });
+                allUsed.arrive_and_wait();
+            });
+        }
+    }
+
+    EXPECT_THAT(map.Size(), Ge(usize{numThreads}));
+
+    int total = 0;
+    map.ForEach([&total](int& value) { total += value; });
+    EXPECT_THAT(total, Eq(numThreads));
+}
+
+} // namespace